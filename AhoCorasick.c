@@ -0,0 +1,169 @@
+/*
+ *  AhoCorasick.c
+ *  Notation
+ *
+ */
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+
+#include "AhoCorasick.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct _ACAutomaton {
+	//fully-resolved transition table: failure links are folded in, so scanning is one lookup per byte
+	int32_t (*delta)[256];
+	uint64_t *outputs; //bits of the needles ending at each state, including those reached through failure links
+	uint32_t stateCount;
+
+	uint64_t allNeedlesMask;
+	size_t *needleLengths;
+
+	//the needles themselves, one after another with their NULs, to be compared by ACAutomatonHasNeedles
+	char *needleBytes;
+	unsigned int needleCount;
+	volatile int32_t referenceCount;
+};
+
+ACAutomaton *ACAutomatonCreate(const char **needles, unsigned int needleCount) {
+	unsigned int i;
+	size_t maxStates = 1;
+
+	if (!needleCount || needleCount > kACMaxNeedles)
+		return NULL;
+
+	for (i=0; i<needleCount; i++) {
+		size_t len = strlen(needles[i]);
+		if (!len) return NULL;
+		maxStates += len;
+	}
+
+	ACAutomaton *automaton = (ACAutomaton*)calloc(1, sizeof(ACAutomaton));
+	automaton->delta = calloc(maxStates, sizeof(int32_t[256]));
+	automaton->outputs = (uint64_t*)calloc(maxStates, sizeof(uint64_t));
+	automaton->needleLengths = (size_t*)malloc(needleCount * sizeof(size_t));
+	automaton->needleBytes = (char*)malloc(maxStates - 1 + needleCount);
+	automaton->needleCount = needleCount;
+	automaton->referenceCount = 1;
+	automaton->stateCount = 1;
+
+	//0 doubles as "no transition" while building the trie, as nothing transitions back into the root
+	for (i=0; i<needleCount; i++) {
+		const unsigned char *s = (const unsigned char*)needles[i];
+		int32_t state = 0;
+
+		for (; *s; s++) {
+			if (!automaton->delta[state][*s])
+				automaton->delta[state][*s] = automaton->stateCount++;
+			state = automaton->delta[state][*s];
+		}
+		automaton->outputs[state] |= (1ULL << i);
+		automaton->needleLengths[i] = strlen(needles[i]);
+	}
+	char *needleBytes = automaton->needleBytes;
+	for (i=0; i<needleCount; i++) {
+		memcpy(needleBytes, needles[i], automaton->needleLengths[i] + 1);
+		needleBytes += automaton->needleLengths[i] + 1;
+	}
+	automaton->allNeedlesMask = needleCount == 64 ? ~0ULL : ((1ULL << needleCount) - 1);
+
+	//breadth-first over the trie, so that a state's failure target is always resolved before the state itself
+	int32_t *fail = (int32_t*)calloc(automaton->stateCount, sizeof(int32_t));
+	int32_t *queue = (int32_t*)malloc(automaton->stateCount * sizeof(int32_t));
+	uint32_t head = 0, tail = 0;
+	int c;
+
+	for (c=0; c<256; c++) {
+		int32_t next = automaton->delta[0][c];
+		if (next) {
+			fail[next] = 0;
+			queue[tail++] = next;
+		}
+	}
+	while (head < tail) {
+		int32_t state = queue[head++];
+		automaton->outputs[state] |= automaton->outputs[fail[state]];
+
+		for (c=0; c<256; c++) {
+			int32_t next = automaton->delta[state][c];
+			if (next) {
+				fail[next] = automaton->delta[fail[state]][c];
+				queue[tail++] = next;
+			} else {
+				automaton->delta[state][c] = automaton->delta[fail[state]][c];
+			}
+		}
+	}
+	free(queue);
+	free(fail);
+
+	return automaton;
+}
+
+ACAutomaton *ACAutomatonRetain(ACAutomaton *automaton) {
+	if (automaton) __sync_add_and_fetch(&automaton->referenceCount, 1);
+	return automaton;
+}
+
+void ACAutomatonFree(ACAutomaton *automaton) {
+	if (!automaton || __sync_sub_and_fetch(&automaton->referenceCount, 1) > 0) return;
+
+	free(automaton->delta);
+	free(automaton->outputs);
+	free(automaton->needleLengths);
+	free(automaton->needleBytes);
+	free(automaton);
+}
+
+int ACAutomatonHasNeedles(const ACAutomaton *automaton, const char **needles, unsigned int needleCount) {
+	const char *needleBytes = automaton->needleBytes;
+	unsigned int i;
+
+	if (needleCount != automaton->needleCount)
+		return 0;
+	for (i=0; i<needleCount; i++) {
+		if (strcmp(needleBytes, needles[i]))
+			return 0;
+		needleBytes += automaton->needleLengths[i] + 1;
+	}
+	return 1;
+}
+
+uint64_t ACAutomatonAllNeedlesMask(const ACAutomaton *automaton) {
+	return automaton->allNeedlesMask;
+}
+
+const char *ACAutomatonScan(const ACAutomaton *automaton, const char *text, uint64_t *foundMask, unsigned int trackedNeedle) {
+	const unsigned char *s = (const unsigned char*)text;
+	const char *trackedMatch = NULL;
+	uint64_t trackedBit = 1ULL << trackedNeedle, found = *foundMask;
+	int32_t state = 0;
+
+	for (; *s; s++) {
+		state = automaton->delta[state][*s];
+
+		uint64_t output = automaton->outputs[state];
+		if (output) {
+			found |= output;
+
+			if ((output & trackedBit) && !trackedMatch) {
+				trackedMatch = (const char*)s - automaton->needleLengths[trackedNeedle] + 1;
+			}
+			if (trackedMatch && found == automaton->allNeedlesMask)
+				break;
+		}
+	}
+
+	*foundMask = found;
+	return trackedMatch;
+}
@@ -0,0 +1,40 @@
+/*
+ *  AhoCorasick.h
+ *  Notation
+ *
+ */
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+//a byte-level Aho-Corasick automaton, so that every word of a search string can be found in one pass over a note
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define kACMaxNeedles 64
+
+typedef struct _ACAutomaton ACAutomaton;
+
+//needles must be non-empty; returns NULL if there are none or more than kACMaxNeedles
+ACAutomaton *ACAutomatonCreate(const char **needles, unsigned int needleCount);
+//an automaton can be shared, e.g. by a search running in the background; each reference is given up with ACAutomatonFree
+ACAutomaton *ACAutomatonRetain(ACAutomaton *automaton);
+void ACAutomatonFree(ACAutomaton *automaton);
+
+//whether the automaton was made for these needles, in this order, so that it can be used again instead of rebuilt
+int ACAutomatonHasNeedles(const ACAutomaton *automaton, const char **needles, unsigned int needleCount);
+
+uint64_t ACAutomatonAllNeedlesMask(const ACAutomaton *automaton);
+
+//ORs the bit of every needle found in text into *foundMask, and returns the first occurrence of needle trackedNeedle (or NULL)
+//stops early once every needle has been found, counting those already in *foundMask, and trackedNeedle has been found in text
+const char *ACAutomatonScan(const ACAutomaton *automaton, const char *text, uint64_t *foundMask, unsigned int trackedNeedle);
@@ -171,6 +171,7 @@ void outletObjectAwoke(id sender);
 
 - (NSString*)fieldSearchString;
 - (void)cacheTypedStringIfNecessary:(NSString*)aString;
+- (void)updateSelectionAfterFilteringFromFieldEditor:(NSTextView*)fieldEditor didFilter:(BOOL)didFilter;
 - (NSString*)typedString;
 
 - (IBAction)showHelpDocument:(id)sender;
@@ -1159,13 +1159,14 @@ terminateApp:
 	[notationController checkJournalExistence];
 	
     if ([notationController currentNoteStorageFormat] != SingleDatabaseFormat)
-		[notationController performSelector:@selector(synchronizeNotesFromDirectory) withObject:nil afterDelay:0.0];
+		[notationController performSelector:@selector(synchronizeChangedNotesFromDirectory) withObject:nil afterDelay:0.0];
 	[notationController updateDateStringsIfNecessary];
 }
 
 - (void)applicationWillResignActive:(NSNotification *)aNotification {
 	//sync note files when switching apps so user doesn't have to guess when they'll be updated
 	[notationController synchronizeNoteChanges:nil];
+	[notationController releaseUnusedNoteBodies];
     [[NSNotificationCenter defaultCenter] postNotificationName:@"ModTimersShouldReset" object:nil];
     
 }
@@ -1380,69 +1381,81 @@ terminateApp:
 	}
 }
 
-//from fieldeditor
-- (void)controlTextDidChange:(NSNotification *)aNotification {
-    
-	if ([aNotification object] == field) {
-		typedStringIsCached = NO;
-		isFilteringFromTyping = YES;
-		
-		NSTextView *fieldEditor = [[aNotification userInfo] objectForKey:@"NSFieldEditor"];
-		NSString *fieldString = [fieldEditor string];
+- (void)updateSelectionAfterFilteringFromFieldEditor:(NSTextView*)fieldEditor didFilter:(BOOL)didFilter {
+	NSString *fieldString = [fieldEditor string];
+	
+	if ([fieldString length] > 0) {
+//             [[NSNotificationCenter defaultCenter] postNotificationName:@"TextFindContextShouldReset" object:self];
+		[field setSnapbackString:nil];
 		
-		BOOL didFilter = [notationController filterNotesFromString:fieldString];
+            
+		NSUInteger preferredNoteIndex = [notationController preferredSelectedNoteIndex];
 		
-		if ([fieldString length] > 0) {
-//             [[NSNotificationCenter defaultCenter] postNotificationName:@"TextFindContextShouldReset" object:self];
-			[field setSnapbackString:nil];
+		//lastLengthReplaced depends on textView:shouldChangeTextInRange:replacementString: being sent before controlTextDidChange: runs
+		if ([prefsController autoCompleteSearches] && preferredNoteIndex != NSNotFound && ([field lastLengthReplaced] > 0)) {
 			
-            
-			NSUInteger preferredNoteIndex = [notationController preferredSelectedNoteIndex];
+			[notesTableView selectRowAndScroll:preferredNoteIndex];
 			
-			//lastLengthReplaced depends on textView:shouldChangeTextInRange:replacementString: being sent before controlTextDidChange: runs
-			if ([prefsController autoCompleteSearches] && preferredNoteIndex != NSNotFound && ([field lastLengthReplaced] > 0)) {
-				
-				[notesTableView selectRowAndScroll:preferredNoteIndex];
-				
-				if (didFilter) {
-					//current selection may be at the same row, but note at that row may have changed
-					[self displayContentsForNoteAtIndex:preferredNoteIndex];
-				}
+			if (didFilter) {
+				//current selection may be at the same row, but note at that row may have changed
+				[self displayContentsForNoteAtIndex:preferredNoteIndex];
+			}
+			
+			NSAssert(currentNote != nil, @"currentNote must not--cannot--be nil!");
+			
+			NSRange typingRange = [fieldEditor selectedRange];
+			
+			//fill in the remaining characters of the title and select
+			if ([field lastLengthReplaced] > 0 && typingRange.location < [titleOfNote(currentNote) length]) {
 				
-				NSAssert(currentNote != nil, @"currentNote must not--cannot--be nil!");
+				[self cacheTypedStringIfNecessary:fieldString];
 				
-				NSRange typingRange = [fieldEditor selectedRange];
+				NSAssert([fieldString isEqualToString:[fieldEditor string]], @"I don't think it makes sense for fieldString to change");
 				
-				//fill in the remaining characters of the title and select
-				if ([field lastLengthReplaced] > 0 && typingRange.location < [titleOfNote(currentNote) length]) {
-					
-					[self cacheTypedStringIfNecessary:fieldString];
-					
-					NSAssert([fieldString isEqualToString:[fieldEditor string]], @"I don't think it makes sense for fieldString to change");
-					
-					NSString *remainingTitle = [titleOfNote(currentNote) substringFromIndex:typingRange.location];
-					typingRange.length = [fieldString length] - typingRange.location;
-					typingRange.length = MAX(typingRange.length, 0U);
-					
-					[fieldEditor replaceCharactersInRange:typingRange withString:remainingTitle];
-					typingRange.length = [remainingTitle length];
-					[fieldEditor setSelectedRange:typingRange];
-				}
+				NSString *remainingTitle = [titleOfNote(currentNote) substringFromIndex:typingRange.location];
+				typingRange.length = [fieldString length] - typingRange.location;
+				typingRange.length = MAX(typingRange.length, 0U);
 				
-			} else {
-				//auto-complete is off, search string doesn't prefix any title, or part of the search string is being removed
-				goto selectNothing;
+				[fieldEditor replaceCharactersInRange:typingRange withString:remainingTitle];
+				typingRange.length = [remainingTitle length];
+				[fieldEditor setSelectedRange:typingRange];
 			}
+			
 		} else {
-			//selecting nothing; nothing typed
-		selectNothing:
+			//auto-complete is off, search string doesn't prefix any title, or part of the search string is being removed
+			goto selectNothing;
+		}
+	} else {
+		//selecting nothing; nothing typed
+	selectNothing:
+		isFilteringFromTyping = NO;
+		[notesTableView deselectAll:nil];
+		
+		//reloadData could have already de-selected us, and hence this notification would not be sent from -deselectAll:
+		[self processChangedSelectionForTable:notesTableView];
+	}
+}
+
+//from fieldeditor
+- (void)controlTextDidChange:(NSNotification *)aNotification {
+    
+	if ([aNotification object] == field) {
+		typedStringIsCached = NO;
+		isFilteringFromTyping = YES;
+		
+		NSTextView *fieldEditor = [[aNotification userInfo] objectForKey:@"NSFieldEditor"];
+		NSString *fieldString = [fieldEditor string];
+		
+		if ([fieldString length] > 0 && [notationController searchesInBackground]) {
+			//the selection is updated once the search has finished, in notation:didPublishBackgroundSearchResultsFinal:
+			[notationController filterNotesInBackgroundFromString:fieldString];
 			isFilteringFromTyping = NO;
-			[notesTableView deselectAll:nil];
-			
-			//reloadData could have already de-selected us, and hence this notification would not be sent from -deselectAll:
-			[self processChangedSelectionForTable:notesTableView];
+			return;
 		}
 		
+		BOOL didFilter = [notationController filterNotesFromString:fieldString];
+		[self updateSelectionAfterFilteringFromFieldEditor:fieldEditor didFilter:didFilter];
+		
 		isFilteringFromTyping = NO;
         
 	} else if ([tagEditor isMultitagging]) { //<--for elasticthreads multitagging
@@ -1689,7 +1702,8 @@ terminateApp:
 			[textView setNeedsDisplayInRect:[textView visibleRect] avoidAdditionalLayout:YES];
 		}
 		
-		//restore string
+		//restore string; a body that couldn't be read must not be edited, as the empty text shown in its place would then be saved
+		[textView setEditable:[note hasReadableBody]];
 		[[textView textStorage] setAttributedString:[note contentString]];
 		[self postTextUpdate];
 		[self updateWordCount:(![prefsController showWordCount])];
@@ -2121,6 +2135,24 @@ terminateApp:
 	}
 }
 
+- (void)notationWillPublishBackgroundSearchResults:(NotationController*)someNotation {
+	//as when filtering synchronously, the selection follows the search rather than being restored
+	if (someNotation == notationController)
+		isFilteringFromTyping = YES;
+}
+
+- (void)notation:(NotationController*)someNotation didPublishBackgroundSearchResultsFinal:(BOOL)isFinal {
+	if (someNotation == notationController) {
+		NSTextView *fieldEditor = (NSTextView*)[field currentEditor];
+		
+		//only a search typed into the field, which is still being edited, can still be completed
+		if (isFinal && fieldEditor)
+			[self updateSelectionAfterFilteringFromFieldEditor:fieldEditor didFilter:YES];
+		
+		isFilteringFromTyping = NO;
+	}
+}
+
 - (void)titleUpdatedForNote:(NoteObject*)aNoteObject {
     if (aNoteObject == currentNote) {
         //	if ([toolbar isVisible]) {
@@ -2136,6 +2168,7 @@ terminateApp:
 - (void)contentsUpdatedForNote:(NoteObject*)aNoteObject {
 	if (aNoteObject == currentNote) {
 		NSArray *selRanges=[textView selectedRanges];
+		[textView setEditable:[aNoteObject hasReadableBody]];
 		[[textView textStorage] setAttributedString:[aNoteObject contentString]];
         if (![selRanges isEqualToArray:[textView selectedRanges]]) {
             NSRange testEnd=[[selRanges lastObject] rangeValue];
@@ -18,6 +18,7 @@
 
 
 #include <Carbon/Carbon.h>
+#include "StringSearch.h"
 
 #define ResizeArray(__DirectBuffer, __objCount, __bufObjCount)	_ResizeBuffer((void***)(__DirectBuffer), (__objCount), (__bufObjCount), sizeof(typeof(**(__DirectBuffer))))
 
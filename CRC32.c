@@ -7,10 +7,21 @@
  */
 
 #include "CRC32.h"
+#include <pthread.h>
 
+//define NV_CRC32_CLMUL as 0 to build only the table-driven version
+#if !defined(NV_CRC32_CLMUL) && (defined(__x86_64__) || defined(__i386__)) && defined(__has_attribute)
+#if __has_attribute(target)
+#define NV_CRC32_CLMUL 1
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+#endif
 
 //1024 bytes
-static unsigned long crc32_tab[] = {
+static const uint32_t crc32_tab[] = {
     0x00000000L, 0x77073096L, 0xee0e612cL, 0x990951baL, 0x076dc419L,
     0x706af48fL, 0xe963a535L, 0x9e6495a3L, 0x0edb8832L, 0x79dcb8a4L,
     0xe0d5e91eL, 0x97d2d988L, 0x09b64c2bL, 0x7eb17cbdL, 0xe7b82d07L,
@@ -65,15 +76,181 @@ static unsigned long crc32_tab[] = {
     0x2d02ef8dL
 };
 
+//crc32_slices[k][b] is the register after b is followed by k zero bytes, letting 8 bytes be folded in at once
+static uint32_t crc32_slices[8][256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+#if NV_CRC32_CLMUL
+static int crc32_hasCLMUL = 0;
+#endif
+
+static void InitCRC32Slices(void) {
+	unsigned int i, k;
+	
+	for (i = 0; i < 256; i++) {
+		uint32_t crc = crc32_tab[i];
+		crc32_slices[0][i] = crc;
+		for (k = 1; k < 8; k++) {
+			crc = crc32_tab[crc & 0xff] ^ (crc >> 8);
+			crc32_slices[k][i] = crc;
+		}
+	}
+#if NV_CRC32_CLMUL
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		//SSE4.1 for the final extract; PCLMULQDQ for the folding
+		crc32_hasCLMUL = (ecx & bit_SSE4_1) && (ecx & bit_PCLMUL);
+	}
+#endif
+}
+
+static uint32_t UpdateCRC32Slices(uint32_t crc, const unsigned char *s, size_t len) {
+	
+	while (len && ((uintptr_t)s & 7)) {
+		crc = crc32_tab[(crc ^ *s++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	while (len >= 8) {
+		uint32_t one = crc ^ ((uint32_t)s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16) | ((uint32_t)s[3] << 24));
+		uint32_t two = (uint32_t)s[4] | ((uint32_t)s[5] << 8) | ((uint32_t)s[6] << 16) | ((uint32_t)s[7] << 24);
+		
+		crc = crc32_slices[7][one & 0xff] ^ crc32_slices[6][(one >> 8) & 0xff] ^
+			crc32_slices[5][(one >> 16) & 0xff] ^ crc32_slices[4][one >> 24] ^
+			crc32_slices[3][two & 0xff] ^ crc32_slices[2][(two >> 8) & 0xff] ^
+			crc32_slices[1][(two >> 16) & 0xff] ^ crc32_slices[0][two >> 24];
+		s += 8;
+		len -= 8;
+	}
+	while (len--) {
+		crc = crc32_tab[(crc ^ *s++) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#if NV_CRC32_CLMUL
+
+//folds 64 bytes at a time with carry-less multiplication and then Barrett-reduces to 32 bits, after
+//"Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Gopal et al., Intel, 2009)
+//len must be at least 64 and a multiple of 16
+__attribute__((target("sse4.1,pclmul")))
+static uint32_t UpdateCRC32CLMUL(uint32_t crc, const unsigned char *s, size_t len) {
+	//the bit-reflected constants of the paper: x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32), x^64 mod P(x), and the polynomials
+	static const uint64_t k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+	static const uint64_t k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+	static const uint64_t k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124ULL, 0x0000000000ULL };
+	static const uint64_t poly[2] __attribute__((aligned(16))) = { 0x01db710641ULL, 0x01f7011641ULL };
+	
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+	
+	x1 = _mm_loadu_si128((const __m128i*)(s + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(s + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(s + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(s + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	
+	x0 = _mm_load_si128((const __m128i*)k1k2);
+	s += 64;
+	len -= 64;
+	
+	//four independent lanes, to keep the multiplier busy
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		
+		y5 = _mm_loadu_si128((const __m128i*)(s + 0x00));
+		y6 = _mm_loadu_si128((const __m128i*)(s + 0x10));
+		y7 = _mm_loadu_si128((const __m128i*)(s + 0x20));
+		y8 = _mm_loadu_si128((const __m128i*)(s + 0x30));
+		
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		
+		s += 64;
+		len -= 64;
+	}
+	
+	//fold the lanes into one
+	x0 = _mm_load_si128((const __m128i*)k3k4);
+	
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+	
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i*)s);
+		
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		
+		s += 16;
+		len -= 16;
+	}
+	
+	//128 bits to 64
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	
+	x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+	
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	
+	//and Barrett reduction to 32
+	x0 = _mm_load_si128((const __m128i*)poly);
+	
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+#endif
+
+//operates on the un-inverted register
+static uint32_t UpdateCRC32(uint32_t crc, const unsigned char *s, size_t len) {
+	pthread_once(&crc32_once, InitCRC32Slices);
+	
+#if NV_CRC32_CLMUL
+	if (crc32_hasCLMUL && len >= 64) {
+		size_t foldedLength = len & ~(size_t)15;
+		crc = UpdateCRC32CLMUL(crc, s, foldedLength);
+		s += foldedLength;
+		len -= foldedLength;
+	}
+#endif
+	return UpdateCRC32Slices(crc, s, len);
+}
+
+uint32_t nv_crc32_update(uint32_t crc, const unsigned char *s, size_t len) {
+	
+	return ~UpdateCRC32(~crc, s, len);
+}
+
 unsigned long nv_crc32(const unsigned char *s, unsigned int len) {
-    unsigned int i;
-    unsigned long crc32val;
-    
-    crc32val = 0;
-    for (i = 0;  i < len;  i ++) {
-	crc32val =
-	crc32_tab[(crc32val ^ s[i]) & 0xff] ^
-	(crc32val >> 8);
-    }
-    return crc32val;    
+	
+	return UpdateCRC32(0, s, len);
 }
@@ -7,4 +7,12 @@
  *
  */
 
-unsigned long nv_crc32(const unsigned char *s, unsigned int len);
\ No newline at end of file
+#include <stddef.h>
+#include <stdint.h>
+
+//the same checksum as zlib's crc32(crc, s, len), starting from 0 for the first buffer
+//processes 8 bytes per step with sliced tables, or 64 at a time with carry-less multiplication on CPUs that have it
+uint32_t nv_crc32_update(uint32_t crc, const unsigned char *s, size_t len);
+
+//the original un-inverted variant of the checksum above
+unsigned long nv_crc32(const unsigned char *s, unsigned int len);
@@ -0,0 +1,300 @@
+/*
+ *  ChunkedCompression.c
+ *  Notation
+ *
+ */
+
+#include "ChunkedCompression.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <dispatch/dispatch.h>
+
+typedef struct {
+	size_t (*bound)(size_t length);
+	int (*compress)(const void *src, size_t length, void *dest, size_t *destLength, int level);
+	int (*decompress)(const void *src, size_t length, void *dest, size_t destLength);
+} CompressionCodec;
+
+/*
+ * The chunked format: a header of the magic bytes, the codec, the chunk size,
+ * the number of chunks and the original length, followed by the compressed
+ * length of each chunk, followed by the chunks themselves; all big-endian.
+ * A chunk whose length has CHUNK_STORED_FLAG set is stored as-is, as it did
+ * not get any smaller when compressed.
+ */
+
+static int ZlibCompressChunk(const void *src, size_t length, void *dest, size_t *destLength, int level) {
+	uLongf outLength = *destLength;
+	int zlibError = compress2(dest, &outLength, src, length, level);
+	*destLength = outLength;
+	return zlibError == Z_OK;
+}
+
+static int ZlibDecompressChunk(const void *src, size_t length, void *dest, size_t destLength) {
+	uLongf outLength = destLength;
+	return uncompress(dest, &outLength, src, length) == Z_OK && outLength == destLength;
+}
+
+static size_t ZlibChunkBound(size_t length) {
+	return compressBound(length);
+}
+
+static const CompressionCodec CompressionCodecs[] = {
+	[NVCompressionCodecZlib] = { ZlibChunkBound, ZlibCompressChunk, ZlibDecompressChunk }
+};
+#define CompressionCodecCount (sizeof(CompressionCodecs) / sizeof(CompressionCodec))
+
+static const char ChunkedCompressionMagic[4] = { 'N', 'V', 'z', 'C' };
+#define CHUNKED_HEADER_LEN (sizeof(ChunkedCompressionMagic) + 4 + 4 + 4 + 8)
+#define CHUNK_STORED_FLAG 0x80000000U
+//no writer has used chunks larger than this, so a header that claims them is damaged
+#define MAX_CHUNK_SIZE (16 * 1024 * 1024)
+
+static void WriteBig32(unsigned char *p, uint32_t value) {
+	p[0] = value >> 24; p[1] = value >> 16; p[2] = value >> 8; p[3] = value;
+}
+static uint32_t ReadBig32(const unsigned char *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+int nv_is_chunked_compressed(const unsigned char *bytes, size_t length) {
+	return length >= CHUNKED_HEADER_LEN && !memcmp(bytes, ChunkedCompressionMagic, sizeof(ChunkedCompressionMagic));
+}
+
+int nv_is_zlib_compressed(const unsigned char *bytes, size_t length) {
+	/*
+	 * The checks are:
+	 *    ( *bytes & 0x0F ) == 8           : method is deflate (this is called CM compression method, in the RFC)
+	 *    ( *bytes & 0x80 ) == 0           : info must be at most seven, this makes sure the MSB is not set, otherwise it
+	 *                                       is at least 8 (this is called CINFO, compression info, in the RFC)
+	 *    the first two bytes % 31 == 0    : the two first bytes as a whole (big endian format) must be a multiple of 31
+	 *                                       (this is discussed in the FCHECK in FLG, flags, section)
+	 */
+	return length >= 2 && (bytes[0] & 0x0F) == 8 && (bytes[0] & 0x80) == 0 && ((bytes[0] << 8) | bytes[1]) % 31 == 0;
+}
+
+unsigned char *nv_zlib_compress(const unsigned char *bytes, size_t length, int level, size_t *compressedLength) {
+	if (length > UINT32_MAX) return NULL;
+
+	uLongf bufferLength = compressBound(length);
+	unsigned char *compressed = (unsigned char *)malloc(bufferLength + 4);
+	if (!compressed) return NULL;
+
+	if (compress2(compressed, &bufferLength, bytes, length, level) != Z_OK) {
+		free(compressed);
+		return NULL;
+	}
+	WriteBig32(compressed + bufferLength, (uint32_t)length);
+	*compressedLength = bufferLength + 4;
+	return compressed;
+}
+
+static unsigned char *ZlibUncompress(const unsigned char *bytes, size_t length, size_t *uncompressedLength) {
+	if (length < 4 || !nv_is_zlib_compressed(bytes, length)) return NULL;
+
+	uLongf outLength = ReadBig32(bytes + length - 4);
+	unsigned char *uncompressed = (unsigned char *)malloc(outLength ? outLength : 1);
+	if (!uncompressed) return NULL;
+
+	uLongf originalLength = outLength;
+	if (uncompress(uncompressed, &outLength, bytes, length - 4) != Z_OK || outLength != originalLength) {
+		free(uncompressed);
+		return NULL;
+	}
+	*uncompressedLength = outLength;
+	return uncompressed;
+}
+
+//set from the dispatch_apply_f workers, any number of which can fail at once
+static void MarkFailed(int *failed) {
+	__sync_fetch_and_or(failed, 1);
+}
+
+typedef struct {
+	const CompressionCodec *codec;
+	const unsigned char *bytes;
+	size_t length;
+	int level;
+	unsigned char **chunks;
+	size_t *chunkLengths;
+	int failed;
+} CompressionJob;
+
+static void CompressChunk(void *context, size_t chunk) {
+	CompressionJob *job = (CompressionJob *)context;
+	size_t chunkOffset = chunk * NV_COMPRESSION_CHUNK_SIZE;
+	size_t chunkLength = job->length - chunkOffset < NV_COMPRESSION_CHUNK_SIZE ? job->length - chunkOffset : NV_COMPRESSION_CHUNK_SIZE;
+	size_t bufferLength = job->codec->bound(chunkLength);
+
+	if (!(job->chunks[chunk] = (unsigned char *)malloc(bufferLength))) {
+		MarkFailed(&job->failed);
+	} else if (!job->codec->compress(job->bytes + chunkOffset, chunkLength, job->chunks[chunk], &bufferLength, job->level)) {
+		MarkFailed(&job->failed);
+	} else if (bufferLength >= chunkLength) {
+		memcpy(job->chunks[chunk], job->bytes + chunkOffset, chunkLength);
+		job->chunkLengths[chunk] = chunkLength | CHUNK_STORED_FLAG;
+	} else {
+		job->chunkLengths[chunk] = bufferLength;
+	}
+}
+
+unsigned char *nv_chunked_compress(const unsigned char *bytes, size_t length, NVCompressionCodecID codec, int level, size_t *compressedLength) {
+	size_t i, chunkCount = (length + NV_COMPRESSION_CHUNK_SIZE - 1) / NV_COMPRESSION_CHUNK_SIZE;
+	if ((unsigned)codec >= CompressionCodecCount || chunkCount > UINT32_MAX)
+		return NULL;
+
+	CompressionJob job = { &CompressionCodecs[codec], bytes, length, level,
+		(unsigned char **)calloc(chunkCount + 1, sizeof(unsigned char*)), (size_t *)calloc(chunkCount + 1, sizeof(size_t)), 0 };
+	unsigned char *compressed = NULL;
+
+	if (job.chunks && job.chunkLengths) {
+		dispatch_apply_f(chunkCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), &job, CompressChunk);
+
+		size_t totalLength = CHUNKED_HEADER_LEN + chunkCount * 4;
+		for (i = 0; i < chunkCount; i++)
+			totalLength += job.chunkLengths[i] & ~CHUNK_STORED_FLAG;
+
+		if (!job.failed && (compressed = (unsigned char *)malloc(totalLength))) {
+			unsigned char *p = compressed;
+
+			memcpy(p, ChunkedCompressionMagic, sizeof(ChunkedCompressionMagic));
+			WriteBig32(p + 4, codec);
+			WriteBig32(p + 8, NV_COMPRESSION_CHUNK_SIZE);
+			WriteBig32(p + 12, (uint32_t)chunkCount);
+			WriteBig32(p + 16, (uint32_t)((uint64_t)length >> 32));
+			WriteBig32(p + 20, (uint32_t)length);
+			p += CHUNKED_HEADER_LEN;
+
+			for (i = 0; i < chunkCount; i++, p += 4)
+				WriteBig32(p, (uint32_t)job.chunkLengths[i]);
+			for (i = 0; i < chunkCount; i++) {
+				memcpy(p, job.chunks[i], job.chunkLengths[i] & ~CHUNK_STORED_FLAG);
+				p += job.chunkLengths[i] & ~CHUNK_STORED_FLAG;
+			}
+			*compressedLength = totalLength;
+		}
+	}
+
+	for (i = 0; job.chunks && i < chunkCount; i++)
+		free(job.chunks[i]);
+	free(job.chunks);
+	free(job.chunkLengths);
+
+	return compressed;
+}
+
+typedef struct {
+	const CompressionCodec *codec;
+	const unsigned char *bytes;
+	size_t chunkSize, chunkCount;
+	uint64_t originalLength;
+	size_t *chunkOffsets;
+
+	unsigned char *outBytes;
+	int failed;
+} ChunkedLayout;
+
+//checks the header and the chunk table against the data, and finds the offset of each chunk
+static int ReadChunkedLayout(const unsigned char *bytes, size_t length, ChunkedLayout *layout) {
+	size_t i;
+
+	if (!nv_is_chunked_compressed(bytes, length))
+		return 0;
+
+	uint32_t codecID = ReadBig32(bytes + 4);
+	size_t chunkSize = ReadBig32(bytes + 8), chunkCount = ReadBig32(bytes + 12);
+	uint64_t originalLength = ((uint64_t)ReadBig32(bytes + 16) << 32) | ReadBig32(bytes + 20);
+
+	if (codecID >= CompressionCodecCount || !chunkSize || chunkSize > MAX_CHUNK_SIZE || (length - CHUNKED_HEADER_LEN) / 4 < chunkCount ||
+		originalLength > (uint64_t)chunkSize * chunkCount || (chunkCount && originalLength <= (uint64_t)chunkSize * (chunkCount - 1)) ||
+		originalLength > SIZE_MAX)
+		return 0;
+
+	size_t *chunkOffsets = (size_t *)malloc((chunkCount + 1) * sizeof(size_t));
+	if (!chunkOffsets) return 0;
+
+	chunkOffsets[0] = CHUNKED_HEADER_LEN + chunkCount * 4;
+	for (i = 0; i < chunkCount; i++) {
+		size_t chunkLength = ReadBig32(bytes + CHUNKED_HEADER_LEN + i * 4) & ~CHUNK_STORED_FLAG;
+		if (chunkLength > length - chunkOffsets[i]) {
+			free(chunkOffsets);
+			return 0;
+		}
+		chunkOffsets[i + 1] = chunkOffsets[i] + chunkLength;
+	}
+
+	ChunkedLayout readLayout = { &CompressionCodecs[codecID], bytes, chunkSize, chunkCount, originalLength, chunkOffsets, NULL, 0 };
+	*layout = readLayout;
+	return 1;
+}
+
+static size_t ChunkOriginalLength(const ChunkedLayout *layout, size_t chunk) {
+	uint64_t remaining = layout->originalLength - (uint64_t)chunk * layout->chunkSize;
+	return remaining < layout->chunkSize ? (size_t)remaining : layout->chunkSize;
+}
+
+static void DecompressChunk(void *context, size_t chunk) {
+	ChunkedLayout *layout = (ChunkedLayout *)context;
+	size_t outLength = ChunkOriginalLength(layout, chunk);
+	size_t inLength = layout->chunkOffsets[chunk + 1] - layout->chunkOffsets[chunk];
+	const unsigned char *inBytes = layout->bytes + layout->chunkOffsets[chunk];
+	unsigned char *outBytes = layout->outBytes + chunk * layout->chunkSize;
+
+	if (ReadBig32(layout->bytes + CHUNKED_HEADER_LEN + chunk * 4) & CHUNK_STORED_FLAG) {
+		if (inLength == outLength) memcpy(outBytes, inBytes, outLength);
+		else MarkFailed(&layout->failed);
+	} else if (!layout->codec->decompress(inBytes, inLength, outBytes, outLength)) {
+		MarkFailed(&layout->failed);
+	}
+}
+
+int nv_chunked_uncompressed_length(const unsigned char *bytes, size_t length, uint64_t *uncompressedLength) {
+	ChunkedLayout layout;
+	if (!ReadChunkedLayout(bytes, length, &layout))
+		return 0;
+
+	*uncompressedLength = layout.originalLength;
+	free(layout.chunkOffsets);
+	return 1;
+}
+
+int nv_chunked_uncompress(const unsigned char *bytes, size_t length, unsigned char *dest, size_t destLength) {
+	ChunkedLayout layout;
+	if (!ReadChunkedLayout(bytes, length, &layout))
+		return 0;
+
+	if (layout.originalLength == destLength) {
+		layout.outBytes = dest;
+		dispatch_apply_f(layout.chunkCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), &layout, DecompressChunk);
+	} else {
+		layout.failed = 1;
+	}
+	free(layout.chunkOffsets);
+	return !layout.failed;
+}
+
+unsigned char *nv_compress(const unsigned char *bytes, size_t length, int level, size_t *compressedLength) {
+	if (length <= NV_COMPRESSION_CHUNK_SIZE)
+		return nv_zlib_compress(bytes, length, level, compressedLength);
+
+	return nv_chunked_compress(bytes, length, NVCompressionCodecZlib, level, compressedLength);
+}
+
+unsigned char *nv_uncompress(const unsigned char *bytes, size_t length, size_t *uncompressedLength) {
+	if (!nv_is_chunked_compressed(bytes, length))
+		return ZlibUncompress(bytes, length, uncompressedLength);
+
+	uint64_t originalLength;
+	if (!nv_chunked_uncompressed_length(bytes, length, &originalLength))
+		return NULL;
+
+	unsigned char *uncompressed = (unsigned char *)malloc(originalLength ? (size_t)originalLength : 1);
+	if (uncompressed && !nv_chunked_uncompress(bytes, length, uncompressed, (size_t)originalLength)) {
+		free(uncompressed);
+		return NULL;
+	}
+	*uncompressedLength = (size_t)originalLength;
+	return uncompressed;
+}
@@ -0,0 +1,40 @@
+/*
+ *  ChunkedCompression.h
+ *  Notation
+ *
+ *  the compressed form of note record parts and of the database blob written by older versions;
+ *  NSData_transformations wraps these for Foundation, and Tests/compression_test.c checks them directly
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+//data larger than this is compressed in independent chunks of this size, on as many cores as are available;
+//anything smaller is written in the legacy format: a single zlib stream followed by its big-endian 32-bit original length
+#define NV_COMPRESSION_CHUNK_SIZE (256 * 1024)
+
+//the algorithms that chunked data can be compressed with; each chunked blob records the one it used
+typedef enum {
+	NVCompressionCodecZlib = 0
+} NVCompressionCodecID;
+
+//whether the bytes start with the chunked container's header, or look like a zlib stream (RFC 1950), respectively
+int nv_is_chunked_compressed(const unsigned char *bytes, size_t length);
+int nv_is_zlib_compressed(const unsigned char *bytes, size_t length);
+
+//compresses in whichever format suits the length, returning a malloc'd buffer or NULL
+unsigned char *nv_compress(const unsigned char *bytes, size_t length, int level, size_t *compressedLength);
+
+//decompresses either format, returning a malloc'd buffer or NULL when the data is damaged or not compressed
+unsigned char *nv_uncompress(const unsigned char *bytes, size_t length, size_t *uncompressedLength);
+
+//the two formats on their own
+unsigned char *nv_zlib_compress(const unsigned char *bytes, size_t length, int level, size_t *compressedLength);
+unsigned char *nv_chunked_compress(const unsigned char *bytes, size_t length, NVCompressionCodecID codec, int level, size_t *compressedLength);
+
+//the original length recorded in a chunked header, once the header and the chunk table have been checked against the data
+int nv_chunked_uncompressed_length(const unsigned char *bytes, size_t length, uint64_t *uncompressedLength);
+
+//decompresses every chunk straight into its place in dest, which must be exactly the original length
+int nv_chunked_uncompress(const unsigned char *bytes, size_t length, unsigned char *dest, size_t destLength);
@@ -76,6 +76,10 @@
 	return [NSString stringWithFormat:@"DeletedNoteObj(%@) %@", [NSString uuidStringWithBytes:uniqueNoteIDBytes], syncServicesMD];
 }
 
+- (void)_syncServicesMDDidChange {
+	//deleted notes are always stored along with the database itself
+}
+
 #include "SynchronizedNoteMixIns.h"
 
 - (void)dealloc {
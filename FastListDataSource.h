@@ -22,7 +22,7 @@
 
 @interface FastListDataSource : NSObject {
 	id *objects;
-    NSUInteger count;
+    NSUInteger count, capacity;
 }
 
 - (const id *)immutableObjects;
@@ -32,9 +32,14 @@
 - (NSArray*)objectsAtFilteredIndexes:(NSIndexSet*)indexSet;
 
 - (void)fillArrayFromArray:(NSArray*)array;
+- (void)fillArrayFromObjects:(const id *)objs count:(NSUInteger)objCount;
 - (BOOL)filterArrayUsingFunction:(BOOL (*)(id, void*))present context:(void*)context;
+- (BOOL)filterArrayConcurrentlyUsingFunction:(BOOL (*)(id, void*))present context:(void*)context;
 
 - (void)sortStableUsingFunction:(NSInteger (*)(id *, id *))compare;
+- (void)sortUsingKeyFunction:(uint64_t (*)(id))keyFunction descending:(BOOL)descending tiebreakFunction:(NSInteger (*)(id *, id *))compare;
+//returns NSNotFound without inserting if the object is already among those that sort equal to it
+- (NSUInteger)insertObject:(id)anObject sortedUsingFunction:(NSInteger (*)(id *, id *))compare;
 
 - (void)tableView:(NSTableView *)aTableView setObjectValue:(id)anObject 
    forTableColumn:(NSTableColumn *)aTableColumn row:(NSInteger)rowIndex;
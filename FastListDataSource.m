@@ -19,9 +19,23 @@
 #import "FastListDataSource.h"
 #import "NotesTableView.h"
 #import "NoteAttributeColumn.h"
+#import "NSCollection_utils.h"
+#include <dispatch/dispatch.h>
+
+//below this many objects the cost of dispatching outweighs any gain from the other cores
+#define kMinimumConcurrentFilterCount 2048
+#define kConcurrentFilterChunkSize 512
 
 @implementation FastListDataSource
 
+//grows the buffer geometrically, so that filing notes in one at a time does not reallocate it on each
+- (void)_ensureCapacity:(NSUInteger)neededCount {
+	if (neededCount > capacity || !objects) {
+		capacity = MAX(MAX(neededCount, capacity * 2), 16);
+		objects = (id*)realloc(objects, capacity * sizeof(id));
+	}
+}
+
 - (const id *)immutableObjects {
 	return (const id *)objects;
 }
@@ -73,7 +87,6 @@
 //as long as this class is only used for temporary display, we probably do not need to uncomment the retains and releases
 
 - (void)fillArrayFromArray:(NSArray*)array {
-	NSUInteger oldArraySize = count;
 	
 	//release old values
 	//unsigned int i;
@@ -83,9 +96,7 @@
 	}
 	
 	count = CFArrayGetCount((CFArrayRef)array);	
-	if (count > oldArraySize) {
-	    objects = (id*)realloc(objects, count * sizeof(id));
-	}
+	[self _ensureCapacity:count];
 
 	CFArrayGetValues((CFArrayRef)array, CFRangeMake(0, count), (const void **)objects);
 	
@@ -94,6 +105,13 @@
 		//objRetain(objects[i], @selector(retain));
 }
 
+- (void)fillArrayFromObjects:(const id *)objs count:(NSUInteger)objCount {
+	[self _ensureCapacity:objCount];
+	
+	memcpy(objects, objs, objCount * sizeof(id));
+	count = objCount;
+}
+
 - (BOOL)filterArrayUsingFunction:(BOOL (*)(id, void*))present context:(void*)context {
 	register NSUInteger j = 0, i, oldCount = count;
 	
@@ -116,11 +134,75 @@
 	return (count != oldCount);
 }
 
+//same as above, but evaluates the predicate on chunks of the array in parallel
+//present must be safe to call concurrently for different objects
+- (BOOL)filterArrayConcurrentlyUsingFunction:(BOOL (*)(id, void*))present context:(void*)context {
+	NSUInteger j = 0, i, oldCount = count;
+	
+	if (!objects)
+		return NO;
+	
+	if (oldCount < kMinimumConcurrentFilterCount)
+		return [self filterArrayUsingFunction:present context:context];
+	
+	id *objs = objects;
+	unsigned char *survivors = (unsigned char *)malloc(oldCount);
+	size_t chunkCount = (oldCount + kConcurrentFilterChunkSize - 1) / kConcurrentFilterChunkSize;
+	
+	dispatch_apply(chunkCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^(size_t chunk) {
+		NSUInteger k = chunk * kConcurrentFilterChunkSize, end = MIN(k + kConcurrentFilterChunkSize, oldCount);
+		for (; k < end; k++)
+			survivors[k] = present(objs[k], context) ? 1 : 0;
+	});
+	
+	//compact in place, preserving order
+	for (i=0; i<oldCount; i++) {
+		if (survivors[i])
+			objects[j++] = objects[i];
+	}
+	free(survivors);
+	
+	count = j;
+	
+	return (count != oldCount);
+}
+
 - (void)sortStableUsingFunction:(NSInteger (*)(id *, id *))compare {
 	
 	mergesort((void *)objects, (size_t)count, sizeof(id), (int (*)(const void *, const void *))compare);
 }
 
+- (void)sortUsingKeyFunction:(uint64_t (*)(id))keyFunction descending:(BOOL)descending tiebreakFunction:(NSInteger (*)(id *, id *))compare {
+	
+	RadixSortObjects(objects, (size_t)count, keyFunction, descending, compare);
+}
+
+- (NSUInteger)insertObject:(id)anObject sortedUsingFunction:(NSInteger (*)(id *, id *))compare {
+	NSUInteger low = 0, high = count;
+	
+	while (low < high) {
+		NSUInteger mid = low + (high - low) / 2;
+		if (compare(&anObject, &objects[mid]) < 0)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+	
+	//the list is sorted with the same function, so an object already in it lies among those just below
+	NSUInteger i;
+	for (i = low; i > 0 && !compare(&anObject, &objects[i - 1]); i--) {
+		if (objects[i - 1] == anObject)
+			return NSNotFound;
+	}
+	
+	[self _ensureCapacity:count + 1];
+	memmove(objects + low + 1, objects + low, (count - low) * sizeof(id));
+	objects[low] = anObject;
+	count++;
+	
+	return low;
+}
+
 - (void)tableView:(NSTableView *)aTableView setObjectValue:(id)anObject 
    forTableColumn:(NSTableColumn *)aTableColumn row:(NSInteger)rowIndex {
 	
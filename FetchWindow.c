@@ -0,0 +1,153 @@
+/*
+ *  FetchWindow.c
+ *  Notation
+ *
+ */
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+#include "FetchWindow.h"
+
+#include <stdlib.h>
+
+enum { EntryWaiting = 0, EntryRunning, EntryRetrying, EntryFinished, EntryMerged };
+
+struct _FetchWindow {
+	size_t entryCount, maximumConcurrent;
+	size_t nextEntryToStart, nextEntryToMerge, finishedCount;
+	size_t runningCount, retriesPending;
+	unsigned int maximumAttempts;
+	double retryBaseDelay;
+	int stopped;
+
+	unsigned char *states, *attempts;
+};
+
+FetchWindow *FetchWindowCreate(size_t entryCount, size_t maximumConcurrent, unsigned int maximumAttempts, double retryBaseDelay) {
+	FetchWindow *window = (FetchWindow *)calloc(1, sizeof(FetchWindow));
+	if (!window) return NULL;
+
+	window->entryCount = entryCount;
+	window->maximumConcurrent = maximumConcurrent ? maximumConcurrent : 1;
+	//attempts are counted in a byte
+	window->maximumAttempts = maximumAttempts < 1 ? 1 : (maximumAttempts > 255 ? 255 : maximumAttempts);
+	window->retryBaseDelay = retryBaseDelay;
+	window->states = (unsigned char *)calloc(entryCount ? entryCount : 1, sizeof(unsigned char));
+	window->attempts = (unsigned char *)calloc(entryCount ? entryCount : 1, sizeof(unsigned char));
+	if (!window->states || !window->attempts) {
+		FetchWindowFree(window);
+		return NULL;
+	}
+	return window;
+}
+
+void FetchWindowFree(FetchWindow *window) {
+	if (!window) return;
+	free(window->states);
+	free(window->attempts);
+	free(window);
+}
+
+void FetchWindowSetMaximumConcurrent(FetchWindow *window, size_t maximumConcurrent) {
+	if (FetchWindowHasStarted(window)) return;
+	window->maximumConcurrent = maximumConcurrent ? maximumConcurrent : 1;
+}
+
+size_t FetchWindowMaximumConcurrent(const FetchWindow *window) {
+	return window->maximumConcurrent;
+}
+
+int FetchWindowStatusIsRetryable(long statusCode) {
+	//no response at all, a server error or a request to back off
+	return statusCode == 0 || statusCode == 429 || (statusCode >= 500 && statusCode < 600);
+}
+
+size_t FetchWindowStartNextEntry(FetchWindow *window) {
+	//an entry waiting to be retried still counts against the window
+	if (window->stopped || window->nextEntryToStart >= window->entryCount ||
+		window->runningCount + window->retriesPending >= window->maximumConcurrent)
+		return FETCH_WINDOW_NONE;
+
+	size_t entry = window->nextEntryToStart++;
+	window->states[entry] = EntryRunning;
+	window->attempts[entry] = 1;
+	window->runningCount++;
+	return entry;
+}
+
+double FetchWindowFinishEntry(FetchWindow *window, size_t entry, int failed, int retryable) {
+	if (entry >= window->entryCount || window->states[entry] != EntryRunning) return -1.0;
+	window->runningCount--;
+
+	if (failed && retryable && !window->stopped && window->attempts[entry] < window->maximumAttempts) {
+		window->states[entry] = EntryRetrying;
+		window->retriesPending++;
+		return window->retryBaseDelay * (double)(1U << (window->attempts[entry] - 1));
+	}
+
+	window->states[entry] = EntryFinished;
+	window->finishedCount++;
+	return -1.0;
+}
+
+int FetchWindowStartRetry(FetchWindow *window, size_t entry) {
+	if (window->stopped || entry >= window->entryCount || window->states[entry] != EntryRetrying) return 0;
+
+	window->retriesPending--;
+	window->states[entry] = EntryRunning;
+	window->attempts[entry]++;
+	window->runningCount++;
+	return 1;
+}
+
+size_t FetchWindowNextEntryToMerge(FetchWindow *window) {
+	if (window->nextEntryToMerge >= window->entryCount || window->states[window->nextEntryToMerge] != EntryFinished)
+		return FETCH_WINDOW_NONE;
+
+	size_t entry = window->nextEntryToMerge++;
+	window->states[entry] = EntryMerged;
+	return entry;
+}
+
+void FetchWindowStop(FetchWindow *window) {
+	size_t i;
+
+	window->stopped = 1;
+	//the entries that were waiting to be retried are given up where they are, neither finished nor merged
+	for (i = 0; window->retriesPending && i < window->nextEntryToStart; i++) {
+		if (window->states[i] == EntryRetrying) {
+			window->states[i] = EntryWaiting;
+			window->retriesPending--;
+		}
+	}
+}
+
+int FetchWindowHasStarted(const FetchWindow *window) {
+	return window->nextEntryToStart != 0;
+}
+
+size_t FetchWindowFinishedCount(const FetchWindow *window) {
+	return window->finishedCount;
+}
+
+size_t FetchWindowRunningCount(const FetchWindow *window) {
+	return window->runningCount;
+}
+
+size_t FetchWindowRetriesPending(const FetchWindow *window) {
+	return window->retriesPending;
+}
+
+int FetchWindowIsDone(const FetchWindow *window) {
+	if (window->runningCount || window->retriesPending) return 0;
+	return window->stopped || window->nextEntryToMerge >= window->entryCount;
+}
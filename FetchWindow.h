@@ -0,0 +1,61 @@
+/*
+ *  FetchWindow.h
+ *  Notation
+ *
+ *  the scheduling behind SimplenoteEntryCollector: which entry to fetch next without exceeding the window of concurrent
+ *  requests, whether and when a failed fetch is tried again, and which finished entries can be handed over in order;
+ *  the collector drives it with its fetchers, and Tests/fetch_window_test.c with a scripted transport and clock
+ *
+ */
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+#include <stddef.h>
+
+#define FETCH_WINDOW_NONE ((size_t)-1)
+
+typedef struct _FetchWindow FetchWindow;
+
+//an entry is attempted at most maximumAttempts times, its nth retry waiting retryBaseDelay * 2^(n-1) seconds
+FetchWindow *FetchWindowCreate(size_t entryCount, size_t maximumConcurrent, unsigned int maximumAttempts, double retryBaseDelay);
+void FetchWindowFree(FetchWindow *window);
+
+//only before the first entry has been started
+void FetchWindowSetMaximumConcurrent(FetchWindow *window, size_t maximumConcurrent);
+size_t FetchWindowMaximumConcurrent(const FetchWindow *window);
+
+//whether a response with this HTTP status (0 for none at all) is worth another attempt
+int FetchWindowStatusIsRetryable(long statusCode);
+
+//the next entry to fetch if there is room for it in the window, or FETCH_WINDOW_NONE; the caller must start it
+size_t FetchWindowStartNextEntry(FetchWindow *window);
+
+//a fetch has ended; returns the seconds to wait before calling FetchWindowStartRetry for the entry,
+//which keeps its place in the window meanwhile, or a negative value once the entry is finished for good
+double FetchWindowFinishEntry(FetchWindow *window, size_t entry, int failed, int retryable);
+
+//whether the retry of an entry should be started now that its delay has passed; never after FetchWindowStop
+int FetchWindowStartRetry(FetchWindow *window, size_t entry);
+
+//the first finished entry not yet handed over, provided every entry before it has been, or FETCH_WINDOW_NONE
+size_t FetchWindowNextEntryToMerge(FetchWindow *window);
+
+//starts nothing more and forgets pending retries; fetches still running must still be finished
+void FetchWindowStop(FetchWindow *window);
+
+int FetchWindowHasStarted(const FetchWindow *window);
+size_t FetchWindowFinishedCount(const FetchWindow *window);
+size_t FetchWindowRunningCount(const FetchWindow *window);
+size_t FetchWindowRetriesPending(const FetchWindow *window);
+
+//nothing running or waiting to be retried, and every entry handed over unless the window was stopped
+int FetchWindowIsDone(const FetchWindow *window);
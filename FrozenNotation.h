@@ -18,18 +18,20 @@
 #import <Cocoa/Cocoa.h>
 
 @class NotationPrefs;
+@class NoteRecordStore;
 
 @interface FrozenNotation : NSObject <NSCoding> {
 	NSMutableArray *allNotes;
 	NSMutableSet *deletedNoteSet;
-	NSMutableData *notesData;
+	NSMutableData *notesData; //only in databases written before the note record store
+	NSData *recordIndex;
 	NotationPrefs *prefs;
 }
-- (id)initWithNotes:(NSMutableArray*)notes deletedNotes:(NSMutableSet*)antiNotes prefs:(NotationPrefs*)prefs;
+- (id)initWithRecordIndex:(NSData*)indexData deletedNotes:(NSMutableSet*)antiNotes prefs:(NotationPrefs*)prefs;
 
-+ (NSData*)frozenDataWithExistingNotes:(NSMutableArray*)notes deletedNotes:(NSMutableSet*)antiNotes prefs:(NotationPrefs*)prefs;
-- (NSMutableArray*)unpackedNotesWithPrefs:(NotationPrefs*)somePrefs returningError:(OSStatus*)err;
-- (NSMutableArray*)unpackedNotesReturningError:(OSStatus*)err;
++ (NSData*)frozenDataWithRecordIndex:(NSData*)indexData deletedNotes:(NSMutableSet*)antiNotes prefs:(NotationPrefs*)prefs;
+- (NSMutableArray*)unpackedNotesFromRecordStore:(NoteRecordStore*)recordStore returningError:(OSStatus*)err;
+- (NSData*)recordIndex;
 - (NSMutableSet*)deletedNotes; //these won't need to be encrypted
 - (NotationPrefs*)notationPrefs;
 
@@ -20,6 +20,7 @@
 #import "PassphraseRetriever.h"
 #import "NSData_transformations.h"
 #import "NotationPrefs.h"
+#import "NoteRecordStore.h"
 
 @implementation FrozenNotation
 
@@ -27,6 +28,7 @@
 	if ([decoder containsValueForKey:VAR_STR(prefs)]) {
 		prefs = [[decoder decodeObjectForKey:VAR_STR(prefs)] retain];
 		notesData = [[decoder decodeObjectForKey:VAR_STR(notesData)] retain];
+		recordIndex = [[decoder decodeObjectForKey:VAR_STR(recordIndex)] retain];
 		deletedNoteSet = [[decoder decodeObjectForKey:VAR_STR(deletedNoteSet)] retain];
 	} else {
 		NSLog(@"FrozenNotation: decoding legacy %@", decoder);
@@ -40,7 +42,7 @@
 - (void)encodeWithCoder:(NSCoder *)coder {
 	if ([coder allowsKeyedCoding]) {
 		[coder encodeObject:prefs forKey:VAR_STR(prefs)];
-		[coder encodeObject:notesData forKey:VAR_STR(notesData)];
+		[coder encodeObject:recordIndex forKey:VAR_STR(recordIndex)];
 		[coder encodeObject:deletedNoteSet forKey:VAR_STR(deletedNoteSet)];
 	} else {
 		[coder encodeObject:prefs];
@@ -49,38 +51,16 @@
 	}
 }
 
-- (id)initWithNotes:(NSMutableArray*)notes deletedNotes:(NSMutableSet*)antiNotes prefs:(NotationPrefs*)somePrefs {
+- (id)initWithRecordIndex:(NSData*)indexData deletedNotes:(NSMutableSet*)antiNotes prefs:(NotationPrefs*)somePrefs {
 	
 	if ([super init]) {
-
-		notesData = [[NSMutableData alloc] init];
-		NSKeyedArchiver *archiver = [[NSKeyedArchiver alloc] initForWritingWithMutableData:notesData];
-		[archiver encodeObject:notes forKey:@"notes"];
-        [archiver finishEncoding];
-		[archiver release];
-		
+		//the notes themselves are already in the record store; the index names the segment and each note's record in it
+		recordIndex = [indexData retain];
 		prefs = [somePrefs retain];
-		deletedNoteSet = [antiNotes retain];		
-		
-		NSMutableData *oldNotesData = notesData;
-		notesData = [[notesData compressedData] retain];
-		[oldNotesData release];
+		deletedNoteSet = [antiNotes retain];
 		
-		//ostensibly to create more entropy in the first blocks, relying on CBC dependency to crack
-		//[notesData reverseBytes];
-		
-		if ([somePrefs doesEncryption]) {
-			//compress?, reverse?, encrypt notesData based on notationprefs
-			//we also want to have the salt reset here, but that requires knowing the original password
-			
-			if (![prefs encryptDataInNewSession:notesData]) {
-				NSLog(@"Couldn't encrypt data!");
-				return nil;
-			}
-		}
-		
-		if (![notesData length]) {
-			NSLog(@"%s: empty notesData; returning nil", _cmd);
+		if (![recordIndex length]) {
+			NSLog(@"%s: empty recordIndex; returning nil", _cmd);
 			return nil;
 		}
 	}
@@ -91,16 +71,17 @@
 - (void)dealloc {
 	[allNotes release];
 	[notesData release];
+	[recordIndex release];
 	[prefs release];
 	[deletedNoteSet release];
 	
 	[super dealloc];
 }
 
-+ (NSData*)frozenDataWithExistingNotes:(NSMutableArray*)notes 
-						  deletedNotes:(NSMutableSet*)antiNotes 
-								 prefs:(NotationPrefs*)prefs {
-	FrozenNotation *frozenNotation = [[FrozenNotation alloc] initWithNotes:notes deletedNotes:antiNotes prefs:prefs];
++ (NSData*)frozenDataWithRecordIndex:(NSData*)indexData 
+						deletedNotes:(NSMutableSet*)antiNotes 
+							   prefs:(NotationPrefs*)prefs {
+	FrozenNotation *frozenNotation = [[FrozenNotation alloc] initWithRecordIndex:indexData deletedNotes:antiNotes prefs:prefs];
 
 	if (!frozenNotation)
 		return nil;
@@ -111,47 +92,10 @@
 	return encodedNotationData;
 }
 
-- (NSMutableArray*)unpackedNotesWithPrefs:(NotationPrefs*)somePrefs returningError:(OSStatus*)err {
+- (NSMutableArray*)unpackedNotesFromRecordStore:(NoteRecordStore*)recordStore returningError:(OSStatus*)err {
 	
-	//decrypt notesData if necessary, then unarchive
-	
-	*err = noErr;
-	
-	@try {
-		if ([somePrefs doesEncryption]) {
-			if (![somePrefs decryptDataWithCurrentSettings:notesData]) {
-				NSLog(@"Error decrypting data!");
-				*err = kNoAuthErr;
-				return nil;
-			}
-		}
-		
-		NSMutableData *oldNotesData = notesData;
-		notesData = [[notesData uncompressedData] retain];
-		[oldNotesData autorelease];
-		
-		if (!notesData) {
-			*err = kCompressionErr;
-			NSLog(@"Error decompressing data");
-			return nil;
-		}
-		NSKeyedUnarchiver *unarchiver = [[NSKeyedUnarchiver alloc] initForReadingWithData:notesData];
-		allNotes = [[unarchiver decodeObjectForKey:@"notes"] retain];
-		[unarchiver autorelease];
-		
-	} @catch (NSException *e) {
-		*err = kCoderErr;
-		NSLog(@"(VERIFY) Error unarchiving notes from data (%@, %@)", [e name], [e reason]);
-		return nil;
-	}
-	
-	return allNotes;
-}
-
-
-- (NSMutableArray*)unpackedNotesReturningError:(OSStatus*)err {
-	
-	//decrypt notesData, grabbing password from from keychain or user as necessary, then unarchive
+	//grab password from from keychain or user as necessary, then read the notes from the record store
+	//or, for older databases, decrypt and unarchive notesData
 	
 	*err = noErr;
 	
@@ -175,6 +119,14 @@
 					}
 					//if result is 1, passphrase should already be loaded
 				}
+			}
+			
+			if (recordIndex) {
+				allNotes = [[recordStore notesWithIndexData:recordIndex returningError:err] retain];
+				return allNotes;
+			}
+			
+			if ([prefs doesEncryption]) {
 				if (![prefs decryptDataWithCurrentSettings:notesData]) {
 					NSLog(@"Error decrypting data!");
 					*err = kNoAuthErr;
@@ -214,6 +166,10 @@
 	return allNotes;
 }
 
+- (NSData*)recordIndex {
+	return recordIndex;
+}
+
 - (NSMutableSet*)deletedNotes {
 	return deletedNoteSet;
 }
@@ -0,0 +1,56 @@
+//
+//  JSONStreamParser.h
+//  Notation
+//
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+
+#import <Cocoa/Cocoa.h>
+#import "JSONStreamTokenizer.h"
+
+//decodes UTF-8 JSON a chunk at a time as it arrives, so that a response never needs to be held in full;
+//each element of one array (the top-level array, or the array for a given key of the top-level object)
+//is handed to the delegate as soon as it is complete, and only what the delegate returns for it is kept
+
+typedef struct _JSONStreamFrame JSONStreamFrame;
+
+@interface JSONStreamParser : NSObject {
+	id delegate;
+	NSString *streamedArrayKey;
+
+	id rootObject;
+	NSUInteger streamedElementCount;
+
+	JSONStreamTokenizer *tokenizer;
+	JSONStreamFrame *frames;
+	unsigned int depth;
+	BOOL delegateKeepsElements;
+}
+
+- (id)initWithStreamedArrayKey:(NSString*)aKey delegate:(id)aDelegate;
+
+//returns NO once the data seen so far can no longer be valid JSON
+- (BOOL)parseData:(NSData*)data;
+//returns YES if exactly one complete value was parsed
+- (BOOL)finish;
+
+- (id)rootObject;
+- (NSUInteger)streamedElementCount;
+- (NSString*)errorDescription;
+
+@end
+
+@interface NSObject (JSONStreamParserDelegate)
+//the object to keep in the streamed array in place of element, or nil to keep nothing
+- (id)jsonStreamParser:(JSONStreamParser*)parser objectForElement:(id)element;
+@end
@@ -0,0 +1,167 @@
+//
+//  JSONStreamParser.m
+//  Notation
+//
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+
+#import "JSONStreamParser.h"
+
+struct _JSONStreamFrame {
+	id container;
+	NSString *key;
+	BOOL isObject, streams;
+};
+
+@interface JSONStreamParser (Private)
+- (BOOL)_handleToken:(const JSONToken*)token;
+@end
+
+static int HandleToken(void *context, JSONStreamTokenizer *tokenizer, const JSONToken *token) {
+	return [(JSONStreamParser*)context _handleToken:token];
+}
+
+@implementation JSONStreamParser
+
+- (id)initWithStreamedArrayKey:(NSString*)aKey delegate:(id)aDelegate {
+	if ([super init]) {
+		streamedArrayKey = [aKey copy];
+		delegate = aDelegate;
+		delegateKeepsElements = [delegate respondsToSelector:@selector(jsonStreamParser:objectForElement:)];
+
+		frames = (JSONStreamFrame *)calloc(kJSONMaxNestingDepth, sizeof(JSONStreamFrame));
+		tokenizer = JSONStreamTokenizerCreate(HandleToken, self);
+	}
+	return self;
+}
+
+- (void)dealloc {
+	while (depth--) {
+		[frames[depth].container release];
+		[frames[depth].key release];
+	}
+	free(frames);
+	JSONStreamTokenizerFree(tokenizer);
+	[streamedArrayKey release];
+	[rootObject release];
+	[super dealloc];
+}
+
+- (id)rootObject {
+	return JSONStreamTokenizerIsDone(tokenizer) ? rootObject : nil;
+}
+
+- (NSUInteger)streamedElementCount {
+	return streamedElementCount;
+}
+
+- (NSString*)errorDescription {
+	const char *error = JSONStreamTokenizerError(tokenizer);
+	return error ? [NSString stringWithUTF8String:error] : nil;
+}
+
+- (void)_addValue:(id)value {
+	if (!depth) {
+		rootObject = [value retain];
+		return;
+	}
+
+	JSONStreamFrame *frame = &frames[depth - 1];
+	if (frame->streams) {
+		streamedElementCount++;
+		if (delegateKeepsElements) value = [delegate jsonStreamParser:self objectForElement:value];
+		if (value) [frame->container addObject:value];
+	} else if (frame->isObject) {
+		[frame->container setObject:value forKey:frame->key];
+		[frame->key release];
+		frame->key = nil;
+	} else {
+		[frame->container addObject:value];
+	}
+}
+
+- (void)_beginContainer:(BOOL)isObject {
+	//the tokenizer has already refused anything nested deeper than the frames go
+	BOOL streams = NO;
+	if (!isObject) {
+		if (!depth) {
+			streams = streamedArrayKey == nil;
+		} else if (depth == 1 && frames[0].isObject && streamedArrayKey) {
+			streams = [frames[0].key isEqualToString:streamedArrayKey];
+		}
+	}
+	JSONStreamFrame *frame = &frames[depth++];
+	frame->container = isObject ? (id)[[NSMutableDictionary alloc] init] : (id)[[NSMutableArray alloc] init];
+	frame->key = nil;
+	frame->isObject = isObject;
+	frame->streams = streams;
+}
+
+- (void)_endContainer {
+	JSONStreamFrame *frame = &frames[--depth];
+	id container = frame->container;
+	frame->container = nil;
+
+	[self _addValue:container];
+	[container release];
+}
+
+- (BOOL)_handleToken:(const JSONToken*)token {
+	id value = nil;
+
+	switch (token->type) {
+		case JSONTokenBeginObject:
+		case JSONTokenBeginArray:
+			[self _beginContainer:token->type == JSONTokenBeginObject];
+			return YES;
+		case JSONTokenEndObject:
+		case JSONTokenEndArray:
+			[self _endContainer];
+			return YES;
+		case JSONTokenKey:
+		case JSONTokenString:
+			value = (NSString*)CFStringCreateWithBytes(NULL, (const UInt8*)token->bytes, token->length, kCFStringEncodingUTF8, false);
+			if (!value) {
+				JSONStreamTokenizerFail(tokenizer, "String is not valid UTF-8");
+				return NO;
+			}
+			if (token->type == JSONTokenKey) {
+				JSONStreamFrame *frame = &frames[depth - 1];
+				[frame->key release];
+				frame->key = value;
+				return YES;
+			}
+			[value autorelease];
+			break;
+		case JSONTokenInteger: value = [NSNumber numberWithLongLong:token->integer]; break;
+		case JSONTokenReal: value = [NSNumber numberWithDouble:token->real]; break;
+		case JSONTokenTrue: value = [NSNumber numberWithBool:YES]; break;
+		case JSONTokenFalse: value = [NSNumber numberWithBool:NO]; break;
+		case JSONTokenNull: value = [NSNull null]; break;
+	}
+	[self _addValue:value];
+	return YES;
+}
+
+- (BOOL)parseData:(NSData*)data {
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	BOOL parsed = JSONStreamTokenizerParse(tokenizer, [data bytes], [data length]);
+	[pool drain];
+	return parsed;
+}
+
+- (BOOL)finish {
+	return JSONStreamTokenizerFinish(tokenizer);
+}
+
+@end
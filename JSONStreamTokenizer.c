@@ -0,0 +1,412 @@
+/*
+ *  JSONStreamTokenizer.c
+ *  Notation
+ *
+ */
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+
+#include "JSONStreamTokenizer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+
+enum {
+	JSONExpectValue = 0,
+	JSONExpectFirstElement, //a value or the end of an empty array
+	JSONExpectFirstKey,     //a key or the end of an empty object
+	JSONExpectKey,
+	JSONExpectColon,
+	JSONExpectSeparator,    //a comma or the end of the enclosing container
+	JSONInString,
+	JSONInNumber,
+	JSONInLiteral,
+	JSONDone,
+	JSONFailed
+};
+
+struct _JSONStreamTokenizer {
+	JSONTokenHandler handler;
+	void *context;
+
+	int state;
+	unsigned char isObject[kJSONMaxNestingDepth];
+	unsigned int depth;
+
+	//the bytes of the string, number or literal currently being read
+	char *token;
+	size_t tokenLength, tokenCapacity;
+	int tokenIsKey, tokenHasFraction, inEscape;
+	unsigned int unicodeDigitsLeft, literalIndex;
+	uint16_t unicodeValue, highSurrogate;
+	const char *expectedLiteral;
+
+	char error[96];
+};
+
+#define IsHighSurrogate(__unit) ((__unit) >= 0xD800 && (__unit) <= 0xDBFF)
+#define IsLowSurrogate(__unit) ((__unit) >= 0xDC00 && (__unit) <= 0xDFFF)
+
+JSONStreamTokenizer *JSONStreamTokenizerCreate(JSONTokenHandler handler, void *context) {
+	JSONStreamTokenizer *tokenizer = (JSONStreamTokenizer *)calloc(1, sizeof(JSONStreamTokenizer));
+	tokenizer->handler = handler;
+	tokenizer->context = context;
+	tokenizer->tokenCapacity = 256;
+	tokenizer->token = (char *)malloc(tokenizer->tokenCapacity);
+	tokenizer->state = JSONExpectValue;
+	return tokenizer;
+}
+
+void JSONStreamTokenizerFree(JSONStreamTokenizer *tokenizer) {
+	if (!tokenizer) return;
+	free(tokenizer->token);
+	free(tokenizer);
+}
+
+void JSONStreamTokenizerFail(JSONStreamTokenizer *tokenizer, const char *description) {
+	if (tokenizer->state == JSONFailed) return;
+	tokenizer->state = JSONFailed;
+	snprintf(tokenizer->error, sizeof(tokenizer->error), "%s", description);
+}
+
+const char *JSONStreamTokenizerError(const JSONStreamTokenizer *tokenizer) {
+	return tokenizer->state == JSONFailed ? tokenizer->error : NULL;
+}
+
+int JSONStreamTokenizerIsDone(const JSONStreamTokenizer *tokenizer) {
+	return tokenizer->state == JSONDone;
+}
+
+static void AppendTokenBytes(JSONStreamTokenizer *tokenizer, const void *bytes, size_t length) {
+	if (tokenizer->tokenLength + length + 1 > tokenizer->tokenCapacity) {
+		while (tokenizer->tokenLength + length + 1 > tokenizer->tokenCapacity) tokenizer->tokenCapacity *= 2;
+		tokenizer->token = (char *)realloc(tokenizer->token, tokenizer->tokenCapacity);
+	}
+	memcpy(tokenizer->token + tokenizer->tokenLength, bytes, length);
+	tokenizer->tokenLength += length;
+}
+
+static void AppendCodePoint(JSONStreamTokenizer *tokenizer, uint32_t ch) {
+	char utf8[4];
+	size_t length;
+	if (ch < 0x80) {
+		utf8[0] = (char)ch;
+		length = 1;
+	} else if (ch < 0x800) {
+		utf8[0] = (char)(0xC0 | (ch >> 6));
+		utf8[1] = (char)(0x80 | (ch & 0x3F));
+		length = 2;
+	} else if (ch < 0x10000) {
+		utf8[0] = (char)(0xE0 | (ch >> 12));
+		utf8[1] = (char)(0x80 | ((ch >> 6) & 0x3F));
+		utf8[2] = (char)(0x80 | (ch & 0x3F));
+		length = 3;
+	} else {
+		utf8[0] = (char)(0xF0 | (ch >> 18));
+		utf8[1] = (char)(0x80 | ((ch >> 12) & 0x3F));
+		utf8[2] = (char)(0x80 | ((ch >> 6) & 0x3F));
+		utf8[3] = (char)(0x80 | (ch & 0x3F));
+		length = 4;
+	}
+	AppendTokenBytes(tokenizer, utf8, length);
+}
+
+static void FlushHighSurrogate(JSONStreamTokenizer *tokenizer) {
+	//a high surrogate escape that isn't followed by a low one can't be represented
+	if (tokenizer->highSurrogate) {
+		tokenizer->highSurrogate = 0;
+		AppendCodePoint(tokenizer, 0xFFFD);
+	}
+}
+
+static void AppendEscapedUnit(JSONStreamTokenizer *tokenizer, uint16_t unit) {
+	if (IsLowSurrogate(unit) && tokenizer->highSurrogate) {
+		AppendCodePoint(tokenizer, 0x10000 + ((uint32_t)(tokenizer->highSurrogate - 0xD800) << 10) + (unit - 0xDC00));
+		tokenizer->highSurrogate = 0;
+		return;
+	}
+	FlushHighSurrogate(tokenizer);
+	if (IsHighSurrogate(unit)) {
+		tokenizer->highSurrogate = unit;
+	} else {
+		AppendCodePoint(tokenizer, IsLowSurrogate(unit) ? 0xFFFD : unit);
+	}
+}
+
+static void SendToken(JSONStreamTokenizer *tokenizer, JSONToken *token) {
+	token->depth = tokenizer->depth;
+	if (!tokenizer->handler(tokenizer->context, tokenizer, token))
+		JSONStreamTokenizerFail(tokenizer, "Stopped by the handler");
+}
+
+static void SendValue(JSONStreamTokenizer *tokenizer, JSONToken *token) {
+	SendToken(tokenizer, token);
+	if (tokenizer->state != JSONFailed)
+		tokenizer->state = tokenizer->depth ? JSONExpectSeparator : JSONDone;
+}
+
+static void BeginContainer(JSONStreamTokenizer *tokenizer, int isObject) {
+	JSONToken token = { isObject ? JSONTokenBeginObject : JSONTokenBeginArray };
+	if (tokenizer->depth >= kJSONMaxNestingDepth) {
+		JSONStreamTokenizerFail(tokenizer, "JSON nested too deeply");
+		return;
+	}
+	SendToken(tokenizer, &token);
+	if (tokenizer->state == JSONFailed) return;
+
+	tokenizer->isObject[tokenizer->depth++] = (unsigned char)isObject;
+	tokenizer->state = isObject ? JSONExpectFirstKey : JSONExpectFirstElement;
+}
+
+static void EndContainer(JSONStreamTokenizer *tokenizer, int isObject) {
+	JSONToken token = { isObject ? JSONTokenEndObject : JSONTokenEndArray };
+	if (!tokenizer->depth || tokenizer->isObject[tokenizer->depth - 1] != isObject) {
+		JSONStreamTokenizerFail(tokenizer, isObject ? "Unexpected '}'" : "Unexpected ']'");
+		return;
+	}
+	tokenizer->depth--;
+	SendValue(tokenizer, &token);
+}
+
+static void BeginToken(JSONStreamTokenizer *tokenizer) {
+	tokenizer->tokenLength = 0;
+	tokenizer->tokenHasFraction = tokenizer->inEscape = 0;
+	tokenizer->unicodeDigitsLeft = 0;
+	tokenizer->highSurrogate = 0;
+}
+
+static void FinishString(JSONStreamTokenizer *tokenizer) {
+	JSONToken token = { tokenizer->tokenIsKey ? JSONTokenKey : JSONTokenString };
+	tokenizer->token[tokenizer->tokenLength] = '\0';
+	token.bytes = tokenizer->token;
+	token.length = tokenizer->tokenLength;
+
+	if (tokenizer->tokenIsKey) {
+		SendToken(tokenizer, &token);
+		if (tokenizer->state != JSONFailed) tokenizer->state = JSONExpectColon;
+	} else {
+		SendValue(tokenizer, &token);
+	}
+}
+
+static void FinishNumber(JSONStreamTokenizer *tokenizer) {
+	JSONToken token = { JSONTokenInteger };
+	char *number = tokenizer->token, *end = NULL;
+	size_t length = tokenizer->tokenLength;
+	int parsed = 0;
+
+	number[length] = '\0';
+	if (!tokenizer->tokenHasFraction) {
+		errno = 0;
+		token.integer = strtoll(number, &end, 10);
+		parsed = errno != ERANGE && end == number + length && length;
+	}
+	if (!parsed) {
+		token.type = JSONTokenReal;
+		token.real = strtod(number, &end);
+		if (end != number + length || !length) {
+			char description[sizeof(tokenizer->error)];
+			snprintf(description, sizeof(description), "Invalid number '%s'", number);
+			JSONStreamTokenizerFail(tokenizer, description);
+			return;
+		}
+	}
+	SendValue(tokenizer, &token);
+}
+
+static void FinishLiteral(JSONStreamTokenizer *tokenizer) {
+	JSONToken token = { JSONTokenNull };
+	switch (tokenizer->expectedLiteral[0]) {
+		case 't': token.type = JSONTokenTrue; break;
+		case 'f': token.type = JSONTokenFalse; break;
+	}
+	SendValue(tokenizer, &token);
+}
+
+static size_t ConsumeStringBytes(JSONStreamTokenizer *tokenizer, const unsigned char *bytes, size_t length) {
+	size_t i = 0;
+
+	while (i < length && tokenizer->state == JSONInString) {
+		unsigned char c = bytes[i];
+
+		if (tokenizer->unicodeDigitsLeft) {
+			unsigned int digit;
+			if (c >= '0' && c <= '9') digit = c - '0';
+			else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+			else {
+				JSONStreamTokenizerFail(tokenizer, "Invalid unicode escape");
+				break;
+			}
+			tokenizer->unicodeValue = (uint16_t)((tokenizer->unicodeValue << 4) | digit);
+			if (!--tokenizer->unicodeDigitsLeft) AppendEscapedUnit(tokenizer, tokenizer->unicodeValue);
+			i++;
+		} else if (tokenizer->inEscape) {
+			tokenizer->inEscape = 0;
+			char unescaped;
+			switch (c) {
+				case '"': case '\\': case '/': unescaped = c; break;
+				case 'b': unescaped = '\b'; break;
+				case 'f': unescaped = '\f'; break;
+				case 'n': unescaped = '\n'; break;
+				case 'r': unescaped = '\r'; break;
+				case 't': unescaped = '\t'; break;
+				case 'u':
+					tokenizer->unicodeDigitsLeft = 4;
+					tokenizer->unicodeValue = 0;
+					i++;
+					continue;
+				default: {
+					char description[32];
+					snprintf(description, sizeof(description), "Invalid escape '\\%c'", c);
+					JSONStreamTokenizerFail(tokenizer, description);
+					return i;
+				}
+			}
+			FlushHighSurrogate(tokenizer);
+			AppendTokenBytes(tokenizer, &unescaped, 1);
+			i++;
+		} else if (c == '\\') {
+			tokenizer->inEscape = 1;
+			i++;
+		} else if (c == '"') {
+			FlushHighSurrogate(tokenizer);
+			i++;
+			FinishString(tokenizer);
+		} else {
+			//copy the whole run of unescaped bytes at once
+			size_t start = i;
+			while (i < length && bytes[i] != '"' && bytes[i] != '\\') i++;
+			FlushHighSurrogate(tokenizer);
+			AppendTokenBytes(tokenizer, bytes + start, i - start);
+		}
+	}
+	return i;
+}
+
+static void ParseStructuralByte(JSONStreamTokenizer *tokenizer, unsigned char c) {
+	switch (tokenizer->state) {
+		case JSONDone:
+			JSONStreamTokenizerFail(tokenizer, "Unexpected data after the end of the value");
+			return;
+		case JSONExpectColon:
+			if (c == ':') tokenizer->state = JSONExpectValue;
+			else JSONStreamTokenizerFail(tokenizer, "Expected ':'");
+			return;
+		case JSONExpectSeparator:
+			if (c == ',') tokenizer->state = tokenizer->isObject[tokenizer->depth - 1] ? JSONExpectKey : JSONExpectValue;
+			else if (c == '}' || c == ']') EndContainer(tokenizer, c == '}');
+			else JSONStreamTokenizerFail(tokenizer, "Expected ',' or the end of a container");
+			return;
+		case JSONExpectFirstKey:
+			if (c == '}') {
+				EndContainer(tokenizer, 1);
+				return;
+			}
+			//fall through
+		case JSONExpectKey:
+			if (c == '"') {
+				BeginToken(tokenizer);
+				tokenizer->tokenIsKey = 1;
+				tokenizer->state = JSONInString;
+			} else {
+				JSONStreamTokenizerFail(tokenizer, "Expected a string key");
+			}
+			return;
+		case JSONExpectFirstElement:
+			if (c == ']') {
+				EndContainer(tokenizer, 0);
+				return;
+			}
+			//fall through
+		case JSONExpectValue:
+			switch (c) {
+				case '{': BeginContainer(tokenizer, 1); return;
+				case '[': BeginContainer(tokenizer, 0); return;
+				case '"':
+					BeginToken(tokenizer);
+					tokenizer->tokenIsKey = 0;
+					tokenizer->state = JSONInString;
+					return;
+				case 't': tokenizer->expectedLiteral = "true"; break;
+				case 'f': tokenizer->expectedLiteral = "false"; break;
+				case 'n': tokenizer->expectedLiteral = "null"; break;
+				default:
+					if (c == '-' || (c >= '0' && c <= '9')) {
+						BeginToken(tokenizer);
+						AppendTokenBytes(tokenizer, &c, 1);
+						tokenizer->state = JSONInNumber;
+					} else {
+						char description[32];
+						snprintf(description, sizeof(description), "Unexpected character '%c'", c);
+						JSONStreamTokenizerFail(tokenizer, description);
+					}
+					return;
+			}
+			tokenizer->literalIndex = 1;
+			tokenizer->state = JSONInLiteral;
+			return;
+	}
+}
+
+int JSONStreamTokenizerParse(JSONStreamTokenizer *tokenizer, const unsigned char *bytes, size_t length) {
+	size_t i = 0;
+
+	while (i < length && tokenizer->state != JSONFailed) {
+		unsigned char c = bytes[i];
+
+		switch (tokenizer->state) {
+			case JSONInString:
+				i += ConsumeStringBytes(tokenizer, bytes + i, length - i);
+				break;
+			case JSONInNumber:
+				if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') {
+					if (c == '.' || c == 'e' || c == 'E') tokenizer->tokenHasFraction = 1;
+					AppendTokenBytes(tokenizer, &c, 1);
+					i++;
+				} else {
+					//the number ended at this byte, which must still be read on its own
+					FinishNumber(tokenizer);
+				}
+				break;
+			case JSONInLiteral:
+				if (c != (unsigned char)tokenizer->expectedLiteral[tokenizer->literalIndex]) {
+					char description[48];
+					snprintf(description, sizeof(description), "Invalid literal; expected '%s'", tokenizer->expectedLiteral);
+					JSONStreamTokenizerFail(tokenizer, description);
+					break;
+				}
+				i++;
+				if (!tokenizer->expectedLiteral[++tokenizer->literalIndex]) FinishLiteral(tokenizer);
+				break;
+			default:
+				if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+					ParseStructuralByte(tokenizer, c);
+				}
+				i++;
+		}
+	}
+	return tokenizer->state != JSONFailed;
+}
+
+int JSONStreamTokenizerFinish(JSONStreamTokenizer *tokenizer) {
+	//a number at the top level has nothing after it to end it
+	if (tokenizer->state == JSONInNumber && !tokenizer->depth) FinishNumber(tokenizer);
+
+	if (tokenizer->state != JSONDone && tokenizer->state != JSONFailed) {
+		JSONStreamTokenizerFail(tokenizer, "Unexpected end of data");
+	}
+	return tokenizer->state == JSONDone;
+}
@@ -0,0 +1,67 @@
+/*
+ *  JSONStreamTokenizer.h
+ *  Notation
+ *
+ */
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+//the byte-level half of JSONStreamParser: reads UTF-8 JSON in chunks split anywhere, even inside an escape or a number,
+//checks its structure and hands each key, scalar and container boundary to a handler in document order;
+//strings are passed with their escapes decoded to UTF-8 but are otherwise not validated
+
+#include <stddef.h>
+
+#define kJSONMaxNestingDepth 512
+
+typedef enum {
+	JSONTokenBeginObject,
+	JSONTokenEndObject,
+	JSONTokenBeginArray,
+	JSONTokenEndArray,
+	JSONTokenKey,
+	JSONTokenString,
+	JSONTokenInteger,
+	JSONTokenReal,
+	JSONTokenTrue,
+	JSONTokenFalse,
+	JSONTokenNull
+} JSONTokenType;
+
+typedef struct {
+	JSONTokenType type;
+	//the decoded bytes of a key or string, NUL-terminated, valid only during the call
+	const char *bytes;
+	size_t length;
+	long long integer;
+	double real;
+	//the number of containers enclosing this token, not counting any that it begins or ends
+	unsigned int depth;
+} JSONToken;
+
+typedef struct _JSONStreamTokenizer JSONStreamTokenizer;
+
+//returns 0 to stop the parse, after calling JSONStreamTokenizerFail to say why
+typedef int (*JSONTokenHandler)(void *context, JSONStreamTokenizer *tokenizer, const JSONToken *token);
+
+JSONStreamTokenizer *JSONStreamTokenizerCreate(JSONTokenHandler handler, void *context);
+void JSONStreamTokenizerFree(JSONStreamTokenizer *tokenizer);
+
+//returns 0 once the bytes seen so far can no longer be valid JSON
+int JSONStreamTokenizerParse(JSONStreamTokenizer *tokenizer, const unsigned char *bytes, size_t length);
+//returns 1 if exactly one complete value was read
+int JSONStreamTokenizerFinish(JSONStreamTokenizer *tokenizer);
+int JSONStreamTokenizerIsDone(const JSONStreamTokenizer *tokenizer);
+
+void JSONStreamTokenizerFail(JSONStreamTokenizer *tokenizer, const char *description);
+//NULL unless the parse has failed
+const char *JSONStreamTokenizerError(const JSONStreamTokenizer *tokenizer);
@@ -0,0 +1,1667 @@
+/*
+ *  MarkdownRenderer.c
+ *  Notation
+ *
+ */
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+
+//a port of Markdown.pl 1.0.1: each pass below stands in for the subroutine of the same name and
+//reproduces what its regular expressions match (quirks included), so that notes render as they did
+
+#include "MarkdownRenderer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+typedef struct _MDBuffer {
+	char *bytes; //always NUL-terminated, so passes can peek one byte past the end
+	size_t length, capacity;
+} MDBuffer;
+
+typedef struct _LinkDefinition {
+	char *identifier; //lowercase
+	char *url, *title; //title is NULL if none was ever given
+} LinkDefinition;
+
+typedef struct _MarkdownContext {
+	LinkDefinition *links;
+	size_t linkCount, linkCapacity;
+
+	//html set aside by HashHTMLBlocks, left in the text as keys until FormParagraphs puts it back
+	MDBuffer *blocks;
+	size_t blockCount, blockCapacity;
+
+	unsigned int listLevel;
+} MarkdownContext;
+
+//bytes dropped from the input so that they can mark escaped characters and hashed blocks
+#define kEscapeMark '\x1A'
+#define kBlockMark '\x1B'
+
+static const char kEscapableChars[] = "\\`*_{}[]()>#+-.!";
+
+static void RunBlockGamut(MarkdownContext *ctx, MDBuffer *text);
+static void RunSpanGamut(MarkdownContext *ctx, MDBuffer *text);
+static void DoLists(MarkdownContext *ctx, MDBuffer *text);
+
+#pragma mark buffers
+
+static void BufferReserve(MDBuffer *buffer, size_t additional) {
+	if (buffer->length + additional + 1 > buffer->capacity) {
+		size_t capacity = buffer->capacity ? buffer->capacity : 64;
+		while (capacity < buffer->length + additional + 1) capacity *= 2;
+		buffer->bytes = (char*)realloc(buffer->bytes, capacity);
+		buffer->capacity = capacity;
+	}
+}
+
+static void BufferAppend(MDBuffer *buffer, const char *bytes, size_t length) {
+	BufferReserve(buffer, length);
+	if (length) memcpy(buffer->bytes + buffer->length, bytes, length);
+	buffer->length += length;
+	buffer->bytes[buffer->length] = '\0';
+}
+
+#define BufferAppendLiteral(buffer, literal) BufferAppend((buffer), (literal), sizeof(literal) - 1)
+
+static void BufferAppendChar(MDBuffer *buffer, char c) {
+	BufferAppend(buffer, &c, 1);
+}
+
+static void BufferInit(MDBuffer *buffer, const char *bytes, size_t length) {
+	buffer->bytes = NULL;
+	buffer->length = buffer->capacity = 0;
+	BufferAppend(buffer, bytes, length);
+}
+
+//gives text the contents of result, leaving result empty
+static void BufferReplace(MDBuffer *text, MDBuffer *result) {
+	free(text->bytes);
+	*text = *result;
+	result->bytes = NULL;
+	result->length = result->capacity = 0;
+}
+
+#pragma mark scanning
+
+static inline int IsSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static inline int IsSpaceOrTab(char c) {
+	return c == ' ' || c == '\t';
+}
+
+static inline int IsAlpha(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline int IsDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static inline int IsWord(char c) {
+	return IsAlpha(c) || IsDigit(c) || c == '_';
+}
+
+static inline char Lowercase(char c) {
+	return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+static inline size_t LineEnd(const char *s, size_t n, size_t p) {
+	const char *newline = p < n ? (const char*)memchr(s + p, '\n', n - p) : NULL;
+	return newline ? (size_t)(newline - s) : n;
+}
+
+//the position after the newline ending the line at p, or n
+static inline size_t NextLine(const char *s, size_t n, size_t p) {
+	size_t end = LineEnd(s, n, p);
+	return end < n ? end + 1 : n;
+}
+
+//perl's ^ under /m, which does not match after a newline that ends the text
+static inline int IsLineStart(const char *s, size_t n, size_t p) {
+	return p < n && (!p || s[p - 1] == '\n');
+}
+
+//perl's \Z
+static inline int IsTextEnd(const char *s, size_t n, size_t p) {
+	return p == n || (p + 1 == n && s[p] == '\n');
+}
+
+static inline size_t SkipSpacesAndTabs(const char *s, size_t n, size_t p) {
+	while (p < n && IsSpaceOrTab(s[p])) p++;
+	return p;
+}
+
+static inline size_t SkipNewlines(const char *s, size_t n, size_t p) {
+	while (p < n && s[p] == '\n') p++;
+	return p;
+}
+
+static inline int HasPrefix(const char *s, size_t n, size_t p, const char *prefix, size_t prefixLength) {
+	return p + prefixLength <= n && !memcmp(s + p, prefix, prefixLength);
+}
+
+static inline int HasPrefixIgnoringCase(const char *s, size_t n, size_t p, const char *prefix, size_t prefixLength) {
+	size_t i;
+	if (p + prefixLength > n) return 0;
+	for (i = 0; i < prefixLength; i++) {
+		if (Lowercase(s[p + i]) != prefix[i]) return 0;
+	}
+	return 1;
+}
+
+static size_t FindBytes(const char *s, size_t n, size_t p, const char *bytes, size_t length) {
+	for (; p + length <= n; p++) {
+		if (s[p] == bytes[0] && !memcmp(s + p, bytes, length)) return p;
+	}
+	return SIZE_MAX;
+}
+
+#pragma mark escapes, links and blocks
+
+static void AppendEscapedChar(MDBuffer *out, char c) {
+	char token[2] = { kEscapeMark, (char)('A' + (strchr(kEscapableChars, c) - kEscapableChars)) };
+	BufferAppend(out, token, sizeof(token));
+}
+
+static void UnescapeSpecialChars(MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		if (s[p] == kEscapeMark && p + 1 < n && s[p + 1] >= 'A' && s[p + 1] < 'A' + (int)sizeof(kEscapableChars) - 1) {
+			BufferAppendChar(&out, kEscapableChars[s[p + 1] - 'A']);
+			p += 2;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+//appends an attribute value, with " encoded and/or * and _ hidden from the emphasis passes
+static void AppendAttribute(MDBuffer *out, const char *s, size_t n, int encodeQuotes, int hideEmphasis) {
+	size_t i;
+	for (i = 0; i < n; i++) {
+		if (encodeQuotes && s[i] == '"') BufferAppendLiteral(out, "&quot;");
+		else if (hideEmphasis && (s[i] == '*' || s[i] == '_')) AppendEscapedChar(out, s[i]);
+		else BufferAppendChar(out, s[i]);
+	}
+}
+
+static void EncodeAmpsAndAngles(const char *s, size_t n, MDBuffer *out) {
+	size_t i;
+	for (i = 0; i < n; i++) {
+		if (s[i] == '&') {
+			//leave entities alone (perl's escape tokens are hex digests, so they count as part of a name)
+			size_t name = i + 1 + (i + 1 < n && s[i + 1] == '#'), end = name;
+			while (end < n && (IsWord(s[end]) || (s[end] == kEscapeMark && end + 1 < n))) end += s[end] == kEscapeMark ? 2 : 1;
+			if (end > name && end < n && s[end] == ';') BufferAppendChar(out, '&');
+			else BufferAppendLiteral(out, "&amp;");
+		} else if (s[i] == '<') {
+			char next = i + 1 < n ? s[i + 1] : '\0';
+			//as for tokens, only the digests of these characters begin with a letter
+			if (next == kEscapeMark && i + 2 < n) next = strchr("_{}>", kEscapableChars[s[i + 2] - 'A']) ? 'a' : '0';
+			if (IsAlpha(next) || next == '/' || next == '?' || next == '$' || next == '!') BufferAppendChar(out, '<');
+			else BufferAppendLiteral(out, "&lt;");
+		} else {
+			BufferAppendChar(out, s[i]);
+		}
+	}
+}
+
+static void EncodeCode(const char *s, size_t n, MDBuffer *out) {
+	size_t i;
+	for (i = 0; i < n; i++) {
+		switch (s[i]) {
+			case '&': BufferAppendLiteral(out, "&amp;"); break;
+			case '<': BufferAppendLiteral(out, "&lt;"); break;
+			case '>': BufferAppendLiteral(out, "&gt;"); break;
+			case '*': case '_': case '{': case '}': case '[': case ']': case '\\':
+				AppendEscapedChar(out, s[i]);
+				break;
+			default: BufferAppendChar(out, s[i]);
+		}
+	}
+}
+
+static LinkDefinition *FindLinkDefinition(MarkdownContext *ctx, const char *identifier, size_t length) {
+	size_t i, j;
+	for (i = 0; i < ctx->linkCount; i++) {
+		const char *candidate = ctx->links[i].identifier;
+		for (j = 0; j < length && candidate[j] == Lowercase(identifier[j]); j++);
+		if (j == length && !candidate[j]) return &ctx->links[i];
+	}
+	return NULL;
+}
+
+static void HashBlock(MarkdownContext *ctx, const char *s, size_t n, MDBuffer *out) {
+	char key[32];
+	if (ctx->blockCount == ctx->blockCapacity) {
+		ctx->blockCapacity = ctx->blockCapacity ? ctx->blockCapacity * 2 : 16;
+		ctx->blocks = (MDBuffer*)realloc(ctx->blocks, ctx->blockCapacity * sizeof(MDBuffer));
+	}
+	BufferInit(&ctx->blocks[ctx->blockCount], s, n);
+	snprintf(key, sizeof(key), "\n\n%c%lu%c\n\n", kBlockMark, (unsigned long)ctx->blockCount++, kBlockMark);
+	BufferAppend(out, key, strlen(key));
+}
+
+static const MDBuffer *BlockForKey(MarkdownContext *ctx, const char *s, size_t n) {
+	size_t i, index = 0;
+	if (n < 3 || s[0] != kBlockMark || s[n - 1] != kBlockMark) return NULL;
+	for (i = 1; i < n - 1; i++) {
+		if (!IsDigit(s[i])) return NULL;
+		index = index * 10 + (s[i] - '0');
+	}
+	return index < ctx->blockCount ? &ctx->blocks[index] : NULL;
+}
+
+#pragma mark leaked keys
+
+static void AppendTextWithBlocks(MarkdownContext *ctx, MDBuffer *out, const char *s, size_t n) {
+	size_t p = 0;
+	while (p < n) {
+		size_t end = p + 1;
+		if (s[p] == kBlockMark) {
+			while (end < n && IsDigit(s[end])) end++;
+			const MDBuffer *block = end < n ? BlockForKey(ctx, s + p, end + 1 - p) : NULL;
+			if (block) {
+				AppendTextWithBlocks(ctx, out, block->bytes, block->length);
+				p = end + 1;
+				continue;
+			}
+		}
+		BufferAppendChar(out, s[p++]);
+	}
+}
+
+//keys that FormParagraphs couldn't put back, which only malformed html leaves, are replaced by the html as written
+//(along with any keys within it); Markdown.pl shows the MD5 of the block there instead, which means nothing to a reader
+static void RestoreLeakedBlockKeys(MarkdownContext *ctx, MDBuffer *text) {
+	if (!ctx->blockCount || !memchr(text->bytes, kBlockMark, text->length))
+		return;
+
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	AppendTextWithBlocks(ctx, &out, text->bytes, text->length);
+	BufferReplace(text, &out);
+}
+
+#pragma mark whole-text passes
+
+static void Detab(MDBuffer *text) {
+	size_t i, column = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	for (i = 0; i < text->length; i++) {
+		char c = text->bytes[i];
+		if (c == '\t') {
+			size_t spaces = 4 - column % 4;
+			column += spaces;
+			while (spaces--) BufferAppendChar(&out, ' ');
+		} else {
+			BufferAppendChar(&out, c);
+			column = c == '\n' ? 0 : column + 1;
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+static void StripWhitespaceOnlyLines(MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t end = LineEnd(s, n, p);
+		if (SkipSpacesAndTabs(s, end, p) < end) BufferAppend(&out, s + p, end - p);
+		if (end < n) BufferAppendChar(&out, '\n');
+		p = end + 1;
+	}
+	BufferReplace(text, &out);
+}
+
+//removes one level of indentation, a tab or up to four spaces, from every line
+static void Outdent(MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t next = NextLine(s, n, p), indent = 0;
+		if (s[p] == '\t') {
+			indent = 1;
+		} else {
+			while (indent < 4 && p + indent < next && s[p + indent] == ' ') indent++;
+		}
+		BufferAppend(&out, s + p + indent, next - p - indent);
+		p = next;
+	}
+	BufferReplace(text, &out);
+}
+
+#pragma mark html blocks
+
+static int IsBlockTagName(const char *name, size_t length, int includeInsDel) {
+	static const char *const tags[] = { "p", "div", "h1", "h2", "h3", "h4", "h5", "h6", "blockquote", "pre", "table", "dl", "ol", "ul",
+		"script", "noscript", "form", "fieldset", "iframe", "math", "ins", "del", NULL };
+	unsigned int i;
+	for (i = 0; tags[i]; i++) {
+		if (!includeInsDel && (!strcmp(tags[i], "ins") || !strcmp(tags[i], "del"))) continue;
+		if (strlen(tags[i]) == length && !memcmp(tags[i], name, length)) return 1;
+	}
+	return 0;
+}
+
+static int IsEndTagAt(const char *s, size_t n, size_t p, const char *name, size_t nameLength) {
+	return p + nameLength + 3 <= n && s[p] == '<' && s[p + 1] == '/' && !memcmp(s + p + 2, name, nameLength) && s[p + 2 + nameLength] == '>';
+}
+
+//the end of a block whose end tag begins a line (or directly follows the start tag's name), or 0
+static size_t EndOfBlockClosedAtLineStart(const char *s, size_t n, size_t p, const char *name, size_t nameLength) {
+	for (;;) {
+		if (IsEndTagAt(s, n, p, name, nameLength)) {
+			size_t end = SkipSpacesAndTabs(s, n, p + nameLength + 3);
+			if (end == n || s[end] == '\n') return end;
+		}
+		if ((p = LineEnd(s, n, p)) == n) return 0;
+		p++;
+	}
+}
+
+//the end of a block whose end tag finishes a line, or 0
+static size_t EndOfBlockClosedAtLineEnd(const char *s, size_t n, size_t p, const char *name, size_t nameLength) {
+	for (;;) {
+		size_t end = LineEnd(s, n, p), tagEnd = end;
+		while (tagEnd > p && IsSpaceOrTab(s[tagEnd - 1])) tagEnd--;
+		if (tagEnd >= p + nameLength + 3 && IsEndTagAt(s, n, tagEnd - nameLength - 3, name, nameLength)) return end;
+		if (end == n) return 0;
+		p = end + 1;
+	}
+}
+
+//block-level elements starting at the beginning of a line; the first pass wants the end tag at the start of a line,
+//the second (without ins and del) will take it at the end of one
+static void HashTaggedBlocks(MarkdownContext *ctx, MDBuffer *text, int closedAtLineStart) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t end = 0;
+		if (IsLineStart(s, n, p) && s[p] == '<') {
+			size_t nameEnd = p + 1;
+			while (nameEnd < n && IsWord(s[nameEnd])) nameEnd++;
+			if (IsBlockTagName(s + p + 1, nameEnd - p - 1, closedAtLineStart)) {
+				end = closedAtLineStart ? EndOfBlockClosedAtLineStart(s, n, nameEnd, s + p + 1, nameEnd - p - 1) :
+					EndOfBlockClosedAtLineEnd(s, n, nameEnd, s + p + 1, nameEnd - p - 1);
+			}
+		}
+		if (end) {
+			HashBlock(ctx, s + p, end - p, &out);
+			p = end;
+		} else {
+			size_t next = NextLine(s, n, p);
+			BufferAppend(&out, s + p, next - p);
+			p = next;
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+static inline int IsFollowedByBlankLine(const char *s, size_t n, size_t p) {
+	return (s[p] == '\n' && s[p + 1] == '\n') || IsTextEnd(s, n, p);
+}
+
+static size_t EndOfStandaloneRule(const char *s, size_t n, size_t p) {
+	size_t end;
+	if (!HasPrefix(s, n, p, "<hr", 3) || IsWord(s[p + 3])) return 0;
+	for (end = p + 3; end < n && s[end] != '<' && s[end] != '>'; end++);
+	if (end == n || s[end] == '<') return 0;
+	end = SkipSpacesAndTabs(s, n, end + 1);
+	return IsFollowedByBlankLine(s, n, end) ? end : 0;
+}
+
+static size_t EndOfStandaloneComment(const char *s, size_t n, size_t p) {
+	size_t dashes;
+	if (!HasPrefix(s, n, p, "<!--", 4)) return 0;
+	for (dashes = p + 4; dashes + 1 < n; dashes++) {
+		if (s[dashes] == '-' && s[dashes + 1] == '-') {
+			size_t end = dashes + 2;
+			while (end < n && IsSpace(s[end])) end++;
+			if (s[end] == '>') {
+				end = SkipSpacesAndTabs(s, n, end + 1);
+				if (IsFollowedByBlankLine(s, n, end)) return end;
+			}
+		}
+	}
+	return 0;
+}
+
+//an <hr> or a comment standing alone after a blank line or at the start of the text
+static void HashStandaloneBlocks(MarkdownContext *ctx, MDBuffer *text, size_t (*endOfElement)(const char*, size_t, size_t)) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t start = SIZE_MAX, end = 0;
+		if (!p) start = s[0] == '\n';
+		else if (p >= 2 && s[p - 1] == '\n' && s[p - 2] == '\n') start = p;
+		if (start != SIZE_MAX) {
+			size_t element = start;
+			while (element < start + 3 && s[element] == ' ') element++;
+			end = endOfElement(s, n, element);
+		}
+		if (end) {
+			HashBlock(ctx, s + start, end - start, &out);
+			p = end;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+static void HashHTMLBlocks(MarkdownContext *ctx, MDBuffer *text) {
+	HashTaggedBlocks(ctx, text, 1);
+	HashTaggedBlocks(ctx, text, 0);
+	HashStandaloneBlocks(ctx, text, EndOfStandaloneRule);
+	HashStandaloneBlocks(ctx, text, EndOfStandaloneComment);
+}
+
+#pragma mark link definitions
+
+//newlines or the end of the text at p; returns the position after them, or 0
+static size_t EndOfDefinitionAt(const char *s, size_t n, size_t p) {
+	if (s[p] == '\n') return SkipNewlines(s, n, p);
+	return IsTextEnd(s, n, p) ? p : 0;
+}
+
+static size_t EndOfDefinitionTitle(const char *s, size_t n, size_t p, size_t *titleStart, size_t *titleEnd) {
+	size_t close, lineEnd = LineEnd(s, n, p);
+	if (!p || !IsSpace(s[p - 1]) || (s[p] != '"' && s[p] != '(')) return 0;
+	for (close = p + 2; close < lineEnd; close++) {
+		if (s[close] == '"' || s[close] == ')') {
+			size_t end = EndOfDefinitionAt(s, n, SkipSpacesAndTabs(s, n, close + 1));
+			if (end) {
+				*titleStart = p + 1;
+				*titleEnd = close;
+				return end;
+			}
+		}
+	}
+	return 0;
+}
+
+//what may follow a definition's url: a title on the same or the next line, then the end of the line
+static size_t EndOfDefinitionTail(const char *s, size_t n, size_t p, size_t *titleStart, size_t *titleEnd) {
+	size_t end;
+	p = SkipSpacesAndTabs(s, n, p);
+	if (s[p] == '\n') {
+		size_t nextLine = SkipSpacesAndTabs(s, n, p + 1);
+		if ((end = EndOfDefinitionTitle(s, n, nextLine, titleStart, titleEnd))) return end;
+		if ((end = EndOfDefinitionAt(s, n, nextLine))) return end;
+	}
+	if ((end = EndOfDefinitionTitle(s, n, p, titleStart, titleEnd))) return end;
+	return EndOfDefinitionAt(s, n, p);
+}
+
+static void AddLinkDefinition(MarkdownContext *ctx, const char *s, size_t idStart, size_t idEnd,
+							  size_t urlStart, size_t urlEnd, size_t titleStart, size_t titleEnd) {
+	LinkDefinition *link = FindLinkDefinition(ctx, s + idStart, idEnd - idStart);
+	MDBuffer url;
+	if (!link) {
+		size_t i;
+		if (ctx->linkCount == ctx->linkCapacity) {
+			ctx->linkCapacity = ctx->linkCapacity ? ctx->linkCapacity * 2 : 16;
+			ctx->links = (LinkDefinition*)realloc(ctx->links, ctx->linkCapacity * sizeof(LinkDefinition));
+		}
+		link = &ctx->links[ctx->linkCount++];
+		link->identifier = (char*)malloc(idEnd - idStart + 1);
+		for (i = idStart; i < idEnd; i++) link->identifier[i - idStart] = Lowercase(s[i]);
+		link->identifier[idEnd - idStart] = '\0';
+		link->url = link->title = NULL;
+	}
+	BufferInit(&url, NULL, 0);
+	EncodeAmpsAndAngles(s + urlStart, urlEnd - urlStart, &url);
+	free(link->url);
+	link->url = url.bytes;
+
+	//perl keeps an earlier title when the new one is missing (or is "0")
+	if (titleEnd > titleStart && !(titleEnd - titleStart == 1 && s[titleStart] == '0')) {
+		MDBuffer title;
+		BufferInit(&title, NULL, 0);
+		AppendAttribute(&title, s + titleStart, titleEnd - titleStart, 1, 0);
+		free(link->title);
+		link->title = title.bytes;
+	}
+}
+
+//parses a definition of the form [id]: url "optional title" at the line starting at p; returns where it ends, or 0
+static size_t ParseLinkDefinition(MarkdownContext *ctx, const char *s, size_t n, size_t p) {
+	size_t bracket = p, lineEnd = LineEnd(s, n, p), colon;
+	while (bracket < p + 3 && s[bracket] == ' ') bracket++;
+	if (s[bracket] != '[') return 0;
+
+	//the id runs to the last "]:" on the line that works
+	for (colon = lineEnd; colon-- > bracket + 3; ) {
+		size_t urlStart, urlEnd, runEnd, end, titleStart = 0, titleEnd = 0;
+		if (s[colon] != ':' || s[colon - 1] != ']') continue;
+
+		urlStart = SkipSpacesAndTabs(s, n, colon + 1);
+		if (s[urlStart] == '\n') urlStart = SkipSpacesAndTabs(s, n, urlStart + 1);
+		if (urlStart == n || IsSpace(s[urlStart])) continue;
+		for (runEnd = urlStart; runEnd < n && !IsSpace(s[runEnd]); runEnd++);
+		if (s[urlStart] == '<' && runEnd > urlStart + 1) urlStart++;
+		urlEnd = s[runEnd - 1] == '>' && runEnd - 1 > urlStart ? runEnd - 1 : runEnd;
+
+		if ((end = EndOfDefinitionTail(s, n, runEnd, &titleStart, &titleEnd))) {
+			AddLinkDefinition(ctx, s, bracket + 1, colon - 1, urlStart, urlEnd, titleStart, titleEnd);
+			return end;
+		}
+	}
+	return 0;
+}
+
+static void StripLinkDefinitions(MarkdownContext *ctx, MDBuffer *text) {
+	size_t p = 0, lines;
+	while (p < text->length) {
+		size_t end = ParseLinkDefinition(ctx, text->bytes, text->length, p);
+		if (end) {
+			memmove(text->bytes + p, text->bytes + end, text->length - end + 1);
+			text->length -= end - p;
+			//a definition can span three lines, so those before may now form one with what followed it
+			for (lines = 0; lines < 2 && p; lines++) {
+				for (p--; p && text->bytes[p - 1] != '\n'; p--);
+			}
+		} else {
+			p = NextLine(text->bytes, text->length, p);
+		}
+	}
+}
+
+#pragma mark block gamut
+
+static void AppendSpanGamut(MarkdownContext *ctx, MDBuffer *out, const char *s, size_t n) {
+	MDBuffer span;
+	BufferInit(&span, s, n);
+	RunSpanGamut(ctx, &span);
+	BufferAppend(out, span.bytes, span.length);
+	free(span.bytes);
+}
+
+static void AppendHeader(MarkdownContext *ctx, MDBuffer *out, unsigned int level, const char *s, size_t n) {
+	char tag[8];
+	snprintf(tag, sizeof(tag), "<h%u>", level);
+	BufferAppend(out, tag, strlen(tag));
+	AppendSpanGamut(ctx, out, s, n);
+	snprintf(tag, sizeof(tag), "</h%u>", level);
+	BufferAppend(out, tag, strlen(tag));
+	BufferAppendLiteral(out, "\n\n");
+}
+
+static void DoSetextHeaders(MarkdownContext *ctx, MDBuffer *text, char underline, unsigned int level) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t lineEnd = LineEnd(s, n, p), end = 0;
+		if (lineEnd > p && lineEnd < n && s[lineEnd + 1] == underline) {
+			size_t q = lineEnd + 1;
+			while (s[q] == underline) q++;
+			q = SkipSpacesAndTabs(s, n, q);
+			if (s[q] == '\n') end = SkipNewlines(s, n, q);
+		}
+		if (end) {
+			AppendHeader(ctx, &out, level, s + p, lineEnd - p);
+			p = end;
+		} else {
+			size_t next = NextLine(s, n, p);
+			BufferAppend(&out, s + p, next - p);
+			p = next;
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+static void DoAtxHeaders(MarkdownContext *ctx, MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t lineEnd = LineEnd(s, n, p), end = 0, level = 0;
+		if (s[p] == '#' && lineEnd < n) {
+			while (s[p + level] == '#') level++;
+			for (level = level > 6 ? 6 : level; level > 0; level--) {
+				size_t start = SkipSpacesAndTabs(s, n, p + level), textEnd = lineEnd;
+				if (start == lineEnd) {
+					//a header of nothing but spaces keeps the last of them as its text
+					if (start == p + level) continue;
+					start--;
+				}
+				//closing hashes and the space before them are not part of the header
+				while (textEnd > start && s[textEnd - 1] == '#') textEnd--;
+				while (textEnd > start && IsSpaceOrTab(s[textEnd - 1])) textEnd--;
+				if (textEnd < start + 1) textEnd = start + 1;
+
+				AppendHeader(ctx, &out, (unsigned int)level, s + start, textEnd - start);
+				end = SkipNewlines(s, n, lineEnd);
+				break;
+			}
+		}
+		if (end) {
+			p = end;
+		} else {
+			size_t next = NextLine(s, n, p);
+			BufferAppend(&out, s + p, next - p);
+			p = next;
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+static void DoHeaders(MarkdownContext *ctx, MDBuffer *text) {
+	DoSetextHeaders(ctx, text, '=', 1);
+	DoSetextHeaders(ctx, text, '-', 2);
+	DoAtxHeaders(ctx, text);
+}
+
+//three or more of c, each separated by at most two spaces, with at most three spaces before them
+static int IsRuleLine(const char *s, size_t p, size_t lineEnd, char c) {
+	size_t q = p, count = 0;
+	while (q < lineEnd && s[q] == ' ') q++;
+	if (q - p > 3 || q == lineEnd || s[q] != c) return 0;
+	for (;;) {
+		size_t gap = 0;
+		count++;
+		for (q++; q < lineEnd && s[q] == ' '; q++) gap++;
+		if (q == lineEnd || s[q] != c) break;
+		if (gap > 2) return 0;
+	}
+	return SkipSpacesAndTabs(s, lineEnd, q) == lineEnd && count >= 3;
+}
+
+static void DoHorizontalRules(MDBuffer *text) {
+	const char *rules = "*-_";
+	for (; *rules; rules++) {
+		const char *s = text->bytes;
+		size_t n = text->length, p = 0;
+		MDBuffer out;
+		BufferInit(&out, NULL, 0);
+		while (p < n) {
+			size_t lineEnd = LineEnd(s, n, p);
+			if (IsRuleLine(s, p, lineEnd, *rules)) BufferAppendLiteral(&out, "\n<hr />\n");
+			else BufferAppend(&out, s + p, lineEnd - p);
+			if (lineEnd < n) BufferAppendChar(&out, '\n');
+			p = lineEnd + 1;
+		}
+		BufferReplace(text, &out);
+	}
+}
+
+//the length of a bullet or number marker at p that is followed by a space or tab, or 0
+static size_t ListMarkerLength(const char *s, size_t n, size_t p) {
+	size_t end = p;
+	if (p < n && (s[p] == '*' || s[p] == '+' || s[p] == '-')) {
+		end = p + 1;
+	} else {
+		while (end < n && IsDigit(s[end])) end++;
+		if (end == p || end == n || s[end] != '.') return 0;
+		end++;
+	}
+	return end < n && IsSpaceOrTab(s[end]) ? end - p : 0;
+}
+
+//the end of a list starting at p: the first blank lines followed by something that is neither indented nor
+//another item, or the end of the text; returns 0 if there is no list marker at p
+static size_t EndOfList(const char *s, size_t n, size_t p, int *ordered) {
+	size_t marker = p, markerLength, content, end;
+	while (marker < p + 3 && s[marker] == ' ') marker++;
+	if (!(markerLength = ListMarkerLength(s, n, marker))) return 0;
+	*ordered = IsDigit(s[marker]);
+
+	content = SkipSpacesAndTabs(s, n, marker + markerLength);
+	if (content == n) return content - (marker + markerLength) > 1 ? n : 0;
+	for (end = content + 1; end < n; end++) {
+		if (s[end] == '\n' && s[end + 1] == '\n') {
+			size_t next = SkipNewlines(s, n, end);
+			if (next < n && !IsSpace(s[next]) && !ListMarkerLength(s, n, next)) return next;
+			end = next - 1;
+		}
+	}
+	return n;
+}
+
+//matches one item at p; a blank line before it (leadingLine) or within it makes its contents paragraphs
+static size_t EndOfListItem(const char *s, size_t n, size_t p, size_t *contentStart, int *leadingLine) {
+	int leading;
+	for (leading = s[p] == '\n'; leading >= 0; leading--) {
+		size_t lineStart = p + leading, marker, markerLength, spacesEnd, content, end;
+		if (!IsLineStart(s, n, lineStart)) continue;
+		marker = SkipSpacesAndTabs(s, n, lineStart);
+		if (!(markerLength = ListMarkerLength(s, n, marker))) continue;
+		spacesEnd = SkipSpacesAndTabs(s, n, marker + markerLength);
+
+		//the item ends at a newline followed by the end of the list or by a marker indented as much as its own;
+		//failing that, perl gives a space after the marker back to the text, which lets an empty item end on its first line
+		for (content = spacesEnd; content > marker + markerLength && content + 1 >= spacesEnd; content--) {
+			for (end = content + 1; end < n; end++) {
+				size_t next, indent = marker - lineStart;
+				if (s[end] != '\n') continue;
+				next = SkipNewlines(s, n, end);
+				if (next == n || (next + indent <= n && !memcmp(s + next, s + lineStart, indent) && ListMarkerLength(s, n, next + indent))) {
+					*contentStart = content;
+					*leadingLine = leading;
+					return end + (next - end > 1 ? 2 : 1);
+				}
+				end = next - 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void ProcessListItems(MarkdownContext *ctx, MDBuffer *list) {
+	const char *s = list->bytes;
+	size_t n = list->length, p = 0;
+	MDBuffer out;
+
+	ctx->listLevel++;
+	//trailing blank lines
+	if (n >= 2 && s[n - 1] == '\n' && s[n - 2] == '\n') {
+		while (n > 1 && s[n - 2] == '\n') n--;
+		list->bytes[list->length = n] = '\0';
+	}
+
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t contentStart, end;
+		int leadingLine;
+		if ((end = EndOfListItem(s, n, p, &contentStart, &leadingLine))) {
+			MDBuffer item;
+			BufferInit(&item, s + contentStart, end - contentStart);
+			if (leadingLine || FindBytes(item.bytes, item.length, 0, "\n\n", 2) != SIZE_MAX) {
+				Outdent(&item);
+				RunBlockGamut(ctx, &item);
+			} else {
+				//a sub-list, or just text
+				Outdent(&item);
+				DoLists(ctx, &item);
+				if (item.length && item.bytes[item.length - 1] == '\n') item.bytes[--item.length] = '\0';
+				RunSpanGamut(ctx, &item);
+			}
+			BufferAppendLiteral(&out, "<li>");
+			BufferAppend(&out, item.bytes, item.length);
+			BufferAppendLiteral(&out, "</li>\n");
+			free(item.bytes);
+			p = end;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(list, &out);
+	ctx->listLevel--;
+}
+
+//within a list any line can start a sub-list; outside one, a list must follow a blank line (or start the text),
+//so that a paragraph line that happens to begin with a number is left alone
+static void DoLists(MarkdownContext *ctx, MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t start = SIZE_MAX, end = 0;
+		int ordered = 0;
+		if (ctx->listLevel) {
+			if (IsLineStart(s, n, p)) start = p;
+		} else if (!p) {
+			start = s[0] == '\n';
+		} else if (p >= 2 && s[p - 1] == '\n' && s[p - 2] == '\n') {
+			start = p;
+		}
+		if (start != SIZE_MAX) end = EndOfList(s, n, start, &ordered);
+
+		if (end) {
+			//double returns become triple returns, so that the last item can be made a paragraph if need be
+			MDBuffer list;
+			size_t q = start;
+			BufferInit(&list, NULL, 0);
+			while (q < end) {
+				if (s[q] == '\n' && q + 1 < end && s[q + 1] == '\n') {
+					BufferAppendLiteral(&list, "\n\n\n");
+					q = SkipNewlines(s, end, q);
+				} else {
+					BufferAppendChar(&list, s[q++]);
+				}
+			}
+			ProcessListItems(ctx, &list);
+
+			if (ordered) BufferAppendLiteral(&out, "<ol>\n");
+			else BufferAppendLiteral(&out, "<ul>\n");
+			BufferAppend(&out, list.bytes, list.length);
+			if (ordered) BufferAppendLiteral(&out, "</ol>\n");
+			else BufferAppendLiteral(&out, "</ul>\n");
+			free(list.bytes);
+			p = end;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+static inline int IsIndentedLine(const char *s, size_t n, size_t p) {
+	return s[p] == '\t' || HasPrefix(s, n, p, "    ", 4);
+}
+
+//a code block must be followed by a line indented less than four spaces, or by the end of the text
+static int CodeBlockCanEndAt(const char *s, size_t n, size_t p) {
+	size_t q = p;
+	if (p == n) return 1;
+	if (!IsLineStart(s, n, p)) return 0;
+	while (q < p + 4 && s[q] == ' ') q++;
+	return q < n && !IsSpace(s[q]);
+}
+
+static size_t EndOfCodeBlock(const char *s, size_t n, size_t p) {
+	size_t end = 0;
+	while (p < n && IsIndentedLine(s, n, p)) {
+		size_t lineEnd = LineEnd(s, n, p);
+		if (lineEnd == n) break;
+		p = SkipNewlines(s, n, lineEnd);
+		if (CodeBlockCanEndAt(s, n, p)) end = p;
+	}
+	return end;
+}
+
+static void DoCodeBlocks(MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t start = p + 2, end = 0;
+		if (s[p] == '\n' && s[p + 1] == '\n') end = EndOfCodeBlock(s, n, start);
+		if (!end && !p) end = EndOfCodeBlock(s, n, start = 0);
+
+		if (end) {
+			MDBuffer code, encoded;
+			size_t first = 0, last;
+			BufferInit(&code, s + start, end - start);
+			Outdent(&code);
+			BufferInit(&encoded, NULL, 0);
+			EncodeCode(code.bytes, code.length, &encoded);
+			Detab(&encoded);
+
+			last = encoded.length;
+			while (first < last && encoded.bytes[first] == '\n') first++;
+			while (last > first && IsSpace(encoded.bytes[last - 1])) last--;
+			BufferAppendLiteral(&out, "\n\n<pre><code>");
+			BufferAppend(&out, encoded.bytes + first, last - first);
+			BufferAppendLiteral(&out, "\n</code></pre>\n\n");
+
+			free(code.bytes);
+			free(encoded.bytes);
+			p = end;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+//a line starting with > and having at least one more character
+static int IsQuoteLine(const char *s, size_t n, size_t p) {
+	size_t marker = SkipSpacesAndTabs(s, n, p), lineEnd = LineEnd(s, n, p);
+	return s[marker] == '>' && lineEnd < n && lineEnd > marker + 1;
+}
+
+//Markdown.pl indents the quote by two spaces, then takes two spaces back from the start of every line in its
+//<pre> blocks, whether or not it had put them there
+static void UnindentPreBlocks(MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t pre = p, end = SIZE_MAX;
+		while (pre < n && IsSpace(s[pre])) pre++;
+		if (HasPrefix(s, n, pre, "<pre>", 5)) end = FindBytes(s, n, pre + 6, "</pre>", 6);
+
+		if (end != SIZE_MAX) {
+			size_t q = p;
+			for (end += 6; q < end; ) {
+				size_t lineEnd = LineEnd(s, end, q), next = lineEnd < end ? lineEnd + 1 : end;
+				if (HasPrefix(s, end, q, "  ", 2)) q += 2;
+				BufferAppend(&out, s + q, next - q);
+				q = next;
+			}
+			p = end;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+static void DoBlockQuotes(MarkdownContext *ctx, MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		if (IsLineStart(s, n, p) && IsQuoteLine(s, n, p)) {
+			//quoted lines, the lazily unquoted lines continuing them, and blank lines, for as long as quoting resumes
+			size_t end = p, q;
+			MDBuffer quote;
+			while (IsLineStart(s, n, end) && IsQuoteLine(s, n, end)) {
+				end = LineEnd(s, n, end) + 1;
+				while (end < n && s[end] != '\n' && LineEnd(s, n, end) < n) end = LineEnd(s, n, end) + 1;
+				end = SkipNewlines(s, n, end);
+			}
+
+			BufferInit(&quote, NULL, 0);
+			for (q = p; q < end; ) {
+				size_t next = NextLine(s, end, q), marker = SkipSpacesAndTabs(s, next, q);
+				if (s[marker] == '>') q = marker + 1 + (marker + 1 < next && IsSpaceOrTab(s[marker + 1]));
+				BufferAppend(&quote, s + q, next - q);
+				q = next;
+			}
+			StripWhitespaceOnlyLines(&quote);
+			RunBlockGamut(ctx, &quote);
+			if (quote.length) {
+				MDBuffer indented;
+				BufferInit(&indented, "  ", 2);
+				BufferAppend(&indented, quote.bytes, quote.length);
+				BufferReplace(&quote, &indented);
+			} else {
+				BufferAppendLiteral(&quote, "  ");
+			}
+			UnindentPreBlocks(&quote);
+
+			BufferAppendLiteral(&out, "<blockquote>\n");
+			BufferAppend(&out, quote.bytes, quote.length);
+			BufferAppendLiteral(&out, "\n</blockquote>\n\n");
+			free(quote.bytes);
+			p = end;
+		} else {
+			size_t next = NextLine(s, n, p);
+			BufferAppend(&out, s + p, next - p);
+			p = next;
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+static void FormParagraphs(MarkdownContext *ctx, MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t p = SkipNewlines(s, text->length, 0), n = text->length;
+	MDBuffer out;
+	while (n > p && s[n - 1] == '\n') n--;
+
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t end = FindBytes(s, n, p, "\n\n", 2);
+		const MDBuffer *block;
+		if (end == SIZE_MAX) end = n;
+		if (out.length) BufferAppendLiteral(&out, "\n\n");
+
+		if ((block = BlockForKey(ctx, s + p, end - p))) {
+			BufferAppend(&out, block->bytes, block->length);
+		} else {
+			MDBuffer graf;
+			size_t indent;
+			BufferInit(&graf, s + p, end - p);
+			RunSpanGamut(ctx, &graf);
+			indent = SkipSpacesAndTabs(graf.bytes, graf.length, 0);
+			BufferAppendLiteral(&out, "<p>");
+			BufferAppend(&out, graf.bytes + indent, graf.length - indent);
+			BufferAppendLiteral(&out, "</p>");
+			free(graf.bytes);
+		}
+		p = SkipNewlines(s, n, end);
+	}
+	BufferReplace(text, &out);
+}
+
+static void RunBlockGamut(MarkdownContext *ctx, MDBuffer *text) {
+	DoHeaders(ctx, text);
+	DoHorizontalRules(text);
+	DoLists(ctx, text);
+	DoCodeBlocks(text);
+	DoBlockQuotes(ctx, text);
+
+	//we already ran HashHTMLBlocks before, but that was to hash the raw html blocks in the text;
+	//this hashes the ones the passes above generated
+	HashHTMLBlocks(ctx, text);
+	FormParagraphs(ctx, text);
+}
+
+#pragma mark span gamut
+
+static void DoCodeSpans(MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t run = 0, length = 0, close = 0;
+		if (s[p] == '`') {
+			while (s[p + run] == '`') run++;
+			//the closing run must be exactly as long as the opening one, which can give up backticks to the code
+			for (length = run; length > 0 && !close; length--) {
+				size_t q;
+				for (q = p + length + 1; q + length <= n; q++) {
+					size_t closeRun = 0;
+					if (s[q] != '`' || s[q - 1] == '`') continue;
+					while (s[q + closeRun] == '`') closeRun++;
+					if (closeRun == length) {
+						close = q;
+						break;
+					}
+					q += closeRun - 1;
+				}
+				if (close) break;
+			}
+		}
+		if (close) {
+			size_t start = p + length, end = close;
+			start = SkipSpacesAndTabs(s, end, start);
+			if (end > start && s[end - 1] == '\n') {
+				//perl's $ also matches before a final newline
+				size_t newline = end - 1;
+				while (newline > start && IsSpaceOrTab(s[newline - 1])) newline--;
+				BufferAppendLiteral(&out, "<code>");
+				EncodeCode(s + start, newline - start, &out);
+				BufferAppendLiteral(&out, "\n</code>");
+			} else {
+				while (end > start && IsSpaceOrTab(s[end - 1])) end--;
+				BufferAppendLiteral(&out, "<code>");
+				EncodeCode(s + start, end - start, &out);
+				BufferAppendLiteral(&out, "</code>");
+			}
+			p = close + length;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+//a tag nested up to depth deep, as perl's tokenizer knows it
+static size_t NestedTagLength(const char *s, size_t n, size_t p, unsigned int depth) {
+	size_t q;
+	if (p + 1 >= n || s[p] != '<' || !(IsAlpha(s[p + 1]) || s[p + 1] == '/' || s[p + 1] == '!' || s[p + 1] == '$')) return 0;
+	for (q = p + 2; q < n; ) {
+		if (s[q] == '>') return q + 1 - p;
+		if (s[q] == '<') {
+			size_t inner = depth > 1 ? NestedTagLength(s, n, q, depth - 1) : 0;
+			if (!inner) return 0;
+			q += inner;
+		} else {
+			q++;
+		}
+	}
+	return 0;
+}
+
+//the length of the comment, processing instruction or tag at p, or 0
+static size_t HTMLTagLength(const char *s, size_t n, size_t p) {
+	size_t q;
+	if (HasPrefix(s, n, p, "<!--", 4)) {
+		for (q = p + 4; q + 1 < n; q++) {
+			if (s[q] == '-' && s[q + 1] == '-') {
+				size_t end = q + 2;
+				while (end < n && IsSpace(s[end])) end++;
+				if (s[end] == '>') return end + 1 - p;
+			}
+		}
+	}
+	if (HasPrefix(s, n, p, "<?", 2)) {
+		if ((q = FindBytes(s, n, p + 2, "?>", 2)) != SIZE_MAX) return q + 2 - p;
+	}
+	return NestedTagLength(s, n, p, 6);
+}
+
+//hides * and _ inside tags, so that the emphasis passes leave attributes alone, and backslash-escaped characters
+//everywhere else
+static void EscapeSpecialChars(MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t tagLength = s[p] == '<' ? HTMLTagLength(s, n, p) : 0;
+		if (tagLength) {
+			AppendAttribute(&out, s + p, tagLength, 0, 1);
+			p += tagLength;
+		} else if (s[p] == '\\' && p + 1 < n && s[p + 1] && strchr(kEscapableChars, s[p + 1])) {
+			AppendEscapedChar(&out, s[p + 1]);
+			p += 2;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+//the start of the id in "[id]", which may follow a space and/or a newline, or 0
+static size_t ReferenceIDStart(const char *s, size_t p) {
+	if (s[p] == ' ') p++;
+	if (s[p] == '\n') {
+		for (p++; s[p] == ' '; p++);
+	}
+	return s[p] == '[' ? p + 1 : 0;
+}
+
+//the position of the bracket closing one opened before p, skipping balanced pairs, or 0
+static size_t MatchingBracket(const char *s, size_t n, size_t p) {
+	size_t depth = 0;
+	for (; p < n; p++) {
+		if (s[p] == '[') depth++;
+		else if (s[p] == ']' && !depth--) return p;
+	}
+	return 0;
+}
+
+static void AppendReferenceImage(MarkdownContext *ctx, MDBuffer *out, const char *s, size_t altStart, size_t altEnd, size_t idStart, size_t idEnd) {
+	LinkDefinition *link = idEnd > idStart ? FindLinkDefinition(ctx, s + idStart, idEnd - idStart) :
+		FindLinkDefinition(ctx, s + altStart, altEnd - altStart);
+	if (!link) {
+		BufferAppend(out, s + altStart - 2, idEnd + 1 - (altStart - 2));
+		return;
+	}
+	BufferAppendLiteral(out, "<img src=\"");
+	AppendAttribute(out, link->url, strlen(link->url), 0, 1);
+	BufferAppendLiteral(out, "\" alt=\"");
+	AppendAttribute(out, s + altStart, altEnd - altStart, 1, 0);
+	BufferAppendChar(out, '"');
+	if (link->title) {
+		BufferAppendLiteral(out, " title=\"");
+		AppendAttribute(out, link->title, strlen(link->title), 0, 1);
+		BufferAppendChar(out, '"');
+	}
+	BufferAppendLiteral(out, " />");
+}
+
+static void DoReferenceImages(MarkdownContext *ctx, MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t altEnd, idStart = 0, idEnd = 0;
+		if (s[p] == '!' && s[p + 1] == '[') {
+			//the alt text runs to the first ] that is followed by an [id]
+			for (altEnd = p + 2; altEnd < n; altEnd++) {
+				if (s[altEnd] == ']' && (idStart = ReferenceIDStart(s, altEnd + 1)) &&
+					(idEnd = FindBytes(s, n, idStart, "]", 1)) != SIZE_MAX) break;
+				idStart = 0;
+			}
+		}
+		if (idStart) {
+			AppendReferenceImage(ctx, &out, s, p + 2, altEnd, idStart, idEnd);
+			p = idEnd + 1;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+//matches what follows "![alt](": <url> or url (without spaces), then optionally a quoted title, then a parenthesis
+static size_t EndOfInlineImage(const char *s, size_t n, size_t p, size_t *urlStart, size_t *urlEnd, size_t *titleStart, size_t *titleEnd) {
+	int bracketed;
+	p = SkipSpacesAndTabs(s, n, p);
+	for (bracketed = s[p] == '<'; bracketed >= 0; bracketed--) {
+		size_t start = p + bracketed, end = start;
+		while (end < n && !IsSpace(s[end])) {
+			int closed;
+			for (end++, closed = s[end] == '>'; closed >= 0; closed--) {
+				size_t q = SkipSpacesAndTabs(s, n, end + closed), close;
+				*urlStart = start;
+				*urlEnd = end;
+				if (s[q] == '"' || s[q] == '\'') {
+					for (close = q + 1; close < n; close++) {
+						size_t paren;
+						if (s[close] != s[q]) continue;
+						paren = SkipSpacesAndTabs(s, n, close + 1);
+						if (s[paren] == ')') {
+							*titleStart = q + 1;
+							*titleEnd = close;
+							return paren + 1;
+						}
+					}
+				}
+				if (s[q] == ')') {
+					*titleStart = *titleEnd = 0;
+					return q + 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+static void DoInlineImages(MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t altEnd = 0, urlStart, urlEnd, titleStart, titleEnd, end = 0;
+		if (s[p] == '!' && s[p + 1] == '[') {
+			for (altEnd = p + 2; altEnd < n; altEnd++) {
+				if (s[altEnd] == ']' && s[altEnd + 1] == '(' &&
+					(end = EndOfInlineImage(s, n, altEnd + 2, &urlStart, &urlEnd, &titleStart, &titleEnd))) break;
+			}
+		}
+		if (end) {
+			BufferAppendLiteral(&out, "<img src=\"");
+			AppendAttribute(&out, s + urlStart, urlEnd - urlStart, 0, 1);
+			BufferAppendLiteral(&out, "\" alt=\"");
+			AppendAttribute(&out, s + p + 2, altEnd - (p + 2), 1, 0);
+			//perl always gives inline images a title, if only an empty one
+			BufferAppendLiteral(&out, "\" title=\"");
+			AppendAttribute(&out, s + titleStart, titleEnd - titleStart, 1, 1);
+			BufferAppendLiteral(&out, "\" />");
+			p = end;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+static void DoReferenceLinks(MarkdownContext *ctx, MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t close = 0, idStart = 0, idEnd = SIZE_MAX;
+		if (s[p] == '[' && (close = MatchingBracket(s, n, p + 1)) && (idStart = ReferenceIDStart(s, close + 1)))
+			idEnd = FindBytes(s, n, idStart, "]", 1);
+
+		if (idEnd != SIZE_MAX) {
+			LinkDefinition *link = idEnd > idStart ? FindLinkDefinition(ctx, s + idStart, idEnd - idStart) :
+				FindLinkDefinition(ctx, s + p + 1, close - p - 1);
+			if (link) {
+				BufferAppendLiteral(&out, "<a href=\"");
+				AppendAttribute(&out, link->url, strlen(link->url), 0, 1);
+				BufferAppendChar(&out, '"');
+				if (link->title) {
+					BufferAppendLiteral(&out, " title=\"");
+					AppendAttribute(&out, link->title, strlen(link->title), 0, 1);
+					BufferAppendChar(&out, '"');
+				}
+				BufferAppendChar(&out, '>');
+				BufferAppend(&out, s + p + 1, close - p - 1);
+				BufferAppendLiteral(&out, "</a>");
+			} else {
+				BufferAppend(&out, s + p, idEnd + 1 - p);
+			}
+			p = idEnd + 1;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+//matches what follows "[text](": the shortest url (spaces and all) that is followed by an optional quoted title
+//and a parenthesis
+static size_t EndOfInlineLink(const char *s, size_t n, size_t p, size_t *urlStart, size_t *urlEnd, size_t *titleStart, size_t *titleEnd) {
+	int bracketed;
+	p = SkipSpacesAndTabs(s, n, p);
+	if (!memchr(s + p, ')', n - p)) return 0;
+	for (bracketed = s[p] == '<'; bracketed >= 0; bracketed--) {
+		size_t start = p + bracketed, end;
+		for (end = start; end <= n; end++) {
+			int closed;
+			for (closed = s[end] == '>'; closed >= 0; closed--) {
+				size_t q = SkipSpacesAndTabs(s, n, end + closed), close;
+				*urlStart = start;
+				*urlEnd = end;
+				if (s[q] == '"' || s[q] == '\'') {
+					for (close = q + 1; close + 1 < n; close++) {
+						if (s[close] == s[q] && s[close + 1] == ')') {
+							*titleStart = q + 1;
+							*titleEnd = close;
+							return close + 2;
+						}
+					}
+				}
+				if (s[q] == ')') {
+					*titleStart = *titleEnd = SIZE_MAX;
+					return q + 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+static void DoInlineLinks(MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t close = 0, urlStart, urlEnd, titleStart, titleEnd, end = 0;
+		if (s[p] == '[' && (close = MatchingBracket(s, n, p + 1)) && s[close + 1] == '(')
+			end = EndOfInlineLink(s, n, close + 2, &urlStart, &urlEnd, &titleStart, &titleEnd);
+
+		if (end) {
+			BufferAppendLiteral(&out, "<a href=\"");
+			AppendAttribute(&out, s + urlStart, urlEnd - urlStart, 0, 1);
+			BufferAppendChar(&out, '"');
+			if (titleStart != SIZE_MAX) {
+				BufferAppendLiteral(&out, " title=\"");
+				AppendAttribute(&out, s + titleStart, titleEnd - titleStart, 1, 1);
+				BufferAppendChar(&out, '"');
+			}
+			BufferAppendChar(&out, '>');
+			BufferAppend(&out, s + p + 1, close - p - 1);
+			BufferAppendLiteral(&out, "</a>");
+			p = end;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+//one or more dot-separated labels of letters, digits and hyphens, the last of them letters only
+static int IsEmailDomain(const char *s, size_t n) {
+	size_t i, labelStart = 0, labels = 0;
+	for (i = 0; i <= n; i++) {
+		if (i == n || s[i] == '.') {
+			if (i == labelStart) return 0;
+			labels++;
+			if (i < n) labelStart = i + 1;
+		}
+	}
+	for (i = labelStart; i < n; i++) {
+		if (!IsAlpha(s[i])) return 0;
+	}
+	return labels >= 2;
+}
+
+//writes the characters of the mailto: url as entities, to keep the address from harvesters; as in Markdown.pl,
+//each is chosen at random (about 10% left as is, 45% hexadecimal, 45% decimal), the @ always decimal and the : never encoded,
+//except that characters left as is are hidden from the span passes, where the script would sometimes italicize a_b@c_d
+static void AppendEncodedEmailAddress(MDBuffer *out, const char *s, size_t n) {
+	MDBuffer address, encoded;
+	size_t i, visibleStart = 0;
+
+	BufferInit(&address, "mailto:", 7);
+	BufferAppend(&address, s, n);
+	UnescapeSpecialChars(&address);
+
+	BufferInit(&encoded, NULL, 0);
+	for (i = 0; i < address.length; i++) {
+		unsigned char c = (unsigned char)address.bytes[i];
+		char entity[16];
+#if defined(__APPLE__)
+		unsigned int r = arc4random_uniform(100);
+#else
+		unsigned int r = (unsigned int)rand() % 100;
+#endif
+		if (c == ':') {
+			BufferAppendChar(&encoded, ':');
+			if (!visibleStart) visibleStart = encoded.length;
+			continue;
+		}
+		if (c != '@' && r >= 90) {
+			if (strchr(kEscapableChars, c)) AppendEscapedChar(&encoded, (char)c);
+			else BufferAppendChar(&encoded, (char)c);
+			continue;
+		}
+		if (c != '@' && r < 45) snprintf(entity, sizeof(entity), "&#x%X;", c);
+		else snprintf(entity, sizeof(entity), "&#%u;", c);
+		BufferAppend(&encoded, entity, strlen(entity));
+	}
+
+	BufferAppendLiteral(out, "<a href=\"");
+	BufferAppend(out, encoded.bytes, encoded.length);
+	BufferAppendLiteral(out, "\">");
+	BufferAppend(out, encoded.bytes + visibleStart, encoded.length - visibleStart);
+	BufferAppendLiteral(out, "</a>");
+	free(address.bytes);
+	free(encoded.bytes);
+}
+
+static void DoAutoLinks(MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+
+	//<http://example.com>
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t start = p + 1, end = 0;
+		if (s[p] == '<') {
+			if (HasPrefixIgnoringCase(s, n, start, "http:", 5)) end = start + 5;
+			else if (HasPrefixIgnoringCase(s, n, start, "https:", 6)) end = start + 6;
+			else if (HasPrefixIgnoringCase(s, n, start, "ftp:", 4)) end = start + 4;
+		}
+		if (end) {
+			size_t url = end;
+			while (end < n && s[end] != '\'' && s[end] != '"' && s[end] != '>' && !IsSpace(s[end])) end++;
+			if (end == url || s[end] != '>') end = 0;
+		}
+		if (end) {
+			BufferAppendLiteral(&out, "<a href=\"");
+			BufferAppend(&out, s + start, end - start);
+			BufferAppendLiteral(&out, "\">");
+			BufferAppend(&out, s + start, end - start);
+			BufferAppendLiteral(&out, "</a>");
+			p = end + 1;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+
+	//<address@example.com> or <mailto:address@example.com>
+	s = text->bytes;
+	n = text->length;
+	p = 0;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t start = p + 1, end = 0;
+		if (s[p] == '<') {
+			size_t at, domainEnd;
+			if (HasPrefixIgnoringCase(s, n, start, "mailto:", 7)) start += 7;
+			for (at = start; at < n; ) {
+				if (IsWord(s[at]) || s[at] == '-' || s[at] == '.') at++;
+				else if (s[at] == kEscapeMark && at + 1 < n) at += 2;
+				else break;
+			}
+			if (at > start && s[at] == '@') {
+				for (domainEnd = at + 1; domainEnd < n && (IsAlpha(s[domainEnd]) || IsDigit(s[domainEnd]) ||
+														  s[domainEnd] == '-' || s[domainEnd] == '.'); domainEnd++);
+				if (s[domainEnd] == '>' && IsEmailDomain(s + at + 1, domainEnd - at - 1)) end = domainEnd;
+			}
+		}
+		if (end) {
+			AppendEncodedEmailAddress(&out, s + start, end - start);
+			p = end + 1;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+//<strong> must go first
+static void DoStrongEmphasis(MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		char delimiter = s[p];
+		size_t close = 0;
+		if ((delimiter == '*' || delimiter == '_') && s[p + 1] == delimiter && p + 2 < n && !IsSpace(s[p + 2])) {
+			//perl's (.+?[*_]*) lets each shortest text claim as many of the * and _ after it as it can
+			size_t textEnd, run, q;
+			for (textEnd = p + 3; textEnd < n && !close; textEnd++) {
+				for (run = 0; s[textEnd + run] == '*' || s[textEnd + run] == '_'; run++);
+				for (q = textEnd + run + 1; q-- > textEnd; ) {
+					if (s[q] == delimiter && s[q + 1] == delimiter && !IsSpace(s[q - 1])) {
+						close = q;
+						break;
+					}
+				}
+			}
+		}
+		if (close) {
+			BufferAppendLiteral(&out, "<strong>");
+			BufferAppend(&out, s + p + 2, close - p - 2);
+			BufferAppendLiteral(&out, "</strong>");
+			p = close + 2;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+static void DoEmphasis(MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		char delimiter = s[p];
+		size_t close = 0, q;
+		if ((delimiter == '*' || delimiter == '_') && p + 1 < n && !IsSpace(s[p + 1])) {
+			for (q = p + 2; q < n; q++) {
+				if (s[q] == delimiter && !IsSpace(s[q - 1])) {
+					close = q;
+					break;
+				}
+			}
+		}
+		if (close) {
+			BufferAppendLiteral(&out, "<em>");
+			BufferAppend(&out, s + p + 1, close - p - 1);
+			BufferAppendLiteral(&out, "</em>");
+			p = close + 1;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+static void DoHardBreaks(MDBuffer *text) {
+	const char *s = text->bytes;
+	size_t n = text->length, p = 0;
+	MDBuffer out;
+	BufferInit(&out, NULL, 0);
+	while (p < n) {
+		size_t spaces = 0;
+		while (s[p + spaces] == ' ') spaces++;
+		if (spaces >= 2 && s[p + spaces] == '\n') {
+			BufferAppendLiteral(&out, " <br />\n");
+			p += spaces + 1;
+		} else if (spaces) {
+			BufferAppend(&out, s + p, spaces);
+			p += spaces;
+		} else {
+			BufferAppendChar(&out, s[p++]);
+		}
+	}
+	BufferReplace(text, &out);
+}
+
+static void RunSpanGamut(MarkdownContext *ctx, MDBuffer *text) {
+	MDBuffer encoded;
+
+	DoCodeSpans(text);
+	EscapeSpecialChars(text);
+
+	//images must come first, because ![foo][f] looks like an anchor
+	DoReferenceImages(ctx, text);
+	DoInlineImages(text);
+	DoReferenceLinks(ctx, text);
+	DoInlineLinks(text);
+	DoAutoLinks(text);
+
+	BufferInit(&encoded, NULL, 0);
+	EncodeAmpsAndAngles(text->bytes, text->length, &encoded);
+	BufferReplace(text, &encoded);
+
+	DoStrongEmphasis(text);
+	DoEmphasis(text);
+	DoHardBreaks(text);
+}
+
+#pragma mark -
+
+char *MarkdownCopyXHTML(const char *bytes, size_t length, size_t *outLength) {
+	MarkdownContext ctx;
+	MDBuffer text;
+	size_t i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	BufferInit(&text, NULL, 0);
+	BufferReserve(&text, length + 2);
+
+	//unix line endings, and none of the bytes used as marks here
+	for (i = 0; i < length; i++) {
+		char c = bytes[i];
+		if (c == '\r') {
+			BufferAppendChar(&text, '\n');
+			if (i + 1 < length && bytes[i + 1] == '\n') i++;
+		} else if (c && c != kEscapeMark && c != kBlockMark) {
+			BufferAppendChar(&text, c);
+		}
+	}
+	BufferAppendLiteral(&text, "\n\n");
+
+	Detab(&text);
+	StripWhitespaceOnlyLines(&text);
+	HashHTMLBlocks(&ctx, &text);
+	StripLinkDefinitions(&ctx, &text);
+	RunBlockGamut(&ctx, &text);
+	RestoreLeakedBlockKeys(&ctx, &text);
+	UnescapeSpecialChars(&text);
+	BufferAppendChar(&text, '\n');
+
+	for (i = 0; i < ctx.linkCount; i++) {
+		free(ctx.links[i].identifier);
+		free(ctx.links[i].url);
+		free(ctx.links[i].title);
+	}
+	for (i = 0; i < ctx.blockCount; i++) {
+		free(ctx.blocks[i].bytes);
+	}
+	free(ctx.links);
+	free(ctx.blocks);
+
+	if (outLength) *outLength = text.length;
+	return text.bytes;
+}
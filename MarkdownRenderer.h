@@ -0,0 +1,25 @@
+/*
+ *  MarkdownRenderer.h
+ *  Notation
+ *
+ */
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+//renders Markdown to XHTML within the process, producing what Markdown.pl 1.0.1 would for the same bytes;
+//like the script, it encodes the characters of e-mail addresses as randomly chosen entities, but where malformed
+//html makes the script leave the MD5 placeholder of a block in its output, the block itself is shown instead
+
+#include <stddef.h>
+
+//returns a NUL-terminated string to be freed by the caller; outLength may be NULL
+char *MarkdownCopyXHTML(const char *text, size_t length, size_t *outLength);
@@ -55,9 +55,15 @@
 
 @end
 
+//LSD radix sort of objects by 64-bit keys; runs of objects with equal keys are then ordered by compare
+void RadixSortObjects(id *objects, size_t count, uint64_t (*keyFunction)(id), BOOL descending, NSInteger (*compare)(id *, id *));
+
 @interface NSMutableArray (Sorting)
 
 - (void)sortUnstableUsingFunction:(NSInteger (*)(id *, id *))compare;
 - (void)sortStableUsingFunction:(NSInteger (*)(id *, id *))compare usingBuffer:(id **)buffer ofSize:(unsigned int*)bufSize;
+- (void)sortUsingKeyFunction:(uint64_t (*)(id))keyFunction descending:(BOOL)descending tiebreakFunction:(NSInteger (*)(id *, id *))compare 
+				 usingBuffer:(id **)buffer ofSize:(unsigned int*)bufSize;
+- (NSUInteger)insertObject:(id)anObject sortedUsingFunction:(NSInteger (*)(id *, id *))compare;
 @end
 
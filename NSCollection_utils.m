@@ -224,6 +224,63 @@
 
 @end
 
+typedef struct _KeyedObject {
+	uint64_t key;
+	id object;
+} KeyedObject;
+
+void RadixSortObjects(id *objects, size_t count, uint64_t (*keyFunction)(id), BOOL descending, NSInteger (*compare)(id *, id *)) {
+	if (count < 2) return;
+	
+	KeyedObject *items = (KeyedObject*)malloc(count * 2 * sizeof(KeyedObject)), *scratch = items + count;
+	size_t i, shift;
+	
+	for (i=0; i<count; i++) {
+		uint64_t key = keyFunction(objects[i]);
+		items[i].key = descending ? ~key : key;
+		items[i].object = objects[i];
+	}
+	
+	//one stable counting pass per byte, skipping any byte that is the same for every key (as the high bytes of nearby dates are)
+	for (shift = 0; shift < 64; shift += 8) {
+		size_t counts[256] = { 0 };
+		
+		for (i=0; i<count; i++)
+			counts[(items[i].key >> shift) & 0xff]++;
+		if (counts[(items[0].key >> shift) & 0xff] == count)
+			continue;
+		
+		size_t digit, offset = 0;
+		for (digit = 0; digit < 256; digit++) {
+			size_t digitCount = counts[digit];
+			counts[digit] = offset;
+			offset += digitCount;
+		}
+		for (i=0; i<count; i++)
+			scratch[counts[(items[i].key >> shift) & 0xff]++] = items[i];
+		
+		KeyedObject *sorted = scratch;
+		scratch = items;
+		items = sorted;
+	}
+	
+	for (i=0; i<count; i++)
+		objects[i] = items[i].object;
+	
+	if (compare) {
+		size_t runStart = 0;
+		for (i=1; i<=count; i++) {
+			if (i == count || items[i].key != items[runStart].key) {
+				if (i - runStart > 1)
+					mergesort((void *)(objects + runStart), i - runStart, sizeof(id), (int (*)(const void *, const void *))compare);
+				runStart = i;
+			}
+		}
+	}
+	
+	free(items < scratch ? items : scratch);
+}
+
 @implementation NSMutableArray (Sorting)
 
 - (void)sortUnstableUsingFunction:(NSInteger (*)(id *, id *))compare {
@@ -242,4 +299,35 @@
 	CFArrayReplaceValues((CFMutableArrayRef)self, CFRangeMake(0, count), (const void **)*buffer, count);
 }
 
+- (void)sortUsingKeyFunction:(uint64_t (*)(id))keyFunction descending:(BOOL)descending tiebreakFunction:(NSInteger (*)(id *, id *))compare 
+				 usingBuffer:(id **)buffer ofSize:(unsigned int*)bufSize {
+	CFIndex count = CFArrayGetCount((CFArrayRef)self);
+	
+	ResizeArray(buffer, count, bufSize);
+	
+	CFArrayGetValues((CFArrayRef)self, CFRangeMake(0, count), (const void **)*buffer);
+	
+	RadixSortObjects(*buffer, (size_t)count, keyFunction, descending, compare);
+	
+	CFArrayReplaceValues((CFMutableArrayRef)self, CFRangeMake(0, count), (const void **)*buffer, count);
+}
+
+- (NSUInteger)insertObject:(id)anObject sortedUsingFunction:(NSInteger (*)(id *, id *))compare {
+	//binary search for the position after any objects that compare equal, as a stable sort would have left it
+	NSUInteger low = 0, high = CFArrayGetCount((CFArrayRef)self);
+	
+	while (low < high) {
+		NSUInteger mid = low + (high - low) / 2;
+		id midObject = (id)CFArrayGetValueAtIndex((CFArrayRef)self, mid);
+		
+		if (compare(&anObject, &midObject) < 0)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+	[self insertObject:anObject atIndex:low];
+	
+	return low;
+}
+
 @end
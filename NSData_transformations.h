@@ -16,6 +16,7 @@
 - (NSMutableData *) compressedDataAtLevel:(int)level;
 - (NSMutableData *) uncompressedData;
 - (BOOL) isCompressedFormat;
+- (BOOL) isChunkedCompressedFormat;
 
 + (NSMutableData *)randomDataOfLength:(int)len;
 - (NSMutableData*)derivedKeyOfLength:(int)len salt:(NSData*)salt iterations:(int)count;
@@ -21,6 +21,8 @@
 #include "pbkdf2.h"
 #include "hmacsha1.h"
 #include "broken_md5.h"
+#include "CRC32.h"
+#include "ChunkedCompression.h"
 
 #include <unistd.h>
 #include <zlib.h>
@@ -39,102 +41,48 @@
 
 
 /*
- * Compress the data at the given compression level; stores the original data
- * size at the end of the compressed data
+ * Compress the data at the given compression level; data of up to one chunk is
+ * compressed with zlib as a single stream with the original size at its end, as
+ * every version has written it, and anything larger in chunks that are compressed
+ * independently on all available cores (see ChunkedCompression.h)
  */
 - (NSMutableData *)compressedDataAtLevel:(int)level {
-	
-	NSMutableData *newData;
-	unsigned long bufferLength;
-	int zlibError;
-	
-	/*
-	 * zlib says to make sure the destination has 0.1% more + 12 bytes; last
-	 * additional bytes to store the original size (needed for uncompress)
-	 */
-	bufferLength = ceil( (float) [self length] * 1.001 ) + 12 + sizeof( unsigned );
-	newData = [NSMutableData dataWithLength:bufferLength];
-	if( newData != nil ) {
-		zlibError = compress2([newData mutableBytes], &bufferLength,
-							   [self bytes], [self length], level);
-		if (zlibError == Z_OK) {
-			// Add original size to the end of the buffer, written big-endian
-			*( (unsigned *) ([newData mutableBytes] + bufferLength) ) =
-            NSSwapHostIntToBig( [self length] );
-			[newData setLength:bufferLength + sizeof(unsigned)];
-		} else {
-			NSLog(@"error compressing: %s", zError(zlibError));
-			newData = nil;
-		}
-	} else
-		NSLog(@"error compressing: couldn't allocate memory");
-	
-	return newData;
+	size_t compressedLength = 0;
+	unsigned char *compressed = nv_compress([self bytes], [self length], level, &compressedLength);
+	if (!compressed) {
+		NSLog(@"error compressing: couldn't compress or allocate memory");
+		return nil;
+	}
+	return [NSMutableData dataWithBytesNoCopy:compressed length:compressedLength freeWhenDone:YES];
 }
 
-
 /*
- * Decompress data
+ * Decompress data, in either format; a chunked blob is decompressed on all
+ * available cores, each chunk straight into its place in the result
  */
 - (NSMutableData *) uncompressedData {
-	
-	NSMutableData *newData;
-	unsigned originalSize;
-	unsigned long outSize;
-	int zlibError;
-	
-	newData = nil;
-	if ( [self isCompressedFormat] ) {
-		originalSize = NSSwapBigIntToHost(*((unsigned *) ([self bytes] + [self length] - sizeof(unsigned))));
-		
-		//catch the NSInvalidArgumentException that's thrown if originalSize is too large
-		NS_DURING
-			newData = [ NSMutableData dataWithLength:originalSize ];
-		NS_HANDLER
-			if ([[localException name] isEqualToString:NSInvalidArgumentException] ) {
-				NSLog(@"error decompressing--bad size: %@", [localException reason]);
-				NS_VALUERETURN( nil, NSMutableData * );
-			} else
-				[localException raise];   // This should NEVER happen...
-		NS_ENDHANDLER
-		
-		if( newData != nil ) {
-			outSize = originalSize;
-			zlibError = uncompress([newData mutableBytes], &outSize, [self bytes], [self length] - sizeof(unsigned));
-			if( zlibError != Z_OK ) {
-				NSLog(@"decompression failed: %s", zError(zlibError));
-				newData = nil;
-			} else if (originalSize != outSize)
-				NSLog(@"error decompressing: extracted size %u does not match original of %u", outSize, originalSize);
-		} else
-			NSLog(@"error allocating memory while decompressing");
-	} else
+	if (![self isChunkedCompressedFormat] && ![self isCompressedFormat]) {
 		NSLog(@"error decompressing: data does not seem to be compressed with zlib");
-	
-	return newData;
+		return nil;
+	}
+	size_t uncompressedLength = 0;
+	unsigned char *uncompressed = nv_uncompress([self bytes], [self length], &uncompressedLength);
+	if (!uncompressed) {
+		NSLog(@"decompression failed: the data is damaged or too large");
+		return nil;
+	}
+	return [NSMutableData dataWithBytesNoCopy:uncompressed length:uncompressedLength freeWhenDone:YES];
 }
 
+- (BOOL)isChunkedCompressedFormat {
+	return nv_is_chunked_compressed([self bytes], [self length]);
+}
 
 /*
- * Quick check of the data to avoid obviously-not-compressed data (see RFC)
+ * Quick check of the data to avoid obviously-not-compressed data (see RFC 1950)
  */
 - (BOOL)isCompressedFormat {
-	const unsigned char *bytes;
-	
-	bytes = [self bytes];
-	/*
-	 * The checks are:
-	 *    ( *bytes & 0x0F ) == 8           : method is deflate (this is called CM compression method, in the RFC)
-	 *    ( *bytes & 0x80 ) == 0           : info must be at most seven, this makes sure the MSB is not set, otherwise it
-	 *                                       is at least 8 (this is called CINFO, compression info, in the RFC)
-	 *    *( (short *) bytes ) ) % 31 == 0 : the two first bytes as a whole (big endian format) must be a multiple of 31
-	 *                                       (this is discussed in the FCHECK in FLG, flags, section)
-	 */
-	if( ( *bytes & 0x0F ) == 8 && ( *bytes & 0x80 ) == 0 &&
-		NSSwapBigShortToHost( *( (short *) bytes ) ) % 31 == 0 )
-		return YES;
-	
-	return NO;
+	return nv_is_zlib_compressed([self bytes], [self length]);
 }
 
 + (NSMutableData *)randomDataOfLength:(int)len {
@@ -183,8 +131,8 @@
 }
 
 - (unsigned long)CRC32 {
-	uLong crc = crc32(0L, Z_NULL, 0);
-    return crc32(crc, [self bytes], [self length]);
+	//the same checksum as zlib's crc32, several times faster
+    return nv_crc32_update(0, [self bytes], [self length]);
 }
 
 - (NSData*)SHA1Digest {
@@ -1,5 +0,0 @@
-@interface NSString (Markdown)
-
-+ (NSString*)stringWithProcessedMarkdown:(NSString*)inputString;
-
-@end
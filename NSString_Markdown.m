@@ -5,40 +5,23 @@
 
 #import "NSString_Markdown.h"
 #import "NoteObject.h"
+#include "MarkdownRenderer.h"
 
 @implementation NSString (Markdown)
 
 + (NSString*)stringWithProcessedMarkdown:(NSString*)inputString
 {
-	NSString* mdScriptPath = [[[[NSBundle mainBundle] resourcePath] stringByAppendingPathComponent:@"Markdown_1.0.1"] stringByAppendingPathComponent:@"Markdown.pl"];
+	//rendered in-process, so that each preview refresh no longer pays for launching perl and compiling Markdown.pl
+	NSData *inputData = [inputString dataUsingEncoding:NSUTF8StringEncoding];
+	size_t outputLength = 0;
+	char *output = MarkdownCopyXHTML([inputData bytes], [inputData length], &outputLength);
 	
-	NSTask* task = [[NSTask alloc] init];
-    NSMutableArray* args = [NSMutableArray array];
- 
-    [args addObject:mdScriptPath];
-    [task setArguments:args];
-	
-	NSPipe* stdinPipe = [NSPipe pipe];
-	NSPipe* stdoutPipe = [NSPipe pipe];
-	NSFileHandle* stdinFileHandle = [stdinPipe fileHandleForWriting];
-	NSFileHandle* stdoutFileHandle = [stdoutPipe fileHandleForReading];
-		
-	[task setStandardInput:stdinPipe];
-	[task setStandardOutput:stdoutPipe];
-	
-    [task setLaunchPath:@"/usr/bin/perl"];	
-    [task launch];
-	
-	[stdinFileHandle writeData:[inputString dataUsingEncoding:NSUTF8StringEncoding]];
-	[stdinFileHandle closeFile];
-	
-	NSData* outputData = [stdoutFileHandle readDataToEndOfFile];
-	NSString* outputString = [[[NSString alloc] initWithData:outputData encoding:NSUTF8StringEncoding] autorelease];
-	[stdoutFileHandle closeFile];
-
-	[task waitUntilExit];
-
-	return outputString;
+	NSString *outputString = [[NSString alloc] initWithBytesNoCopy:output length:outputLength encoding:NSUTF8StringEncoding freeWhenDone:YES];
+	if (!outputString) {
+		free(output);
+		return @"";
+	}
+	return [outputString autorelease];
 }
 
 @end
@@ -0,0 +1,23 @@
+//
+//  NSString_Markup.h
+//  Notation
+//
+//  the one way into every markup processor, whether it runs in-process (Markdown) or as a filter tool (MultiMarkdown, Textile)
+//
+
+#import <Cocoa/Cocoa.h>
+
+@interface NSString (Markup)
+
+//previewMode is MarkdownPreview, MultiMarkdownPreview or TextilePreview; nil for any other
++ (NSString*)stringWithProcessedMarkup:(NSString*)inputString previewMode:(NSInteger)previewMode;
++ (NSString*)documentWithProcessedMarkup:(NSString*)inputString previewMode:(NSInteger)previewMode;
++ (NSString*)xhtmlWithProcessedMarkup:(NSString*)inputString previewMode:(NSInteger)previewMode;
+
+//processedString embedded in the preview's HTML template and style sheet
++ (NSString*)documentWithProcessedString:(NSString*)processedString;
+
+//the output of the tool at launchPath given inputString on its standard input, as UTF-8 both ways
++ (NSString*)stringByFilteringString:(NSString*)inputString throughTool:(NSString*)launchPath arguments:(NSArray*)arguments;
+
+@end
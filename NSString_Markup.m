@@ -0,0 +1,89 @@
+//
+//  NSString_Markup.m
+//  Notation
+//
+
+#import "NSString_Markup.h"
+#import "NSString_Markdown.h"
+#import "NSString_MultiMarkdown.h"
+#import "NSString_Textile.h"
+#import "PreviewController.h"
+#import "AppController.h"
+#import "NSFileManager+DirectoryLocations.h"
+#import "NoteObject.h"
+
+@implementation NSString (Markup)
+
++ (NSString*)stringWithProcessedMarkup:(NSString*)inputString previewMode:(NSInteger)previewMode {
+	//Markdown is rendered in process, so that a refresh of its preview no longer launches a tool
+	if (previewMode == MarkdownPreview) {
+		return [self stringWithProcessedMarkdown:inputString];
+	} else if (previewMode == MultiMarkdownPreview) {
+		return [self stringWithProcessedMultiMarkdown:inputString];
+	} else if (previewMode == TextilePreview) {
+		return [self stringWithProcessedTextile:inputString];
+	}
+	return nil;
+}
+
++ (NSString*)documentWithProcessedMarkup:(NSString*)inputString previewMode:(NSInteger)previewMode {
+	if (previewMode == MarkdownPreview) {
+		return [self documentWithProcessedString:[self stringWithProcessedMarkdown:inputString]];
+	} else if (previewMode == MultiMarkdownPreview) {
+		return [self documentWithProcessedMultiMarkdown:inputString];
+	} else if (previewMode == TextilePreview) {
+		return [self documentWithProcessedTextile:inputString];
+	}
+	return nil;
+}
+
++ (NSString*)xhtmlWithProcessedMarkup:(NSString*)inputString previewMode:(NSInteger)previewMode {
+	if (previewMode == MarkdownPreview) {
+		return [self stringWithProcessedMarkdown:inputString];
+	} else if (previewMode == MultiMarkdownPreview) {
+		return [self xhtmlWithProcessedMultiMarkdown:inputString];
+	} else if (previewMode == TextilePreview) {
+		return [self xhtmlWithProcessedTextile:inputString];
+	}
+	return nil;
+}
+
++ (NSString*)documentWithProcessedString:(NSString*)processedString {
+	AppController *app = [[NSApplication sharedApplication] delegate];
+	NSMutableString *outputString = [NSMutableString stringWithString:[PreviewController html]];
+	NSString *noteTitle = [app selectedNoteObject] ? [NSString stringWithFormat:@"%@", titleOfNote([app selectedNoteObject])] : @"";
+	NSString *nvSupportPath = [[NSFileManager defaultManager] applicationSupportDirectory];
+	
+	[outputString replaceOccurrencesOfString:@"{%support%}" withString:nvSupportPath options:0 range:NSMakeRange(0, [outputString length])];
+	[outputString replaceOccurrencesOfString:@"{%title%}" withString:noteTitle options:0 range:NSMakeRange(0, [outputString length])];
+	[outputString replaceOccurrencesOfString:@"{%content%}" withString:processedString options:0 range:NSMakeRange(0, [outputString length])];
+	[outputString replaceOccurrencesOfString:@"{%style%}" withString:[PreviewController css] options:0 range:NSMakeRange(0, [outputString length])];
+	return outputString;
+}
+
++ (NSString*)stringByFilteringString:(NSString*)inputString throughTool:(NSString*)launchPath arguments:(NSArray*)arguments {
+	NSTask *task = [[[NSTask alloc] init] autorelease];
+	NSPipe *stdinPipe = [NSPipe pipe];
+	NSPipe *stdoutPipe = [NSPipe pipe];
+	NSFileHandle *stdinFileHandle = [stdinPipe fileHandleForWriting];
+	NSFileHandle *stdoutFileHandle = [stdoutPipe fileHandleForReading];
+	
+	[task setLaunchPath:launchPath];
+	[task setArguments:arguments ? arguments : [NSArray array]];
+	[task setStandardInput:stdinPipe];
+	[task setStandardOutput:stdoutPipe];
+	[task launch];
+	
+	[stdinFileHandle writeData:[inputString dataUsingEncoding:NSUTF8StringEncoding]];
+	[stdinFileHandle closeFile];
+	
+	NSData *outputData = [stdoutFileHandle readDataToEndOfFile];
+	NSString *outputString = [[[NSString alloc] initWithData:outputData encoding:NSUTF8StringEncoding] autorelease];
+	[stdoutFileHandle closeFile];
+	
+	[task waitUntilExit];
+	
+	return outputString;
+}
+
+@end
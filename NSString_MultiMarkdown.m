@@ -6,9 +6,7 @@
 //
 
 #import "NSString_MultiMarkdown.h"
-#import "PreviewController.h"
-#import "AppController.h"
-#import "NoteObject.h"
+#import "NSString_Markup.h"
 
 @implementation NSString (MultiMarkdown)
 
@@ -36,35 +34,7 @@
 
 +(NSString*)processTaskPaper:(NSString*)inputString
 {
-	NSString* mdScriptPath = [[self class] tp2mdDirectory];
-
-	NSTask* task = [[[NSTask alloc] init] autorelease];
-	NSMutableArray* args = [NSMutableArray array];
-	
-	[task setArguments:args];
-	
-	NSPipe* stdinPipe = [NSPipe pipe];
-	NSPipe* stdoutPipe = [NSPipe pipe];
-	NSFileHandle* stdinFileHandle = [stdinPipe fileHandleForWriting];
-	NSFileHandle* stdoutFileHandle = [stdoutPipe fileHandleForReading];
-	
-	[task setStandardInput:stdinPipe];
-	[task setStandardOutput:stdoutPipe];
-	
-	[task setLaunchPath: [mdScriptPath stringByExpandingTildeInPath]];
-	[task launch];
-	
-	[stdinFileHandle writeData:[inputString dataUsingEncoding:NSUTF8StringEncoding]];
-	[stdinFileHandle closeFile];
-	
-	NSData* outputData = [stdoutFileHandle readDataToEndOfFile];
-	NSString* outputString = [[[NSString alloc] initWithData:outputData encoding:NSUTF8StringEncoding] autorelease];
-	[stdoutFileHandle closeFile];
-	
-	[task waitUntilExit];
-	
-	return outputString;
-	
+	return [self stringByFilteringString:inputString throughTool:[[[self class] tp2mdDirectory] stringByExpandingTildeInPath] arguments:nil];
 }
 
 
@@ -75,52 +45,12 @@
   if (archiveFoundRange.location != NSNotFound || tagFoundRange.location != NSNotFound) {
     inputString = [self processTaskPaper:inputString];
   }
-	NSString* mdScriptPath = [[self class] mmdDirectory];
-//    NSString* tpScriptPath = [[self class] tp2mdDirectory];
-	NSTask* task = [[[NSTask alloc] init] autorelease];
-	NSMutableArray* args = [NSMutableArray array];
-	
-	[task setArguments:args];
-	
-	NSPipe* stdinPipe = [NSPipe pipe];
-	NSPipe* stdoutPipe = [NSPipe pipe];
-	NSFileHandle* stdinFileHandle = [stdinPipe fileHandleForWriting];
-	NSFileHandle* stdoutFileHandle = [stdoutPipe fileHandleForReading];
-	
-	[task setStandardInput:stdinPipe];
-	[task setStandardOutput:stdoutPipe];
-	
-	[task setLaunchPath: [mdScriptPath stringByExpandingTildeInPath]];
-	[task launch];
-	
-	[stdinFileHandle writeData:[inputString dataUsingEncoding:NSUTF8StringEncoding]];
-	[stdinFileHandle closeFile];
-	
-	NSData* outputData = [stdoutFileHandle readDataToEndOfFile];
-	NSString* outputString = [[[NSString alloc] initWithData:outputData encoding:NSUTF8StringEncoding] autorelease];
-	[stdoutFileHandle closeFile];
-	
-	[task waitUntilExit];
-	
-	return outputString;
-	
+	return [self stringByFilteringString:inputString throughTool:[[[self class] mmdDirectory] stringByExpandingTildeInPath] arguments:nil];
 }
 
 +(NSString*)documentWithProcessedMultiMarkdown:(NSString*)inputString
 {
-  AppController *app = [[NSApplication sharedApplication] delegate];
-  NSString *processedString = [self processMultiMarkdown:inputString];
-  NSString *htmlString = [[PreviewController class] html];
-  NSString *cssString = [[PreviewController class] css];
-  NSMutableString *outputString = [NSMutableString stringWithString:(NSString *)htmlString];
-  NSString *noteTitle =  ([app selectedNoteObject]) ? [NSString stringWithFormat:@"%@",titleOfNote([app selectedNoteObject])] : @"";
-		NSString *nvSupportPath = [[NSFileManager defaultManager] applicationSupportDirectory];
-
-  [outputString replaceOccurrencesOfString:@"{%support%}" withString:nvSupportPath options:0 range:NSMakeRange(0, [outputString length])];
-  [outputString replaceOccurrencesOfString:@"{%title%}" withString:noteTitle options:0 range:NSMakeRange(0, [outputString length])];
-  [outputString replaceOccurrencesOfString:@"{%content%}" withString:processedString options:0 range:NSMakeRange(0, [outputString length])];
-  [outputString replaceOccurrencesOfString:@"{%style%}" withString:cssString options:0 range:NSMakeRange(0, [outputString length])];
-  return outputString;
+	return [self documentWithProcessedString:[self processMultiMarkdown:inputString]];
 }
 
 +(NSString*)xhtmlWithProcessedMultiMarkdown:(NSString*)inputString
@@ -48,6 +48,7 @@ CFDateFormatterRef simplenoteDateFormatter(int lowPrecision);
 
 - (char*)copyLowercaseASCIIString;
 - (const char*)lowercaseUTF8String;
+- (const char*)collationKeyUTF8String;
 - (NSString*)stringWithPercentEscapes;
 - (NSString *)stringByReplacingPercentEscapes;
 - (BOOL)superficiallyResemblesAnHTTPURL;
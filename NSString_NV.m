@@ -499,6 +499,16 @@ BOOL IsHardLineBreakUnichar(unichar uchar, NSString *str, unsigned charIndex) {
 	return utf8String;
 }
 
+- (const char*)collationKeyUTF8String {
+	//decomposed and case-folded, so that comparing the bytes of two keys with strcmp orders them
+	//(nearly) as CFStringCompare with kCFCompareCaseInsensitive would, without redoing the Unicode work each time
+	CFMutableStringRef str2 = CFStringCreateMutableCopy(NULL, 0, (CFStringRef)self);
+	CFStringNormalize(str2, kCFStringNormalizationFormD);
+	CFStringFold(str2, kCFCompareCaseInsensitive, NULL);
+	
+	return [[(NSString*)str2 autorelease] UTF8String];
+}
+
 - (NSString *)stringByReplacingPercentEscapes {
     return [(NSString*) CFURLCreateStringByReplacingPercentEscapes(NULL, (CFStringRef) self, CFSTR("")) autorelease];
 }
@@ -4,7 +4,7 @@
 //
 
 #import "NSString_Textile.h"
-#import "PreviewController.h"
+#import "NSString_Markup.h"
 #import "AppController.h"
 #import "NoteObject.h"
 
@@ -14,52 +14,12 @@
 {
 	NSString* mdScriptPath = [[[[NSBundle mainBundle] resourcePath] stringByAppendingPathComponent:@"Textile_2.12"] stringByAppendingPathComponent:@"textilize.pl"];
 	
-	NSTask* task = [[NSTask alloc] init];
-    NSMutableArray* args = [NSMutableArray array];
-    
-    [args addObject:mdScriptPath];
-    [task setArguments:args];
-	
-	NSPipe* stdinPipe = [NSPipe pipe];
-	NSPipe* stdoutPipe = [NSPipe pipe];
-	NSFileHandle* stdinFileHandle = [stdinPipe fileHandleForWriting];
-	NSFileHandle* stdoutFileHandle = [stdoutPipe fileHandleForReading];
-    
-	[task setStandardInput:stdinPipe];
-	[task setStandardOutput:stdoutPipe];
-	
-    [task setLaunchPath:@"/usr/bin/perl"];	
-    [task launch];
-	
-	[stdinFileHandle writeData:[inputString dataUsingEncoding:NSUTF8StringEncoding]];
-	[stdinFileHandle closeFile];
-	
-	NSData* outputData = [stdoutFileHandle readDataToEndOfFile];
-	NSString* outputString = [[[NSString alloc] initWithData:outputData encoding:NSUTF8StringEncoding] autorelease];
-	[stdoutFileHandle closeFile];
-    
-	[task waitUntilExit];
-
-	return outputString;
+	return [self stringByFilteringString:inputString throughTool:@"/usr/bin/perl" arguments:[NSArray arrayWithObject:mdScriptPath]];
 }
 
 +(NSString*)documentWithProcessedTextile:(NSString*)inputString
 {
-    AppController *app = [[NSApplication sharedApplication] delegate];
-    NSString *processedString = [self processTextile:inputString];
-	NSString *htmlString = [[PreviewController class] html];
-	NSString *cssString = [[PreviewController class] css];
-	NSMutableString *outputString = [NSMutableString stringWithString:(NSString *)htmlString];
-	NSString *noteTitle =  ([app selectedNoteObject]) ? [NSString stringWithFormat:@"%@",titleOfNote([app selectedNoteObject])] : @"";
-		
-		NSString *nvSupportPath = [[NSFileManager defaultManager] applicationSupportDirectory];
-
-	[outputString replaceOccurrencesOfString:@"{%support%}" withString:nvSupportPath options:0 range:NSMakeRange(0, [outputString length])];
-	[outputString replaceOccurrencesOfString:@"{%title%}" withString:noteTitle options:0 range:NSMakeRange(0, [outputString length])];
-	[outputString replaceOccurrencesOfString:@"{%content%}" withString:processedString options:0 range:NSMakeRange(0, [outputString length])];
-	[outputString replaceOccurrencesOfString:@"{%style%}" withString:cssString options:0 range:NSMakeRange(0, [outputString length])];
-	
-	return outputString;
+	return [self documentWithProcessedString:[self processTextile:inputString]];
 }
 
 +(NSString*)xhtmlWithProcessedTextile:(NSString*)inputString
@@ -20,6 +20,10 @@
 #import "FastListDataSource.h"
 #import "LabelsListController.h"
 #import "WALController.h"
+#import "NoteRecordStore.h"
+#import "TrigramIndex.h"
+#import "AhoCorasick.h"
+#import "TitlePrefixTrie.h"
 
 #import <CoreServices/CoreServices.h>
 
@@ -55,6 +59,9 @@ typedef struct _NoteCatalogEntry {
 	id delegate;
 	
 	float titleColumnWidth;
+	//notes' table previews are current only if they were made for this key; see tablePreviewOfNote()
+	uint32_t tablePreviewKey, tablePreviewGeneration;
+	NSRange previewPrefetchRows;
 	NoteAttributeColumn* sortColumn;
 	
     NoteObject **allNotesBuffer;
@@ -63,8 +70,28 @@ typedef struct _NoteCatalogEntry {
     NSUInteger selectedNoteIndex;
     char *currentFilterStr, *manglingString;
     NSInteger lastWordInFilterStr;
+	
+	TrigramIndex *searchIndex;
+	//notes added or changed since they were last indexed, consumed a limited number at a time by -updateSearchIndex
+	NSMutableSet *notesNeedingSearchIndex;
+	uint8_t *candidateDocs;
+	size_t candidateDocsSize;
+	//the automaton for the words last searched for, kept for as long as the same words are searched again
+	ACAutomaton *searchMatcher;
+	//the string being searched for in the background, if any; searches check searchGeneration to learn they were superseded
+	char *backgroundSearchStr;
+	volatile int32_t searchGeneration;
+	//the titles of all notes, for auto-completion; built when first needed and then kept current
+	TitlePrefixTrie *titlePrefixTrie;
     
 	BOOL directoryChangesFound;
+	//notes created from new files during the current directory sync, to be filed into the list in place
+	NSMutableArray *notesAddedFromDirectory;
+	//case-folded filename -> note and file node ID -> note, kept current as notes are added, renamed and removed
+	//so that the contents of the notes directory can be matched to notes without sorting either
+	CFMutableDictionaryRef notesByFilenameKey, notesByNodeID;
+	//service name -> index of the sync keys of all notes for that service, built when first needed
+	NSMutableDictionary *syncKeyIndexes;
     
     NotationPrefs *notationPrefs;
 	
@@ -79,7 +106,12 @@ typedef struct _NoteCatalogEntry {
     FNSubscriptionRef noteDirSubscription;	
 #endif
 	FSEventStreamRef noteDirEventStreamRef;
-	BOOL eventStreamStarted;
+	BOOL eventStreamStarted, eventStreamReportsFiles, directoryNeedsFullScan;
+	//names of the files in the notes directory that FSEvents has reported changed since they were last read
+	NSMutableSet *changedDirectoryFilenames;
+	FSEventStreamEventId lastDirectoryEventID;
+	CFUUIDRef directoryEventsUUID;
+	char *eventStreamPath;
 	    
     size_t catEntriesCount, totalCatEntriesCount;
     NoteCatalogEntry *catalogEntries, **sortedCatalogEntries;
@@ -93,9 +125,12 @@ typedef struct _NoteCatalogEntry {
     FSRef noteDirectoryRef, noteDatabaseRef;
     AliasHandle aliasHandle;
     BOOL aliasNeedsUpdating;
-    OSStatus lastWriteError;
+    OSStatus lastWriteError, lastReadError;
+	//titles of the notes whose bodies couldn't be read since they were last reported
+	NSMutableArray *unreadableNoteTitles;
     
     WALStorageController *walWriter;
+    NoteRecordStore *recordStore;
     NSMutableSet *unwrittenNotes;
 	BOOL notesChanged;
 	NSTimer *changeWritingTimer;
@@ -117,6 +152,8 @@ typedef struct _NoteCatalogEntry {
 - (void)closeJournal;
 - (BOOL)flushAllNoteChanges;
 - (void)flushEverything;
+- (void)releaseUnusedNoteBodies;
+- (void)logMemoryUsage;
 
 - (void)upgradeDatabaseIfNecessary;
 
@@ -132,16 +169,22 @@ typedef struct _NoteCatalogEntry {
 - (void)updateDateStringsIfNecessary;
 - (void)makeForegroundTextColorMatchGlobalPrefs;
 - (void)setForegroundTextColor:(NSColor*)aColor;
+- (NSColor*)foregroundTextColor;
 - (void)restyleAllNotes;
 - (void)setUndoManager:(NSUndoManager*)anUndoManager;
 - (NSUndoManager*)undoManager;
 - (void)noteDidNotWrite:(NoteObject*)note errorCode:(OSStatus)error;
+- (void)noteBodyCouldNotBeRead:(NoteObject*)note error:(OSStatus)err;
 - (void)scheduleWriteForNote:(NoteObject*)note;
+- (void)invalidateStoredRecordForNote:(NoteObject*)note;
 - (void)closeAllResources;
 - (void)trashRemainingNoteFilesInDirectory;
 - (void)checkIfNotationIsTrashed;
 - (void)updateLinksToNote:(NoteObject*)aNoteObject fromOldName:(NSString*)oldname;
 - (void)updateTitlePrefixConnections;
+- (void)invalidateTitlePrefixConnections;
+- (void)updateTitlePrefixConnectionsForNote:(NoteObject*)note;
+- (void)removeNoteFromTitlePrefixConnections:(NoteObject*)note;
 - (void)addNotes:(NSArray*)noteArray;
 - (void)addNotesFromSync:(NSArray*)noteArray;
 - (void)addNewNote:(NoteObject*)aNoteObject;
@@ -153,6 +196,7 @@ typedef struct _NoteCatalogEntry {
 - (DeletedNoteObject*)_addDeletedNote:(id<SynchronizedNote>)aNote;
 - (void)_registerDeletionUndoForNote:(NoteObject*)aNote;
 - (NoteObject*)addNoteFromCatalogEntry:(NoteCatalogEntry*)catEntry;
+- (NoteObject*)addNoteFromCatalogEntry:(NoteCatalogEntry*)catEntry decodedContents:(NSMutableAttributedString*)decodedString encoding:(NSStringEncoding)encoding;
 
 - (BOOL)openFiles:(NSArray*)filenames;
 
@@ -163,9 +207,21 @@ typedef struct _NoteCatalogEntry {
 - (void)filterNotesFromLabelIndexSet:(NSIndexSet*)indexSet;
 - (void)updateLabelConnectionsAfterDecoding;
 
+- (void)scheduleSearchIndexUpdate;
+- (void)updateSearchIndex;
+- (void)invalidateSearchIndex;
+- (void)removeNoteFromSearchIndex:(NoteObject*)note;
+
 - (void)refilterNotes;
 - (BOOL)filterNotesFromString:(NSString*)string;
 - (BOOL)filterNotesFromUTF8String:(const char*)searchString forceUncached:(BOOL)forceUncached;
+- (BOOL)searchesInBackground;
+- (void)filterNotesInBackgroundFromString:(NSString*)string;
+- (void)cancelBackgroundSearch;
+- (BOOL)_restartBackgroundSearchIfNecessary;
+- (void)_startBackgroundSearch;
+- (ACAutomaton*)_retainedMatcherForTokens:(char**)tokens count:(NSUInteger)tokenCount;
+- (void)_selectNoteWithTitlePrefixOfUTF8String:(const char*)searchString length:(size_t)newLen;
 - (NSUInteger)preferredSelectedNoteIndex;
 - (NSArray*)noteTitlesPrefixedByString:(NSString*)prefixString indexOfSelectedItem:(NSInteger *)anIndex;
 - (NoteObject*)noteObjectAtFilteredIndex:(int)noteIndex;
@@ -178,11 +234,15 @@ typedef struct _NoteCatalogEntry {
 - (NoteAttributeColumn*)sortColumn;
 - (void)setSortColumn:(NoteAttributeColumn*)col;
 - (void)resortAllNotes;
+- (void)insertAddedNotesInPlace:(NSArray*)addedNotes;
 - (void)sortAndRedisplayNotes;
 
 - (float)titleColumnWidth;
 - (void)regeneratePreviewsForColumn:(NSTableColumn*)col visibleFilteredRows:(NSRange)rows forceUpdate:(BOOL)force;
 - (void)regenerateAllPreviews;
+- (uint32_t)tablePreviewKey;
+- (void)_updateTablePreviewKey;
+- (void)_prefetchTablePreviews;
 
 //for setting up the nstableviews
 - (id)labelsListDataSource;
@@ -205,6 +265,8 @@ enum { NVDefaultReveal = 0, NVDoNotChangeScrollPosition = 1, NVOrderFrontWindow
 - (BOOL)notationListShouldChange:(NotationController*)someNotation;
 - (void)notationListMightChange:(NotationController*)someNotation;
 - (void)notationListDidChange:(NotationController*)someNotation;
+- (void)notationWillPublishBackgroundSearchResults:(NotationController*)someNotation;
+- (void)notation:(NotationController*)someNotation didPublishBackgroundSearchResultsFinal:(BOOL)isFinal;
 - (void)notation:(NotationController*)notation revealNote:(NoteObject*)note options:(NSUInteger)opts;
 - (void)notation:(NotationController*)notation revealNotes:(NSArray*)notes;
 
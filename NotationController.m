@@ -42,6 +42,23 @@
 #import "BookmarksController.h"
 #import "DeletionManager.h"
 #import "nvaDevConfig.h"
+#include <libkern/OSAtomic.h>
+
+//beyond this many notes added at once, a full resort is no slower than filing each into place
+#define kMaxNotesToInsertInPlace 64
+//how many of a note's prefix parents to consider when auto-completing to one of them
+#define kMaxPrefixParents 32
+//below this many notes, searching as the user types is fast enough to do on the main thread
+#define kMinNotesToSearchInBackground 4000
+//how long to wait for another keystroke before starting a background search
+#define kBackgroundSearchDelay 0.05
+//matches found before the rest of a background search finishes, enough to fill the top of the table
+#define kSearchScreenfulCount 50
+//notes captured on the main thread per pass of the run loop, each then scanned as one block on another core
+#define kBackgroundSearchSliceCount 1024
+//previews made ahead of time for the rows just past those visible, a few at a time while the run loop is idle
+#define kPreviewPrefetchRowCount 200
+#define kPreviewPrefetchBatchSize 20
 
 @implementation NotationController
 
@@ -51,6 +68,10 @@
 		
 		allNotes = [[NSMutableArray alloc] init]; //<--the authoritative list of all memory-accessible notes
 		deletedNotes = [[NSMutableSet alloc] init];
+		notesAddedFromDirectory = [[NSMutableArray alloc] init];
+		notesByFilenameKey = notesByNodeID = NULL;
+		changedDirectoryFilenames = [[NSMutableSet alloc] init];
+		directoryNeedsFullScan = YES;
 		labelsListController = [[LabelsListController alloc] init];
 		prefsController = [GlobalPrefs defaultPrefs];
 		notesListDataSource = [[FastListDataSource alloc] init];
@@ -58,9 +79,15 @@
 		
 		allNotesBuffer = NULL;
 		allNotesBufferSize = 0;
-		manglingString = currentFilterStr = NULL;
+		manglingString = currentFilterStr = backgroundSearchStr = NULL;
 		lastWordInFilterStr = 0;
+		searchGeneration = 0;
 		selectedNoteIndex = NSNotFound;
+		searchIndex = TrigramIndexCreate();
+		notesNeedingSearchIndex = [[NSMutableSet alloc] init];
+		[self _updateTablePreviewKey];
+		candidateDocs = NULL;
+		candidateDocsSize = 0;
 		
 		fsCatInfoArray = NULL;
 		HFSUniNameArray = NULL;
@@ -80,8 +107,9 @@
 		lastCheckedDateInHours = hoursFromAbsoluteTime(CFAbsoluteTimeGetCurrent());
 		blockSize = 0;
 		
-		lastWriteError = noErr;
+		lastWriteError = lastReadError = noErr;
 		unwrittenNotes = [[NSMutableSet alloc] init];
+		unreadableNoteTitles = [[NSMutableArray alloc] init];
     }
     return self;
 }
@@ -156,6 +184,7 @@
 		[self upgradeDatabaseIfNecessary];
 		
 		[self updateTitlePrefixConnections];
+		[self scheduleSearchIndexUpdate];
     }
     
     return self;
@@ -204,6 +233,7 @@
 		
 		if (epochIteration < EPOC_ITERATION) {
 			NSLog(@"epochIteration was upgraded from %u to %u", epochIteration, EPOC_ITERATION);
+			[recordStore invalidateAllRecords];
 			notesChanged = YES;
 			[self flushEverything];
 		} else if ([notationPrefs epochIteration] > EPOC_ITERATION) {
@@ -216,7 +246,7 @@
 }
 
 //used to ensure a newly-written Notes & Settings file is valid before finalizing the save
-//read the file back from disk, deserialize it, decrypt and decompress it, and compare the notes roughly to our current notes
+//read the file back from disk, deserialize it, and check its record index against our current notes, reading back any newly-written records
 - (NSNumber*)verifyDataAtTemporaryFSRef:(NSValue*)fsRefValue withFinalName:(NSString*)filename {
 	
 	NSDate *date = [NSDate date];
@@ -243,28 +273,20 @@
 		result = kCoderErr;
 		goto returnResult;
 	}
-	//unpack notes using the current NotationPrefs instance (not the just-unarchived one), with which we presumably just used to encrypt it
-	NSMutableArray *notesToVerify = [[frozenNotation unpackedNotesWithPrefs:notationPrefs returningError:&err] retain];	
-	if (noErr != err) {
+	//the records were written with the current NotationPrefs instance, so the record store can decrypt them as-is
+	if ((err = [recordStore verifyIndexData:[frozenNotation recordIndex] againstNotes:allNotes]) != noErr) {
 		result = err;
 		goto returnResult;
 	}
-	//notes were unpacked--now roughly compare notesToVerify with allNotes, plus deletedNotes and notationPrefs
-	if (!notesToVerify || [notesToVerify count] != [allNotes count] || [[frozenNotation deletedNotes] count] != [deletedNotes  count] || 
+	//index was checked--now roughly compare deletedNotes and notationPrefs
+	if ([[frozenNotation deletedNotes] count] != [deletedNotes  count] || 
 		[[frozenNotation notationPrefs] notesStorageFormat] != [notationPrefs notesStorageFormat] ||
 		[[frozenNotation notationPrefs] hashIterationCount] != [notationPrefs hashIterationCount]) {
 		result = kItemVerifyErr;
 		goto returnResult;
 	}
-	unsigned int i;
-	for (i=0; i<[notesToVerify count]; i++) {
-		if ([[[notesToVerify objectAtIndex:i] contentString] length] != [[[allNotes objectAtIndex:i] contentString] length]) {
-			result = kItemVerifyErr;
-			goto returnResult;
-		}
-	}
 	
-	NSLog(@"verified %lu notes in %g s", [notesToVerify count], (float)[[NSDate date] timeIntervalSinceDate:date]);
+	NSLog(@"verified %lu notes in %g s", [allNotes count], (float)[[NSDate date] timeIntervalSinceDate:date]);
 returnResult:
 	if (notesData) free(notesData);
 	return [NSNumber numberWithInt:result];
@@ -312,12 +334,31 @@ returnResult:
 	//which will be used to determine which attr-mod-time to use for each note after decoding
 	[self initializeDiskUUIDIfNecessary];
 	
+	//the note records live alongside the database file
+	const UInt32 maxPathSize = 8 * 1024;
+	UInt8 *convertedPath = (UInt8*)malloc(maxPathSize * sizeof(UInt8));
+	if ((err = FSRefMakePath(&noteDirectoryRef, convertedPath, maxPathSize)) != noErr) {
+		NSLog(@"FSRefMakePath error: %d", err);
+		free(convertedPath);
+		if (notesData)
+			free(notesData);
+		return err;
+	}
+	[recordStore release];
+	recordStore = [[NoteRecordStore alloc] initWithParentFSRep:(char*)convertedPath notationPrefs:notationPrefs];
+	[recordStore setDelegate:self];
+	free(convertedPath);
+	
 	[allNotes release];
+	[self invalidateFileIndexes];
+	[self invalidateSyncKeyIndexes];
+	[self invalidateTitlePrefixConnections];
+	[self invalidateSearchIndex];
 	
 	syncSessionController = [[SyncSessionController alloc] initWithSyncDelegate:self notationPrefs:notationPrefs];
 	
 	//frozennotation will work out passwords, keychains, decryption, etc...
-	if (!(allNotes = [[frozenNotation unpackedNotesReturningError:&err] retain])) {
+	if (!(allNotes = [[frozenNotation unpackedNotesFromRecordStore:recordStore returningError:&err] retain])) {
 		//notes could be nil because the user cancelled password authentication
 		//or because they were corrupted, or for some other reason
 		if (err != noErr)
@@ -326,6 +367,11 @@ returnResult:
 		allNotes = [[NSMutableArray alloc] init];
 	} else {
 		[allNotes makeObjectsPerformSelector:@selector(setDelegate:) withObject:self];
+		[notesNeedingSearchIndex addObjectsFromArray:allNotes];
+		
+		//move a database from before the record store into it at the next flush
+		if (![frozenNotation recordIndex])
+			notesChanged = YES;
 	}
 	
 	[deletedNotes release];
@@ -401,7 +447,7 @@ returnResult:
 						//this allows for an ever-growing journal in the case of broken database serialization
 						//it should not be an acceptable condition for permanent use; hopefully an update would come soon
 						//warn the user, perhaps
-						[walWriter writeNoteObjects:[recoveredNotes allValues]];
+						[walWriter writeNoteObjects:[recoveredNotes allValues] failedNotes:nil];
 					}
 					[self refilterNotes];
 				}
@@ -452,6 +498,10 @@ bail:
 						NSLog(@"got a newer deleted note %@", obj);
 						//except that normally the undomanager doesn't exist by this point			
 						[self _registerDeletionUndoForNote:existingNote];
+						[self removeNoteFromFileIndexes:existingNote];
+						[self removeNoteFromSyncKeyIndexes:existingNote];
+						[self removeNoteFromTitlePrefixConnections:existingNote];
+						[self removeNoteFromSearchIndex:existingNote];
 						[allNotes removeObjectAtIndex:existingNoteIndex];
 						//try to use use the deleted note object instead of allowing _addDeletedNote: to make a new one, to preserve any changes to the syncMD
 						[self _addDeletedNote:obj];
@@ -473,6 +523,7 @@ bail:
 					[(NoteObject*)obj setDelegate:self];
 					[(NoteObject*)obj updateLabelConnectionsAfterDecoding];
 					[allNotes replaceObjectAtIndex:existingNoteIndex withObject:obj];
+					[recordStore invalidateRecordForNote:obj];
 					notesChanged = YES;
 				} else {
 					// NSLog(@"note %@ is not being replaced because its LSN is %u, while the old note's LSN is %u", 
@@ -543,7 +594,14 @@ bail:
 		[self purgeOldPerDiskInfoFromNotes];
 		
 		
-		NSData *serializedData = [FrozenNotation frozenDataWithExistingNotes:allNotes deletedNotes:deletedNotes prefs:notationPrefs];
+		//append records only for notes that changed since the last flush
+		if (![recordStore writeRecordsForNotes:allNotes]) {
+			
+			NSLog(@"couldn't write note records!");
+			return NO;
+		}
+		
+		NSData *serializedData = [FrozenNotation frozenDataWithRecordIndex:[recordStore indexDataForNotes:allNotes] deletedNotes:deletedNotes prefs:notationPrefs];
 		if (!serializedData) {
 			
 			NSLog(@"serialized data is nil!");
@@ -555,14 +613,72 @@ bail:
 								   verifyWithSelector:@selector(verifyDataAtTemporaryFSRef:withFinalName:) verificationDelegate:self] != noErr)
 			return NO;
 		
+		[recordStore indexWasCommitted];
 		[notationPrefs setPreferencesAreStored];
 		notesChanged = NO;
 		
+		//the notes just written can now be read back from their records
+		[self releaseUnusedNoteBodies];
     }
 	
     return YES;
 }
 
+- (void)releaseUnusedNoteBodies {
+	//bodies that haven't changed since their records were written are left in the record store until they are next needed,
+	//so that each note keeps only its search cache in memory; the note being edited keeps its body, as do notes with undo actions
+	NoteObject *openNote = [delegate respondsToSelector:@selector(selectedNoteObject)] ? [delegate selectedNoteObject] : nil;
+	NSUInteger i, releasedCount = 0;
+	
+	for (i=0; i<[allNotes count]; i++) {
+		NoteObject *note = [allNotes objectAtIndex:i];
+		if (note == openNote || ![note canReleaseContentString])
+			continue;
+		
+		NoteRecordBody *body = [recordStore copyStoredBodyOfNote:note];
+		if (body) {
+			[note releaseContentStringForBody:body];
+			[body release];
+			releasedCount++;
+		}
+	}
+	
+	//runs at every flush and deactivation, so it is quiet unless asked for with "defaults write net.elasticthreads.nv LogNoteMemoryUsage -bool YES"
+	if ([[NSUserDefaults standardUserDefaults] boolForKey:@"LogNoteMemoryUsage"]) {
+		if (releasedCount) {
+			NSLog(@"released the bodies of %lu notes", (unsigned long)releasedCount);
+			[self logMemoryUsage];
+		}
+		
+		//a restyled body is kept only until its record is written again, so one whose record is current should have been released
+		NSUInteger keptCount = 0;
+		for (i=0; i<[allNotes count]; i++) {
+			NoteObject *note = [allNotes objectAtIndex:i];
+			NoteRecordBody *body = note != openNote && [note bodyWasRestyled] ? [recordStore copyStoredBodyOfNote:note] : nil;
+			if (body) {
+				[body release];
+				keptCount++;
+			}
+		}
+		if (keptCount)
+			NSLog(@"the restyled bodies of %lu notes were kept although their records were current", (unsigned long)keptCount);
+	}
+}
+
+- (void)logMemoryUsage {
+	NoteMemoryUsage usage;
+	bzero(&usage, sizeof(usage));
+	
+	NSUInteger i;
+	for (i=0; i<[allNotes count]; i++) {
+		addMemoryUsageOfNote([allNotes objectAtIndex:i], &usage);
+	}
+	
+	NSLog(@"memory used by %lu notes: bodies %lu KB (%lu in memory, %lu stored), search caches %lu KB, previews %lu KB (%lu)",
+		  (unsigned long)usage.noteCount, (unsigned long)(usage.bodyBytes / 1024), (unsigned long)usage.bodyCount, (unsigned long)usage.storedBodyCount,
+		  (unsigned long)(usage.searchCacheBytes / 1024), (unsigned long)(usage.previewBytes / 1024), (unsigned long)usage.previewCount);
+}
+
 - (void)handleJournalError {
     
     //we can be static because the resulting action (exit) is global to the app
@@ -585,6 +701,10 @@ bail:
 
 //notation prefs delegate method
 - (void)databaseEncryptionSettingsChanged {
+	//every note must be stored again under the new settings
+	[recordStore encryptionSettingsChanged];
+	notesChanged = YES;
+	
 	//we _must_ re-init the journal (if fmt is single-db and jrnl exists) in addition to flushing DB
 	[self flushEverything];
 	
@@ -613,8 +733,10 @@ bail:
 		//otherwise it would be necessary to set notesChanged = YES; after this method
 		
 		//also make sure not to write new notes unless changing to a different format; don't rewrite deleted notes upon launch
-		if (currentStorageFormat != oldFormat)
+		if (currentStorageFormat != oldFormat) {
 			[allNotes makeObjectsPerformSelector:@selector(writeUsingCurrentFileFormatIfNonExistingOrChanged)];
+			[recordStore invalidateAllRecords];
+		}
 
 		//flush and close the journal if necessary
 		/*if (walWriter) {
@@ -625,12 +747,19 @@ bail:
 		
 		[self startFileNotifications];
 		
-		[self synchronizeNotesFromDirectory];
+		[self synchronizeChangedNotesFromDirectory];
     }
 	//perform after delay because this could trigger the mounting of a RAM disk in a background  NSTask
 	[[ODBEditor sharedODBEditor] performSelector:@selector(initializeDatabase:) withObject:notationPrefs afterDelay:0.0];
 }
 
+//record store delegate method
+- (void)noteRecordStoreDidCompact:(NoteRecordStore*)store {
+	//the old segment can be removed only once the database refers to the compacted one
+	notesChanged = YES;
+	[self flushAllNoteChanges];
+}
+
 - (int)currentNoteStorageFormat {
     return [notationPrefs notesStorageFormat];
 }
@@ -647,8 +776,39 @@ bail:
     }
 }
 
+- (void)noteBodyCouldNotBeRead:(NoteObject*)note error:(OSStatus)err {
+	//reported together once the current event is done, as a damaged segment can fail the reads of many notes at once
+	if (![unreadableNoteTitles count])
+		[self performSelector:@selector(_reportUnreadableNotes) withObject:nil afterDelay:0.0];
+	
+	[unreadableNoteTitles addObject:titleOfNote(note)];
+	lastReadError = err;
+}
+
+- (void)_reportUnreadableNotes {
+	if (![unreadableNoteTitles count])
+		return;
+	
+	NSRunAlertPanel([NSString stringWithFormat:NSLocalizedString(@"The text of %u note(s) could not be read because %@.",
+																 @"alert title appearing when note bodies couldn't be read"), 
+		(unsigned int)[unreadableNoteTitles count], [NSString reasonStringFromCarbonFSError:lastReadError]], 
+					@"%@", NSLocalizedString(@"OK",nil), NULL, NULL, 
+					[NSString stringWithFormat:NSLocalizedString(@"These notes will appear empty, and their stored text will be kept as it is until it is replaced: %@", nil), 
+					 [unreadableNoteTitles componentsJoinedByString:@", "]]);
+	
+	[unreadableNoteTitles removeAllObjects];
+}
+
 - (void)synchronizeNoteChanges:(NSTimer*)timer {
     
+	//notes whose bodies couldn't be read keep their records as they are; written anywhere else, they would have lost their bodies
+	NSEnumerator *enumerator = [[unwrittenNotes allObjects] objectEnumerator];
+	NoteObject *unwrittenNote = nil;
+	while ((unwrittenNote = [enumerator nextObject])) {
+		if (![unwrittenNote hasReadableBody])
+			[unwrittenNotes removeObject:unwrittenNote];
+	}
+	
     if ([unwrittenNotes count] > 0) {
 		lastWriteError = noErr;
 		if ([notationPrefs notesStorageFormat] != SingleDatabaseFormat) {
@@ -659,15 +819,26 @@ bail:
 			//this always seems to call ourselves
 			FNNotify(&noteDirectoryRef, kFNDirectoryModifiedMessage, kFNNoImplicitAllSubscription);
 		}
+		NSMutableArray *failedNotes = [NSMutableArray array];
 		if (walWriter) {
 			//append unwrittenNotes to journal, if one exists
-			[unwrittenNotes makeObjectsPerformSelector:@selector(writeUsingJournal:) withObject:walWriter];
+			if ([unwrittenNotes count] > 1) {
+				//many notes changed at once (e.g., by syncing or importing), so group-commit them with a single write and fsync
+				[walWriter writeEstablishedNotes:[unwrittenNotes allObjects] failedNotes:failedNotes];
+			} else {
+				[unwrittenNotes makeObjectsPerformSelector:@selector(writeUsingJournal:) withObject:walWriter];
+			}
 		}
 				
 		//NSLog(@"wrote %d unwritten notes", [unwrittenNotes count]);
 		
 		[unwrittenNotes removeAllObjects];
 		
+		//only the notes of records that didn't make it to disk stay unwritten, to be tried again at the next flush
+		NSUInteger i;
+		for (i=0; i<[failedNotes count]; i++)
+			[self noteDidNotWrite:[failedNotes objectAtIndex:i] errorCode:kWriteJournalErr];
+		
 		[self scheduleUpdateListForAttribute:NoteDateModifiedColumnString];
 
     }
@@ -749,42 +920,47 @@ bail:
 }
 
 - (void)updateLinksToNote:(NoteObject*)aNoteObject fromOldName:(NSString*)oldname {
+	[self removeNote:aNoteObject fromFileIndexesWithFilename:oldname];
+	[self addNoteToFileIndexes:aNoteObject];
+	
     //O(n)
 }
 
 - (void)updateTitlePrefixConnections {
 	//used to auto-complete titles to the first, shortest title of the same prefix--
 	//to prevent auto-completing "Chicago Brauhaus" before "Chicago" when search string is "Chi", for example.
-	//builds a tree-overlay in the list of notes, to find, for any given note, 
-	//all other notes whose complete titles are a prefix of it
-	
-	//***
-	//*** this method must run after any note is added, deleted, or retitled **
-	//***
+	//the trie finds, for any given note, all other notes whose complete titles are a prefix of it;
+	//once built it is kept current as notes are added, removed and retitled, so calling this again costs nothing
 	
-	if (![prefsController autoCompleteSearches] || ![allNotes count])
+	if (![prefsController autoCompleteSearches]) {
+		[self invalidateTitlePrefixConnections];
+		return;
+	}
+	if (titlePrefixTrie)
 		return;
 	
-	//sort alphabetically to find shorter prefixes first
-	NSMutableArray *allNotesAlpha = [allNotes mutableCopy];
-	[allNotesAlpha sortStableUsingFunction:compareTitleString usingBuffer:&allNotesBuffer ofSize:&allNotesBufferSize];
-	[allNotes makeObjectsPerformSelector:@selector(removeAllPrefixParentNotes)];
-
-	NSUInteger j, i = 0, count = [allNotesAlpha count];
-	for (i=0; i<count - 1; i++) {
-		NoteObject *shorterNote = [allNotesAlpha objectAtIndex:i];
-		BOOL isAPrefix = NO;
-		//scan all notes sorted beneath this one for matching prefixes
-		j = i + 1;
-		do {
-			NoteObject *longerNote = [allNotesAlpha objectAtIndex:j];
-			if ((isAPrefix = noteTitleIsAPrefixOfOtherNoteTitle(longerNote, shorterNote))) {
-				[longerNote addPrefixParentNote:shorterNote];
-			}
-		} while (isAPrefix && ++j<count);
+	titlePrefixTrie = TitlePrefixTrieCreate();
+	
+	NSUInteger i, count = [allNotes count];
+	for (i=0; i<count; i++)
+		updateTitlePrefixTrieForNote([allNotes objectAtIndex:i], titlePrefixTrie);
+}
+
+- (void)invalidateTitlePrefixConnections {
+	if (titlePrefixTrie) {
+		TitlePrefixTrieFree(titlePrefixTrie);
+		titlePrefixTrie = NULL;
 	}
+}
+
+- (void)updateTitlePrefixConnectionsForNote:(NoteObject*)note {
+	if (titlePrefixTrie)
+		updateTitlePrefixTrieForNote(note, titlePrefixTrie);
+}
 
-	[allNotesAlpha release];
+- (void)removeNoteFromTitlePrefixConnections:(NoteObject*)note {
+	if (titlePrefixTrie)
+		TitlePrefixTrieRemoveValue(titlePrefixTrie, note);
 }
 
 - (void)addNewNote:(NoteObject*)note {
@@ -811,20 +987,24 @@ bail:
 			[undoManager setActionName:[NSString stringWithFormat:NSLocalizedString(@"Create Note quotemark%@quotemark",@"undo action name for creating a single note"), titleOfNote(note)]];
 	}
     
-	[self resortAllNotes];
-    [self refilterNotes];
+	[self insertAddedNotesInPlace:[NSArray arrayWithObject:note]];
     
     [delegate notation:self revealNote:note options:NVEditNoteToReveal | NVOrderFrontWindow];	
 }
 
 //do not update the view here (why not?)
 - (NoteObject*)addNoteFromCatalogEntry:(NoteCatalogEntry*)catEntry {
-	NoteObject *newNote = [[NoteObject alloc] initWithCatalogEntry:catEntry delegate:self];
+	return [self addNoteFromCatalogEntry:catEntry decodedContents:nil encoding:0];
+}
+
+- (NoteObject*)addNoteFromCatalogEntry:(NoteCatalogEntry*)catEntry decodedContents:(NSMutableAttributedString*)decodedString encoding:(NSStringEncoding)encoding {
+	NoteObject *newNote = [[NoteObject alloc] initWithCatalogEntry:catEntry decodedContents:decodedString encoding:encoding delegate:self];
 	[self _addNote:newNote];
 	[newNote release];
 	
 	[self schedulePushToAllSyncServicesForNote:newNote];
 	
+	[notesAddedFromDirectory addObject:newNote];
 	directoryChangesFound = YES;
 	
 	return newNote;
@@ -855,8 +1035,7 @@ bail:
 	
 	[self synchronizeNoteChanges:nil];
 		
-	[self resortAllNotes];
-	[self refilterNotes];
+	[self insertAddedNotesInPlace:noteArray];
 }
 
 - (void)addNotes:(NSArray*)noteArray {
@@ -886,8 +1065,7 @@ bail:
 		if (! [[self undoManager] isUndoing] && ! [[self undoManager] isRedoing])
 			[undoManager setActionName:[NSString stringWithFormat:NSLocalizedString(@"Add %d Notes", @"undo action name for creating multiple notes"), [noteArray count]]];	
 	}
-	[self resortAllNotes];
-	[self refilterNotes];
+	[self insertAddedNotesInPlace:noteArray];
 	
 	if ([noteArray count] > 1)
 		[delegate notation:self revealNotes:noteArray];
@@ -915,8 +1093,8 @@ bail:
 	if ([attribute isEqualToString:NoteTitleColumnString]) {
 		[delegate titleUpdatedForNote:note];
 		
-		//also update notationcontroller's psuedo-prefix tree for autocompletion
-		[self updateTitlePrefixConnections];
+		//also update notationcontroller's prefix tree for autocompletion
+		[self updateTitlePrefixConnectionsForNote:note];
 		//should perhaps instead trigger a coalesced notification that also updates wiki-link-titles
 	}
 }
@@ -933,7 +1111,7 @@ bail:
 		//notes are stored as separate files, so if these paths are in the notes folder then NV can claim ownership over them
 		
 		//probably should sync directory here to make sure notesWithFilenames has the freshest data
-		[self synchronizeNotesFromDirectory];
+		[self synchronizeChangedNotesFromDirectory];
 		
 		NSSet *existingNotes = [self notesWithFilenames:filenames unknownFiles:&unknownPaths];
 		if ([existingNotes count] > 1) {
@@ -995,6 +1173,7 @@ bail:
 		notesChanged = YES;
 		
 		[unwrittenNotes addObject:note];
+		[recordStore invalidateRecordForNote:note];
 		
 		//always synchronize absolutely no matter what 15 seconds after any change
 		if (!changeWritingTimer)
@@ -1023,14 +1202,25 @@ bail:
 	}
 }
 
+//for changes to a note that are not otherwise written, so that its record is at least replaced at the next flush
+- (void)invalidateStoredRecordForNote:(NoteObject*)note {
+	[recordStore invalidateRecordForNote:note];
+}
+
 //the gatekeepers!
 - (void)_addNote:(NoteObject*)aNoteObject {
     [aNoteObject setDelegate:self];	
 	
     [allNotes addObject:aNoteObject];
 	[deletedNotes removeObject:aNoteObject];
+	[self addNoteToFileIndexes:aNoteObject];
+	[self addNoteToSyncKeyIndexes:aNoteObject];
+	[self updateTitlePrefixConnectionsForNote:aNoteObject];
+	[notesNeedingSearchIndex addObject:aNoteObject];
     
     notesChanged = YES;
+	
+	[self scheduleSearchIndexUpdate];
 }
 
 //the gateway methods must always show warnings, or else flash overlay window if show-warnings-pref is off
@@ -1057,6 +1247,10 @@ bail:
 	[aNoteObject abortEditingInExternalEditor];
 	
     [allNotes removeObjectIdenticalTo:aNoteObject];
+	[self removeNoteFromFileIndexes:aNoteObject];
+	[self removeNoteFromSyncKeyIndexes:aNoteObject];
+	[self removeNoteFromTitlePrefixConnections:aNoteObject];
+	[self removeNoteFromSearchIndex:aNoteObject];
 	DeletedNoteObject *deletedNote = [self _addDeletedNote:aNoteObject];
 	
 	updateForVerifiedDeletedNote(deletionManager, aNoteObject);
@@ -1184,11 +1378,16 @@ bail:
 	//foreground color is archived only for practicality, and should be for display only
 	NSAssert(fgColor != nil, @"foreground color cannot be nil");
 
+	//notes whose bodies are still pending take the color from -foregroundTextColor when they are read
 	[allNotes makeObjectsPerformSelector:@selector(setForegroundTextColorOnly:) withObject:fgColor];
 	
 	[notationPrefs setForegroundTextColor:fgColor];
 }
 
+- (NSColor*)foregroundTextColor {
+	return [notationPrefs foregroundColor];
+}
+
 - (void)restyleAllNotes {
 	NSFont *baseFont = [notationPrefs baseBodyFont];
 	NSAssert(baseFont != nil, @"base body font from notation prefs should ALWAYS be valid!");
@@ -1243,8 +1442,52 @@ bail:
 	[delegate notationListDidChange:self];
 }
 
+- (void)noteDidUpdateSearchCaches:(NoteObject*)note {
+	invalidateSearchIndexForNote(note, searchIndex);
+	[self updateTitlePrefixConnectionsForNote:note];
+	[notesNeedingSearchIndex addObject:note];
+	[self scheduleSearchIndexUpdate];
+}
+
+- (void)invalidateSearchIndex {
+	//the documents of notes that are no longer loaded would otherwise stay in the index
+	TrigramIndexFree(searchIndex);
+	searchIndex = TrigramIndexCreate();
+	[notesNeedingSearchIndex removeAllObjects];
+}
+
+- (void)removeNoteFromSearchIndex:(NoteObject*)note {
+	removeNoteFromSearchIndex(note, searchIndex);
+	[notesNeedingSearchIndex removeObject:note];
+}
+
+- (void)scheduleSearchIndexUpdate {
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(updateSearchIndex) object:nil];
+	[self performSelector:@selector(updateSearchIndex) withObject:nil afterDelay:0.0];
+}
+
+- (void)updateSearchIndex {
+	//index a limited number of notes per pass so that a large database doesn't block the run loop after launch;
+	//notes that haven't been indexed yet are simply always searched directly
+	NSUInteger updatedCount = 0;
+	NoteObject *note = nil;
+	
+	while (updatedCount < 100 && (note = [notesNeedingSearchIndex anyObject])) {
+		if (noteNeedsSearchIndexUpdate(note, searchIndex)) {
+			updateSearchIndexForNote(note, searchIndex);
+			updatedCount++;
+		}
+		[notesNeedingSearchIndex removeObject:note];
+	}
+	
+	if ([notesNeedingSearchIndex count])
+		[self scheduleSearchIndexUpdate];
+}
+
 - (BOOL)filterNotesFromString:(NSString*)string {
 	
+	[self cancelBackgroundSearch];
+	
 	[delegate notationListMightChange:self];
 	if ([self filterNotesFromUTF8String:[string lowercaseUTF8String] forceUncached:NO]) {
 		[delegate notationListDidChange:self];
@@ -1257,11 +1500,97 @@ bail:
 
 - (void)refilterNotes {
 	
+	if ([self _restartBackgroundSearchIfNecessary])
+		return;
+	
     [delegate notationListMightChange:self];
     [self filterNotesFromUTF8String:(currentFilterStr ? currentFilterStr : "") forceUncached:YES];
     [delegate notationListDidChange:self];
 }
 
+- (BOOL)_noteMatchesCurrentFilter:(NoteObject*)note {
+	//searches one note for every word of the current search string, as filterNotesFromUTF8String would from scratch
+	const char *searchString = currentFilterStr ? currentFilterStr : "";
+	
+	resetFoundPtrsForNote(note);
+	if (!*searchString)
+		return YES;
+	
+	char *token, *separators = (strchr(searchString, '"') ? "\"" : " :\t\r\n");
+	char *searchCopy = strdup(searchString), *preMangler = searchCopy;
+	BOOL matches = YES;
+	
+	NoteFilterContext filterContext;
+	bzero(&filterContext, sizeof(NoteFilterContext));
+	prepareNoteForContentSearch(note, &filterContext);
+	
+	while (matches && (token = strsep(&preMangler, separators))) {
+		if (*token != '\0') {
+			filterContext.needle = token;
+			matches = noteContainsUTF8String(note, &filterContext);
+		}
+	}
+	free(searchCopy);
+	
+	return matches;
+}
+
+//files notes that _addNote: has just appended to allNotes into their sorted positions, and into the filtered list if they match
+//the current search; with only a few notes added, this is much cheaper than resortAllNotes and refilterNotes
+- (void)insertAddedNotesInPlace:(NSArray*)addedNotes {
+	NSUInteger i, addedCount = [addedNotes count], allCount = [allNotes count];
+	BOOL notesAreAtEnd = sortColumn && addedCount <= MIN(allCount, kMaxNotesToInsertInPlace);
+	
+	for (i=0; notesAreAtEnd && i<addedCount; i++)
+		notesAreAtEnd = [allNotes objectAtIndex:allCount - addedCount + i] == [addedNotes objectAtIndex:i];
+	
+	if (!notesAreAtEnd || backgroundSearchStr) {
+		[self resortAllNotes];
+		[self refilterNotes];
+		return;
+	}
+	
+	[delegate notationListMightChange:self];
+	
+	BOOL reversed = [prefsController tableIsReverseSorted];
+	NSInteger (*sortFunction) (id*, id*) = (reversed ? [sortColumn reverseSortFunction] : [sortColumn sortFunction]);
+	
+	[allNotes removeObjectsInRange:NSMakeRange(allCount - addedCount, addedCount)];
+	
+	for (i=0; i<addedCount; i++) {
+		NoteObject *note = [addedNotes objectAtIndex:i];
+		
+		[allNotes insertObject:note sortedUsingFunction:sortFunction];
+		if ([self _noteMatchesCurrentFilter:note])
+			[notesListDataSource insertObject:note sortedUsingFunction:sortFunction];
+	}
+	
+	const char *searchString = currentFilterStr ? currentFilterStr : "";
+	[self _selectNoteWithTitlePrefixOfUTF8String:searchString length:strlen(searchString)];
+	
+	[delegate notationListDidChange:self];
+}
+
+- (void)_prepareFilteredNotesForContentSearch:(NoteFilterContext*)context {
+	//notes whose bodies are still in the record store have nothing to search until their caches are read in
+	NSUInteger i, noteCount = [notesListDataSource count];
+	NoteObject **notesBuffer = [notesListDataSource immutableObjects];
+	
+	for (i=0; i<noteCount; i++)
+		prepareNoteForContentSearch(notesBuffer[i], context);
+}
+
+- (ACAutomaton*)_retainedMatcherForTokens:(char**)tokens count:(NSUInteger)tokenCount {
+	//refiltering for the same words, as after an edit or a trailing space, needn't build all of the automaton's tables again
+	if (!searchMatcher || !ACAutomatonHasNeedles(searchMatcher, (const char **)tokens, (unsigned int)tokenCount)) {
+		ACAutomaton *matcher = ACAutomatonCreate((const char **)tokens, (unsigned int)tokenCount);
+		if (!matcher) return NULL;
+		ACAutomatonFree(searchMatcher);
+		searchMatcher = matcher;
+	}
+	return ACAutomatonRetain(searchMatcher);
+}
+
 - (BOOL)filterNotesFromUTF8String:(const char*)searchString forceUncached:(BOOL)forceUncached {
     BOOL stringHasExistingPrefix = YES;
     BOOL didFilterNotes = NO;
@@ -1304,21 +1633,57 @@ bail:
 		//otherwise, filtered notes already reflect all-notes-state
 		
 		char *preMangler = manglingString + lastWordInFilterStr;
+		char **tokens = (char**)malloc(sizeof(char*) * (newLen / 2 + 2));
+		NSUInteger t = 0, tokenCount = 0;
+		
 		while ((token = strsep(&preMangler, separators))) {
+			if (*token != '\0')
+				tokens[tokenCount++] = token;
+		}
+		bzero(&filterContext, sizeof(NoteFilterContext));
+		
+		if (tokenCount && stringHasExistingPrefix && tokens[0] == manglingString + lastWordInFilterStr) {
+			//this is the same token that we had scanned previously, so continue from where it was found
+			filterContext.useCachedPositions = YES;
+			filterContext.needle = tokens[0];
 			
-			if (*token != '\0') {
-				//if this is the same token that we had scanned previously
-				filterContext.useCachedPositions = stringHasExistingPrefix && (token == manglingString + lastWordInFilterStr);
-				filterContext.needle = token;
-				
-				touchedNotes = YES;
+			[self _prepareFilteredNotesForContentSearch:&filterContext];
+			if ([notesListDataSource filterArrayConcurrentlyUsingFunction:(BOOL (*)(id, void*))noteContainsUTF8String context:&filterContext])
+				didFilterNotes = YES;
+			t++;
+		}
+		
+		//narrow the candidates using the trigram index, as the remaining words must be searched from scratch
+		filterContext.useCachedPositions = NO;
+		if (t < tokenCount && TrigramIndexCopyCandidates(searchIndex, (const char **)tokens + t, (unsigned int)(tokenCount - t),
+														 &candidateDocs, &candidateDocsSize, &filterContext.candidateDocLimit))
+			filterContext.candidateDocs = candidateDocs;
+		if (t < tokenCount)
+			[self _prepareFilteredNotesForContentSearch:&filterContext];
+		
+		ACAutomaton *matcher = NULL;
+		if (tokenCount - t > 1 && (matcher = [self _retainedMatcherForTokens:tokens + t count:tokenCount - t])) {
+			//look for all of the remaining words in a single pass over each note
+			filterContext.matcher = matcher;
+			filterContext.trackedNeedle = (unsigned int)(tokenCount - t - 1);
+			
+			if ([notesListDataSource filterArrayConcurrentlyUsingFunction:(BOOL (*)(id, void*))noteContainsAllUTF8Strings context:&filterContext])
+				didFilterNotes = YES;
+			ACAutomatonFree(matcher);
+		} else {
+			for (; t<tokenCount; t++) {
+				filterContext.needle = tokens[t];
 				
-				if ([notesListDataSource filterArrayUsingFunction:(BOOL (*)(id, void*))noteContainsUTF8String context:&filterContext])
+				if ([notesListDataSource filterArrayConcurrentlyUsingFunction:(BOOL (*)(id, void*))noteContainsUTF8String context:&filterContext])
 					didFilterNotes = YES;
-								
-				lastWordInFilterStr = token - manglingString;
 			}
 		}
+		
+		if (tokenCount) {
+			touchedNotes = YES;
+			lastWordInFilterStr = tokens[tokenCount - 1] - manglingString;
+		}
+		free(tokens);
     }
     
 	//PHASE 3: reset found pointers in case have been cleared
@@ -1343,27 +1708,281 @@ bail:
 	//PHASE 4: autocomplete based on results
 	//even if the controller didn't filter, the search string could have changed its representation wrt spacing
 	//which will still influence note title prefixes 
+	[self _selectNoteWithTitlePrefixOfUTF8String:searchString length:newLen];
+    
+    currentFilterStr = replaceString(currentFilterStr, searchString);
+	
+	if (!initialCount && initialCount == filteredNoteCount)
+		return NO;
+    
+    return didFilterNotes;
+}
+
+//the state of one background search, shared by the main thread, which captures the notes a slice at a time,
+//and the blocks that scan each captured slice
+typedef struct _BackgroundSearch {
+	int32_t generation;
+	char *searchString, *tokenString, **tokens;
+	NSUInteger tokenCount;
+	NoteFilterContext filterContext;
+	ACAutomaton *matcher;
+	uint8_t *searchCandidates;
+	
+	NSArray *notes;
+	NSUInteger noteCount, capturedCount, scannedCount, scannedMatchCount;
+	NoteSearchSnapshot *snapshots;
+	unsigned char *matches, *sliceIsScanned;
+	dispatch_group_t scanGroup;
+	BOOL publishedScreenful;
+} BackgroundSearch;
+
+//searchGeneration is bumped on the main thread and read from the scanning threads
+static BOOL backgroundSearchIsCurrent(const BackgroundSearch *search, volatile int32_t *currentGeneration) {
+	return OSAtomicAdd32Barrier(0, currentGeneration) == search->generation;
+}
+
+static BOOL snapshotMatchesTokens(const NoteSearchSnapshot *snapshot, const NoteFilterContext *context, char **tokens, NSUInteger tokenCount) {
+	NoteFilterContext tokenContext = *context;
+	NSUInteger t;
+	
+	if (tokenContext.matcher || !tokenCount)
+		return !tokenCount || noteSnapshotContainsAllUTF8Strings(snapshot, &tokenContext);
+	
+	for (t=0; t<tokenCount; t++) {
+		tokenContext.needle = tokens[t];
+		if (!noteSnapshotContainsAllUTF8Strings(snapshot, &tokenContext))
+			return NO;
+	}
+	return YES;
+}
+
+- (BOOL)searchesInBackground {
+	return [allNotes count] >= kMinNotesToSearchInBackground;
+}
+
+- (void)filterNotesInBackgroundFromString:(NSString*)string {
+	//keystrokes typed in quick succession are coalesced, and each new string supersedes any search still running;
+	//the delegate is told when the first screenful of matches and then the full list are in notesListDataSource
+	[self cancelBackgroundSearch];
+	
+	backgroundSearchStr = replaceString(backgroundSearchStr, [string lowercaseUTF8String]);
+	[self performSelector:@selector(_startBackgroundSearch) withObject:nil afterDelay:kBackgroundSearchDelay];
+}
+
+- (void)cancelBackgroundSearch {
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(_startBackgroundSearch) object:nil];
+	OSAtomicIncrement32Barrier(&searchGeneration);
+	
+	if (backgroundSearchStr) {
+		free(backgroundSearchStr);
+		backgroundSearchStr = NULL;
+	}
+}
+
+- (BOOL)_restartBackgroundSearchIfNecessary {
+	if (!backgroundSearchStr)
+		return NO;
+	
+	//the notes have changed underneath the search, so search all of them again from scratch
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(_startBackgroundSearch) object:nil];
+	if (currentFilterStr) {
+		free(currentFilterStr);
+		currentFilterStr = NULL;
+	}
+	[self _startBackgroundSearch];
+	return YES;
+}
+
+- (void)_publishSearchResultsFromSnapshots:(const NoteSearchSnapshot*)snapshots matches:(const unsigned char*)matches 
+									 count:(NSUInteger)count forUTF8String:(const char*)searchString final:(BOOL)isFinal {
+	NSUInteger i, matchCount = 0;
+	NoteObject **matchedNotes = (NoteObject**)malloc(MAX(count, 1) * sizeof(NoteObject*));
+	
+	for (i=0; i<count; i++) {
+		if (matches[i]) {
+			matchedNotes[matchCount++] = snapshots[i].note;
+			//the search didn't move them, so a later search continuing from them will simply look at everything
+			resetFoundPtrsForNote(snapshots[i].note);
+		}
+	}
+	
+	[delegate notationWillPublishBackgroundSearchResults:self];
+	[delegate notationListMightChange:self];
+	
+	[notesListDataSource fillArrayFromObjects:(id*)matchedNotes count:matchCount];
+	free(matchedNotes);
+	lastWordInFilterStr = 0;
+	
+	if (isFinal) {
+		currentFilterStr = replaceString(currentFilterStr, searchString);
+		[self _selectNoteWithTitlePrefixOfUTF8String:searchString length:strlen(searchString)];
+		
+		free(backgroundSearchStr);
+		backgroundSearchStr = NULL;
+	} else {
+		//only the start of the list is known, so no filter string describes it yet
+		if (currentFilterStr) {
+			free(currentFilterStr);
+			currentFilterStr = NULL;
+		}
+		selectedNoteIndex = NSNotFound;
+	}
+	
+	[delegate notationListDidChange:self];
+	[delegate notation:self didPublishBackgroundSearchResultsFinal:isFinal];
+}
+
+- (void)_backgroundSearch:(BackgroundSearch*)search didScanSlice:(NSUInteger)slice {
+	//slices may finish in any order; once those scanned from the top of the list hold a screenful of matches,
+	//show them before the rest are done
+	search->sliceIsScanned[slice] = 1;
+	while (search->scannedCount < search->capturedCount && search->sliceIsScanned[search->scannedCount / kBackgroundSearchSliceCount]) {
+		NSUInteger j, end = MIN(search->scannedCount + kBackgroundSearchSliceCount, search->noteCount);
+		for (j=search->scannedCount; j<end; j++)
+			search->scannedMatchCount += search->matches[j];
+		search->scannedCount = end;
+	}
+	
+	if (!search->publishedScreenful && search->scannedMatchCount >= kSearchScreenfulCount && search->scannedCount < search->noteCount &&
+		backgroundSearchIsCurrent(search, &searchGeneration)) {
+		search->publishedScreenful = YES;
+		[self _publishSearchResultsFromSnapshots:search->snapshots matches:search->matches count:search->scannedCount 
+								   forUTF8String:search->searchString final:NO];
+	}
+}
+
+- (void)_finishBackgroundSearch:(BackgroundSearch*)search {
+	NSUInteger j;
+	
+	if (backgroundSearchIsCurrent(search, &searchGeneration))
+		[self _publishSearchResultsFromSnapshots:search->snapshots matches:search->matches count:search->noteCount 
+								   forUTF8String:search->searchString final:YES];
+	
+	for (j=0; j<search->capturedCount; j++)
+		[search->snapshots[j].note release];
+	endReadingSearchCaches();
+	
+	dispatch_release(search->scanGroup);
+	[search->notes release];
+	free(search->snapshots);
+	free(search->matches);
+	free(search->sliceIsScanned);
+	if (search->matcher) ACAutomatonFree(search->matcher);
+	if (search->searchCandidates) free(search->searchCandidates);
+	free(search->tokens);
+	free(search->tokenString);
+	free(search->searchString);
+	free(search);
+}
+
+- (void)_captureSliceOfBackgroundSearch:(BackgroundSearch*)search {
+	//bodies must be read and caches captured here on the main thread, and the scans read only the snapshots;
+	//one slice per pass of the run loop leaves keystrokes waiting for no more than that, and a newer search stops the capture
+	volatile int32_t *currentGeneration = &searchGeneration;
+	
+	if (backgroundSearchIsCurrent(search, currentGeneration)) {
+		NSUInteger i, start = search->capturedCount, end = MIN(start + kBackgroundSearchSliceCount, search->noteCount);
+		
+		for (i=start; i<end; i++) {
+			NoteObject *note = [search->notes objectAtIndex:i];
+			if (search->tokenCount)
+				prepareNoteForContentSearch(note, &search->filterContext);
+			captureNoteForSearch(note, &search->snapshots[i]);
+		}
+		search->capturedCount = end;
+		
+		dispatch_group_async(search->scanGroup, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^{
+			NSUInteger j;
+			for (j=start; j<end && backgroundSearchIsCurrent(search, currentGeneration); j++)
+				search->matches[j] = snapshotMatchesTokens(&search->snapshots[j], &search->filterContext, search->tokens, search->tokenCount);
+			
+			dispatch_async(dispatch_get_main_queue(), ^{
+				[self _backgroundSearch:search didScanSlice:start / kBackgroundSearchSliceCount];
+			});
+		});
+		
+		if (end < search->noteCount) {
+			dispatch_async(dispatch_get_main_queue(), ^{
+				[self _captureSliceOfBackgroundSearch:search];
+			});
+			return;
+		}
+	}
+	
+	//every note has been captured, or the search was superseded; either way it ends once the scans in flight are done
+	dispatch_group_notify(search->scanGroup, dispatch_get_main_queue(), ^{
+		[self _finishBackgroundSearch:search];
+	});
+}
+
+- (void)_startBackgroundSearch {
+	if (!backgroundSearchStr)
+		return;
+	
+	BackgroundSearch *search = (BackgroundSearch*)calloc(1, sizeof(BackgroundSearch));
+	search->generation = OSAtomicIncrement32Barrier(&searchGeneration);
+	search->searchString = strdup(backgroundSearchStr);
+	
+	//as in filterNotesFromUTF8String, notes already narrowed by a prefix of this string needn't be searched again;
+	//only the list itself is copied now, and its notes are captured a slice at a time by _captureSliceOfBackgroundSearch:
+	BOOL stringHasExistingPrefix = currentFilterStr && !strncmp(currentFilterStr, search->searchString, strlen(currentFilterStr));
+	search->notes = stringHasExistingPrefix ? [[NSArray alloc] initWithObjects:[notesListDataSource immutableObjects] count:[notesListDataSource count]] : [allNotes copy];
+	search->noteCount = [search->notes count];
+	
+	char *token, *separators = (strchr(search->searchString, '"') ? "\"" : " :\t\r\n");
+	char *preMangler = search->tokenString = strdup(search->searchString);
+	search->tokens = (char**)malloc(sizeof(char*) * (strlen(search->searchString) / 2 + 2));
+	
+	while ((token = strsep(&preMangler, separators))) {
+		if (*token != '\0')
+			search->tokens[search->tokenCount++] = token;
+	}
+	
+	size_t searchCandidatesSize = 0;
+	if (TrigramIndexCopyCandidates(searchIndex, (const char **)search->tokens, (unsigned int)search->tokenCount,
+								   &search->searchCandidates, &searchCandidatesSize, &search->filterContext.candidateDocLimit))
+		search->filterContext.candidateDocs = search->searchCandidates;
+	search->matcher = search->tokenCount > 1 ? [self _retainedMatcherForTokens:search->tokens count:search->tokenCount] : NULL;
+	search->filterContext.matcher = search->matcher;
+	if (search->tokenCount && !search->matcher)
+		search->filterContext.needle = search->tokens[0];
+	
+	search->snapshots = (NoteSearchSnapshot*)malloc(MAX(search->noteCount, 1) * sizeof(NoteSearchSnapshot));
+	search->matches = (unsigned char*)calloc(MAX(search->noteCount, 1), 1);
+	search->sliceIsScanned = (unsigned char*)calloc(search->noteCount / kBackgroundSearchSliceCount + 1, 1);
+	search->scanGroup = dispatch_group_create();
+	beginReadingSearchCaches();
+	
+	[self _captureSliceOfBackgroundSearch:search];
+}
+
+- (void)_selectNoteWithTitlePrefixOfUTF8String:(const char*)searchString length:(size_t)newLen {
 	selectedNoteIndex = NSNotFound;
 	
     if (newLen && [prefsController autoCompleteSearches]) {
-
+		if (!titlePrefixTrie) [self updateTitlePrefixConnections];
+		
+		//a note whose title begins with the search string contains every word of it, and so is listed
+		//unless the list was narrowed some other way; prefer the shortest of those titles
+		NoteObject *shortestNote = (NoteObject*)TitlePrefixTrieShortestTitleWithPrefix(titlePrefixTrie, searchString, newLen);
+		if (!shortestNote || (selectedNoteIndex = [notesListDataSource indexOfObjectIdenticalTo:shortestNote]) != NSNotFound)
+			return;
+		
+		NSUInteger i, filteredNoteCount = [notesListDataSource count];
+		NoteObject **notesBuffer = [notesListDataSource immutableObjects];
+		
 		for (i=0; i<filteredNoteCount; i++) {			
 			//because we already searched word-by-word up there, this is just way simpler
 			if (noteTitleHasPrefixOfUTF8String(notesBuffer[i], searchString, newLen)) {
 				selectedNoteIndex = i;
 				//this note matches, but what if there are other note-titles that are prefixes of both this one and the search string?
-				//find the first prefix-parent of which searchString is also a prefix
-				NSUInteger j = 0, prefixParentIndex = NSNotFound;
-				NSArray *prefixParents = prefixParentsOfNote(notesBuffer[i]);
+				//find the first prefix-parent that is actually in the list; the shorter prefixes will always be first
+				NoteObject *prefixParents[kMaxPrefixParents];
+				size_t j, prefixParentCount = prefixParentsOfNote(notesBuffer[i], titlePrefixTrie, newLen, prefixParents, kMaxPrefixParents);
 				
-				for (j=0; j<[prefixParents count]; j++) {
-					NoteObject *obj = [prefixParents objectAtIndex:j];
-					
-					if (noteTitleHasPrefixOfUTF8String(obj, searchString, newLen) &&
-						(prefixParentIndex = [notesListDataSource indexOfObjectIdenticalTo:obj]) != NSNotFound) {
-						//figure out where this prefix parent actually is in the list--if it actually is in the list, that is
-						//otherwise look at the next prefix parent, etc.
-						//the prefix parents array should always be alpha-sorted, so the shorter prefixes will always be first
+				for (j=0; j<prefixParentCount; j++) {
+					NSUInteger prefixParentIndex = [notesListDataSource indexOfObjectIdenticalTo:prefixParents[j]];
+					if (prefixParentIndex != NSNotFound) {
 						selectedNoteIndex = prefixParentIndex;
 						break;
 					}
@@ -1372,13 +1991,6 @@ bail:
 			}
 		}
     }
-    
-    currentFilterStr = replaceString(currentFilterStr, searchString);
-	
-	if (!initialCount && initialCount == filteredNoteCount)
-		return NO;
-    
-    return didFilterNotes;
 }
 
 - (NSUInteger)preferredSelectedNoteIndex {
@@ -1468,17 +2080,15 @@ bail:
 	if (col) {
 		BOOL reversed = [prefsController tableIsReverseSorted];
 		NSInteger (*sortFunction) (id *, id *) = (reversed ? [col reverseSortFunction] : [col sortFunction]);
-		NSInteger (*stringSortFunction) (id*, id*) = (reversed ? compareTitleStringReverse : compareTitleString);
-		
-		[allNotes sortStableUsingFunction:stringSortFunction usingBuffer:&allNotesBuffer ofSize:&allNotesBufferSize];
-		if (sortFunction != stringSortFunction)
-			[allNotes sortStableUsingFunction:sortFunction usingBuffer:&allNotesBuffer ofSize:&allNotesBufferSize];
+		uint64_t (*sortKeyFunction) (id) = [col sortKeyFunction];
 		
+		[self resortAllNotes];
 		
 		if ([notesListDataSource count] != [allNotes count]) {
-				
-			[notesListDataSource sortStableUsingFunction:stringSortFunction];	
-		    if (sortFunction != stringSortFunction)
+			
+			if (sortKeyFunction)
+				[notesListDataSource sortUsingKeyFunction:sortKeyFunction descending:reversed tiebreakFunction:sortFunction];
+			else
 				[notesListDataSource sortStableUsingFunction:sortFunction];
 			
 		} else {
@@ -1487,6 +2097,9 @@ bail:
 		}
 		
 		[delegate notationListDidChange:self];
+		
+		//a search still in progress would otherwise publish its results in the old order
+		[self _restartBackgroundSearchIfNecessary];
 	}
 }
 
@@ -1498,10 +2111,12 @@ bail:
 		BOOL reversed = [prefsController tableIsReverseSorted];
 	
 		NSInteger (*sortFunction) (id*, id*) = (reversed ? [col reverseSortFunction] : [col sortFunction]);
-		NSInteger (*stringSortFunction) (id*, id*) = (reversed ? compareTitleStringReverse : compareTitleString);
-
-		[allNotes sortStableUsingFunction:stringSortFunction usingBuffer:&allNotesBuffer ofSize:&allNotesBufferSize];
-		if (sortFunction != stringSortFunction)
+		uint64_t (*sortKeyFunction) (id) = [col sortKeyFunction];
+		
+		//every column's comparator breaks ties by title, so one pass suffices; dates are radix-sorted by their keys
+		if (sortKeyFunction)
+			[allNotes sortUsingKeyFunction:sortKeyFunction descending:reversed tiebreakFunction:sortFunction usingBuffer:&allNotesBuffer ofSize:&allNotesBufferSize];
+		else
 			[allNotes sortStableUsingFunction:sortFunction usingBuffer:&allNotesBuffer ofSize:&allNotesBufferSize];
 	}
 }
@@ -1517,20 +2132,49 @@ bail:
 	if (force || roundf(width) != roundf(titleColumnWidth)) {
 		titleColumnWidth = width;
 		
-		//regenerate previews for visible rows immediately and post a delayed message to regenerate previews for all rows
-		if (rows.length > 0) {
-			CFArrayRef visibleNotes = CFArrayCreate(NULL, (const void **)([notesListDataSource immutableObjects] + rows.location), rows.length, NULL);
-			[(NSArray*)visibleNotes makeObjectsPerformSelector:@selector(updateTablePreviewString)];
-			CFRelease(visibleNotes);
-		}
+		//previews are remade only as the table draws them, starting with the visible rows;
+		//those just past the visible rows are made ahead of time, so that scrolling finds them ready
+		if (force) tablePreviewGeneration++;
+		[self _updateTablePreviewKey];
 		
-		[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(regenerateAllPreviews) object:nil];
-		[self performSelector:@selector(regenerateAllPreviews) withObject:nil afterDelay:0.0];
+		[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(_prefetchTablePreviews) object:nil];
+		previewPrefetchRows = NSMakeRange(NSMaxRange(rows), kPreviewPrefetchRowCount);
+		[self performSelector:@selector(_prefetchTablePreviews) withObject:nil afterDelay:0.0];
 	}
 }
 
 - (void)regenerateAllPreviews {
-	[allNotes makeObjectsPerformSelector:@selector(updateTablePreviewString)];
+	tablePreviewGeneration++;
+	[self _updateTablePreviewKey];
+}
+
+- (uint32_t)tablePreviewKey {
+	return tablePreviewKey;
+}
+
+- (void)_updateTablePreviewKey {
+	//the low 4 bits describe the layout, the next 12 the rounded width of the title column, 
+	//and the rest count the other changes that affect previews (such as fonts); 0 is never a key
+	uint32_t layoutBits = 1 | ([prefsController tableColumnsShowPreview] << 1) | ([prefsController horizontalLayout] << 2) |
+		(ColumnIsSet(NoteLabelsColumn, [prefsController tableColumnsBitmap]) << 3);
+	uint32_t widthBucket = (uint32_t)MIN(MAX(roundf(titleColumnWidth), 0.0f), 4095.0f);
+	
+	tablePreviewKey = (tablePreviewGeneration << 16) | (widthBucket << 4) | layoutBits;
+}
+
+- (void)_prefetchTablePreviews {
+	NSUInteger i, count = [notesListDataSource count];
+	NSUInteger end = MIN(NSMaxRange(previewPrefetchRows), count);
+	NSUInteger batchEnd = MIN(previewPrefetchRows.location + kPreviewPrefetchBatchSize, end);
+	NoteObject **notes = [notesListDataSource immutableObjects];
+	
+	for (i=previewPrefetchRows.location; i<batchEnd; i++)
+		tablePreviewOfNote(notes[i]);
+	
+	if (batchEnd < end) {
+		previewPrefetchRows = NSMakeRange(batchEnd, end - batchEnd);
+		[self performSelector:@selector(_prefetchTablePreviews) withObject:nil afterDelay:0.0];
+	}
 }
 
 - (NotationPrefs*)notationPrefs {
@@ -1568,6 +2212,13 @@ bail:
 		free(sortedCatalogEntries);
     if (allNotesBuffer)
 		free(allNotesBuffer);
+	if (candidateDocs)
+		free(candidateDocs);
+	ACAutomatonFree(searchMatcher);
+	if (backgroundSearchStr)
+		free(backgroundSearchStr);
+	TrigramIndexFree(searchIndex);
+	[notesNeedingSearchIndex release];
 	
     [undoManager release];
     [notesListDataSource release];
@@ -1576,8 +2227,20 @@ bail:
 	[deletionManager release];
     [allNotes release];
 	[deletedNotes release];
+	[notesAddedFromDirectory release];
+	[self invalidateFileIndexes];
+	[self invalidateSyncKeyIndexes];
+	[self invalidateTitlePrefixConnections];
+	[changedDirectoryFilenames release];
+	if (directoryEventsUUID)
+		CFRelease(directoryEventsUUID);
+	if (eventStreamPath)
+		free(eventStreamPath);
 	[notationPrefs release];
 	[unwrittenNotes release];
+	[unreadableNoteTitles release];
+	[recordStore setDelegate:nil];
+	[recordStore release];
     
     [super dealloc];
 }
@@ -29,14 +29,32 @@ NSInteger compareCatalogValueFileSize(id *a, id *b);
 void NotesDirFNSubscriptionProc(FNMessage message, OptionBits flags, void * refcon, FNSubscriptionRef subscription);
 #endif
 
+- (void)_rebuildFileIndexes;
+- (void)invalidateFileIndexes;
+- (void)addNoteToFileIndexes:(NoteObject*)aNoteObject;
+- (void)removeNote:(NoteObject*)aNoteObject fromFileIndexesWithFilename:(NSString*)filename;
+- (void)removeNoteFromFileIndexes:(NoteObject*)aNoteObject;
+
 - (NSSet*)notesWithFilenames:(NSArray*)filenames unknownFiles:(NSArray**)unknownFiles;
 
+- (void)_growCatalogEntriesToCount:(size_t)count;
 - (BOOL)_readFilesInDirectory;
+- (BOOL)_readFiles:(NSArray*)filenames inDirectoryReturningMissing:(NSMutableArray*)missingFilenames;
 - (BOOL)modifyNoteIfNecessary:(NoteObject*)aNoteObject usingCatalogEntry:(NoteCatalogEntry*)catEntry;
+- (void)_matchCatalogEntries:(NoteCatalogEntry**)catEntriesPtrs ofSize:(size_t)catCount toNotes:(CFMutableSetRef)matchedNotes 
+			  addingUnmatchedTo:(NSMutableArray*)addedEntries;
+- (void)_processAddedEntries:(NSMutableArray*)addedEntries removed:(NSMutableArray*)removedEntries;
 - (void)makeNotesMatchCatalogEntries:(NoteCatalogEntry**)catEntriesPtrs ofSize:(size_t)catCount;
+- (void)makeNotesMatchChangedCatalogEntries:(NoteCatalogEntry**)catEntriesPtrs ofSize:(size_t)catCount missingFilenames:(NSArray*)missingFilenames;
 - (void)processNotesAddedByCNID:(NSMutableArray*)addedEntries removed:(NSMutableArray*)removedEntries;
 - (void)processNotesAddedByContent:(NSMutableArray*)addedEntries removed:(NSMutableArray*)removedEntries;
+- (void)addNotesFromCatalogEntries:(NSArray*)entryValues;
+- (void)_beginDirectorySynchronization;
+- (void)_endDirectorySynchronization;
+- (void)_setSynchronizedDirectoryEventID:(FSEventStreamEventId)eventID;
 - (BOOL)synchronizeNotesFromDirectory;
+- (BOOL)synchronizeChangedNotesFromDirectory;
+- (void)_handleDirectoryEvents:(size_t)numEvents atPaths:(char**)paths withFlags:(const FSEventStreamEventFlags*)flags IDs:(const FSEventStreamEventId*)eventIDs;
 - (void)_destroyDirEventStream;
 - (void)_configureDirEventStream;
 - (void)startFileNotifications;
@@ -24,8 +24,16 @@
 #import "NoteObject.h"
 #import "DeletionManager.h"
 #import "NSCollection_utils.h"
+#import "NotationFileManager.h"
+#include <dispatch/dispatch.h>
+#include <sys/param.h>
+#include <sys/stat.h>
 
 #define kMaxFileIteratorCount 100
+//fewer new files than this are read one after another on the main thread
+#define kMinFilesToReadConcurrently 8
+//files are read and decoded on other threads this many at a time, while the notes of the previous batch are created
+#define kConcurrentReadBatchSize 256
 
 @implementation NotationController (NotationDirectoryManager)
 
@@ -50,6 +58,71 @@ NSInteger compareCatalogValueFileSize(id *a, id *b) {
 }
 
 
+//the key under which a note is found in notesByFilenameKey: the name in composed form, folded the way
+//CFStringCompare's kCFCompareCaseInsensitive would compare it; catalog entry names are already composed
+static CFStringRef CreateFilenameKey(CFStringRef filename, Boolean isNormalized) {
+	CFMutableStringRef key = CFStringCreateMutableCopy(NULL, 0, filename);
+	if (!isNormalized)
+		CFStringNormalize(key, kCFStringNormalizationFormC);
+	CFStringFold(key, kCFCompareCaseInsensitive, NULL);
+	return key;
+}
+
+- (void)_rebuildFileIndexes {
+	if (notesByFilenameKey) CFRelease(notesByFilenameKey);
+	if (notesByNodeID) CFRelease(notesByNodeID);
+	
+	NSUInteger i, noteCount = [allNotes count];
+	
+	notesByFilenameKey = CFDictionaryCreateMutable(NULL, noteCount, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+	//node IDs of notes can change without a message to us (e.g., when a file is replaced by another program),
+	//so this one doesn't retain its notes and is only trusted for notes already known to exist
+	notesByNodeID = CFDictionaryCreateMutable(NULL, noteCount, NULL, NULL);
+	
+	for (i=0; i<noteCount; i++) {
+		[self addNoteToFileIndexes:[allNotes objectAtIndex:i]];
+	}
+}
+
+- (void)invalidateFileIndexes {
+	//they will be rebuilt from allNotes when the directory is next synchronized
+	if (notesByFilenameKey) CFRelease(notesByFilenameKey);
+	if (notesByNodeID) CFRelease(notesByNodeID);
+	notesByFilenameKey = notesByNodeID = NULL;
+}
+
+- (void)addNoteToFileIndexes:(NoteObject*)aNoteObject {
+	if (!notesByFilenameKey) return;
+	
+	NSString *filename = filenameOfNote(aNoteObject);
+	if (filename) {
+		CFStringRef filenameKey = CreateFilenameKey((CFStringRef)filename, false);
+		CFDictionarySetValue(notesByFilenameKey, filenameKey, aNoteObject);
+		CFRelease(filenameKey);
+	}
+	UInt32 nodeID = fileNodeIDOfNote(aNoteObject);
+	if (nodeID) CFDictionarySetValue(notesByNodeID, (const void*)(uintptr_t)nodeID, aNoteObject);
+}
+
+- (void)removeNote:(NoteObject*)aNoteObject fromFileIndexesWithFilename:(NSString*)filename {
+	if (!notesByFilenameKey) return;
+	
+	//another note may since have taken this name or node ID
+	if (filename) {
+		CFStringRef filenameKey = CreateFilenameKey((CFStringRef)filename, false);
+		if (CFDictionaryGetValue(notesByFilenameKey, filenameKey) == aNoteObject)
+			CFDictionaryRemoveValue(notesByFilenameKey, filenameKey);
+		CFRelease(filenameKey);
+	}
+	UInt32 nodeID = fileNodeIDOfNote(aNoteObject);
+	if (nodeID && CFDictionaryGetValue(notesByNodeID, (const void*)(uintptr_t)nodeID) == aNoteObject)
+		CFDictionaryRemoveValue(notesByNodeID, (const void*)(uintptr_t)nodeID);
+}
+
+- (void)removeNoteFromFileIndexes:(NoteObject*)aNoteObject {
+	[self removeNote:aNoteObject fromFileIndexesWithFilename:filenameOfNote(aNoteObject)];
+}
+
 //used to find notes corresponding to a group of existing files in the notes dir, with the understanding 
 //that the files' contents are up-to-date and the filename property of the note objs is also up-to-date
 //e.g. caller should know that if notes are stored as a single DB, then the file could still be out-of-date
@@ -86,29 +159,60 @@ NSInteger compareCatalogValueFileSize(id *a, id *b) {
 void FSEventsCallback(ConstFSEventStreamRef stream, void* info, size_t num_events, void* event_paths, 
 					  const FSEventStreamEventFlags flags[],
                       const FSEventStreamEventId event_ids[]) {
-	NotationController* self = (NotationController*)info;
+	
+	[(NotationController*)info _handleDirectoryEvents:num_events atPaths:(char**)event_paths withFlags:flags IDs:event_ids];
+}
+
+- (void)_handleDirectoryEvents:(size_t)numEvents atPaths:(char**)paths withFlags:(const FSEventStreamEventFlags*)flags IDs:(const FSEventStreamEventId*)eventIDs {
 	
 	BOOL rootChanged = NO;
-	size_t i = 0;
-	for (i = 0; i < num_events; i++) {
+	size_t i = 0, dirPathLength = eventStreamPath ? strlen(eventStreamPath) : 0;
+	for (i = 0; i < numEvents; i++) {
 		//on 10.5, could also check whether all the events are bookended by eventIDs that were contemporaneous with a change by NotationFileManager
 		//as it lacks kFSEventStreamCreateFlagIgnoreSelf
-		if ((flags[i] & kFSEventStreamEventFlagRootChanged) && !event_ids[i]) {
+		if ((flags[i] & kFSEventStreamEventFlagRootChanged) && !eventIDs[i]) {
 			rootChanged = YES;
 			break;
 		}
+		lastDirectoryEventID = MAX(lastDirectoryEventID, eventIDs[i]);
+		
+		if (flags[i] & kFSEventStreamEventFlagHistoryDone)
+			continue;
+		
+		if (!eventStreamReportsFiles || (flags[i] & (kFSEventStreamEventFlagMustScanSubDirs | kFSEventStreamEventFlagUserDropped | 
+													 kFSEventStreamEventFlagKernelDropped | kFSEventStreamEventFlagEventIdsWrapped))) {
+			//the event names only the directory, or some events were lost
+			directoryNeedsFullScan = YES;
+			continue;
+		}
+		
+		const char *path = paths[i];
+		if (dirPathLength && !strncasecmp(path, eventStreamPath, dirPathLength) && path[dirPathLength] == '/') {
+			const char *filename = path + dirPathLength + 1;
+			
+			//the directory itself and anything inside its subdirectories are never read as notes
+			if (*filename && !strchr(filename, '/') && !(flags[i] & 0x00020000 /*kFSEventStreamEventFlagItemIsDir*/)) {
+				NSString *filenameString = [NSString stringWithUTF8String:filename];
+				if (filenameString) [changedDirectoryFilenames addObject:filenameString];
+				else directoryNeedsFullScan = YES;
+			}
+		} else if (!dirPathLength || strcasecmp(path, eventStreamPath)) {
+			//this path isn't spelled the way we expect, so there's no telling which note it belongs to
+			directoryNeedsFullScan = YES;
+		}
 	}
 	
 	//the directory was moved; re-initialize the event stream for the new path
 	//but do so after this callback ends to avoid confusing FSEvents
 	if (rootChanged) {
 		NSLog(@"FSEventsCallback detected directory dislocation; reconfiguring stream");
+		directoryNeedsFullScan = YES;
 		[self performSelector:@selector(_configureDirEventStream) withObject:nil afterDelay:0];
 	}
 	
 	//NSLog(@"FSEventsCallback got a path change");
-	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(synchronizeNotesFromDirectory) object:nil];
-	[self performSelector:@selector(synchronizeNotesFromDirectory) withObject:nil afterDelay:0.0];
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(synchronizeChangedNotesFromDirectory) object:nil];
+	[self performSelector:@selector(synchronizeChangedNotesFromDirectory) withObject:nil afterDelay:0.0];
 }
 
 
@@ -118,6 +222,7 @@ void FSEventsCallback(ConstFSEventStreamRef stream, void* info, size_t num_event
 	
 	if (!eventStreamStarted) return;
 	
+	BOOL isRestarting = noteDirEventStreamRef != NULL;
 	if (noteDirEventStreamRef) {
 		//remove the event stream if it already exists, so that a new one can be created
 		[self _destroyDirEventStream];
@@ -125,10 +230,31 @@ void FSEventsCallback(ConstFSEventStreamRef stream, void* info, size_t num_event
 	
 	NSString *path = [[NSFileManager defaultManager] pathWithFSRef:&noteDirectoryRef];
 	
+	//event paths are reported with symlinks resolved, and are matched against this
+	char resolvedPath[PATH_MAX];
+	if (eventStreamPath) free(eventStreamPath);
+	eventStreamPath = strdup(realpath([path fileSystemRepresentation], resolvedPath) ? resolvedPath : [path fileSystemRepresentation]);
+	
+	//event IDs saved with the notes can be replayed only while the volume keeps the same event database
+	struct stat sb;
+	if (directoryEventsUUID) CFRelease(directoryEventsUUID);
+	directoryEventsUUID = !stat(eventStreamPath, &sb) ? FSEventsCopyUUIDForDevice(sb.st_dev) : NULL;
+	
+	FSEventStreamEventId sinceEventID = (FSEventStreamEventId)[notationPrefs directoryEventIDForEventsUUID:directoryEventsUUID];
+	if (!isRestarting) {
+		//without an event to start from, nothing short of reading the whole directory can tell what happened since the notes were stored
+		directoryNeedsFullScan = !sinceEventID;
+	}
+	
+	//file-level events are available only on 10.7 and later; on earlier systems every event requires reading the whole directory
+	eventStreamReportsFiles = IsLionOrLater;
+	
 	FSEventStreamContext context = { 0, self, CFRetain, CFRelease, CFCopyDescription };
 	
-	noteDirEventStreamRef = FSEventStreamCreate(NULL, &FSEventsCallback, &context, (CFArrayRef)[NSArray arrayWithObject:path], kFSEventStreamEventIdSinceNow, 
-												1.0, kFSEventStreamCreateFlagWatchRoot | 0x00000008 /*kFSEventStreamCreateFlagIgnoreSelf*/);
+	noteDirEventStreamRef = FSEventStreamCreate(NULL, &FSEventsCallback, &context, (CFArrayRef)[NSArray arrayWithObject:path], 
+												sinceEventID ? sinceEventID : kFSEventStreamEventIdSinceNow, 1.0, 
+												kFSEventStreamCreateFlagWatchRoot | 0x00000008 /*kFSEventStreamCreateFlagIgnoreSelf*/ | 
+												(eventStreamReportsFiles ? 0x00000010 /*kFSEventStreamCreateFlagFileEvents*/ : 0));
 	
 	FSEventStreamScheduleWithRunLoop(noteDirEventStreamRef, CFRunLoopGetCurrent(), kCFRunLoopDefaultMode);
 	if (!FSEventStreamStart(noteDirEventStreamRef)) {
@@ -207,17 +333,47 @@ void NotesDirFNSubscriptionProc(FNMessage message, OptionBits flags, void * refc
 }
 #endif
 
+- (void)_beginDirectorySynchronization {
+	directoryChangesFound = NO;
+	[notesAddedFromDirectory removeAllObjects];
+}
+
+- (void)_endDirectorySynchronization {
+	if (directoryChangesFound) {
+		if ([notesAddedFromDirectory count]) {
+			//renamed notes update the list themselves, so only new files need filing into it
+			[self insertAddedNotesInPlace:notesAddedFromDirectory];
+			[notesAddedFromDirectory removeAllObjects];
+		} else {
+			[self resortAllNotes];
+			[self refilterNotes];
+		}
+		
+		[self updateTitlePrefixConnections];
+	}
+}
+
+- (void)_setSynchronizedDirectoryEventID:(FSEventStreamEventId)eventID {
+	//stored with the notes at the next flush, so that the next launch can replay only the events after it
+	if (directoryEventsUUID && eventID)
+		[notationPrefs setDirectoryEventID:eventID forEventsUUID:directoryEventsUUID];
+}
+
 - (BOOL)synchronizeNotesFromDirectory {
     if ([self currentNoteStorageFormat] == SingleDatabaseFormat) {
 		//NSLog(@"%s: called when storage format is singledatabase", _cmd);
 		return NO;
 	}
 	
+	//every change up to this event will be seen by reading the directory now
+	FSEventStreamEventId scanEventID = IsLeopardOrLater ? FSEventsGetCurrentEventId() : 0;
+	
     //NSDate *date = [NSDate date];
     if ([self _readFilesInDirectory]) {
 		//NSLog(@"read files in directory");
 		
-		directoryChangesFound = NO;
+		[self _beginDirectorySynchronization];
+		
 		if (catEntriesCount && [allNotes count]) {
 			[self makeNotesMatchCatalogEntries:sortedCatalogEntries ofSize:catEntriesCount];
 		} else {
@@ -225,10 +381,12 @@ void NotesDirFNSubscriptionProc(FNMessage message, OptionBits flags, void * refc
 			
 			if (![allNotes count]) {
 				//no notes exist, so every file must be new
+				NSMutableArray *addedEntries = [NSMutableArray arrayWithCapacity:catEntriesCount];
 				for (i=0; i<catEntriesCount; i++) {
 					if ([notationPrefs catalogEntryAllowed:sortedCatalogEntries[i]])
-						[self addNoteFromCatalogEntry:sortedCatalogEntries[i]];
+						[addedEntries addObject:[NSValue valueWithPointer:sortedCatalogEntries[i]]];
 				}
+				[self addNotesFromCatalogEntries:addedEntries];
 			}
 			
 			if (!catEntriesCount) {
@@ -237,12 +395,11 @@ void NotesDirFNSubscriptionProc(FNMessage message, OptionBits flags, void * refc
 			}
 		}
 		
-		if (directoryChangesFound) {
-			[self resortAllNotes];
-		    [self refilterNotes];
-			
-			[self updateTitlePrefixConnections];
-		}
+		[self _endDirectorySynchronization];
+		
+		[changedDirectoryFilenames removeAllObjects];
+		directoryNeedsFullScan = NO;
+		[self _setSynchronizedDirectoryEventID:scanEventID];
 		
 		//NSLog(@"file sync time: %g, ",[[NSDate date] timeIntervalSinceDate:date]);
 		return YES;
@@ -251,6 +408,82 @@ void NotesDirFNSubscriptionProc(FNMessage message, OptionBits flags, void * refc
     return NO;
 }
 
+//reads only those files that FSEvents reported changed since the directory was last synchronized,
+//unless the events can't account for every change, in which case the whole directory is read again
+- (BOOL)synchronizeChangedNotesFromDirectory {
+    if ([self currentNoteStorageFormat] == SingleDatabaseFormat) {
+		return NO;
+	}
+	
+	if (noteDirEventStreamRef) {
+		//collect the events still being held back by the stream's latency
+		FSEventStreamFlushSync(noteDirEventStreamRef);
+	}
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(synchronizeChangedNotesFromDirectory) object:nil];
+	
+	if (!noteDirEventStreamRef || directoryNeedsFullScan) {
+		[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(synchronizeNotesFromDirectory) object:nil];
+		return [self synchronizeNotesFromDirectory];
+	}
+	
+	if ([changedDirectoryFilenames count]) {
+		NSArray *changedFilenames = [changedDirectoryFilenames allObjects];
+		NSMutableArray *missingFilenames = [NSMutableArray array];
+		
+		if (![self _readFiles:changedFilenames inDirectoryReturningMissing:missingFilenames]) {
+			return [self synchronizeNotesFromDirectory];
+		}
+		[changedDirectoryFilenames removeAllObjects];
+		
+		[self _beginDirectorySynchronization];
+		[self makeNotesMatchChangedCatalogEntries:sortedCatalogEntries ofSize:catEntriesCount missingFilenames:missingFilenames];
+		[self _endDirectorySynchronization];
+	}
+	
+	[self _setSynchronizedDirectoryEventID:lastDirectoryEventID];
+	
+	return YES;
+}
+
+- (void)_growCatalogEntriesToCount:(size_t)count {
+	if (count > totalCatEntriesCount) {
+		unsigned int oldCatEntriesCount = totalCatEntriesCount;
+		
+		totalCatEntriesCount = count;
+		catalogEntries = (NoteCatalogEntry *)realloc(catalogEntries, count * sizeof(NoteCatalogEntry));
+		sortedCatalogEntries = (NoteCatalogEntry **)realloc(sortedCatalogEntries, count * sizeof(NoteCatalogEntry*));
+		
+		//clear unused memory to make filename and filenameChars null
+		
+		size_t newSpace = (totalCatEntriesCount - oldCatEntriesCount) * sizeof(NoteCatalogEntry);
+		bzero(catalogEntries + oldCatEntriesCount, newSpace);
+	}
+}
+
+static void SetCatalogEntryFromInfo(NoteCatalogEntry *entry, FSCatalogInfo *info, HFSUniStr255 *filename) {
+	
+	entry->fileType = ((FileInfo *)info->finderInfo)->fileType;
+	entry->logicalSize = (UInt32)(info->dataLogicalSize & 0xFFFFFFFF);
+	entry->nodeID = (UInt32)info->nodeID;
+	entry->lastModified = info->contentModDate;
+	entry->lastAttrModified = info->attributeModDate;
+	
+	if (filename->length > entry->filenameCharCount) {
+		entry->filenameCharCount = filename->length;
+		entry->filenameChars = (UniChar*)realloc(entry->filenameChars, entry->filenameCharCount * sizeof(UniChar));
+	}
+	
+	memcpy(entry->filenameChars, filename->unicode, filename->length * sizeof(UniChar));
+	
+	if (!entry->filename)
+		entry->filename = CFStringCreateMutableWithExternalCharactersNoCopy(NULL, entry->filenameChars, filename->length, entry->filenameCharCount, kCFAllocatorNull);
+	else
+		CFStringSetExternalCharactersNoCopy(entry->filename, entry->filenameChars, filename->length, entry->filenameCharCount);
+	
+	// mipe: Normalize the filename to make sure that it will be found regardless of international characters
+	CFStringNormalize(entry->filename, kCFStringNormalizationFormC);
+}
+
 //scour the notes directory for fresh meat
 - (BOOL)_readFilesInDirectory {
     
@@ -277,18 +510,7 @@ void NotesDirFNSubscriptionProc(FNMessage message, OptionBits flags, void * refc
                 status = noErr;
 				
 				totalObjects += dirObjectCount;
-				if (totalObjects > totalCatEntriesCount) {
-					unsigned int oldCatEntriesCount = totalCatEntriesCount;
-					
-					totalCatEntriesCount = totalObjects;
-					catalogEntries = (NoteCatalogEntry *)realloc(catalogEntries, totalObjects * sizeof(NoteCatalogEntry));
-					sortedCatalogEntries = (NoteCatalogEntry **)realloc(sortedCatalogEntries, totalObjects * sizeof(NoteCatalogEntry*));
-					
-					//clear unused memory to make filename and filenameChars null
-					
-					size_t newSpace = (totalCatEntriesCount - oldCatEntriesCount) * sizeof(NoteCatalogEntry);
-					bzero(catalogEntries + oldCatEntriesCount, newSpace);
-				}
+				[self _growCatalogEntriesToCount:totalObjects];
 				
 				for (i = 0; i < dirObjectCount; i++) {
 					// Only read files, not directories
@@ -296,31 +518,7 @@ void NotesDirFNSubscriptionProc(FNMessage message, OptionBits flags, void * refc
 						//filter these only for files that will be added
 						//that way we can catch changes in files whose format is still being lazily updated
 						
-						NoteCatalogEntry *entry = &catalogEntries[catIndex];
-						HFSUniStr255 *filename = &HFSUniNameArray[i];
-						
-						entry->fileType = ((FileInfo *)fsCatInfoArray[i].finderInfo)->fileType;
-						entry->logicalSize = (UInt32)(fsCatInfoArray[i].dataLogicalSize & 0xFFFFFFFF);
-						entry->nodeID = (UInt32)fsCatInfoArray[i].nodeID;
-						entry->lastModified = fsCatInfoArray[i].contentModDate;
-						entry->lastAttrModified = fsCatInfoArray[i].attributeModDate;
-
-						
-						if (filename->length > entry->filenameCharCount) {
-							entry->filenameCharCount = filename->length;
-							entry->filenameChars = (UniChar*)realloc(entry->filenameChars, entry->filenameCharCount * sizeof(UniChar));
-						}
-						
-						memcpy(entry->filenameChars, filename->unicode, filename->length * sizeof(UniChar));
-						
-						if (!entry->filename)
-							entry->filename = CFStringCreateMutableWithExternalCharactersNoCopy(NULL, entry->filenameChars, filename->length, entry->filenameCharCount, kCFAllocatorNull);
-						else
-							CFStringSetExternalCharactersNoCopy(entry->filename, entry->filenameChars, filename->length, entry->filenameCharCount);
-						
-						// mipe: Normalize the filename to make sure that it will be found regardless of international characters
-						CFStringNormalize(entry->filename, kCFStringNormalizationFormC);
-
+						SetCatalogEntryFromInfo(&catalogEntries[catIndex], &fsCatInfoArray[i], &HFSUniNameArray[i]);
 						catIndex++;
                     }
                 }
@@ -344,6 +542,52 @@ void NotesDirFNSubscriptionProc(FNMessage message, OptionBits flags, void * refc
     return NO;
 }
 
+//reads the catalog info of only the named files, in place of the entries left by the last reading of the directory
+- (BOOL)_readFiles:(NSArray*)filenames inDirectoryReturningMissing:(NSMutableArray*)missingFilenames {
+	
+	NSUInteger i, catIndex = 0, count = [filenames count];
+	[self _growCatalogEntriesToCount:count];
+	
+	//the same file can be reported under more than one name, as when its name changes only in case
+	CFMutableSetRef nodeIDsRead = CFSetCreateMutable(NULL, count, NULL);
+	
+	for (i=0; i<count; i++) {
+		//names from FSEvents are POSIX names, whose colons are slashes to the Carbon File Manager
+		NSString *filename = [[filenames objectAtIndex:i] stringByReplacingOccurrencesOfString:@":" withString:@"/"];
+		UniChar chars[256];
+		CFRange range = {0, MIN(CFStringGetLength((CFStringRef)filename), 255)};
+		CFStringGetCharacters((CFStringRef)filename, range, chars);
+		
+		FSRef childRef;
+		FSCatalogInfo info;
+		HFSUniStr255 hfsName;
+		OSStatus err = FSMakeFSRefUnicode(&noteDirectoryRef, range.length, chars, kTextEncodingUnknown, &childRef);
+		if (err == noErr) {
+			err = FSGetCatalogInfo(&childRef, kFSCatInfoNodeFlags | kFSCatInfoFinderInfo | kFSCatInfoContentMod | 
+								   kFSCatInfoAttrMod | kFSCatInfoDataSizes | kFSCatInfoNodeID, &info, &hfsName, NULL, NULL);
+		}
+		
+		if (err == fnfErr || err == nsvErr) {
+			[missingFilenames addObject:filename];
+		} else if (err != noErr) {
+			NSLog(@"Error reading catalog info of changed file %@: %d", filename, err);
+			CFRelease(nodeIDsRead);
+			return NO;
+		} else if (!(info.nodeFlags & kFSNodeIsDirectoryMask) && !CFSetContainsValue(nodeIDsRead, (const void*)(uintptr_t)info.nodeID)) {
+			CFSetAddValue(nodeIDsRead, (const void*)(uintptr_t)info.nodeID);
+			
+			SetCatalogEntryFromInfo(&catalogEntries[catIndex], &info, &hfsName);
+			sortedCatalogEntries[catIndex] = &catalogEntries[catIndex];
+			catIndex++;
+		}
+	}
+	CFRelease(nodeIDsRead);
+	
+	catEntriesCount = catIndex;
+	
+	return YES;
+}
+
 - (BOOL)modifyNoteIfNecessary:(NoteObject*)aNoteObject usingCatalogEntry:(NoteCatalogEntry*)catEntry {
 	//check dates
 	UTCDateTime lastReadDate = fileModifiedDateOfNote(aNoteObject);
@@ -380,6 +624,7 @@ void NotesDirFNSubscriptionProc(FNMessage message, OptionBits flags, void * refc
 			
 			[self performSelector:@selector(scheduleUpdateListForAttribute:) withObject:NoteDateModifiedColumnString afterDelay:0.0];
 			
+			[recordStore invalidateRecordForNote:aNoteObject];
 			notesChanged = YES;
 			NSLog(@"FILE WAS MODIFIED: %@", catEntry->filename);
 			
@@ -394,175 +639,163 @@ void NotesDirFNSubscriptionProc(FNMessage message, OptionBits flags, void * refc
 	return NO;
 }
 
-- (void)makeNotesMatchCatalogEntries:(NoteCatalogEntry**)catEntriesPtrs ofSize:(size_t)catCount {
-    
-    unsigned int aSize = [allNotes count];
-    unsigned int bSize = catCount;
-    
-	ResizeArray(&allNotesBuffer, aSize, &allNotesBufferSize);
-	
-	NSAssert(allNotesBuffer != NULL, @"sorting buffer not initialized");
-	
-    NoteObject **currentNotes = allNotesBuffer;
-    [allNotes getObjects:(id*)currentNotes];
-	
-	mergesort((void *)allNotesBuffer, (size_t)aSize, sizeof(id), (int (*)(const void *, const void *))compareFilename);
-	mergesort((void *)catEntriesPtrs, (size_t)bSize, sizeof(NoteCatalogEntry*), (int (*)(const void *, const void *))compareCatalogEntryName);
+- (void)_matchCatalogEntries:(NoteCatalogEntry**)catEntriesPtrs ofSize:(size_t)catCount toNotes:(CFMutableSetRef)matchedNotes 
+			  addingUnmatchedTo:(NSMutableArray*)addedEntries {
 	
-    NSMutableArray *addedEntries = [NSMutableArray array];
-    NSMutableArray *removedEntries = [NSMutableArray array];
+	NSUInteger i;
 	
-    //oldItems(a,i) = currentNotes
-    //newItems(b,j) = catEntries;
-    
-    unsigned int i, j, lastInserted = 0;
-    
-    for (i=0; i<aSize; i++) {
+	for (i=0; i<catCount; i++) {
+		NoteCatalogEntry *catEntry = catEntriesPtrs[i];
 		
-		BOOL exitedEarly = NO;
-		for (j=lastInserted; j<bSize; j++) {
-			
-			CFComparisonResult order = CFStringCompare((CFStringRef)(catEntriesPtrs[j]->filename),
-													   (CFStringRef)filenameOfNote(currentNotes[i]), 
-													   kCFCompareCaseInsensitive);
-			if (order == kCFCompareGreaterThan) {    //if (A[i] < B[j])
-				lastInserted = j;
-				exitedEarly = YES;
-				
-				//NSLog(@"FILE DELETED (during): %@", filenameOfNote(currentNotes[i]));
-				[removedEntries addObject:currentNotes[i]];
-				break;
-			} else if (order == kCFCompareEqualTo) {			//if (A[i] == B[j])
-				//the name matches, so add this to changed iff its contents also changed
-				lastInserted = j + 1;
-				exitedEarly = YES;
-				
-				[self modifyNoteIfNecessary:currentNotes[i] usingCatalogEntry:catEntriesPtrs[j]];
-				
-				break;
-			}
-			
-			//NSLog(@"FILE ADDED (during): %@", catEntriesPtrs[j]->filename);
-			if ([notationPrefs catalogEntryAllowed:catEntriesPtrs[j]])
-				[addedEntries addObject:[NSValue valueWithPointer:catEntriesPtrs[j]]];
-		}
+		CFStringRef filenameKey = CreateFilenameKey((CFStringRef)catEntry->filename, true);
+		NoteObject *note = (NoteObject*)CFDictionaryGetValue(notesByFilenameKey, filenameKey);
+		CFRelease(filenameKey);
 		
-		if (!exitedEarly) {
+		if (note && !CFSetContainsValue(matchedNotes, note)) {
+			//the name matches, so the note changes iff its contents also changed
+			CFSetAddValue(matchedNotes, note);
 			
-			//element A[i] "appended" to the end of list B
-			if (CFStringCompare((CFStringRef)filenameOfNote(currentNotes[i]),
-								(CFStringRef)(catEntriesPtrs[MIN(lastInserted, bSize-1)]->filename), 
-								kCFCompareCaseInsensitive) == kCFCompareGreaterThan) {
-				lastInserted = bSize;
-				
-				//NSLog(@"FILE DELETED (after): %@", filenameOfNote(currentNotes[i]));
-				[removedEntries addObject:currentNotes[i]];
+			[self modifyNoteIfNecessary:note usingCatalogEntry:catEntry];
+			
+			//a file replaced by another program is likely to have a new node ID, which later renames will be looked up by
+			if (catEntry->nodeID && fileNodeIDOfNote(note) == catEntry->nodeID &&
+				CFDictionaryGetValue(notesByNodeID, (const void*)(uintptr_t)catEntry->nodeID) != note) {
+				CFDictionarySetValue(notesByNodeID, (const void*)(uintptr_t)catEntry->nodeID, note);
 			}
+		} else if ([notationPrefs catalogEntryAllowed:catEntry]) {
+			//NSLog(@"FILE ADDED: %@", catEntry->filename);
+			[addedEntries addObject:[NSValue valueWithPointer:catEntry]];
 		}
-		
-    }
-    
-    for (j=lastInserted; j<bSize; j++) {
-		
-		//NSLog(@"FILE ADDED (after): %@", catEntriesPtrs[j]->filename);
-		if ([notationPrefs catalogEntryAllowed:catEntriesPtrs[j]])
-			[addedEntries addObject:[NSValue valueWithPointer:catEntriesPtrs[j]]];
-    }
-    
+	}
+}
+
+- (void)_processAddedEntries:(NSMutableArray*)addedEntries removed:(NSMutableArray*)removedEntries {
+	NSUInteger i;
+	
 	if ([addedEntries count] && [removedEntries count]) {
 		[self processNotesAddedByCNID:addedEntries removed:removedEntries];
 	} else {
 		
 		if (![removedEntries count]) {
-			for (i=0; i<[addedEntries count]; i++) {
-				[self addNoteFromCatalogEntry:(NoteCatalogEntry*)[[addedEntries objectAtIndex:i] pointerValue]];
-			}
+			[self addNotesFromCatalogEntries:addedEntries];
 		}
 		
 		if (![addedEntries count]) {
 			[deletionManager addDeletedNotes:removedEntries];
 		}
 	}
+}
+
+- (void)makeNotesMatchCatalogEntries:(NoteCatalogEntry**)catEntriesPtrs ofSize:(size_t)catCount {
+	//each file is matched to its note through notesByFilenameKey, so that neither list needs sorting;
+	//notes left without a file were renamed or removed, and files left without a note were renamed or are new
+	
+	if (!notesByFilenameKey) [self _rebuildFileIndexes];
+	
+	NSUInteger i, noteCount = [allNotes count];
+	CFMutableSetRef matchedNotes = CFSetCreateMutable(NULL, noteCount, NULL);
+	
+    NSMutableArray *addedEntries = [NSMutableArray array];
+    NSMutableArray *removedEntries = [NSMutableArray array];
+	
+	[self _matchCatalogEntries:catEntriesPtrs ofSize:catCount toNotes:matchedNotes addingUnmatchedTo:addedEntries];
+	
+	if ((NSUInteger)CFSetGetCount(matchedNotes) < noteCount) {
+		for (i=0; i<noteCount; i++) {
+			NoteObject *note = [allNotes objectAtIndex:i];
+			if (!CFSetContainsValue(matchedNotes, note)) {
+				//NSLog(@"FILE DELETED: %@", filenameOfNote(note));
+				[removedEntries addObject:note];
+			}
+		}
+	}
+	CFRelease(matchedNotes);
+    
+	[self _processAddedEntries:addedEntries removed:removedEntries];
+}
+
+- (void)makeNotesMatchChangedCatalogEntries:(NoteCatalogEntry**)catEntriesPtrs ofSize:(size_t)catCount missingFilenames:(NSArray*)missingFilenames {
+	//as above, but only for files reported changed; notes are removed only if their own files were reported missing
+	
+	if (!notesByFilenameKey) [self _rebuildFileIndexes];
+	
+	NSUInteger i;
+	CFMutableSetRef matchedNotes = CFSetCreateMutable(NULL, catCount, NULL);
+	
+    NSMutableArray *addedEntries = [NSMutableArray array];
+    NSMutableArray *removedEntries = [NSMutableArray array];
+	
+	[self _matchCatalogEntries:catEntriesPtrs ofSize:catCount toNotes:matchedNotes addingUnmatchedTo:addedEntries];
+	
+	for (i=0; i<[missingFilenames count]; i++) {
+		CFStringRef filenameKey = CreateFilenameKey((CFStringRef)[missingFilenames objectAtIndex:i], false);
+		NoteObject *note = (NoteObject*)CFDictionaryGetValue(notesByFilenameKey, filenameKey);
+		CFRelease(filenameKey);
+		
+		if (note && !CFSetContainsValue(matchedNotes, note) && [removedEntries indexOfObjectIdenticalTo:note] == NSNotFound) {
+			//NSLog(@"FILE DELETED: %@", filenameOfNote(note));
+			[removedEntries addObject:note];
+		}
+	}
+	CFRelease(matchedNotes);
 	
+	[self _processAddedEntries:addedEntries removed:removedEntries];
 }
 
 //find renamed notes through unique file IDs
 - (void)processNotesAddedByCNID:(NSMutableArray*)addedEntries removed:(NSMutableArray*)removedEntries {
-	unsigned int aSize = [removedEntries count], bSize = [addedEntries count];
-    
-    //sort on nodeID here
-	[addedEntries sortUnstableUsingFunction:compareCatalogValueNodeID];
-	[removedEntries sortUnstableUsingFunction:compareNodeID];
+	NSUInteger i, aSize = [removedEntries count], bSize = [addedEntries count];
+	
+	if (!notesByNodeID) [self _rebuildFileIndexes];
+	
+	CFMutableSetRef missingNotes = CFSetCreateMutable(NULL, aSize, NULL);
+	for (i=0; i<aSize; i++) {
+		CFSetAddValue(missingNotes, [removedEntries objectAtIndex:i]);
+	}
 	
 	NSMutableArray *hfsAddedEntries = [NSMutableArray array];
 	NSMutableArray *hfsRemovedEntries = [NSMutableArray array];
 	
-    //oldItems(a,i) = currentNotes
-    //newItems(b,j) = catEntries;
-    
-    unsigned int i, j, lastInserted = 0;
-    
-    for (i=0; i<aSize; i++) {
-		NoteObject *currentNote = [removedEntries objectAtIndex:i];
+	for (i=0; i<bSize; i++) {
+		NSValue *entryValue = [addedEntries objectAtIndex:i];
+		NoteCatalogEntry *catEntry = (NoteCatalogEntry *)[entryValue pointerValue];
 		
-		BOOL exitedEarly = NO;
-		for (j=lastInserted; j<bSize; j++) {
-			
-			NoteCatalogEntry *catEntry = (NoteCatalogEntry *)[[addedEntries objectAtIndex:j] pointerValue];
-			int order = catEntry->nodeID - fileNodeIDOfNote(currentNote);
+		//notesByNodeID does not retain its notes, so a note found there is only looked at once it is known to be one of the missing ones
+		NoteObject *currentNote = catEntry->nodeID ? (NoteObject*)CFDictionaryGetValue(notesByNodeID, (const void*)(uintptr_t)catEntry->nodeID) : nil;
+		
+		if (currentNote && CFSetContainsValue(missingNotes, currentNote) && fileNodeIDOfNote(currentNote) == catEntry->nodeID) {
+			CFSetRemoveValue(missingNotes, currentNote);
 			
-			if (order > 0) {    //if (A[i] < B[j])
-				lastInserted = j;
-				exitedEarly = YES;
-				
-				NSLog(@"File deleted as per CNID: %@", filenameOfNote(currentNote));
-				[hfsRemovedEntries addObject:currentNote];
-				
-				break;
-			} else if (order == 0) {			//if (A[i] == B[j])
-				lastInserted = j + 1;
-				exitedEarly = YES;
+			//note was renamed!
+			NSLog(@"File %@ renamed as per CNID to %@", filenameOfNote(currentNote), catEntry->filename);
+			if (![self modifyNoteIfNecessary:currentNote usingCatalogEntry:catEntry]) {
+				//at least update the file name, because we _know_ that changed
 				
+				directoryChangesFound = YES;
 				
-				//note was renamed!
-				NSLog(@"File %@ renamed as per CNID to %@", filenameOfNote(currentNote), catEntry->filename);
-				if (![self modifyNoteIfNecessary:currentNote usingCatalogEntry:catEntry]) {
-					//at least update the file name, because we _know_ that changed
-					
-					directoryChangesFound = YES;
-					
-					[currentNote setFilename:(NSString*)catEntry->filename withExternalTrigger:YES];
-				}
-				
-				notesChanged = YES;
-				
-				break;
+				[currentNote setFilename:(NSString*)catEntry->filename withExternalTrigger:YES];
 			}
 			
+			[recordStore invalidateRecordForNote:currentNote];
+			notesChanged = YES;
+		} else {
 			//a new file was found on the disk! read it into memory!
 			
 			NSLog(@"File added as per CNID: %@", catEntry->filename);
-			[hfsAddedEntries addObject:[NSValue valueWithPointer:catEntry]];
+			[hfsAddedEntries addObject:entryValue];
 		}
+	}
+	
+	for (i=0; i<aSize; i++) {
+		NoteObject *currentNote = [removedEntries objectAtIndex:i];
 		
-		if (!exitedEarly) {
-			
-			NoteCatalogEntry *appendedCatEntry = (NoteCatalogEntry *)[[addedEntries objectAtIndex:MIN(lastInserted, bSize-1)] pointerValue];
-			if (fileNodeIDOfNote(currentNote) - appendedCatEntry->nodeID > 0) {
-				lastInserted = bSize;
-				
-				//file deleted from disk; 
-				NSLog(@"File deleted as per CNID: %@", filenameOfNote(currentNote));
-				[hfsRemovedEntries addObject:currentNote];
-			}
+		if (CFSetContainsValue(missingNotes, currentNote)) {
+			//file deleted from disk; 
+			NSLog(@"File deleted as per CNID: %@", filenameOfNote(currentNote));
+			[hfsRemovedEntries addObject:currentNote];
 		}
-    }
-    
-    for (j=lastInserted; j<bSize; j++) {
-		NoteCatalogEntry *appendedCatEntry = (NoteCatalogEntry *)[[addedEntries objectAtIndex:j] pointerValue];
-		NSLog(@"File added as per CNID: %@", appendedCatEntry->filename);
-		[hfsAddedEntries addObject:[NSValue valueWithPointer:appendedCatEntry]];
-    }
+	}
+	CFRelease(missingNotes);
 	
 	if ([hfsAddedEntries count] && [hfsRemovedEntries count]) {
 		[self processNotesAddedByContent:hfsAddedEntries removed:hfsRemovedEntries];
@@ -571,8 +804,8 @@ void NotesDirFNSubscriptionProc(FNMessage message, OptionBits flags, void * refc
 		if (![hfsRemovedEntries count]) {
 			for (i=0; i<[hfsAddedEntries count]; i++) {
 				NSLog(@"File _actually_ added: %@ (%s)", ((NoteCatalogEntry*)[[hfsAddedEntries objectAtIndex:i] pointerValue])->filename, _cmd);
-				[self addNoteFromCatalogEntry:(NoteCatalogEntry*)[[hfsAddedEntries objectAtIndex:i] pointerValue]];
 			}
+			[self addNotesFromCatalogEntries:hfsAddedEntries];
 		}
 		
 		if (![hfsAddedEntries count]) {
@@ -637,6 +870,7 @@ void NotesDirFNSubscriptionProc(FNMessage message, OptionBits flags, void * refc
 					directoryChangesFound = YES;
 					notesChanged = YES;
 					[removedObj setFilename:filenameOfNote(addedObjToCompare) withExternalTrigger:YES];
+					[recordStore invalidateRecordForNote:removedObj];
 				}
 				
 				if ([sameSizeObj isKindOfClass:[NSArray class]]) {
@@ -660,8 +894,91 @@ void NotesDirFNSubscriptionProc(FNMessage message, OptionBits flags, void * refc
 	for (i=0; i<[addedEntries count]; i++) {
 		NoteCatalogEntry *appendedCatEntry = (NoteCatalogEntry *)[[addedEntries objectAtIndex:i] pointerValue];
 		NSLog(@"File _actually_ added: %@ (%s)", appendedCatEntry->filename, _cmd);
-		[self addNoteFromCatalogEntry:appendedCatEntry];
-    }	
+    }
+	[self addNotesFromCatalogEntries:addedEntries];
+}
+
+//creates notes for many new files at once: their contents are read and decoded on other threads in batches,
+//each batch overlapping the creation of the previous batch's notes here, in the order of the entries
+- (void)addNotesFromCatalogEntries:(NSArray*)entryValues {
+	NSUInteger i, entryCount = [entryValues count];
+	int format = [self currentNoteStorageFormat];
+	
+	//HTML can only be decoded by WebKit on the main thread
+	if (entryCount < kMinFilesToReadConcurrently || format == HTMLFormat || format == SingleDatabaseFormat) {
+		for (i=0; i<entryCount; i++) {
+			[self addNoteFromCatalogEntry:(NoteCatalogEntry*)[[entryValues objectAtIndex:i] pointerValue]];
+		}
+		return;
+	}
+	
+	NoteCatalogEntry **entries = (NoteCatalogEntry **)malloc(entryCount * sizeof(NoteCatalogEntry*));
+	NSMutableAttributedString **contents = (NSMutableAttributedString **)calloc(entryCount, sizeof(NSMutableAttributedString*));
+	NSStringEncoding *encodings = (NSStringEncoding *)malloc(entryCount * sizeof(NSStringEncoding));
+	for (i=0; i<entryCount; i++) {
+		entries[i] = (NoteCatalogEntry*)[[entryValues objectAtIndex:i] pointerValue];
+		//the encoding a new note would otherwise have tried first
+		encodings[i] = NSUTF8StringEncoding;
+	}
+	
+	//everything the other threads need from us or from GlobalPrefs is looked up now
+	NSDictionary *bodyAttributes = [[GlobalPrefs defaultPrefs] noteBodyAttributes];
+	size_t blockSize = (size_t)BlockSizeForNotation(self);
+	FSRef *directoryRef = &noteDirectoryRef;
+	dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+	
+	NSUInteger batchCount = (entryCount + kConcurrentReadBatchSize - 1) / kConcurrentReadBatchSize;
+	dispatch_group_t *batchGroups = (dispatch_group_t *)calloc(batchCount, sizeof(dispatch_group_t));
+	
+	void (^readBatch)(NSUInteger) = ^(NSUInteger batch) {
+		size_t firstEntry = batch * kConcurrentReadBatchSize;
+		
+		batchGroups[batch] = dispatch_group_create();
+		dispatch_group_async(batchGroups[batch], queue, ^{
+			dispatch_apply(MIN(kConcurrentReadBatchSize, entryCount - firstEntry), queue, ^(size_t k) {
+				NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+				
+				size_t n = firstEntry + k;
+				FSRef fileRef;
+				UniChar chars[256];
+				UInt64 fileSize = entries[n]->logicalSize;
+				char *fileBytes = NULL;
+				
+				if (FSRefMakeInDirectoryWithString(directoryRef, &fileRef, (CFStringRef)entries[n]->filename, chars) == noErr &&
+					FSRefReadData(&fileRef, blockSize, &fileSize, (void**)&fileBytes, noCacheMask) == noErr && fileBytes) {
+					
+					NSMutableData *data = [[NSMutableData alloc] initWithBytesNoCopy:fileBytes length:fileSize freeWhenDone:YES];
+					contents[n] = [NoteObject newContentStringFromData:data inFormat:format guessedEncoding:&encodings[n] 
+															   fileRef:&fileRef bodyAttributes:bodyAttributes];
+					[data release];
+				}
+				//files that can't be read here are left for addNoteFromCatalogEntry: to read (and complain about) again
+				
+				[pool release];
+			});
+		});
+	};
+	
+	readBatch(0);
+	for (i=0; i<batchCount; i++) {
+		if (i + 1 < batchCount) readBatch(i + 1);
+		
+		dispatch_group_wait(batchGroups[i], DISPATCH_TIME_FOREVER);
+		dispatch_release(batchGroups[i]);
+		
+		NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+		NSUInteger n, lastEntry = MIN((i + 1) * kConcurrentReadBatchSize, entryCount);
+		for (n = i * kConcurrentReadBatchSize; n < lastEntry; n++) {
+			[self addNoteFromCatalogEntry:entries[n] decodedContents:contents[n] encoding:encodings[n]];
+			[contents[n] release];
+		}
+		[pool release];
+	}
+	
+	free(batchGroups);
+	free(encodings);
+	free(contents);
+	free(entries);
 }
 
 @end
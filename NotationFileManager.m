@@ -23,6 +23,8 @@
 #import "NoteObject.h"
 #import "GlobalPrefs.h"
 #import "NSData_transformations.h"
+#import "NotationDirectoryManager.h"
+#import "NotationSyncServiceManager.h"
 #include <sys/param.h>
 #include <sys/mount.h>
 
@@ -319,10 +321,18 @@ long BlockSizeForNotation(NotationController *controller) {
 			walNote = [[obj retain] autorelease];
 	}
 	if (dbNote) {
+		[self removeNoteFromFileIndexes:dbNote];
+		[self removeNoteFromSyncKeyIndexes:dbNote];
+		[self removeNoteFromTitlePrefixConnections:dbNote];
+		[self removeNoteFromSearchIndex:dbNote];
 		[allNotes removeObjectIdenticalTo:dbNote];
 		[self _addDeletedNote:dbNote];
 	}
 	if (walNote) {
+		[self removeNoteFromFileIndexes:walNote];
+		[self removeNoteFromSyncKeyIndexes:walNote];
+		[self removeNoteFromTitlePrefixConnections:walNote];
+		[self removeNoteFromSearchIndex:walNote];
 		[allNotes removeObjectIdenticalTo:walNote];
 		[self _addDeletedNote:walNote];
 	}
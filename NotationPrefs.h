@@ -50,6 +50,11 @@ extern NSString *NotationPrefsDidChangeNotification;
 	
 	NSMutableArray *seenDiskUUIDEntries;
 	
+	//the last FSEvents event ID whose changes to the notes directory are reflected in the notes stored alongside these prefs,
+	//valid only for as long as the event database of the volume keeps the same UUID
+	UInt64 directoryEventID;
+	NSString *directoryEventsUUIDString;
+	
 	UInt32 epochIteration;
 	BOOL firstTimeUsed;
 	BOOL preferencesChanged;
@@ -104,6 +109,7 @@ NSMutableDictionary *ServiceAccountDictInit(NotationPrefs *prefs, NSString* serv
 - (BOOL)encryptDataInNewSession:(NSMutableData*)data;
 - (BOOL)decryptDataWithCurrentSettings:(NSMutableData*)data;
 - (NSData*)WALSessionKey;
+- (NSData*)noteRecordKey;
 
 - (void)setNotesStorageFormat:(NSInteger)formatID;
 - (BOOL)shouldDisplaySheetForProposedFormat:(NSInteger)proposedFormat;
@@ -121,6 +127,8 @@ NSMutableDictionary *ServiceAccountDictInit(NotationPrefs *prefs, NSString* serv
 - (void)setKeyLengthInBits:(unsigned int)newLength;
 
 - (NSUInteger)tableIndexOfDiskUUID:(CFUUIDRef)UUIDRef;
+- (UInt64)directoryEventIDForEventsUUID:(CFUUIDRef)UUIDRef;
+- (void)setDirectoryEventID:(UInt64)eventID forEventsUUID:(CFUUIDRef)UUIDRef;
 - (void)checkForKnownRedundantSyncConduitsAtPath:(NSString*)dbPath;
 
 + (NSString*)pathExtensionForFormat:(int)format;
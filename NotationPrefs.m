@@ -144,6 +144,9 @@ NSMutableDictionary *ServiceAccountDictInit(NotationPrefs *prefs, NSString* serv
 		if (!(seenDiskUUIDEntries = [[decoder decodeObjectForKey:VAR_STR(seenDiskUUIDEntries)] retain]))
 			seenDiskUUIDEntries = [[NSMutableArray alloc] init];
 		
+		directoryEventID = (UInt64)[decoder decodeInt64ForKey:VAR_STR(directoryEventID)];
+		directoryEventsUUIDString = [[decoder decodeObjectForKey:VAR_STR(directoryEventsUUIDString)] retain];
+		
 		masterSalt = [[decoder decodeObjectForKey:VAR_STR(masterSalt)] retain];
 		dataSessionSalt = [[decoder decodeObjectForKey:VAR_STR(dataSessionSalt)] retain];
 		verifierKey = [[decoder decodeObjectForKey:VAR_STR(verifierKey)] retain];
@@ -192,6 +195,9 @@ NSMutableDictionary *ServiceAccountDictInit(NotationPrefs *prefs, NSString* serv
 	
 	[coder encodeObject:seenDiskUUIDEntries forKey:VAR_STR(seenDiskUUIDEntries)];
 	
+	[coder encodeInt64:(int64_t)directoryEventID forKey:VAR_STR(directoryEventID)];
+	[coder encodeObject:directoryEventsUUIDString forKey:VAR_STR(directoryEventsUUIDString)];
+	
 	[coder encodeObject:masterSalt forKey:VAR_STR(masterSalt)];
 	[coder encodeObject:dataSessionSalt forKey:VAR_STR(dataSessionSalt)];
 	[coder encodeObject:verifierKey forKey:VAR_STR(verifierKey)];
@@ -210,6 +216,7 @@ NSMutableDictionary *ServiceAccountDictInit(NotationPrefs *prefs, NSString* serv
 	
 	[syncServiceAccounts release];
 	[seenDiskUUIDEntries release];
+	[directoryEventsUUIDString release];
 	[keychainDatabaseIdentifier release];
 	[baseBodyFont release];
 	[foregroundColor release];
@@ -593,6 +600,15 @@ NSMutableDictionary *ServiceAccountDictInit(NotationPrefs *prefs, NSString* serv
 	return [masterKey derivedKeyOfLength:keyLengthInBits/8 salt:sessionSalt iterations:1];
 }
 
+- (NSData*)noteRecordKey {
+	//unlike the journal, records of an unencrypted database are stored only compressed, as the database itself was
+	if (!doesEncryption || !masterKey)
+		return nil;
+	
+	NSData *recordSalt = [NSData dataWithBytesNoCopy:RECORD_STORE_SALT length:sizeof(RECORD_STORE_SALT) freeWhenDone:NO];
+	return [masterKey derivedKeyOfLength:keyLengthInBits/8 salt:recordSalt iterations:1];
+}
+
 - (void)setNotesStorageFormat:(NSInteger)formatID {
 	if (formatID != notesStorageFormat) {
 		NSInteger oldFormat = notesStorageFormat;
@@ -840,6 +856,25 @@ NSMutableDictionary *ServiceAccountDictInit(NotationPrefs *prefs, NSString* serv
 	return [seenDiskUUIDEntries count] - 1;
 }
 
+- (UInt64)directoryEventIDForEventsUUID:(CFUUIDRef)UUIDRef {
+	//returns 0 if there is no event ID that can be used with this event database
+	if (!UUIDRef || !directoryEventID || !directoryEventsUUIDString) return 0ULL;
+	
+	CFStringRef UUIDString = CFUUIDCreateString(NULL, UUIDRef);
+	BOOL isSameDatabase = [directoryEventsUUIDString isEqualToString:(NSString*)UUIDString];
+	CFRelease(UUIDString);
+	
+	return isSameDatabase ? directoryEventID : 0ULL;
+}
+
+- (void)setDirectoryEventID:(UInt64)eventID forEventsUUID:(CFUUIDRef)UUIDRef {
+	//not worth a flush by itself; events that were never stored are just replayed at the next launch
+	directoryEventID = UUIDRef ? eventID : 0ULL;
+	
+	[directoryEventsUUIDString release];
+	directoryEventsUUIDString = UUIDRef ? (NSString*)CFUUIDCreateString(NULL, UUIDRef) : nil;
+}
+
 - (void)checkForKnownRedundantSyncConduitsAtPath:(NSString*)dbPath {
 	//is inside dropbox folder and notes are separate files
 	//is set to sync with any service
@@ -1059,6 +1094,9 @@ NSMutableDictionary *ServiceAccountDictInit(NotationPrefs *prefs, NSString* serv
 	if ([filename isEqualToString:@"Interim Note-Changes"]) {
 		return NO;
 	}
+	if ([NoteRecordStore isSegmentFilename:filename]) {
+		return NO;
+	}
 	
 	if ([self pathExtensionAllowed:[filename pathExtension] forFormat:notesStorageFormat])
 		return YES;
@@ -28,6 +28,12 @@
 
 - (NoteObject*)noteForKey:(NSString*)key ofServiceClass:(Class<SyncServiceSession>)serviceClass;
 
+- (CFDictionaryRef)notesBySyncKeyForServiceClass:(Class<SyncServiceSession>)serviceClass;
+- (void)invalidateSyncKeyIndexes;
+- (void)addNoteToSyncKeyIndexes:(NoteObject*)aNoteObject;
+- (void)updateNoteInSyncKeyIndexes:(NoteObject*)aNoteObject;
+- (void)removeNoteFromSyncKeyIndexes:(NoteObject*)aNoteObject;
+
 - (void)processPartialNotesList:(NSArray*)entries withRemovedList:(NSArray*)removedEntries fromSyncSession:(id <SyncServiceSession>)syncSession;
 - (void)makeNotesMatchList:(NSArray*)MDEntries fromSyncSession:(id <SyncServiceSession>)syncSession;
 
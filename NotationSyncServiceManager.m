@@ -59,14 +59,84 @@
 }
 
 - (NoteObject*)noteForKey:(NSString*)key ofServiceClass:(Class<SyncServiceSession>)serviceClass {
-	NSUInteger i = 0;
-	for (i=0; i<[allNotes count]; i++) {
-		NoteObject *note = [allNotes objectAtIndex:i];
-		if ([[[[note syncServicesMD] objectForKey:[serviceClass serviceName]] 
-			  objectForKey:[serviceClass nameOfKeyElement]] isEqualToString:key])
-			return note;
+	if (!key) return nil;
+	return (NoteObject*)CFDictionaryGetValue([self notesBySyncKeyForServiceClass:serviceClass], (CFStringRef)key);
+}
+
+//each index is an array of: sync key -> note, note -> sync key (or kCFNull for notes without one), and the name of the key element;
+//every note in allNotes is in the second dictionary, so that only their sync metadata changes need be tracked
+
+enum { kSyncKeyToNote = 0, kNoteToSyncKey = 1, kSyncKeyElementName = 2 };
+
+- (void)_indexSyncKeyOfNote:(NoteObject*)note inIndex:(NSArray*)index forService:(NSString*)serviceName {
+	CFMutableDictionaryRef keyToNote = (CFMutableDictionaryRef)[index objectAtIndex:kSyncKeyToNote];
+	CFMutableDictionaryRef noteToKey = (CFMutableDictionaryRef)[index objectAtIndex:kNoteToSyncKey];
+	
+	CFTypeRef oldKey = CFDictionaryGetValue(noteToKey, note);
+	NSString *key = [[[note syncServicesMD] objectForKey:serviceName] objectForKey:[index objectAtIndex:kSyncKeyElementName]];
+	
+	if (oldKey && oldKey != kCFNull) {
+		if (key && [key isEqualToString:(NSString*)oldKey]) return;
+		if (CFDictionaryGetValue(keyToNote, oldKey) == note) CFDictionaryRemoveValue(keyToNote, oldKey);
+	}
+	key = [[key copy] autorelease];
+	CFDictionarySetValue(noteToKey, note, key ? (CFTypeRef)key : kCFNull);
+	if (key) CFDictionarySetValue(keyToNote, (CFStringRef)key, note);
+}
+
+- (CFDictionaryRef)notesBySyncKeyForServiceClass:(Class<SyncServiceSession>)serviceClass {
+	NSString *serviceName = [serviceClass serviceName];
+	NSArray *index = [syncKeyIndexes objectForKey:serviceName];
+	
+	if (!index) {
+		if (!syncKeyIndexes) syncKeyIndexes = [[NSMutableDictionary alloc] init];
+		
+		CFMutableDictionaryRef keyToNote = CFDictionaryCreateMutable(NULL, [allNotes count], &kCFTypeDictionaryKeyCallBacks, NULL);
+		CFMutableDictionaryRef noteToKey = CFDictionaryCreateMutable(NULL, [allNotes count], NULL, &kCFTypeDictionaryValueCallBacks);
+		index = [NSArray arrayWithObjects:(id)keyToNote, (id)noteToKey, [serviceClass nameOfKeyElement], nil];
+		CFRelease(keyToNote);
+		CFRelease(noteToKey);
+		[syncKeyIndexes setObject:index forKey:serviceName];
+		
+		NSUInteger i = 0;
+		for (i=0; i<[allNotes count]; i++) {
+			[self _indexSyncKeyOfNote:[allNotes objectAtIndex:i] inIndex:index forService:serviceName];
+		}
+	}
+	return (CFDictionaryRef)[index objectAtIndex:kSyncKeyToNote];
+}
+
+- (void)invalidateSyncKeyIndexes {
+	[syncKeyIndexes release];
+	syncKeyIndexes = nil;
+}
+
+- (void)addNoteToSyncKeyIndexes:(NoteObject*)aNoteObject {
+	for (NSString *serviceName in syncKeyIndexes) {
+		[self _indexSyncKeyOfNote:aNoteObject inIndex:[syncKeyIndexes objectForKey:serviceName] forService:serviceName];
+	}
+}
+
+- (void)updateNoteInSyncKeyIndexes:(NoteObject*)aNoteObject {
+	//notes not yet in allNotes (such as those just downloaded) must not be indexed
+	for (NSString *serviceName in syncKeyIndexes) {
+		NSArray *index = [syncKeyIndexes objectForKey:serviceName];
+		if (CFDictionaryContainsKey((CFDictionaryRef)[index objectAtIndex:kNoteToSyncKey], aNoteObject))
+			[self _indexSyncKeyOfNote:aNoteObject inIndex:index forService:serviceName];
+	}
+}
+
+- (void)removeNoteFromSyncKeyIndexes:(NoteObject*)aNoteObject {
+	for (NSString *serviceName in syncKeyIndexes) {
+		NSArray *index = [syncKeyIndexes objectForKey:serviceName];
+		CFMutableDictionaryRef keyToNote = (CFMutableDictionaryRef)[index objectAtIndex:kSyncKeyToNote];
+		CFMutableDictionaryRef noteToKey = (CFMutableDictionaryRef)[index objectAtIndex:kNoteToSyncKey];
+		
+		CFTypeRef oldKey = CFDictionaryGetValue(noteToKey, aNoteObject);
+		if (oldKey && oldKey != kCFNull && CFDictionaryGetValue(keyToNote, oldKey) == aNoteObject)
+			CFDictionaryRemoveValue(keyToNote, oldKey);
+		CFDictionaryRemoveValue(noteToKey, aNoteObject);
 	}
-	return nil;
 }
 
 - (void)startSyncServices {
@@ -111,6 +181,7 @@
 	notesChanged = YES;
 	NSUInteger i = 0;
 	for (i = 0; i<[changedNotes count]; i++) {
+		[recordStore invalidateRecordForNote:[changedNotes objectAtIndex:i]];
 		[delegate contentsUpdatedForNote:[changedNotes objectAtIndex:i]];
 	}
 	[self resortAllNotes];
@@ -133,7 +204,7 @@
 	NSMutableArray *notesToDelete = [NSMutableArray array];
 	NSMutableArray *changedNotes = [NSMutableArray array];
 	NSMutableArray *checkEntries = [NSMutableArray array];
-	NSDictionary *localNotesDict = [self invertedDictionaryOfNotes:allNotes forSession:syncSession];
+	NSDictionary *localNotesDict = (NSDictionary*)[self notesBySyncKeyForServiceClass:[syncSession class]];
 
 	//we only have a partial remote list, plus possibly a list of permanently deleted notes.
 	//since we only have some remotes, we can't perform full sync operations like comparing
@@ -189,7 +260,11 @@
 	NSString *serviceName = [[syncSession class] serviceName];
 	NSUInteger i = 0;
 
+	//the remote entries are joined to local notes by sync key: once through allNotes probing the remote entries, 
+	//and once through the remote entries probing the index of local notes' keys, with no other pass over either
+	CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
 	NSDictionary *remoteDict = [self invertedDictionaryOfEntries:MDEntries keyedBy:keyName];
+	CFAbsoluteTime remoteIndexTime = CFAbsoluteTimeGetCurrent();
 	//NSLog(@"%s: got inverted dict of entries: %@", _cmd, remoteDict);
 	
 	//*** get the notes that don't yet exist on the server (added locally)
@@ -249,6 +324,8 @@
 		}
 	}
 	
+	CFAbsoluteTime localJoinTime = CFAbsoluteTimeGetCurrent();
+	
 	//*** get the notes that need to be deleted from the server (deletedNotes set) (removed-locally/already-synced)
 	NSMutableArray *locallyDeletedNotes = [NSMutableArray arrayWithCapacity:[deletedNotes count]];
 	NSArray *deletedNotesArray = [deletedNotes allObjects];
@@ -265,8 +342,9 @@
 	
 	//### get a list of new notes on the server (added remotely)
 	NSMutableArray *remotelyAddedEntries = [NSMutableArray array];
-	NSDictionary *localNotesDict = [self invertedDictionaryOfNotes:allNotes forSession:syncSession];
+	NSDictionary *localNotesDict = (NSDictionary*)[self notesBySyncKeyForServiceClass:[syncSession class]];
 	NSDictionary *localDeletedNotesDict = [self invertedDictionaryOfNotes:locallyDeletedNotes forSession:syncSession];
+	CFAbsoluteTime deletedNotesTime = CFAbsoluteTimeGetCurrent();
 	
 	for (i=0; i<[MDEntries count]; i++) {
 		NSDictionary *remoteEntry = [MDEntries objectAtIndex:i];
@@ -305,6 +383,10 @@
 			NSLog(@"Hmm! remote entry %@ has no key", remoteEntry);
 		}
 	}
+	CFAbsoluteTime remoteJoinTime = CFAbsoluteTimeGetCurrent();
+	NSLog(@"%s: reconciled %u local and %u remote notes in %.1f ms (remote index %.1f ms, local join %.1f ms, deleted notes %.1f ms, remote join %.1f ms)", 
+		  _cmd, [allNotes count], [MDEntries count], (remoteJoinTime - startTime) * 1000.0, (remoteIndexTime - startTime) * 1000.0, 
+		  (localJoinTime - remoteIndexTime) * 1000.0, (deletedNotesTime - localJoinTime) * 1000.0, (remoteJoinTime - deletedNotesTime) * 1000.0);
 	
 	//show this only if there is no evidence of these notes ever being on the server (all remotely removed with none manually deleted)
 	if ([remotelyMissingNotes count] && [allNotes count] == ([remotelyMissingNotes count] + [locallyAddedNotes count])) {
@@ -26,6 +26,7 @@
 	
     NSInteger (*sortFunction) (id*, id*);
     NSInteger (*reverseSortFunction) (id*, id*);
+	uint64_t (*sortKeyFunction) (id); //for columns that can be radix-sorted
     id (*objectAttribute) (id, id, NSInteger);
 	SEL mutateObjectSelector;
 	float absoluteMinimumWidth;
@@ -44,6 +45,8 @@ id (*dereferencingFunction(NoteAttributeColumn *col))(id, id, NSInteger);
 - (NSInteger (*)(id*, id*))sortFunction;
 - (void)setReverseSortingFunction:(NSInteger (*)(id*, id*))aFunction;
 - (NSInteger (*)(id*, id*))reverseSortFunction;
+- (void)setSortKeyFunction:(uint64_t (*)(id))aFunction;
+- (uint64_t (*)(id))sortKeyFunction;
 
 - (void)setResizingMaskNumber:(NSNumber*)resizingMaskNumber;
 
@@ -85,6 +85,14 @@ id columnAttributeForObject(NotesTableView *tv, NoteAttributeColumn *col, id obj
 - (NSInteger (*)(id*, id*))reverseSortFunction {
     return reverseSortFunction;
 }
+
+- (void)setSortKeyFunction:(uint64_t (*)(id))aFunction {
+	sortKeyFunction = aFunction;
+}
+
+- (uint64_t (*)(id))sortKeyFunction {
+	return sortKeyFunction;
+}
 id (*dereferencingFunction(NoteAttributeColumn *col))(id, id, NSInteger) {
 	return col->objectAttribute;
 }
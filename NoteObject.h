@@ -25,23 +25,74 @@
 #import "NotationController.h"
 #import "BufferUtils.h"
 #import "SynchronizedNoteProtocol.h"
+#import "TrigramIndex.h"
+#import "AhoCorasick.h"
+#import "TitlePrefixTrie.h"
 
 @class LabelObject;
 @class WALStorageController;
 @class NotesTableView;
 @class ExternalEditor;
+@class NoteRecordBody;
+@class NoteObject;
 
 typedef struct _NoteFilterContext {
 	char* needle;
 	BOOL useCachedPositions;
+	
+	//when non-NULL, notes indexed below candidateDocLimit that are absent from this bitmap cannot contain needle
+	const uint8_t *candidateDocs;
+	uint32_t candidateDocLimit;
+	
+	//for noteContainsAllUTF8Strings: every word to find, and the one whose positions the found-pointers should track
+	const ACAutomaton *matcher;
+	unsigned int trackedNeedle;
 } NoteFilterContext;
 
+//the search caches of a note as they were when a background search began; see captureNoteForSearch
+typedef struct _NoteSearchSnapshot {
+	NoteObject *note;
+	const char *title, *contents, *labels;
+	uint32_t searchDocID;
+} NoteSearchSnapshot;
+
+//approximate bytes held by notes, per kind of storage; see addMemoryUsageOfNote
+typedef struct _NoteMemoryUsage {
+	NSUInteger noteCount;
+	//bodies in memory, and those left in the record store until they are needed
+	NSUInteger bodyCount, storedBodyCount;
+	size_t bodyBytes;
+	//the lowercase caches and sort keys of titles, bodies and labels
+	size_t searchCacheBytes;
+	NSUInteger previewCount;
+	size_t previewBytes;
+} NoteMemoryUsage;
+
 @interface NoteObject : NSObject <NSCoding, SynchronizedNote> {
+	//made only when the table first draws this note; see tablePreviewOfNote()
 	NSAttributedString *tableTitleString;
+	//the width and layout for which tableTitleString was made (0 if it wasn't), and its neighbors in the recently-drawn list
+	uint32_t tablePreviewKey;
+	NoteObject *newerPreviewNote, *olderPreviewNote;
 	NSMutableAttributedString *contentString;
+	//where contentString is until it is first needed, for notes decoded from the record store; nil otherwise
+	NoteRecordBody *pendingBody;
+	//the base font that pendingBody was stored in, if the body font has changed since; the body is restyled from it when read
+	NSFont *pendingBodyBaseFont;
+	//set if pendingBody couldn't be read; the note then keeps pendingBody and must not be written anywhere else, see -hasReadableBody
+	OSStatus bodyReadError;
+	//set once the body's fonts or styles have been changed for display, until its record is written again; not set by a change
+	//of color, which every body is given again when it is read
+	BOOL bodyWasRestyled;
+	//contentDigestOfString() of the body, kept with the note so that syncing needn't read or hash it again
+	uint64_t bodyDigest;
+	BOOL hasBodyDigest;
 	
 	//caching/searching purposes only -- created at runtime
 	char *cTitle, *cContents, *cLabels, *cTitleFoundPtr, *cContentsFoundPtr, *cLabelsFoundPtr;
+	//binary collation keys for sorting by title or labels; created when first compared
+	char *cTitleSortKey, *cLabelsSortKey;
+	uint32_t searchDocID; //this note's document in the notation controller's trigram index, if any
 	NSMutableSet *labelSet;
 	BOOL contentsWere7Bit, contentCacheNeedsUpdate;
 	//if this note's title is "Chicken Shack menu listing", its prefix parent might have the title "Chicken Shack"
@@ -74,7 +125,6 @@ typedef struct _NoteFilterContext {
 	//each note has its own undo manager--isn't that nice?
 	NSUndoManager *undoManager;
 @public
-	NSMutableArray *prefixParentNotes;
 	NSString *filename;
 	NSString *titleString, *labelString;
 	UInt32 logicalSize;
@@ -101,6 +151,15 @@ NSInteger compareFilename(id *a, id *b);
 NSInteger compareNodeID(id *a, id *b);
 NSInteger compareFileSize(id *a, id *b);
 
+//keys for radix-sorting by date, ordered as the dates themselves
+uint64_t dateModifiedSortKeyOfNote(id note);
+uint64_t dateCreatedSortKeyOfNote(id note);
+
+//the CRC-32 of a string's UTF-8 bytes in the low word and their count in the high word
+uint64_t contentDigestOfString(NSString *string);
+//the digest of the concatenation of two strings, from the digests of each
+uint64_t contentDigestByAppending(uint64_t digest, uint64_t appendedDigest);
+
 //syncing w/ server and from journal
 - (CFUUIDBytes *)uniqueNoteIDBytes;
 - (NSDictionary*)syncServicesMD;
@@ -124,13 +183,14 @@ NSInteger compareFileSize(id *a, id *b);
 	NSString* titleOfNote(NoteObject *note);
 	NSString* labelsOfNote(NoteObject *note);
 
-	NSMutableArray* prefixParentsOfNote(NoteObject *note);
+	size_t prefixParentsOfNote(NoteObject *note, TitlePrefixTrie *trie, size_t minLength, NoteObject **parents, size_t maxParents);
 
 #define DefColAttrAccessor(__FName, __IVar) force_inline id __FName(NotesTableView *tv, NoteObject *note, NSInteger row) { return note->__IVar; }
 #define DefModelAttrAccessor(__FName, __IVar) force_inline typeof (((NoteObject *)0)->__IVar) __FName(NoteObject *note) { return note->__IVar; }
 
 	//return types are NSString or NSAttributedString, satisifying NSTableDataSource protocol otherwise
 	id titleOfNote2(NotesTableView *tv, NoteObject *note, NSInteger row);
+	NSAttributedString *tablePreviewOfNote(NoteObject *note);
 	id tableTitleOfNote(NotesTableView *tv, NoteObject *note, NSInteger row);
 	id properlyHighlightingTableTitleOfNote(NotesTableView *tv, NoteObject *note, NSInteger row);
 	id unifiedCellSingleLineForNote(NotesTableView *tv, NoteObject *note, NSInteger row);
@@ -142,14 +202,30 @@ NSInteger compareFileSize(id *a, id *b);
 
 	void resetFoundPtrsForNote(NoteObject *note);
 	BOOL noteContainsUTF8String(NoteObject *note, NoteFilterContext *context);
+	BOOL noteContainsAllUTF8Strings(NoteObject *note, NoteFilterContext *context);
+	void prepareNoteForContentSearch(NoteObject *note, NoteFilterContext *context);
+	void captureNoteForSearch(NoteObject *note, NoteSearchSnapshot *snapshot);
+	BOOL noteSnapshotContainsAllUTF8Strings(const NoteSearchSnapshot *snapshot, NoteFilterContext *context);
+	void beginReadingSearchCaches(void);
+	void endReadingSearchCaches(void);
 	BOOL noteTitleHasPrefixOfUTF8String(NoteObject *note, const char* fullString, size_t stringLen);
-	BOOL noteTitleIsAPrefixOfOtherNoteTitle(NoteObject *longerNote, NoteObject *shorterNote);
+
+	BOOL noteNeedsSearchIndexUpdate(NoteObject *note, TrigramIndex *index);
+	void updateSearchIndexForNote(NoteObject *note, TrigramIndex *index);
+	void invalidateSearchIndexForNote(NoteObject *note, TrigramIndex *index);
+	void removeNoteFromSearchIndex(NoteObject *note, TrigramIndex *index);
+	void updateTitlePrefixTrieForNote(NoteObject *note, TitlePrefixTrie *trie);
+	void addMemoryUsageOfNote(NoteObject *note, NoteMemoryUsage *usage);
 
 - (id)delegate;
 - (void)setDelegate:(id)theDelegate;
 - (id)initWithNoteBody:(NSAttributedString*)bodyText title:(NSString*)aNoteTitle 
 			  delegate:(id)aDelegate format:(int)formatID labels:(NSString*)aLabelString;
 - (id)initWithCatalogEntry:(NoteCatalogEntry*)entry delegate:(id)aDelegate;
+- (id)initWithCatalogEntry:(NoteCatalogEntry*)entry decodedContents:(NSMutableAttributedString*)decodedString 
+				  encoding:(NSStringEncoding)encoding delegate:(id)aDelegate;
++ (NSMutableAttributedString*)newContentStringFromData:(NSMutableData*)data inFormat:(int)fmt guessedEncoding:(NSStringEncoding*)encoding 
+											  fileRef:(FSRef*)fsRef bodyAttributes:(NSDictionary*)bodyAttributes;
 
 - (NSSet*)labelSet;
 - (void)replaceMatchingLabelSet:(NSSet*)aLabelSet;
@@ -169,6 +245,7 @@ NSInteger compareFileSize(id *a, id *b);
 - (void)removeAllSyncMDForService:(NSString*)serviceName;
 //- (void)removeKey:(NSString*)aKey forService:(NSString*)serviceName;
 - (void)updateWithSyncBody:(NSString*)newBody andTitle:(NSString*)newTitle;
+- (uint64_t)contentDigestWithSeparator:(NSString*)separator;
 - (void)registerModificationWithOwnedServices;
 
 - (OSStatus)writeCurrentFileEncodingToFSRef:(FSRef*)fsRef;
@@ -178,7 +255,9 @@ NSInteger compareFileSize(id *a, id *b);
 - (BOOL)upgradeEncodingToUTF8;
 - (BOOL)updateFromFile;
 - (BOOL)updateFromCatalogEntry:(NoteCatalogEntry*)catEntry;
+- (BOOL)updateFromCatalogEntry:(NoteCatalogEntry*)catEntry decodedContents:(NSMutableAttributedString*)decodedString encoding:(NSStringEncoding)encoding;
 - (BOOL)updateFromData:(NSMutableData*)data inFormat:(int)fmt;
+- (void)_setContentsFromFile:(NSMutableAttributedString*)attributedStringFromData;
 
 - (OSStatus)writeFileDatesAndUpdateTrackingInfo;
 
@@ -207,10 +286,21 @@ NSInteger compareFileSize(id *a, id *b);
 - (BOOL)_setTitleString:(NSString*)aNewTitle;
 - (void)setTitleString:(NSString*)aNewTitle;
 - (void)updateTablePreviewString;
+- (void)invalidateTablePreviewString;
 - (void)initContentCacheCString;
 - (void)updateContentCacheCStringIfNecessary;
 - (void)setContentString:(NSAttributedString*)attributedString;
 - (NSAttributedString*)contentString;
+- (void)setPendingBody:(NoteRecordBody*)aBody;
+- (BOOL)canReleaseContentString;
+- (void)releaseContentStringForBody:(NoteRecordBody*)aBody;
+- (BOOL)bodyWasRestyled;
+- (void)recordWasWritten;
+- (void)_readPendingBody;
+- (BOOL)hasReadableBody;
+- (NoteRecordBody*)pendingBody;
+- (const char*)contentsSearchCache;
+- (void)setContentsSearchCache:(const char*)cacheString length:(NSUInteger)length;
 - (NSAttributedString*)printableStringRelativeToBodyFont:(NSFont*)bodyFont;
 - (NSString*)combinedContentWithContextSeparator:(NSString*)sepWContext;
 - (void)setForegroundTextColorOnly:(NSColor*)aColor;
@@ -222,8 +312,6 @@ NSInteger compareFileSize(id *a, id *b);
 - (void)setSelectedRange:(NSRange)newRange;
 - (NSRange)lastSelectedRange;
 - (BOOL)contentsWere7Bit;
-- (void)addPrefixParentNote:(NoteObject*)aNote;
-- (void)removeAllPrefixParentNotes;
 - (void)previewUsingMarked;
 
 - (NSUndoManager*)undoManager;
@@ -235,5 +323,8 @@ NSInteger compareFileSize(id *a, id *b);
 - (void)note:(NoteObject*)note didAddLabelSet:(NSSet*)labelSet;
 - (void)note:(NoteObject*)note didRemoveLabelSet:(NSSet*)labelSet;
 - (void)note:(NoteObject*)note attributeChanged:(NSString*)attribute;
+- (void)noteDidUpdateSearchCaches:(NoteObject*)note;
+- (void)invalidateStoredRecordForNote:(NoteObject*)note;
+- (void)noteBodyCouldNotBeRead:(NoteObject*)note error:(OSStatus)err;
 @end
 
@@ -37,11 +37,14 @@
 #import "SyncSessionController.h"
 #import "ExternalEditorListController.h"
 #import "NSData_transformations.h"
+#import "NoteRecordStore.h"
 #import "NSCollection_utils.h"
 #import "NotesTableView.h"
 #import "UnifiedCell.h"
 #import "LabelColumnCell.h"
 #import "ODBEditor.h"
+#include "CRC32.h"
+#include <zlib.h>
 
 #if __LP64__
 // Needed for compatability with data created by 32bit app
@@ -53,6 +56,37 @@ typedef struct NSRange32 {
 typedef NSRange NSRange32;
 #endif
 
+//search caches replaced while a background search may still be reading them are freed only once no such search remains
+static NSUInteger searchCacheReaderCount = 0;
+static char **retiredSearchCaches = NULL;
+static size_t retiredSearchCacheCount = 0, retiredSearchCacheCapacity = 0;
+
+static char *replaceSearchCache(char *oldCache, const char *newString) {
+	if (!searchCacheReaderCount || !oldCache)
+		return replaceString(oldCache, newString);
+	
+	if (retiredSearchCacheCount == retiredSearchCacheCapacity) {
+		retiredSearchCacheCapacity = MAX(retiredSearchCacheCapacity * 2, 64);
+		retiredSearchCaches = (char**)realloc(retiredSearchCaches, retiredSearchCacheCapacity * sizeof(char*));
+	}
+	retiredSearchCaches[retiredSearchCacheCount++] = oldCache;
+	
+	return strdup(newString);
+}
+
+void beginReadingSearchCaches(void) {
+	searchCacheReaderCount++;
+}
+
+void endReadingSearchCaches(void) {
+	if (searchCacheReaderCount && !--searchCacheReaderCount) {
+		size_t i;
+		for (i=0; i<retiredSearchCacheCount; i++)
+			free(retiredSearchCaches[i]);
+		retiredSearchCacheCount = 0;
+	}
+}
+
 @implementation NoteObject
 
 static FSRef *noteFileRefInit(NoteObject* obj);
@@ -81,7 +115,7 @@ static void setCatalogNodeID(NoteObject *note, UInt32 cnid);
 	
 	[self invalidateFSRef];
 	
-	[tableTitleString release];
+	[self invalidateTablePreviewString];
 	[titleString release];
 	[labelString release];
 	[labelSet release];
@@ -89,7 +123,6 @@ static void setCatalogNodeID(NoteObject *note, UInt32 cnid);
 	[filename release];
 	[dateModifiedString release];
 	[dateCreatedString release];
-	[prefixParentNotes release];
 	
 	if (perDiskInfoGroups)
 		free(perDiskInfoGroups);
@@ -100,6 +133,13 @@ static void setCatalogNodeID(NoteObject *note, UInt32 cnid);
 		free(cContents);
 	if (cLabels)
 	    free(cLabels);
+	if (cTitleSortKey)
+		free(cTitleSortKey);
+	if (cLabelsSortKey)
+		free(cLabelsSortKey);
+	
+	[pendingBody release];
+	[pendingBodyBaseFont release];
 	
 	[super dealloc];
 }
@@ -115,11 +155,16 @@ static void setCatalogNodeID(NoteObject *note, UInt32 cnid);
 		
 		//do things that ought to have been done during init, but were not possible due to lack of delegate information
 		if (!filename) filename = [[delegate uniqueFilenameForTitle:titleString fromNote:self] retain];
-		if (!tableTitleString && !didUnarchive) [self updateTablePreviewString];
 		if (!labelSet && !didUnarchive) [self updateLabelConnectionsAfterDecoding];
 	}
 }
 
+- (void)_syncServicesMDDidChange {
+	//sync metadata changes don't dirty the note, but must still be stored with it
+	[delegate invalidateStoredRecordForNote:self];
+	[delegate updateNoteInSyncKeyIndexes:self];
+}
+
 static FSRef *noteFileRefInit(NoteObject* obj) {
 	if (!(obj->noteFileRef)) {
 		obj->noteFileRef = (FSRef*)calloc(1, sizeof(FSRef));
@@ -182,31 +227,52 @@ NSInteger compareFilename(id *one, id *two) {
 				(CFStringRef)((*(NoteObject**)two)->filename), kCFCompareCaseInsensitive);
 }
 
+static const char *titleSortKeyOfNote(NoteObject *note) {
+	if (!note->cTitleSortKey) {
+		const char *key = [titleOfNote(note) collationKeyUTF8String];
+		note->cTitleSortKey = strdup(key ? key : "");
+	}
+	return note->cTitleSortKey;
+}
+
+static const char *labelsSortKeyOfNote(NoteObject *note) {
+	if (!note->cLabelsSortKey) {
+		const char *key = [labelsOfNote(note) collationKeyUTF8String];
+		note->cLabelsSortKey = strdup(key ? key : "");
+	}
+	return note->cLabelsSortKey;
+}
+
+static inline NSInteger compareAbsoluteTimes(CFAbsoluteTime t1, CFAbsoluteTime t2) {
+	return t1 < t2 ? -1 : (t1 > t2 ? 1 : 0);
+}
+
+//each comparator falls back to the title (and then creation date and UUID), so that sorting by any column takes only one pass
+
 NSInteger compareDateModified(id *a, id *b) {
-    return (*(NoteObject**)a)->modifiedDate - (*(NoteObject**)b)->modifiedDate;
+	NSInteger dateResult = compareAbsoluteTimes((*(NoteObject**)a)->modifiedDate, (*(NoteObject**)b)->modifiedDate);
+	return dateResult ? dateResult : compareTitleString(a, b);
 }
 NSInteger compareDateCreated(id *a, id *b) {
-    return (*(NoteObject**)a)->createdDate - (*(NoteObject**)b)->createdDate;
+	NSInteger dateResult = compareAbsoluteTimes((*(NoteObject**)a)->createdDate, (*(NoteObject**)b)->createdDate);
+	return dateResult ? dateResult : compareTitleString(a, b);
 }
 NSInteger compareLabelString(id *a, id *b) {    
-    return (NSInteger)CFStringCompare((CFStringRef)(labelsOfNote(*(NoteObject **)a)), 
-								(CFStringRef)(labelsOfNote(*(NoteObject **)b)), kCFCompareCaseInsensitive);
+	NSInteger stringResult = strcmp(labelsSortKeyOfNote(*(NoteObject**)a), labelsSortKeyOfNote(*(NoteObject**)b));
+	return stringResult ? stringResult : compareTitleString(a, b);
 }
 NSInteger compareTitleString(id *a, id *b) {
 	//add kCFCompareNumerically to options for natural order sort
-    CFComparisonResult stringResult = CFStringCompare((CFStringRef)(titleOfNote(*(NoteObject**)a)), 
-													  (CFStringRef)(titleOfNote(*(NoteObject**)b)), 
-													  kCFCompareCaseInsensitive);
-	if (stringResult == kCFCompareEqualTo) {
+	NSInteger stringResult = strcmp(titleSortKeyOfNote(*(NoteObject**)a), titleSortKeyOfNote(*(NoteObject**)b));
+	if (!stringResult) {
 		
-		NSInteger dateResult = compareDateCreated(a, b);
+		NSInteger dateResult = compareAbsoluteTimes((*(NoteObject**)a)->createdDate, (*(NoteObject**)b)->createdDate);
 		if (!dateResult)
 			return compareUniqueNoteIDBytes(a, b);
 		
 		return dateResult;
 	}
-	
-	return (NSInteger)stringResult;
+	return stringResult;
 }
 NSInteger compareUniqueNoteIDBytes(id *a, id *b) {
 	return memcmp((&(*(NoteObject**)a)->uniqueNoteIDBytes), (&(*(NoteObject**)b)->uniqueNoteIDBytes), sizeof(CFUUIDBytes));
@@ -214,28 +280,41 @@ NSInteger compareUniqueNoteIDBytes(id *a, id *b) {
 
 
 NSInteger compareDateModifiedReverse(id *a, id *b) {
-    return (*(NoteObject**)b)->modifiedDate - (*(NoteObject**)a)->modifiedDate;
+	NSInteger dateResult = compareAbsoluteTimes((*(NoteObject**)b)->modifiedDate, (*(NoteObject**)a)->modifiedDate);
+	return dateResult ? dateResult : compareTitleStringReverse(a, b);
 }
 NSInteger compareDateCreatedReverse(id *a, id *b) {
-    return (*(NoteObject**)b)->createdDate - (*(NoteObject**)a)->createdDate;
+	NSInteger dateResult = compareAbsoluteTimes((*(NoteObject**)b)->createdDate, (*(NoteObject**)a)->createdDate);
+	return dateResult ? dateResult : compareTitleStringReverse(a, b);
 }
 NSInteger compareLabelStringReverse(id *a, id *b) {    
-    return (NSInteger)CFStringCompare((CFStringRef)(labelsOfNote(*(NoteObject **)b)), 
-								(CFStringRef)(labelsOfNote(*(NoteObject **)a)), kCFCompareCaseInsensitive);
+	NSInteger stringResult = strcmp(labelsSortKeyOfNote(*(NoteObject**)b), labelsSortKeyOfNote(*(NoteObject**)a));
+	return stringResult ? stringResult : compareTitleStringReverse(a, b);
 }
 NSInteger compareTitleStringReverse(id *a, id *b) {
-    CFComparisonResult stringResult = CFStringCompare((CFStringRef)(titleOfNote(*(NoteObject **)b)), 
-													  (CFStringRef)(titleOfNote(*(NoteObject **)a)), 
-													  kCFCompareCaseInsensitive);
+	NSInteger stringResult = strcmp(titleSortKeyOfNote(*(NoteObject**)b), titleSortKeyOfNote(*(NoteObject**)a));
 	
-	if (stringResult == kCFCompareEqualTo) {
-		NSInteger dateResult = compareDateCreatedReverse(a, b);
+	if (!stringResult) {
+		NSInteger dateResult = compareAbsoluteTimes((*(NoteObject**)b)->createdDate, (*(NoteObject**)a)->createdDate);
 		if (!dateResult)
 			return compareUniqueNoteIDBytes(b, a);
 		
 		return dateResult;
 	}
-	return (NSInteger)stringResult;	
+	return stringResult;
+}
+
+static uint64_t sortKeyOfAbsoluteTime(CFAbsoluteTime time) {
+	//flip the sign bit of positive values and every bit of negative ones, so that the keys order as the doubles do
+	uint64_t bits;
+	memcpy(&bits, &time, sizeof(bits));
+	return (bits & 0x8000000000000000ULL) ? ~bits : (bits | 0x8000000000000000ULL);
+}
+uint64_t dateModifiedSortKeyOfNote(id note) {
+	return sortKeyOfAbsoluteTime(((NoteObject*)note)->modifiedDate);
+}
+uint64_t dateCreatedSortKeyOfNote(id note) {
+	return sortKeyOfAbsoluteTime(((NoteObject*)note)->createdDate);
 }
 
 NSInteger compareNodeID(id *a, id *b) {
@@ -259,23 +338,66 @@ DefModelAttrAccessor(modifiedDateOfNote, modifiedDate)
 DefModelAttrAccessor(createdDateOfNote, createdDate)
 DefModelAttrAccessor(storageFormatOfNote, currentFormatID)
 DefModelAttrAccessor(fileEncodingOfNote, fileEncoding)
-DefModelAttrAccessor(prefixParentsOfNote, prefixParentNotes)
 
 //DefColAttrAccessor(wordCountOfNote, wordCountString)
 DefColAttrAccessor(titleOfNote2, titleString)
 DefColAttrAccessor(dateCreatedStringOfNote, dateCreatedString)
 DefColAttrAccessor(dateModifiedStringOfNote, dateModifiedString)
 
+//notes whose previews have been made, from most to least recently drawn; the previews of the least recently drawn
+//are released beyond kMaxCachedTablePreviews, so that only about a screenful of notes ever needs a preview at once
+#define kMaxCachedTablePreviews 2000
+static NoteObject *newestPreviewNote = nil, *oldestPreviewNote = nil;
+static NSUInteger cachedTablePreviewCount = 0;
+
+static void unlinkPreviewNote(NoteObject *note) {
+	if (note->newerPreviewNote) note->newerPreviewNote->olderPreviewNote = note->olderPreviewNote;
+	else newestPreviewNote = note->olderPreviewNote;
+	if (note->olderPreviewNote) note->olderPreviewNote->newerPreviewNote = note->newerPreviewNote;
+	else oldestPreviewNote = note->newerPreviewNote;
+	note->newerPreviewNote = note->olderPreviewNote = nil;
+}
+
+static void linkNewestPreviewNote(NoteObject *note) {
+	note->olderPreviewNote = newestPreviewNote;
+	note->newerPreviewNote = nil;
+	if (newestPreviewNote) newestPreviewNote->newerPreviewNote = note;
+	else oldestPreviewNote = note;
+	newestPreviewNote = note;
+}
+
+NSAttributedString *tablePreviewOfNote(NoteObject *note) {
+	//the delegate's key changes with the width of the title column, the layout and anything else that affects previews
+	uint32_t key = [note->delegate tablePreviewKey];
+	
+	if (note->tablePreviewKey != key) {
+		[note invalidateTablePreviewString];
+		[note updateTablePreviewString];
+		
+		if ((note->tablePreviewKey = key)) {
+			linkNewestPreviewNote(note);
+			if (++cachedTablePreviewCount > kMaxCachedTablePreviews)
+				[oldestPreviewNote invalidateTablePreviewString];
+		}
+	} else if (key && note != newestPreviewNote) {
+		unlinkPreviewNote(note);
+		linkNewestPreviewNote(note);
+	}
+	return note->tableTitleString;
+}
+
 force_inline id tableTitleOfNote(NotesTableView *tv, NoteObject *note, NSInteger row) {
-	if (note->tableTitleString) return note->tableTitleString;
+	NSAttributedString *preview = tablePreviewOfNote(note);
+	if (preview) return preview;
 	return titleOfNote(note);
 }
 force_inline id properlyHighlightingTableTitleOfNote(NotesTableView *tv, NoteObject *note, NSInteger row) {
-	if (note->tableTitleString) {
+	NSAttributedString *preview = tablePreviewOfNote(note);
+	if (preview) {
 		if ([tv isRowSelected:row]) {
-			return [note->tableTitleString string];
+			return [preview string];
 		}
-		return note->tableTitleString;
+		return preview;
 	}	
 	return titleOfNote(note);
 }
@@ -290,7 +412,8 @@ force_inline id labelColumnCellForNote(NotesTableView *tv, NoteObject *note, NSI
 
 force_inline id unifiedCellSingleLineForNote(NotesTableView *tv, NoteObject *note, NSInteger row) {
 	
-	id obj = note->tableTitleString ? (id)note->tableTitleString : (id)titleOfNote(note);
+	NSAttributedString *preview = tablePreviewOfNote(note);
+	id obj = preview ? (id)preview : (id)titleOfNote(note);
 	
 	UnifiedCell *cell = [[[tv tableColumns] objectAtIndex:0] dataCellForRow:row];
 	[cell setNoteObject:note];
@@ -310,8 +433,9 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 	BOOL rowSelected = [tv isRowSelected:row];
 	BOOL drawShadow = IsSnowLeopardOrLater || (IsLeopardOrLater && rowSelected && [tv currentEditor]);
 	
-	id obj = note->tableTitleString ? (rowSelected ? (id)AttributedStringForSelection(note->tableTitleString, drawShadow) : 
-									   (id)note->tableTitleString) : (id)titleOfNote(note);
+	NSAttributedString *preview = tablePreviewOfNote(note);
+	id obj = preview ? (rowSelected ? (id)AttributedStringForSelection(preview, drawShadow) : 
+									   (id)preview) : (id)titleOfNote(note);
 	
 	
 	return obj;
@@ -362,7 +486,13 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 			
 			titleString = [[decoder decodeObjectForKey:VAR_STR(titleString)] retain];
 			labelString = [[decoder decodeObjectForKey:VAR_STR(labelString)] retain];
-			contentString = [[NSMutableAttributedString alloc] initWithAttributedString: [decoder decodeObjectForKey:VAR_STR(contentString)]];
+			//absent when the record store keeps the body separately; see -setPendingBody:
+			NSAttributedString *decodedContent = [decoder decodeObjectForKey:VAR_STR(contentString)];
+			if (decodedContent) contentString = [[NSMutableAttributedString alloc] initWithAttributedString:decodedContent];
+			if ([decoder containsValueForKey:VAR_STR(bodyDigest)]) {
+				bodyDigest = (uint64_t)[decoder decodeInt64ForKey:VAR_STR(bodyDigest)];
+				hasBodyDigest = YES;
+			}
 			filename = [[decoder decodeObjectForKey:VAR_STR(filename)] retain];
 			
 		} else {
@@ -424,7 +554,7 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 		}
 	
 		//re-created at runtime to save space
-		[self initContentCacheCString];
+		if (contentString) [self initContentCacheCString];
 		cTitleFoundPtr = cTitle = titleString ? strdup([titleString lowercaseUTF8String]) : NULL;
 		cLabelsFoundPtr = cLabels = labelString ? strdup([labelString lowercaseUTF8String]) : NULL;
 		
@@ -437,6 +567,10 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 }
 
 - (void)encodeWithCoder:(NSCoder *)coder {
+	
+	//the record store archives the body in its own part of the record, copying it unread if the note still has it pending
+	if (![coder isKindOfClass:[NSKeyedArchiver class]] || ![[(NSKeyedArchiver*)coder delegate] isKindOfClass:[NoteRecordStore class]])
+		[self _readPendingBody];
 		
 	if ([coder allowsKeyedCoding]) {
 		
@@ -468,6 +602,13 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 		[coder encodeObject:contentString forKey:VAR_STR(contentString)];
 		[coder encodeObject:filename forKey:VAR_STR(filename)];
 		
+		if (!hasBodyDigest && contentString) {
+			bodyDigest = contentDigestOfString([contentString string]);
+			hasBodyDigest = YES;
+		}
+		//a body still pending has no digest until one is asked for, and a zero would be taken for one when decoded
+		if (hasBodyDigest) [coder encodeInt64:(int64_t)bodyDigest forKey:VAR_STR(bodyDigest)];
+		
 	} else {
 // 64bit encoding would break 32bit reading - keyed archives should be used
 #if !__LP64__
@@ -540,9 +681,6 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 		createdDate = modifiedDate = CFAbsoluteTimeGetCurrent();
 		dateCreatedString = [dateModifiedString = [[NSString relativeDateStringWithAbsoluteTime:modifiedDate] retain] retain];
 		UCConvertCFAbsoluteTimeToUTCDateTime(modifiedDate, &fileModifiedDate);
-		
-		if (delegate)
-			[self updateTablePreviewString];
     }
     
     return self;
@@ -551,6 +689,12 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 //only get the fsrefs until we absolutely need them
 
 - (id)initWithCatalogEntry:(NoteCatalogEntry*)entry delegate:(id)aDelegate {
+	return [self initWithCatalogEntry:entry decodedContents:nil encoding:0 delegate:aDelegate];
+}
+
+//decodedString, if not nil, holds the file's contents as already read and decoded (e.g., on another thread) with +newContentStringFromData:...
+- (id)initWithCatalogEntry:(NoteCatalogEntry*)entry decodedContents:(NSMutableAttributedString*)decodedString 
+				  encoding:(NSStringEncoding)encoding delegate:(id)aDelegate {
 	NSAssert(aDelegate != nil, @"must supply a delegate");
     if ([self init]) {
 		delegate = aDelegate;
@@ -574,7 +718,7 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 		contentString = [[NSMutableAttributedString alloc] initWithString:@""];
 		[self initContentCacheCString];
 		
-		if (![self updateFromCatalogEntry:entry]) {						
+		if (![self updateFromCatalogEntry:entry decodedContents:decodedString encoding:encoding]) {
 			//just initialize a blank note for now; if the file becomes readable again we'll be updated
 			//but if we make modifications, well, the original is toast
 			//so warn the user here and offer to trash it?
@@ -587,8 +731,6 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 			dateModifiedString = [dateCreatedString = [[NSString relativeDateStringWithAbsoluteTime:createdDate] retain] retain];	
 		}
     }
-	
-	[self updateTablePreviewString];
     
     return self;
 }
@@ -600,9 +742,20 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 
 - (void)setContentString:(NSAttributedString*)attributedString updateTime:(BOOL)updateTime {
 	if (attributedString) {
+		[self _readPendingBody];
+		if (bodyReadError != noErr) {
+			//a body given explicitly (e.g., by a sync service) replaces the one that couldn't be read
+			contentString = [[NSMutableAttributedString alloc] init];
+			[pendingBody release];
+			pendingBody = nil;
+			[pendingBodyBaseFont release];
+			pendingBodyBaseFont = nil;
+			bodyReadError = noErr;
+		}
 		[contentString setAttributedString:attributedString];
+		hasBodyDigest = bodyWasRestyled = NO;
 		
-		[self updateTablePreviewString];
+		[self invalidateTablePreviewString];
 		contentCacheNeedsUpdate = YES;
 		//[self updateContentCacheCStringIfNecessary];
 		
@@ -612,18 +765,140 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 	}
 }
 - (NSAttributedString*)contentString {
-	return contentString;
+	[self _readPendingBody];
+	//a body that couldn't be read is shown as empty, but never stored that way
+	return contentString ? contentString : [[[NSAttributedString alloc] initWithString:@""] autorelease];
+}
+
+- (NoteRecordBody*)pendingBody {
+	return pendingBody;
+}
+
+- (void)setPendingBody:(NoteRecordBody*)aBody {
+	[pendingBody autorelease];
+	pendingBody = [aBody retain];
+}
+
+- (BOOL)canReleaseContentString {
+	//a body can be read again later only if it has been read in, its search cache is current and it has nothing to undo
+	return contentString && !pendingBody && cContents && !contentCacheNeedsUpdate && !bodyWasRestyled &&
+		![undoManager canUndo] && ![undoManager canRedo];
+}
+
+- (BOOL)bodyWasRestyled {
+	return bodyWasRestyled;
+}
+
+- (void)_bodyWasRestyled {
+	//the stored record is written again at the next flush, after which the body can be released
+	bodyWasRestyled = YES;
+	[delegate invalidateStoredRecordForNote:self];
+}
+
+- (void)recordWasWritten {
+	//the record now holds the body as it is in memory
+	bodyWasRestyled = NO;
+}
+
+- (void)releaseContentStringForBody:(NoteRecordBody*)aBody {
+	//the search cache is kept, so that searching never has to read the body back in
+	[contentString release];
+	contentString = nil;
+	[self setPendingBody:aBody];
+}
+
+- (void)_pendingBodyCouldNotBeRead:(OSStatus)err {
+	//the body stays pending, so that its record can still be copied as it is, and the note stays out of every other write
+	NSLog(@"couldn't read the body of note %@ (error %d)", titleString, (int)err);
+	bodyReadError = err != noErr ? err : kCoderErr;
+	[delegate noteBodyCouldNotBeRead:self error:bodyReadError];
+}
+
+- (char*)_copyContentsCacheOfPendingBody {
+	//the lowercase contents of the pending body, without keeping the body itself
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	OSStatus err = noErr;
+	NSMutableAttributedString *body = bodyReadError == noErr ? [[pendingBody copyBodyReturningError:&err] autorelease] : nil;
+	if (!body && bodyReadError == noErr)
+		[self _pendingBodyCouldNotBeRead:err];
+	const char *cStringData = [[body string] lowercaseUTF8String];
+	char *contents = strdup(cStringData ? cStringData : "");
+	[pool release];
+	
+	return contents;
+}
+
+- (void)_readPendingBody {
+	if (!pendingBody || bodyReadError != noErr) return;
+	
+	OSStatus err = noErr;
+	if (!(contentString = [pendingBody copyBodyReturningError:&err])) {
+		[self _pendingBodyCouldNotBeRead:err];
+		return;
+	}
+	[pendingBody release];
+	pendingBody = nil;
+	
+	//the display styles that changed while the body was pending, which -setForegroundTextColorOnly: and
+	//-updateUnstyledTextWithBaseFont: left for now so as not to read it
+	if (pendingBodyBaseFont) {
+		[contentString restyleTextToFont:[[GlobalPrefs defaultPrefs] noteBodyFont] usingBaseFont:pendingBodyBaseFont];
+		[pendingBodyBaseFont release];
+		pendingBodyBaseFont = nil;
+		[self _bodyWasRestyled];
+	}
+	NSColor *fgColor = [delegate foregroundTextColor];
+	if (fgColor) [contentString addAttribute:NSForegroundColorAttributeName value:fgColor range:NSMakeRange(0, [contentString length])];
+	
+	//a search may have already cached the contents
+	if (!cContents) [self initContentCacheCString];
+}
+
+- (const char*)contentsSearchCache {
+	//the body is read only for a record that was stored without its search cache, and is not kept
+	if (contentString) {
+		[self updateContentCacheCStringIfNecessary];
+	} else if (pendingBody && !cContents) {
+		char *contents = [self _copyContentsCacheOfPendingBody];
+		if (bodyReadError != noErr) {
+			free(contents);
+			return NULL;
+		}
+		cContentsFoundPtr = cContents = contents;
+		contentsWere7Bit = !ContainsHighAscii(cContents, strlen(cContents));
+	}
+	return cContents;
+}
+
+- (void)setContentsSearchCache:(const char*)cacheString length:(NSUInteger)length {
+	//as stored with the note's record, so that a pending body need not be read to search or index it
+	if (cContents || contentString) return;
+	
+	if ((cContents = (char*)malloc(length + 1))) {
+		memcpy(cContents, cacheString, length);
+		cContents[length] = '\0';
+		contentsWere7Bit = !ContainsHighAscii(cContents, length);
+	}
+	cContentsFoundPtr = cContents;
+}
+
+- (BOOL)hasReadableBody {
+	//NO if the stored body couldn't be read, in which case writing the note anywhere but its own record would lose the body
+	[self _readPendingBody];
+	return bodyReadError == noErr;
 }
 
 - (void)updateContentCacheCStringIfNecessary {
 	if (contentCacheNeedsUpdate) {
 		//NSLog(@"updating ccache strs");
-		cContentsFoundPtr = cContents = replaceString(cContents, [[contentString string] lowercaseUTF8String]);
+		cContentsFoundPtr = cContents = replaceSearchCache(cContents, [[contentString string] lowercaseUTF8String]);
 		contentCacheNeedsUpdate = NO;
 		
 		int len = strlen(cContents);
 		contentsWere7Bit = !(ContainsHighAscii(cContents, len));
 		
+		[delegate noteDidUpdateSearchCaches:self];
+		
 		//could cache dumbwordcount here for faster launch, but string creation takes more time, anyway
 		//if (wordCountString) CFRelease((CFStringRef*)wordCountString); //this is CFString, so bridge will just call back to CFRelease, anyway
 		//wordCountString = (NSString*)CFStringFromBase10Integer(DumbWordCount(cContents, len));
@@ -665,7 +940,7 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 	//if separator does not exist or chars do not match trailing and leading chars of title and body, respectively,
 	//then just delimit with a double-newline
 	
-	NSString *content = [contentString string];
+	NSString *content = [[self contentString] string];
 	
 	BOOL defaultJoin = NO;
 	if (![sepWContext length] || ![content length] || ![titleString length] || 
@@ -713,20 +988,36 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 	return largeAttributedTitleString;
 }
 
+- (void)invalidateTablePreviewString {
+	//the preview will be made again when the table next draws this note
+	if (tablePreviewKey) {
+		unlinkPreviewNote(self);
+		cachedTablePreviewCount--;
+		tablePreviewKey = 0;
+	}
+	[tableTitleString release];
+	tableTitleString = nil;
+}
+
 - (void)updateTablePreviewString {
-	//delegate required for this method
+	//delegate required for this method; called only by tablePreviewOfNote()
 	[tableTitleString release];
 	GlobalPrefs *prefs = [GlobalPrefs defaultPrefs];
+	NSAttributedString *previewBody = contentString;
+	if (pendingBody) {
+		//a body that hasn't been read yet is previewed from the excerpt stored along with the note
+		previewBody = [[[NSAttributedString alloc] initWithString:[pendingBody excerpt] ? [pendingBody excerpt] : @""] autorelease];
+	}
 
 	if ([prefs tableColumnsShowPreview]) {
 		if ([prefs horizontalLayout]) {
 			//is called for visible notes at launch and resize only, generation of images for invisible notes is delayed until after launch
 			
 			NSSize labelBlockSize = ColumnIsSet(NoteLabelsColumn, [prefs tableColumnsBitmap]) ? [self sizeOfLabelBlocks] : NSZeroSize;
-			tableTitleString = [[titleString attributedMultiLinePreviewFromBodyText:contentString upToWidth:[delegate titleColumnWidth] 
+			tableTitleString = [[titleString attributedMultiLinePreviewFromBodyText:previewBody upToWidth:[delegate titleColumnWidth] 
 																	 intrusionWidth:labelBlockSize.width] retain];
 		} else {
-			tableTitleString = [[titleString attributedSingleLinePreviewFromBodyText:contentString upToWidth:[delegate titleColumnWidth]] retain];
+			tableTitleString = [[titleString attributedSingleLinePreviewFromBodyText:previewBody upToWidth:[delegate titleColumnWidth]] retain];
 		}
 	} else {
 		if ([prefs horizontalLayout]) {
@@ -766,7 +1057,7 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 		//and thus the format ID will be changed if that was the case
 		[self makeNoteDirtyUpdateTime:YES updateFile:YES];
 		
-		[self updateTablePreviewString];
+		[self invalidateTablePreviewString];
 		
 		/*NSUndoManager *undoMan = [delegate undoManager];
 		[undoMan registerUndoWithTarget:self selector:@selector(setTitleString:) object:oldTitle];
@@ -786,7 +1077,12 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
     [titleString release];
     titleString = [aNewTitle copy];
     
-    cTitleFoundPtr = cTitle = replaceString(cTitle, [titleString lowercaseUTF8String]);
+    cTitleFoundPtr = cTitle = replaceSearchCache(cTitle, [titleString lowercaseUTF8String]);
+	if (cTitleSortKey) {
+		free(cTitleSortKey);
+		cTitleSortKey = NULL;
+	}
+	[delegate noteDidUpdateSearchCaches:self];
     
     return YES;
 }
@@ -813,7 +1109,7 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 		} else {
 			[self _setTitleString:[aString stringByDeletingPathExtension]];	
 			
-			[self updateTablePreviewString];
+			[self invalidateTablePreviewString];
 			[delegate note:self attributeChanged:NoteTitleColumnString];
 		}
 		
@@ -828,6 +1124,8 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 
 - (void)setForegroundTextColorOnly:(NSColor*)aColor {
 	//called when notationPrefs font doesn't match globalprefs font, or user changes the font
+	//a pending body is given the controller's color when it is read
+	if (pendingBody) return;
 	[contentString removeAttribute:NSForegroundColorAttributeName range:NSMakeRange(0, [contentString length])];
 	if (aColor) {
 		[contentString addAttribute:NSForegroundColorAttributeName value:aColor range:NSMakeRange(0, [contentString length])];
@@ -835,7 +1133,9 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 }
 
 - (void)_resanitizeContent {
+	[self _readPendingBody];
 	[contentString santizeForeignStylesForImporting];
+	[self _bodyWasRestyled];
 	
 	//renormalize the title, in case it is still somehow derived from decomposed HFS+ filenames
 	CFMutableStringRef normalizedString = CFStringCreateMutableCopy(NULL, 0, (CFStringRef)titleString);
@@ -851,9 +1151,16 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 //how do we write a thousand RTF files at once, repeatedly? 
 
 - (void)updateUnstyledTextWithBaseFont:(NSFont*)baseFont {
-
+	
+	if (pendingBody && [delegate currentNoteStorageFormat] != RTFTextFormat) {
+		//restyled from the font of its stored record when it is read; only an RTF file must be rewritten in the new font now
+		if (!pendingBodyBaseFont) pendingBodyBaseFont = [baseFont retain];
+		return;
+	}
+	[self _readPendingBody];
 	if ([contentString restyleTextToFont:[[GlobalPrefs defaultPrefs] noteBodyFont] usingBaseFont:baseFont] > 0) {
 		[undoManager removeAllActions];
+		[self _bodyWasRestyled];
 		
 		if ([delegate currentNoteStorageFormat] == RTFTextFormat)
 			[self makeNoteDirtyUpdateTime:NO updateFile:YES];
@@ -890,7 +1197,7 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 	
 	//don't save the range if it's invalid, it's equal to the current range, or the entire note is selected
 	if ((newRange.location != NSNotFound) && !NSEqualRanges(newRange, selectedRange) && 
-		!NSEqualRanges(newRange, NSMakeRange(0, [contentString length]))) {
+		!NSEqualRanges(newRange, NSMakeRange(0, [[self contentString] length]))) {
 	//	NSLog(@"saving: old range: %@, new range: %@", NSStringFromRange(selectedRange), NSStringFromRange(newRange));
 		selectedRange = newRange;
 		[self makeNoteDirtyUpdateTime:NO updateFile:NO];
@@ -969,7 +1276,12 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 		[labelString release];
 		labelString = [newLabelString copy];
 		
-		cLabelsFoundPtr = cLabels = replaceString(cLabels, [labelString lowercaseUTF8String]);
+		cLabelsFoundPtr = cLabels = replaceSearchCache(cLabels, [labelString lowercaseUTF8String]);
+		if (cLabelsSortKey) {
+			free(cLabelsSortKey);
+			cLabelsSortKey = NULL;
+		}
+		[delegate noteDidUpdateSearchCaches:self];
 		
 		[self updateLabelConnections];
 		return YES;
@@ -982,7 +1294,7 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 	if ([self _setLabelString:newLabelString]) {
 	
 		if ([[GlobalPrefs defaultPrefs] horizontalLayout]) {
-			[self updateTablePreviewString];
+			[self invalidateTablePreviewString];
 		}
 		
 		[self makeNoteDirtyUpdateTime:YES updateFile:YES];
@@ -1172,6 +1484,11 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
     NSError *error = nil;
 	NSMutableAttributedString *contentMinusColor = nil;
 	
+	if (![self hasReadableBody]) {
+		NSLog(@"not writing note %@ to a file, as its body could not be read", titleString);
+		return NO;
+	}
+	
     int formatID = [delegate currentNoteStorageFormat];
     switch (formatID) {
 		case SingleDatabaseFormat:
@@ -1409,16 +1726,25 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 }
 
 - (BOOL)updateFromCatalogEntry:(NoteCatalogEntry*)catEntry {
+	return [self updateFromCatalogEntry:catEntry decodedContents:nil encoding:0];
+}
+
+- (BOOL)updateFromCatalogEntry:(NoteCatalogEntry*)catEntry decodedContents:(NSMutableAttributedString*)decodedString encoding:(NSStringEncoding)encoding {
 	BOOL didRestoreLabels = NO;
 	
-    NSMutableData *data = [delegate dataFromFileInNotesDirectory:noteFileRefInit(self) forCatalogEntry:catEntry];
-    if (!data) {
-		NSLog(@"Couldn't update note from file on disk given catalog entry");
-		return NO;
-    }
-	    
-    if (![self updateFromData:data inFormat:currentFormatID])
-		return NO;
+	if (decodedString) {
+		fileEncoding = encoding;
+		[self _setContentsFromFile:decodedString];
+	} else {
+		NSMutableData *data = [delegate dataFromFileInNotesDirectory:noteFileRefInit(self) forCatalogEntry:catEntry];
+		if (!data) {
+			NSLog(@"Couldn't update note from file on disk given catalog entry");
+			return NO;
+		}
+		
+		if (![self updateFromData:data inFormat:currentFormatID])
+			return NO;
+	}
 	
 	[self setFilename:(NSString*)catEntry->filename withExternalTrigger:YES];
     
@@ -1434,7 +1760,7 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 		if (openMetaTags) {
 			//overwrite this note's labels with those from the file; merging may be the wrong thing to do here
 			if ([self _setLabelString:[openMetaTags componentsJoinedByString:@" "]])
-				[self updateTablePreviewString];
+				[self invalidateTablePreviewString];
 		} else if ([labelString length]) {
 			//this file has either never had tags or has had them cleared by accident (e.g., non-user intervention)
 			//so if this note still has tags, then restore them now.
@@ -1470,13 +1796,9 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
     return YES;
 }
 
-- (BOOL)updateFromData:(NSMutableData*)data inFormat:(int)fmt {
-    
-    if (!data) {
-		NSLog(@"%@: Data is nil!", NSStringFromSelector(_cmd));
-		return NO;
-    }
-    
+//decodes the data of a note's file; does not touch any note, so that files can be decoded on other threads, except in HTMLFormat
++ (NSMutableAttributedString*)newContentStringFromData:(NSMutableData*)data inFormat:(int)fmt guessedEncoding:(NSStringEncoding*)encoding 
+											  fileRef:(FSRef*)fsRef bodyAttributes:(NSDictionary*)bodyAttributes {
     NSMutableString *stringFromData = nil;
     NSMutableAttributedString *attributedStringFromData = nil;
     //interpret based on format; text, rtf, html, etc...
@@ -1488,9 +1810,8 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 	    break;
 	case PlainTextFormat:
 		//try to merge/re-match attributes?
-	    if ((stringFromData = [NSMutableString newShortLivedStringFromData:data ofGuessedEncoding:&fileEncoding withPath:NULL orWithFSRef:noteFileRefInit(self)])) {
-			attributedStringFromData = [[NSMutableAttributedString alloc] initWithString:stringFromData 
-																			  attributes:[[GlobalPrefs defaultPrefs] noteBodyAttributes]];
+	    if ((stringFromData = [NSMutableString newShortLivedStringFromData:data ofGuessedEncoding:encoding withPath:NULL orWithFSRef:fsRef])) {
+			attributedStringFromData = [[NSMutableAttributedString alloc] initWithString:stringFromData attributes:bodyAttributes];
 			[stringFromData release];
 	    } else {
 			NSLog(@"String could not be initialized from data");
@@ -1510,14 +1831,39 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 	default:
 	    NSLog(@"%@: Unknown format: %d", NSStringFromSelector(_cmd), fmt);
     }
+	
+	return attributedStringFromData;
+}
+
+- (BOOL)updateFromData:(NSMutableData*)data inFormat:(int)fmt {
     
+    if (!data) {
+		NSLog(@"%@: Data is nil!", NSStringFromSelector(_cmd));
+		return NO;
+    }
+	
+	NSMutableAttributedString *attributedStringFromData = [NoteObject newContentStringFromData:data inFormat:fmt guessedEncoding:&fileEncoding fileRef:noteFileRefInit(self) 
+																				 bodyAttributes:[[GlobalPrefs defaultPrefs] noteBodyAttributes]];
     if (!attributedStringFromData) {
 		NSLog(@"Couldn't make string out of data for note %@ with format %d", titleString, fmt);
 		return NO;
     }
-    
+	
+	[self _setContentsFromFile:attributedStringFromData];
+	[attributedStringFromData release];
+	
+	return YES;
+}
+
+- (void)_setContentsFromFile:(NSMutableAttributedString*)attributedStringFromData {
 	[contentString release];
 	contentString = [attributedStringFromData retain];
+	[pendingBody release];
+	pendingBody = nil;
+	[pendingBodyBaseFont release];
+	pendingBodyBaseFont = nil;
+	bodyReadError = noErr;
+	hasBodyDigest = NO;
 	[contentString santizeForeignStylesForImporting];
 	//NSLog(@"%s(%@): %@", _cmd, [self noteFilePath], [contentString string]);
 	
@@ -1526,13 +1872,9 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
     [self updateContentCacheCStringIfNecessary];
 	[undoManager removeAllActions];
 	
-	[self updateTablePreviewString];
+	[self invalidateTablePreviewString];
     
 	//don't update the date modified here, as this could be old data
-    
-    [attributedStringFromData release];
-    
-    return YES;
 }
 
 - (void)updateWithSyncBody:(NSString*)newBody andTitle:(NSString*)newTitle {
@@ -1551,6 +1893,54 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 	[self setTitleString:newTitle];
 }
 
+- (uint64_t)contentDigestWithSeparator:(NSString*)separator {
+	//the digest of the title, separator and body joined together as a sync service would store them
+	if (!hasBodyDigest && [self hasReadableBody]) {
+		bodyDigest = contentDigestOfString([contentString string]);
+		hasBodyDigest = YES;
+	}
+	uint64_t digest = contentDigestOfString(titleString);
+	if (separator) digest = contentDigestByAppending(digest, contentDigestOfString(separator));
+	return contentDigestByAppending(digest, bodyDigest);
+}
+
+uint64_t contentDigestOfString(NSString *string) {
+	CFStringRef str = (CFStringRef)string;
+	if (!str) return 0;
+	
+	const char *utf8 = CFStringGetCStringPtr(str, kCFStringEncodingUTF8);
+	if (utf8) {
+		size_t byteCount = strlen(utf8);
+		return ((uint64_t)(uint32_t)byteCount << 32) | nv_crc32_update(0, (const unsigned char*)utf8, byteCount);
+	}
+	
+	//convert a piece at a time rather than copying the whole string
+	UInt8 buffer[4096 * 3];
+	CFIndex length = CFStringGetLength(str), location = 0;
+	uint32_t crc = 0, byteCount = 0;
+	while (location < length) {
+		CFIndex rangeLength = MIN(length - location, 4096);
+		//a surrogate pair split between pieces would convert to two lossy bytes
+		if (location + rangeLength < length && CFStringIsSurrogateHighCharacter(CFStringGetCharacterAtIndex(str, location + rangeLength - 1)))
+			rangeLength--;
+		
+		CFIndex usedBytes = 0;
+		CFIndex converted = CFStringGetBytes(str, CFRangeMake(location, rangeLength), kCFStringEncodingUTF8, '?', false, buffer, sizeof(buffer), &usedBytes);
+		if (!converted) break;
+		
+		crc = nv_crc32_update(crc, buffer, usedBytes);
+		byteCount += (uint32_t)usedBytes;
+		location += converted;
+	}
+	return ((uint64_t)byteCount << 32) | crc;
+}
+
+uint64_t contentDigestByAppending(uint64_t digest, uint64_t appendedDigest) {
+	uint32_t appendedLength = (uint32_t)(appendedDigest >> 32);
+	uint32_t crc = (uint32_t)crc32_combine((uLong)(digest & 0xFFFFFFFF), (uLong)(appendedDigest & 0xFFFFFFFF), (z_off_t)appendedLength);
+	return ((uint64_t)((uint32_t)(digest >> 32) + appendedLength) << 32) | crc;
+}
+
 - (void)moveFileToTrash {
 	OSStatus err = noErr;
 	if ((err = [delegate moveFileToTrash:noteFileRefInit(self) forFilename:filename]) != noErr) {
@@ -1591,6 +1981,7 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 - (void)removeAllSyncServiceMD {
 	//potentially dangerous
 	[syncServicesMD removeAllObjects];
+	[self _syncServicesMDDidChange];
 }
 
 
@@ -1632,7 +2023,10 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 	NSData *formattedData = nil;
 	NSError *error = nil;
 	
-	NSMutableAttributedString *contentMinusColor = [[contentString mutableCopy] autorelease];
+	if (![self hasReadableBody])
+		return bodyReadError;
+	
+	NSMutableAttributedString *contentMinusColor = [[[self contentString] mutableCopy] autorelease];
 	[contentMinusColor removeAttribute:NSForegroundColorAttributeName range:NSMakeRange(0, [contentMinusColor length])];
 
 	
@@ -1753,7 +2147,7 @@ force_inline id unifiedCellForNote(NotesTableView *tv, NoteObject *note, NSInteg
 	
 	//an optimization would be to fall back on cached cString if contentsWere7Bit is true, but then we have to handle opts ourselves
 	unsigned int i;
-	NSString *haystack = [contentString string];
+	NSString *haystack = [[self contentString] string];
 	NSRange nextRange = NSMakeRange(NSNotFound, 0);
 	for (i=0; i<[words count]; i++) {
 		NSString *word = [words objectAtIndex:i];
@@ -1773,6 +2167,16 @@ force_inline void resetFoundPtrsForNote(NoteObject *note) {
 	note->cLabelsFoundPtr = note->cLabels;	
 }
 
+static force_inline BOOL docIsSearchCandidate(uint32_t docID, NoteFilterContext *context) {
+	//the index can only rule notes out; anything it might contain must still be confirmed by searching the caches
+	return !context->candidateDocs || !docID || docID >= context->candidateDocLimit || 
+		TrigramBitmapContains(context->candidateDocs, docID);
+}
+
+static force_inline BOOL noteIsSearchCandidate(NoteObject *note, NoteFilterContext *context) {
+	return docIsSearchCandidate(note->searchDocID, context);
+}
+
 BOOL noteContainsUTF8String(NoteObject *note, NoteFilterContext *context) {
 	
     if (!context->useCachedPositions) {
@@ -1780,38 +2184,133 @@ BOOL noteContainsUTF8String(NoteObject *note, NoteFilterContext *context) {
     }
 	
 	char *needle = context->needle;
+	
+	if (!noteIsSearchCandidate(note, context))
+		return NO;
     
-	/* NOTE: strstr in Darwin is heinously, supernaturally optimized; it blows boyer-moore out of the water. 
-	implementations on other OSes will need considerably more code in this function. */
+	/* NOTE: strstr in Darwin is heinously, supernaturally optimized, but libc implementations elsewhere are not;
+	fast_strstr (StringSearch.c) does similar vector filtering without depending on the OS, and stops at the first match. */
 	
     if (note->cTitleFoundPtr)
-		note->cTitleFoundPtr = strstr(note->cTitleFoundPtr, needle);
+		note->cTitleFoundPtr = fast_strstr(note->cTitleFoundPtr, needle);
     
     if (note->cContentsFoundPtr)
-		note->cContentsFoundPtr = strstr(note->cContentsFoundPtr, needle);
+		note->cContentsFoundPtr = fast_strstr(note->cContentsFoundPtr, needle);
     
     if (note->cLabelsFoundPtr)
-		note->cLabelsFoundPtr = strstr(note->cLabelsFoundPtr, needle);
+		note->cLabelsFoundPtr = fast_strstr(note->cLabelsFoundPtr, needle);
         
     return note->cContentsFoundPtr || note->cTitleFoundPtr || note->cLabelsFoundPtr;
 }
 
+BOOL noteContainsAllUTF8Strings(NoteObject *note, NoteFilterContext *context) {
+	//reads each cache only once for all words in the search string, leaving the found-pointers
+	//where a word-by-word search would have left them after its last word
+	
+	if (!noteIsSearchCandidate(note, context))
+		return NO;
+	
+	uint64_t foundMask = 0;
+	
+	note->cTitleFoundPtr = note->cTitle ? (char*)ACAutomatonScan(context->matcher, note->cTitle, &foundMask, context->trackedNeedle) : NULL;
+	note->cLabelsFoundPtr = note->cLabels ? (char*)ACAutomatonScan(context->matcher, note->cLabels, &foundMask, context->trackedNeedle) : NULL;
+	note->cContentsFoundPtr = note->cContents ? (char*)ACAutomatonScan(context->matcher, note->cContents, &foundMask, context->trackedNeedle) : NULL;
+	
+	return foundMask == ACAutomatonAllNeedlesMask(context->matcher);
+}
+
+void prepareNoteForContentSearch(NoteObject *note, NoteFilterContext *context) {
+	//must be called on the main thread before a note is searched concurrently, as it may have to read the note's body:
+	//only the search cache is kept, and only for notes that the index couldn't rule out
+	if (note->pendingBody && !note->cContents && noteIsSearchCandidate(note, context)) {
+		[note contentsSearchCache];
+	}
+}
+
+void captureNoteForSearch(NoteObject *note, NoteSearchSnapshot *snapshot) {
+	//main thread only; the captured caches stay valid until the matching endReadingSearchCaches()
+	snapshot->note = [note retain];
+	snapshot->title = note->cTitle;
+	snapshot->contents = note->cContents;
+	snapshot->labels = note->cLabels;
+	snapshot->searchDocID = note->searchDocID;
+}
+
+BOOL noteSnapshotContainsAllUTF8Strings(const NoteSearchSnapshot *snapshot, NoteFilterContext *context) {
+	//like noteContainsAllUTF8Strings, but reads only the captured caches and leaves the note's found-pointers alone,
+	//so that it can run on any thread
+	if (!docIsSearchCandidate(snapshot->searchDocID, context))
+		return NO;
+	
+	if (!context->matcher) {
+		return (snapshot->title && fast_strstr(snapshot->title, context->needle)) ||
+		(snapshot->contents && fast_strstr(snapshot->contents, context->needle)) ||
+		(snapshot->labels && fast_strstr(snapshot->labels, context->needle));
+	}
+	
+	uint64_t foundMask = 0;
+	if (snapshot->title) ACAutomatonScan(context->matcher, snapshot->title, &foundMask, context->trackedNeedle);
+	if (snapshot->labels) ACAutomatonScan(context->matcher, snapshot->labels, &foundMask, context->trackedNeedle);
+	if (snapshot->contents) ACAutomatonScan(context->matcher, snapshot->contents, &foundMask, context->trackedNeedle);
+	
+	return foundMask == ACAutomatonAllNeedlesMask(context->matcher);
+}
+
 BOOL noteTitleHasPrefixOfUTF8String(NoteObject *note, const char* fullString, size_t stringLen) {
 	return !strncmp(note->cTitle, fullString, stringLen);
 }
-BOOL noteTitleIsAPrefixOfOtherNoteTitle(NoteObject *longerNote, NoteObject *shorterNote) {
-	return !strncmp(longerNote->cTitle, shorterNote->cTitle, strlen(shorterNote->cTitle));
+
+BOOL noteNeedsSearchIndexUpdate(NoteObject *note, TrigramIndex *index) {
+	return !TrigramIndexDocumentIsCurrent(index, note->searchDocID);
+}
+
+void updateSearchIndexForNote(NoteObject *note, TrigramIndex *index) {
+	if (note->searchDocID == kTrigramIndexNoDocument)
+		note->searchDocID = TrigramIndexAddDocument(index);
+	
+	//a body that hasn't been read yet is indexed from the search cache stored with its record
+	const char *fields[3] = { note->cTitle, note->pendingBody && !note->cContents ? [note contentsSearchCache] : note->cContents, note->cLabels };
+	TrigramIndexUpdateDocument(index, note->searchDocID, fields, 3);
+}
+
+void invalidateSearchIndexForNote(NoteObject *note, TrigramIndex *index) {
+	TrigramIndexInvalidateDocument(index, note->searchDocID);
 }
 
-- (void)addPrefixParentNote:(NoteObject*)aNote {
-	if (!prefixParentNotes) {
-		prefixParentNotes = [[NSMutableArray alloc] initWithObjects:&aNote count:1];
-	} else {
-		[prefixParentNotes addObject:aNote];
+void removeNoteFromSearchIndex(NoteObject *note, TrigramIndex *index) {
+	TrigramIndexRemoveDocument(index, note->searchDocID);
+	note->searchDocID = kTrigramIndexNoDocument;
+}
+
+void updateTitlePrefixTrieForNote(NoteObject *note, TitlePrefixTrie *trie) {
+	TitlePrefixTrieSetTitle(trie, note, note->cTitle);
+}
+
+void addMemoryUsageOfNote(NoteObject *note, NoteMemoryUsage *usage) {
+	usage->noteCount++;
+	
+	if (note->contentString) {
+		usage->bodyCount++;
+		usage->bodyBytes += [note->contentString length] * sizeof(unichar);
+	} else if (note->pendingBody) {
+		usage->storedBodyCount++;
+	}
+	
+	char *caches[] = { note->cTitle, note->cContents, note->cLabels, note->cTitleSortKey, note->cLabelsSortKey };
+	unsigned int i;
+	for (i=0; i<sizeof(caches)/sizeof(char*); i++) {
+		if (caches[i]) usage->searchCacheBytes += strlen(caches[i]) + 1;
+	}
+	
+	if (note->tableTitleString) {
+		usage->previewCount++;
+		usage->previewBytes += [note->tableTitleString length] * sizeof(unichar);
 	}
 }
-- (void)removeAllPrefixParentNotes {
-	[prefixParentNotes removeAllObjects];
+
+size_t prefixParentsOfNote(NoteObject *note, TitlePrefixTrie *trie, size_t minLength, NoteObject **parents, size_t maxParents) {
+	//notes whose complete titles are a prefix of this one's and at least minLength bytes long, shortest first
+	return note->cTitle ? TitlePrefixTrieCopyPrefixesOfTitle(trie, note->cTitle, minLength, (const void **)parents, maxParents) : 0;
 }
 
 - (NSSet*)labelSet {
@@ -0,0 +1,108 @@
+//
+//  NoteRecordStore.h
+//  Notation
+//
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+
+#import <Cocoa/Cocoa.h>
+#import "SynchronizedNoteProtocol.h"
+#include <sys/types.h>
+#include <dispatch/dispatch.h>
+
+//each note is archived, compressed and (if the database is encrypted) encrypted as its own record,
+//appended to a segment file in the notes directory; "Notes & Settings" holds only the index of every note's newest record,
+//so that flushing the database writes just the notes that have changed since the last flush
+
+//a record holds the note archived without its body, followed by the body on its own (with its own IV);
+//at launch the segment is mapped and only the former is decoded, leaving each body to be read when the note first needs it
+
+#define RECORD_IV_LEN 16
+//enough of the start of each body to draw the table's preview without reading the rest
+#define RECORD_EXCERPT_LEN 1024
+
+typedef union {
+    struct {
+		u_int32_t dataLength;
+		u_int32_t checksum;
+		CFUUIDBytes uniqueNoteIDBytes;
+		char ivBuffer[RECORD_IV_LEN];
+	};
+	char recordBuffer[(sizeof(u_int32_t) * 2) + sizeof(CFUUIDBytes) + RECORD_IV_LEN];
+} NoteRecordHeader;
+
+@class NotationPrefs, NoteObject, NoteRecordBody;
+
+@interface NoteRecordStore : NSObject <NSKeyedArchiverDelegate> {
+	char *directoryPath;
+	NotationPrefs *notationPrefs;
+	NSData *recordKey;
+	id delegate;
+
+	int segmentFD;
+	//committedGeneration is the segment named by the index on disk, which must not be removed until another index replaces it
+	unsigned int segmentGeneration, committedGeneration, highestGeneration, segmentEpoch;
+	off_t segmentLength, liveBytes, uncommittedOffset;
+	BOOL needsNewSegment;
+
+	//CFUUIDBytes -> NoteRecordEntry of the newest record for each note; notes without one must be written at the next flush
+	CFMutableDictionaryRef entries;
+	//the body being left out of the note archive that is currently being written
+	id omittedBody;
+	//the current segment, mapped for the bodies given back to it by notes that no longer need them; remapped as it grows
+	NSData *mappedSegment;
+
+	dispatch_queue_t compactionQueue;
+	BOOL isCompacting;
+}
+
++ (BOOL)isSegmentFilename:(NSString*)filename;
+
+- (id)initWithParentFSRep:(const char*)path notationPrefs:(NotationPrefs*)prefs;
+- (id)delegate;
+- (void)setDelegate:(id)aDelegate;
+
+- (NSMutableArray*)notesWithIndexData:(NSData*)indexData returningError:(OSStatus*)err;
+
+- (void)invalidateRecordForNote:(id<SynchronizedNote>)aNote;
+- (NoteRecordBody*)copyStoredBodyOfNote:(NoteObject*)aNote;
+- (void)invalidateAllRecords;
+- (void)encryptionSettingsChanged;
+
+- (BOOL)writeRecordsForNotes:(NSArray*)notes;
+- (NSData*)indexDataForNotes:(NSArray*)notes;
+- (OSStatus)verifyIndexData:(NSData*)indexData againstNotes:(NSArray*)notes;
+- (void)indexWasCommitted;
+
+@end
+
+//the still-encoded body of a note decoded from a mapped segment; it holds on to the mapping and key it needs,
+//so it remains readable even after the segment it came from has been replaced or the encryption settings have changed
+@interface NoteRecordBody : NSObject {
+	NSData *segmentData, *recordKey;
+	NSRange recordRange;
+	u_int32_t bodyOffset;
+	NSString *excerpt;
+}
+
+- (id)initWithSegmentData:(NSData*)data recordRange:(NSRange)aRange bodyOffset:(u_int32_t)anOffset key:(NSData*)aKey excerpt:(NSString*)anExcerpt;
+- (NSString*)excerpt;
+- (BOOL)isEncodedWithKey:(NSData*)aKey;
+- (NSData*)encodedBodyPart;
+- (NSMutableAttributedString*)copyBodyReturningError:(OSStatus*)err;
+
+@end
+
+@interface NSObject (NoteRecordStoreDelegate)
+- (void)noteRecordStoreDidCompact:(NoteRecordStore*)store;
+@end
@@ -0,0 +1,970 @@
+//
+//  NoteRecordStore.m
+//  Notation
+//
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "CRC32.h"
+#import "NoteRecordStore.h"
+#import "NotationPrefs.h"
+#import "NSData_transformations.h"
+#import "NSString_NV.h"
+#import "NoteObject.h"
+
+//record segments are named "Note Records <generation>"; a new generation is started
+//whenever the segment is compacted or the encryption settings change
+static const char SegmentFilenamePrefix[] = "Note Records ";
+
+//appended records are buffered up to this size before being written
+#define RECORD_WRITE_CHUNK_SIZE (1024 * 1024)
+//a segment is compacted only once its dead records outweigh the live ones, and by at least this much
+#define MIN_COMPACTION_DEAD_BYTES (512 * 1024)
+
+typedef struct _NoteRecordEntry {
+	CFUUIDBytes uniqueNoteIDBytes;
+	u_int64_t offset;
+	u_int32_t length;
+	u_int32_t bodyOffset; //where the body begins within the record, or 0 if the record holds the whole note in one archive
+} NoteRecordEntry;
+
+//the index is stored big-endian: this header, followed by one NoteRecordEntry per note, in the order of allNotes
+typedef struct _NoteRecordIndexHeader {
+	u_int32_t generation;
+	u_int32_t entryCount;
+} NoteRecordIndexHeader;
+
+static CFStringRef NoteRecordKeyDescription(const void *value) {
+	return value ? (CFStringRef)[[NSString uuidStringWithBytes:*(CFUUIDBytes*)value] retain] : NULL;
+}
+static CFHashCode NoteRecordKeyHash(const void *o) {
+	return CFHashBytes((UInt8*)o, sizeof(CFUUIDBytes));
+}
+static Boolean NoteRecordKeyIsEqual(const void *o, const void *p) {
+	return (!memcmp((CFUUIDBytes*)o, (CFUUIDBytes*)p, sizeof(CFUUIDBytes)));
+}
+static void NoteRecordEntryRelease(CFAllocatorRef allocator, const void *value) {
+	free((void*)value);
+}
+
+static CFMutableDictionaryRef NoteRecordEntriesCreate(void) {
+	//keys point into their own entries, which are freed along with them
+	CFDictionaryKeyCallBacks keyCallbacks = { 0, NULL, NULL, NoteRecordKeyDescription, NoteRecordKeyIsEqual, NoteRecordKeyHash };
+	CFDictionaryValueCallBacks valueCallbacks = { 0, NULL, NoteRecordEntryRelease, NULL, NULL };
+
+	return CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &keyCallbacks, &valueCallbacks);
+}
+
+static void SetNoteRecordEntry(CFMutableDictionaryRef entries, const CFUUIDBytes *uuid, u_int64_t offset, u_int32_t length, u_int32_t bodyOffset) {
+	NoteRecordEntry *entry = (NoteRecordEntry*)calloc(1, sizeof(NoteRecordEntry));
+	entry->uniqueNoteIDBytes = *uuid;
+	entry->offset = offset;
+	entry->length = length;
+	entry->bodyOffset = bodyOffset;
+
+	//CFDictionarySetValue would keep the existing key, which belongs to the entry being replaced
+	CFDictionaryRemoveValue(entries, &entry->uniqueNoteIDBytes);
+	CFDictionarySetValue(entries, &entry->uniqueNoteIDBytes, entry);
+}
+
+static BOOL ReadFully(int fd, void *buffer, size_t length, off_t offset) {
+	while (length > 0) {
+		ssize_t readBytes = pread(fd, buffer, length, offset);
+		if (readBytes < 0 && errno == EINTR) continue;
+		if (readBytes <= 0) return NO;
+
+		buffer += readBytes;
+		offset += readBytes;
+		length -= readBytes;
+	}
+	return YES;
+}
+
+static BOOL WriteFully(int fd, const void *buffer, size_t length, off_t offset) {
+	while (length > 0) {
+		ssize_t writtenBytes = pwrite(fd, buffer, length, offset);
+		if (writtenBytes < 0 && errno == EINTR) continue;
+		if (writtenBytes <= 0) return NO;
+
+		buffer += writtenBytes;
+		offset += writtenBytes;
+		length -= writtenBytes;
+	}
+	return YES;
+}
+
+static BOOL RecordBytesAreIntact(const char *recordBytes, u_int32_t length) {
+	NoteRecordHeader header;
+	if (length < sizeof(header.recordBuffer))
+		return NO;
+
+	memcpy(header.recordBuffer, recordBytes, sizeof(header.recordBuffer));
+	u_int32_t dataLength = CFSwapInt32BigToHost(header.dataLength);
+
+	return (dataLength == length - sizeof(header.recordBuffer) &&
+			nv_crc32_update(0, (const unsigned char*)recordBytes + sizeof(header.recordBuffer), dataLength) == CFSwapInt32BigToHost(header.checksum));
+}
+
+//compresses and (given a key) encrypts one part of a record
+static NSMutableData *EncodedRecordPart(NSData *archive, const char *iv, NSData *key) {
+	NSMutableData *partData = [archive compressedData];
+
+	if (key && ![partData encryptAESDataWithKey:key iv:[NSData dataWithBytesNoCopy:(void*)iv length:RECORD_IV_LEN freeWhenDone:NO]]) {
+		NSLog(@"Couldn't encrypt note record data!");
+		return nil;
+	}
+	return partData;
+}
+
+//the reverse of EncodedRecordPart, returning the archive
+static NSMutableData *DecodedRecordPart(const char *bytes, size_t length, const char *iv, NSData *key, OSStatus *err) {
+	NSMutableData *partData = [NSMutableData dataWithBytes:bytes length:length];
+
+	if (key && ![partData decryptAESDataWithKey:key iv:[NSData dataWithBytesNoCopy:(void*)iv length:RECORD_IV_LEN freeWhenDone:NO]]) {
+		NSLog(@"NoteRecordStore: record decryption failed!");
+		*err = kNoAuthErr;
+		return nil;
+	}
+
+	NSMutableData *archive = [partData uncompressedData];
+	if (!archive)
+		*err = kCompressionErr;
+	return archive;
+}
+
+//the body part of a record is its IV followed by the encoded archive of the note's contentString
+static NSMutableAttributedString *CopyBodyFromRecordPart(const char *bytes, size_t length, NSData *key, OSStatus *err) {
+	if (length < RECORD_IV_LEN) {
+		*err = kDataFormattingErr;
+		return nil;
+	}
+
+	NSMutableData *archive = DecodedRecordPart(bytes + RECORD_IV_LEN, length - RECORD_IV_LEN, bytes, key, err);
+	if (!archive)
+		return nil;
+
+	id body = nil;
+	@try {
+		body = [NSKeyedUnarchiver unarchiveObjectWithData:archive];
+	} @catch (NSException *e) {
+		NSLog(@"NoteRecordStore: error unarchiving note body (%@, %@)", [e name], [e reason]);
+	}
+	if (![body isKindOfClass:[NSAttributedString class]]) {
+		*err = kCoderErr;
+		return nil;
+	}
+
+	return [[NSMutableAttributedString alloc] initWithAttributedString:body];
+}
+
+static NSString *ExcerptOfBody(NSString *bodyString) {
+	return [bodyString substringWithRange:[bodyString rangeOfComposedCharacterSequencesForRange:NSMakeRange(0, MIN([bodyString length], RECORD_EXCERPT_LEN))]];
+}
+
+static const NoteRecordEntry *IndexEntriesFromData(NSData *indexData, unsigned int *generation, NSUInteger *entryCount) {
+	NoteRecordIndexHeader header;
+	if ([indexData length] < sizeof(header))
+		return NULL;
+
+	memcpy(&header, [indexData bytes], sizeof(header));
+	*generation = CFSwapInt32BigToHost(header.generation);
+	*entryCount = CFSwapInt32BigToHost(header.entryCount);
+
+	if (!*generation || [indexData length] != sizeof(header) + *entryCount * sizeof(NoteRecordEntry))
+		return NULL;
+
+	return (const NoteRecordEntry *)([indexData bytes] + sizeof(header));
+}
+
+static int CompareRecordEntryOffsets(const void *a, const void *b) {
+	u_int64_t offsetA = ((const NoteRecordEntry*)a)->offset, offsetB = ((const NoteRecordEntry*)b)->offset;
+	return offsetA < offsetB ? -1 : (offsetA > offsetB ? 1 : 0);
+}
+
+//copies the raw bytes of each record (ordered by offset) to destFD starting at *destLength, storing where each one landed
+static BOOL CopyRecordsToSegment(int sourceFD, int destFD, const NoteRecordEntry *records, u_int64_t *newOffsets, size_t count, off_t *destLength) {
+	char *buffer = (char*)malloc(RECORD_WRITE_CHUNK_SIZE);
+	size_t bufferSize = RECORD_WRITE_CHUNK_SIZE, bufferedLength = 0, i;
+	off_t writeOffset = *destLength;
+	BOOL result = YES;
+
+	for (i=0; i<count && result; i++) {
+		if (bufferedLength + records[i].length > bufferSize) {
+			if (!(result = WriteFully(destFD, buffer, bufferedLength, writeOffset)))
+				break;
+			writeOffset += bufferedLength;
+			bufferedLength = 0;
+
+			if (records[i].length > bufferSize)
+				buffer = (char*)realloc(buffer, (bufferSize = records[i].length));
+		}
+
+		if (!ReadFully(sourceFD, buffer + bufferedLength, records[i].length, records[i].offset) ||
+			!RecordBytesAreIntact(buffer + bufferedLength, records[i].length)) {
+			NSLog(@"CopyRecordsToSegment: record at offset %llu could not be read or is damaged", records[i].offset);
+			result = NO;
+			break;
+		}
+		newOffsets[i] = writeOffset + bufferedLength;
+		bufferedLength += records[i].length;
+	}
+	if (result && bufferedLength)
+		result = WriteFully(destFD, buffer, bufferedLength, writeOffset);
+
+	*destLength = writeOffset + bufferedLength;
+	free(buffer);
+	return result;
+}
+
+@implementation NoteRecordStore
+
++ (BOOL)isSegmentFilename:(NSString*)filename {
+	NSString *prefix = [NSString stringWithUTF8String:SegmentFilenamePrefix];
+	if (![filename hasPrefix:prefix] || [filename length] == [prefix length])
+		return NO;
+
+	NSCharacterSet *nonDigits = [[NSCharacterSet decimalDigitCharacterSet] invertedSet];
+	return [[filename substringFromIndex:[prefix length]] rangeOfCharacterFromSet:nonDigits].location == NSNotFound;
+}
+
+- (id)initWithParentFSRep:(const char*)path notationPrefs:(NotationPrefs*)prefs {
+	if ([super init]) {
+		directoryPath = strdup(path);
+		notationPrefs = [prefs retain];
+
+		segmentFD = -1;
+		segmentGeneration = committedGeneration = highestGeneration = segmentEpoch = 0;
+		segmentLength = liveBytes = uncommittedOffset = 0;
+		needsNewSegment = isCompacting = NO;
+
+		entries = NoteRecordEntriesCreate();
+		compactionQueue = dispatch_queue_create("net.elasticthreads.nv.recordcompaction", NULL);
+	}
+	return self;
+}
+
+- (id)delegate {
+	return delegate;
+}
+
+- (void)setDelegate:(id)aDelegate {
+	delegate = aDelegate;
+}
+
+- (char*)_copyPathForGeneration:(unsigned int)generation {
+	char *path = NULL;
+	asprintf(&path, "%s/%s%u", directoryPath, SegmentFilenamePrefix, generation);
+	return path;
+}
+
+- (int)_openSegmentForGeneration:(unsigned int)generation truncate:(BOOL)truncate {
+	char *path = [self _copyPathForGeneration:generation];
+
+	int fd = open(path, O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		NSLog(@"NoteRecordStore: open error for file %s: %s", path, strerror(errno));
+	}
+	free(path);
+	return fd;
+}
+
+- (void)_removeSegmentForGeneration:(unsigned int)generation {
+	char *path = [self _copyPathForGeneration:generation];
+
+	if (unlink(path) < 0) {
+		NSLog(@"NoteRecordStore: unlink error for file %s: %s", path, strerror(errno));
+	}
+	free(path);
+}
+
+- (unsigned int)_nextGeneration {
+	if (!highestGeneration) {
+		//without an index there is nothing to go on, so avoid clobbering the segments of another database in this directory
+		char *path = NULL;
+		do {
+			free(path);
+			path = [self _copyPathForGeneration:++highestGeneration];
+		} while (!access(path, F_OK));
+		free(path);
+
+		return highestGeneration;
+	}
+	return ++highestGeneration;
+}
+
+- (void)_replaceSegmentWithFD:(int)fd generation:(unsigned int)generation length:(off_t)length {
+	if (segmentFD >= 0) {
+		close(segmentFD);
+
+		//the index on disk still refers to the committed segment, so it can go only after the next commit
+		if (segmentGeneration != committedGeneration)
+			[self _removeSegmentForGeneration:segmentGeneration];
+	}
+	[mappedSegment release];
+	mappedSegment = nil;
+
+	segmentFD = fd;
+	segmentGeneration = generation;
+	segmentLength = uncommittedOffset = length;
+
+	//any compaction still running was made from the previous segment
+	segmentEpoch++;
+}
+
+- (BOOL)_beginNewSegment {
+	unsigned int generation = [self _nextGeneration];
+
+	int fd = [self _openSegmentForGeneration:generation truncate:YES];
+	if (fd < 0)
+		return NO;
+
+	[self _replaceSegmentWithFD:fd generation:generation length:0];
+
+	CFDictionaryRemoveAllValues(entries);
+	liveBytes = 0;
+	needsNewSegment = NO;
+
+	return YES;
+}
+
+- (NSData*)_recordKeyReturningError:(OSStatus*)err {
+	*err = noErr;
+
+	if (![notationPrefs doesEncryption])
+		return nil;
+
+	if (!recordKey && !(recordKey = [[notationPrefs noteRecordKey] retain])) {
+		NSLog(@"NoteRecordStore: no key is available for encrypting note records");
+		*err = kNoAuthErr;
+	}
+	return recordKey;
+}
+
+- (NSData*)_dataOfRecordAtOffset:(u_int64_t)offset length:(u_int32_t)length error:(OSStatus*)err {
+	NoteRecordHeader header;
+
+	if (length < sizeof(header.recordBuffer) || offset + length > (u_int64_t)segmentLength) {
+		NSLog(@"NoteRecordStore: record at offset %llu with length %u lies outside of the segment", offset, length);
+		*err = kDataFormattingErr;
+		return nil;
+	}
+
+	char *recordBytes = (char*)malloc(length);
+	if (!ReadFully(segmentFD, recordBytes, length, offset)) {
+		NSLog(@"NoteRecordStore: couldn't read record at offset %llu: %s", offset, strerror(errno));
+		free(recordBytes);
+		*err = ioErr;
+		return nil;
+	}
+
+	return [NSData dataWithBytesNoCopy:recordBytes length:length freeWhenDone:YES];
+}
+
+//decodes the note in the record at recordRange of data; if the record keeps the body separately,
+//the note is left to read it from data later, so data should be mapped rather than read when there are many records;
+//hasSearchCache, if given, says whether the record carried the search cache of such a body
+- (id)_noteFromRecordInData:(NSData*)data range:(NSRange)recordRange bodyOffset:(u_int32_t)bodyOffset
+			   uniqueNoteID:(const CFUUIDBytes*)uuid hasSearchCache:(BOOL*)hasSearchCache error:(OSStatus*)err {
+	NoteRecordHeader header;
+	u_int32_t length = (u_int32_t)recordRange.length;
+
+	if (length < sizeof(header.recordBuffer) || NSMaxRange(recordRange) > [data length] ||
+		(bodyOffset && (bodyOffset < sizeof(header.recordBuffer) || bodyOffset > length))) {
+		NSLog(@"NoteRecordStore: record at offset %lu with length %u lies outside of the segment", (unsigned long)recordRange.location, length);
+		*err = kDataFormattingErr;
+		return nil;
+	}
+
+	const char *recordBytes = [data bytes] + recordRange.location;
+	memcpy(header.recordBuffer, recordBytes, sizeof(header.recordBuffer));
+
+	//the checksum spans the body, too, so it is checked for split records only once the body is read;
+	//until then the rest of the record is vouched for by its padding and zlib's own checksum
+	if (CFSwapInt32BigToHost(header.dataLength) != length - sizeof(header.recordBuffer) ||
+		memcmp(&header.uniqueNoteIDBytes, uuid, sizeof(CFUUIDBytes)) || (!bodyOffset && !RecordBytesAreIntact(recordBytes, length))) {
+		NSLog(@"NoteRecordStore: record at offset %lu does not match its index entry", (unsigned long)recordRange.location);
+		*err = kDataFormattingErr;
+		return nil;
+	}
+
+	NSData *key = [self _recordKeyReturningError:err];
+	if (*err != noErr)
+		return nil;
+
+	u_int32_t noteEnd = bodyOffset ? bodyOffset : length;
+	NSMutableData *archivedNote = DecodedRecordPart(recordBytes + sizeof(header.recordBuffer), noteEnd - sizeof(header.recordBuffer), header.ivBuffer, key, err);
+	if (!archivedNote)
+		return nil;
+
+	id note = nil;
+	NSString *excerpt = nil;
+	@try {
+		NSKeyedUnarchiver *unarchiver = [[NSKeyedUnarchiver alloc] initForReadingWithData:archivedNote];
+		note = [unarchiver decodeObjectForKey:@"aNote"];
+		excerpt = [unarchiver decodeObjectForKey:@"bodyExcerpt"];
+		
+		NSUInteger cacheLength = 0;
+		const uint8_t *cacheBytes = bodyOffset ? [unarchiver decodeBytesForKey:@"contentsCache" returnedLength:&cacheLength] : NULL;
+		if (cacheBytes) [note setContentsSearchCache:(const char*)cacheBytes length:cacheLength];
+		if (hasSearchCache) *hasSearchCache = !bodyOffset || cacheBytes;
+		[unarchiver release];
+	} @catch (NSException *e) {
+		NSLog(@"NoteRecordStore: error unarchiving note (%@, %@)", [e name], [e reason]);
+	}
+	if (!note) {
+		*err = kCoderErr;
+		return nil;
+	}
+
+	if (bodyOffset) {
+		NoteRecordBody *body = [[NoteRecordBody alloc] initWithSegmentData:data recordRange:recordRange bodyOffset:bodyOffset key:key excerpt:excerpt];
+		[note setPendingBody:body];
+		[body release];
+	}
+
+	return note;
+}
+
+- (NSMutableArray*)notesWithIndexData:(NSData*)indexData returningError:(OSStatus*)err {
+	unsigned int generation = 0;
+	NSUInteger i, count = 0;
+
+	*err = noErr;
+
+	const NoteRecordEntry *indexEntries = IndexEntriesFromData(indexData, &generation, &count);
+	if (!indexEntries) {
+		NSLog(@"NoteRecordStore: index data is malformed");
+		*err = kDataFormattingErr;
+		return nil;
+	}
+
+	char *path = [self _copyPathForGeneration:generation];
+	int fd = open(path, O_RDWR);
+	//records are only ever appended, so the part of the segment mapped here never changes underneath the notes reading from it
+	NSData *segmentData = fd < 0 ? nil : [[NSData alloc] initWithContentsOfFile:[[NSFileManager defaultManager] stringWithFileSystemRepresentation:path length:strlen(path)]
+																	   options:NSDataReadingMapped error:NULL];
+	struct stat sb;
+	if (!segmentData || fstat(fd, &sb) < 0) {
+		NSLog(@"NoteRecordStore: couldn't open or map segment %s: %s", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		[segmentData release];
+		free(path);
+		*err = fnfErr;
+		return nil;
+	}
+	free(path);
+
+	[self _replaceSegmentWithFD:fd generation:generation length:sb.st_size];
+	committedGeneration = highestGeneration = generation;
+
+	NSMutableArray *notes = [NSMutableArray arrayWithCapacity:count];
+
+	for (i=0; i<count; i++) {
+		u_int64_t offset = CFSwapInt64BigToHost(indexEntries[i].offset);
+		u_int32_t length = CFSwapInt32BigToHost(indexEntries[i].length);
+		u_int32_t bodyOffset = CFSwapInt32BigToHost(indexEntries[i].bodyOffset);
+
+		if (offset + length > (u_int64_t)[segmentData length]) {
+			NSLog(@"NoteRecordStore: record at offset %llu with length %u lies outside of the segment", offset, length);
+			*err = kDataFormattingErr;
+			notes = nil;
+			break;
+		}
+
+		NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+		BOOL hasSearchCache = YES;
+		id note = [self _noteFromRecordInData:segmentData range:NSMakeRange((NSUInteger)offset, length) bodyOffset:bodyOffset
+								 uniqueNoteID:&indexEntries[i].uniqueNoteIDBytes hasSearchCache:&hasSearchCache error:err];
+		if (note) [notes addObject:note];
+		[pool release];
+
+		if (!note) {
+			notes = nil;
+			break;
+		}
+
+		//records from before search caches were stored are left stale, to be written again with the cache at the next flush
+		if (hasSearchCache) {
+			SetNoteRecordEntry(entries, &indexEntries[i].uniqueNoteIDBytes, offset, length, bodyOffset);
+			liveBytes += length;
+		}
+	}
+	//the notes whose bodies have yet to be read keep the mapping alive, as does the store for bodies given back to it
+	mappedSegment = segmentData;
+
+	return notes;
+}
+
+- (void)invalidateRecordForNote:(id<SynchronizedNote>)aNote {
+	CFDictionaryRemoveValue(entries, [aNote uniqueNoteIDBytes]);
+}
+
+//the body of the note's newest record, to be read again from the segment instead of kept in memory;
+//nil unless that record is still current, so that the note has not changed since it was written
+- (NoteRecordBody*)copyStoredBodyOfNote:(NoteObject*)aNote {
+	const NoteRecordEntry *entry = (const NoteRecordEntry*)CFDictionaryGetValue(entries, [aNote uniqueNoteIDBytes]);
+	if (!entry || !entry->bodyOffset || segmentFD < 0)
+		return nil;
+
+	if (entry->offset + entry->length > (u_int64_t)[mappedSegment length]) {
+		[mappedSegment release];
+		char *path = [self _copyPathForGeneration:segmentGeneration];
+		mappedSegment = [[NSData alloc] initWithContentsOfFile:[[NSFileManager defaultManager] stringWithFileSystemRepresentation:path length:strlen(path)]
+													   options:NSDataReadingMapped error:NULL];
+		free(path);
+
+		if (entry->offset + entry->length > (u_int64_t)[mappedSegment length]) {
+			NSLog(@"NoteRecordStore: couldn't map segment %u", segmentGeneration);
+			return nil;
+		}
+	}
+
+	OSStatus err = noErr;
+	NSData *key = [self _recordKeyReturningError:&err];
+	if (err != noErr)
+		return nil;
+
+	return [[NoteRecordBody alloc] initWithSegmentData:mappedSegment recordRange:NSMakeRange((NSUInteger)entry->offset, entry->length)
+											bodyOffset:entry->bodyOffset key:key excerpt:ExcerptOfBody([[aNote contentString] string])];
+}
+
+- (void)invalidateAllRecords {
+	CFDictionaryRemoveAllValues(entries);
+}
+
+- (void)encryptionSettingsChanged {
+	[recordKey release];
+	recordKey = nil;
+
+	//rewrite every note into a fresh segment, so that none lingers on disk under the old settings
+	[self invalidateAllRecords];
+	needsNewSegment = YES;
+}
+
+- (BOOL)writeRecordsForNotes:(NSArray*)notes {
+	NSUInteger i, j, staleCount = 0, noteCount = [notes count];
+
+	if ((needsNewSegment || segmentFD < 0) && ![self _beginNewSegment])
+		return NO;
+
+	NoteObject **staleNotes = (NoteObject **)malloc(MAX(noteCount, 1) * sizeof(NoteObject*));
+	for (i=0; i<noteCount; i++) {
+		NoteObject *note = [notes objectAtIndex:i];
+		if (!CFDictionaryContainsKey(entries, [note uniqueNoteIDBytes]))
+			staleNotes[staleCount++] = note;
+	}
+	if (!staleCount) {
+		free(staleNotes);
+		return YES;
+	}
+
+	OSStatus err = noErr;
+	NSData *key = [self _recordKeyReturningError:&err];
+	//one read of /dev/random for all of the records, with an IV for each of their two parts
+	NSData *ivs = key ? [NSData randomDataOfLength:RECORD_IV_LEN * 2 * staleCount] : nil;
+	if (err != noErr || (key && !ivs)) {
+		free(staleNotes);
+		return NO;
+	}
+
+	NoteRecordEntry *writtenEntries = (NoteRecordEntry*)calloc(staleCount, sizeof(NoteRecordEntry));
+	NSMutableData *pendingBytes = [NSMutableData dataWithCapacity:RECORD_WRITE_CHUNK_SIZE];
+	off_t writeOffset = segmentLength;
+	BOOL result = YES;
+
+	for (i=0; i<staleCount && result; i++) {
+		NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+
+		//a body that was never read in is copied just as it was stored, so that the note can be rewritten without reading it
+		//and without losing it if it can't be read; only a change of key forces it to be read and encoded again
+		NoteRecordBody *storedBody = [[[staleNotes[i] pendingBody] retain] autorelease];
+		NSData *storedBodyPart = nil;
+		if (storedBody && ([storedBody isEncodedWithKey:key] || ![staleNotes[i] hasReadableBody]))
+			storedBodyPart = [storedBody encodedBodyPart];
+		
+		NSAttributedString *body = storedBodyPart ? nil : [staleNotes[i] contentString];
+		NSString *excerpt = storedBodyPart ? [storedBody excerpt] : ExcerptOfBody([body string]);
+		const char *contentsCache = [staleNotes[i] contentsSearchCache];
+
+		NSMutableData *noteData = [NSMutableData data];
+		NSKeyedArchiver *archiver = [[NSKeyedArchiver alloc] initForWritingWithMutableData:noteData];
+		[archiver setDelegate:self];
+		omittedBody = body;
+		[archiver encodeObject:staleNotes[i] forKey:@"aNote"];
+		[archiver encodeObject:excerpt forKey:@"bodyExcerpt"];
+		if (contentsCache)
+			[archiver encodeBytes:(const uint8_t*)contentsCache length:strlen(contentsCache) forKey:@"contentsCache"];
+		[archiver finishEncoding];
+		[archiver release];
+		omittedBody = nil;
+
+		NoteRecordHeader header;
+		bzero(&header, sizeof(header));
+		char bodyIV[RECORD_IV_LEN];
+		bzero(bodyIV, sizeof(bodyIV));
+
+		if (key) {
+			memcpy(header.ivBuffer, [ivs bytes] + (i * 2 * RECORD_IV_LEN), RECORD_IV_LEN);
+			memcpy(bodyIV, [ivs bytes] + (i * 2 * RECORD_IV_LEN) + RECORD_IV_LEN, RECORD_IV_LEN);
+		}
+
+		NSMutableData *recordData = EncodedRecordPart(noteData, header.ivBuffer, key);
+		NSMutableData *bodyData = storedBodyPart ? nil : EncodedRecordPart([NSKeyedArchiver archivedDataWithRootObject:body], bodyIV, key);
+		u_int32_t bodyOffset = sizeof(header.recordBuffer) + [recordData length];
+
+		if (recordData && storedBodyPart) {
+			[recordData appendData:storedBodyPart];
+		} else if (recordData && bodyData) {
+			[recordData appendBytes:bodyIV length:RECORD_IV_LEN];
+			[recordData appendData:bodyData];
+		} else {
+			recordData = nil;
+		}
+
+		if ((result = [recordData length] > 0)) {
+			header.dataLength = CFSwapInt32HostToBig([recordData length]);
+			header.checksum = CFSwapInt32HostToBig([recordData CRC32]);
+			header.uniqueNoteIDBytes = *[staleNotes[i] uniqueNoteIDBytes];
+
+			writtenEntries[i].uniqueNoteIDBytes = header.uniqueNoteIDBytes;
+			writtenEntries[i].offset = writeOffset + [pendingBytes length];
+			writtenEntries[i].length = sizeof(header.recordBuffer) + [recordData length];
+			writtenEntries[i].bodyOffset = bodyOffset;
+
+			[pendingBytes appendBytes:header.recordBuffer length:sizeof(header.recordBuffer)];
+			[pendingBytes appendData:recordData];
+
+			if ([pendingBytes length] >= RECORD_WRITE_CHUNK_SIZE || i == staleCount - 1) {
+				if ((result = WriteFully(segmentFD, [pendingBytes bytes], [pendingBytes length], writeOffset))) {
+					writeOffset += [pendingBytes length];
+					[pendingBytes setLength:0];
+				} else {
+					NSLog(@"Unable to write note records to segment %u: %s", segmentGeneration, strerror(errno));
+				}
+			}
+		}
+
+		[pool release];
+	}
+
+	//F_FULLFSYNC is probably overkill, as for the journal
+	if (result && fsync(segmentFD) < 0) {
+		NSLog(@"writeRecordsForNotes: fsync error: %s", strerror(errno));
+		result = NO;
+	}
+
+	if (result) {
+		//the notes are only considered stored once they are known to be on disk
+		segmentLength = writeOffset;
+		for (j=0; j<staleCount; j++) {
+			SetNoteRecordEntry(entries, &writtenEntries[j].uniqueNoteIDBytes, writtenEntries[j].offset, writtenEntries[j].length, writtenEntries[j].bodyOffset);
+			[staleNotes[j] recordWasWritten];
+		}
+	}
+
+	free(writtenEntries);
+	free(staleNotes);
+
+	return result;
+}
+
+- (id)archiver:(NSKeyedArchiver *)archiver willEncodeObject:(id)object {
+	//the body goes into its own part of the record, so that the rest of the note can be decoded without it
+	return object == omittedBody ? nil : object;
+}
+
+- (NSData*)indexDataForNotes:(NSArray*)notes {
+	NSUInteger i, count = [notes count];
+	NSMutableData *indexData = [NSMutableData dataWithLength:sizeof(NoteRecordIndexHeader) + count * sizeof(NoteRecordEntry)];
+
+	NoteRecordIndexHeader *header = (NoteRecordIndexHeader*)[indexData mutableBytes];
+	header->generation = CFSwapInt32HostToBig(segmentGeneration);
+	header->entryCount = CFSwapInt32HostToBig(count);
+
+	//entries for notes that are no longer around are dropped here, and their records become dead space
+	CFMutableDictionaryRef liveEntries = NoteRecordEntriesCreate();
+	NoteRecordEntry *indexEntries = (NoteRecordEntry*)([indexData mutableBytes] + sizeof(NoteRecordIndexHeader));
+	off_t newLiveBytes = 0;
+
+	for (i=0; i<count; i++) {
+		CFUUIDBytes *uuid = [[notes objectAtIndex:i] uniqueNoteIDBytes];
+		NoteRecordEntry *entry = (NoteRecordEntry*)CFDictionaryGetValue(entries, uuid);
+		if (!entry) {
+			NSLog(@"indexDataForNotes: no record was written for note %@", [notes objectAtIndex:i]);
+			CFRelease(liveEntries);
+			return nil;
+		}
+		indexEntries[i].uniqueNoteIDBytes = entry->uniqueNoteIDBytes;
+		indexEntries[i].offset = CFSwapInt64HostToBig(entry->offset);
+		indexEntries[i].length = CFSwapInt32HostToBig(entry->length);
+		indexEntries[i].bodyOffset = CFSwapInt32HostToBig(entry->bodyOffset);
+
+		SetNoteRecordEntry(liveEntries, uuid, entry->offset, entry->length, entry->bodyOffset);
+		newLiveBytes += entry->length;
+	}
+
+	CFRelease(entries);
+	entries = liveEntries;
+	liveBytes = newLiveBytes;
+
+	return indexData;
+}
+
+//the index must name the current segment and the newest record of each note, in order;
+//only the records appended since the last commit are read back, as the rest were verified when they were first written
+- (OSStatus)verifyIndexData:(NSData*)indexData againstNotes:(NSArray*)notes {
+	unsigned int generation = 0;
+	NSUInteger i, count = 0;
+
+	const NoteRecordEntry *indexEntries = IndexEntriesFromData(indexData, &generation, &count);
+	if (!indexEntries || generation != segmentGeneration || count != [notes count])
+		return kItemVerifyErr;
+
+	for (i=0; i<count; i++) {
+		NoteObject *note = [notes objectAtIndex:i];
+		u_int64_t offset = CFSwapInt64BigToHost(indexEntries[i].offset);
+		u_int32_t length = CFSwapInt32BigToHost(indexEntries[i].length);
+		u_int32_t bodyOffset = CFSwapInt32BigToHost(indexEntries[i].bodyOffset);
+
+		NoteRecordEntry *entry = (NoteRecordEntry*)CFDictionaryGetValue(entries, [note uniqueNoteIDBytes]);
+		if (!entry || entry->offset != offset || entry->length != length || entry->bodyOffset != bodyOffset ||
+			memcmp(&indexEntries[i].uniqueNoteIDBytes, [note uniqueNoteIDBytes], sizeof(CFUUIDBytes)))
+			return kItemVerifyErr;
+
+		if (offset >= (u_int64_t)uncommittedOffset) {
+			OSStatus err = noErr;
+			NSData *recordData = [self _dataOfRecordAtOffset:offset length:length error:&err];
+			if (!recordData)
+				return err;
+			if (!RecordBytesAreIntact([recordData bytes], length))
+				return kItemVerifyErr;
+
+			//the checksum has vouched for the body's bytes, so the body is compared by its search cache instead of being decoded
+			BOOL hasSearchCache = NO;
+			NoteObject *storedNote = [self _noteFromRecordInData:recordData range:NSMakeRange(0, length) bodyOffset:bodyOffset
+													uniqueNoteID:&indexEntries[i].uniqueNoteIDBytes hasSearchCache:&hasSearchCache error:&err];
+			if (!storedNote)
+				return err;
+			const char *storedCache = hasSearchCache ? [storedNote contentsSearchCache] : NULL, *noteCache = [note contentsSearchCache];
+			if (bodyOffset && (!storedCache) != (!noteCache))
+				return kItemVerifyErr;
+			if (storedCache && noteCache && strcmp(storedCache, noteCache))
+				return kItemVerifyErr;
+		}
+	}
+
+	return noErr;
+}
+
+- (void)indexWasCommitted {
+	if (committedGeneration && committedGeneration != segmentGeneration)
+		[self _removeSegmentForGeneration:committedGeneration];
+
+	committedGeneration = segmentGeneration;
+	uncommittedOffset = segmentLength;
+
+	[self _compactIfNecessary];
+}
+
+- (void)_compactIfNecessary {
+	off_t deadBytes = segmentLength - liveBytes;
+
+	if (isCompacting || segmentFD < 0 || deadBytes <= liveBytes || deadBytes < MIN_COMPACTION_DEAD_BYTES)
+		return;
+
+	size_t i, count = CFDictionaryGetCount(entries);
+	NoteRecordEntry *records = (NoteRecordEntry*)malloc(MAX(count, 1) * sizeof(NoteRecordEntry));
+	u_int64_t *newOffsets = (u_int64_t*)malloc(MAX(count, 1) * sizeof(u_int64_t));
+	const void **values = (const void **)malloc(MAX(count, 1) * sizeof(void*));
+
+	CFDictionaryGetKeysAndValues(entries, NULL, values);
+	for (i=0; i<count; i++) {
+		records[i] = *(const NoteRecordEntry*)values[i];
+	}
+	free(values);
+	//read the old segment front to back
+	qsort(records, count, sizeof(NoteRecordEntry), CompareRecordEntryOffsets);
+
+	unsigned int generation = [self _nextGeneration], epoch = segmentEpoch;
+	int destFD = [self _openSegmentForGeneration:generation truncate:YES];
+	//our own descriptor, as the segment could be replaced (and closed) while the copy is under way
+	int sourceFD = dup(segmentFD);
+
+	if (destFD < 0 || sourceFD < 0) {
+		if (destFD >= 0) {
+			close(destFD);
+			[self _removeSegmentForGeneration:generation];
+		}
+		if (sourceFD >= 0) close(sourceFD);
+		free(records);
+		free(newOffsets);
+		return;
+	}
+
+	isCompacting = YES;
+
+	dispatch_async(compactionQueue, ^{
+		off_t destLength = 0;
+		BOOL succeeded = CopyRecordsToSegment(sourceFD, destFD, records, newOffsets, count, &destLength);
+		close(sourceFD);
+
+		if (succeeded && fsync(destFD) < 0) {
+			NSLog(@"compaction: fsync error: %s", strerror(errno));
+			succeeded = NO;
+		}
+
+		dispatch_async(dispatch_get_main_queue(), ^{
+			[self _finishCompactionWithRecords:records newOffsets:newOffsets count:count segmentFD:destFD
+										length:destLength generation:generation epoch:epoch succeeded:succeeded];
+			free(records);
+			free(newOffsets);
+		});
+	});
+}
+
+- (void)_finishCompactionWithRecords:(const NoteRecordEntry*)records newOffsets:(const u_int64_t*)newOffsets count:(size_t)count
+						   segmentFD:(int)fd length:(off_t)length generation:(unsigned int)generation epoch:(unsigned int)epoch succeeded:(BOOL)succeeded {
+	size_t i;
+
+	isCompacting = NO;
+
+	if (!succeeded || epoch != segmentEpoch) {
+		//the old segment was replaced in the meantime, so this copy of it is of no use
+		close(fd);
+		[self _removeSegmentForGeneration:generation];
+		return;
+	}
+
+	//records still current since the copy began keep their new positions
+	CFMutableDictionaryRef compactedEntries = NoteRecordEntriesCreate();
+	for (i=0; i<count; i++) {
+		NoteRecordEntry *entry = (NoteRecordEntry*)CFDictionaryGetValue(entries, &records[i].uniqueNoteIDBytes);
+		if (entry && entry->offset == records[i].offset)
+			SetNoteRecordEntry(compactedEntries, &records[i].uniqueNoteIDBytes, newOffsets[i], records[i].length, records[i].bodyOffset);
+	}
+
+	//any written since then are still only in the old segment, and are few enough to copy here
+	CFIndex entryCount = CFDictionaryGetCount(entries);
+	const void **values = (const void **)malloc(MAX(entryCount, 1) * sizeof(void*));
+	CFDictionaryGetKeysAndValues(entries, NULL, values);
+
+	BOOL copiedRecords = NO;
+	for (i=0; i<(size_t)entryCount && succeeded; i++) {
+		const NoteRecordEntry *entry = (const NoteRecordEntry*)values[i];
+		if (CFDictionaryContainsKey(compactedEntries, &entry->uniqueNoteIDBytes))
+			continue;
+
+		u_int64_t newOffset = 0;
+		if ((succeeded = CopyRecordsToSegment(segmentFD, fd, entry, &newOffset, 1, &length))) {
+			SetNoteRecordEntry(compactedEntries, &entry->uniqueNoteIDBytes, newOffset, entry->length, entry->bodyOffset);
+			copiedRecords = YES;
+		}
+	}
+	free(values);
+
+	if (succeeded && copiedRecords && fsync(fd) < 0) {
+		NSLog(@"compaction: fsync error: %s", strerror(errno));
+		succeeded = NO;
+	}
+
+	if (!succeeded) {
+		CFRelease(compactedEntries);
+		close(fd);
+		[self _removeSegmentForGeneration:generation];
+		return;
+	}
+
+	[self _replaceSegmentWithFD:fd generation:generation length:length];
+	CFRelease(entries);
+	entries = compactedEntries;
+	liveBytes = length;
+
+	NSLog(@"compacted note records into segment %u (%llu bytes)", generation, (unsigned long long)length);
+
+	//the old segment remains until the delegate commits an index that names this one
+	[delegate noteRecordStoreDidCompact:self];
+}
+
+- (void)dealloc {
+	if (segmentFD >= 0)
+		close(segmentFD);
+	if (entries)
+		CFRelease(entries);
+	if (compactionQueue)
+		dispatch_release(compactionQueue);
+	free(directoryPath);
+
+	[mappedSegment release];
+	[recordKey release];
+	[notationPrefs release];
+
+	[super dealloc];
+}
+
+@end
+
+@implementation NoteRecordBody
+
+- (id)initWithSegmentData:(NSData*)data recordRange:(NSRange)aRange bodyOffset:(u_int32_t)anOffset key:(NSData*)aKey excerpt:(NSString*)anExcerpt {
+	if ([super init]) {
+		segmentData = [data retain];
+		recordKey = [aKey retain];
+		recordRange = aRange;
+		bodyOffset = anOffset;
+		excerpt = [anExcerpt copy];
+	}
+	return self;
+}
+
+- (NSString*)excerpt {
+	return excerpt;
+}
+
+- (BOOL)isEncodedWithKey:(NSData*)aKey {
+	return recordKey == aKey || [recordKey isEqualToData:aKey];
+}
+
+- (NSData*)encodedBodyPart {
+	//the IV and encoded archive of the body, just as they are in the segment; not to be kept beyond the receiver
+	return [NSData dataWithBytesNoCopy:(void*)([segmentData bytes] + recordRange.location + bodyOffset)
+								length:recordRange.length - bodyOffset freeWhenDone:NO];
+}
+
+- (NSMutableAttributedString*)copyBodyReturningError:(OSStatus*)err {
+	const char *recordBytes = [segmentData bytes] + recordRange.location;
+
+	*err = noErr;
+
+	if (!RecordBytesAreIntact(recordBytes, (u_int32_t)recordRange.length)) {
+		NSLog(@"NoteRecordBody: record at offset %lu is damaged", (unsigned long)recordRange.location);
+		*err = kDataFormattingErr;
+		return nil;
+	}
+
+	return CopyBodyFromRecordPart(recordBytes + bodyOffset, recordRange.length - bodyOffset, recordKey, err);
+}
+
+- (void)dealloc {
+	[segmentData release];
+	[recordKey release];
+	[excerpt release];
+
+	[super dealloc];
+}
+
+@end
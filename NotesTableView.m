@@ -81,6 +81,7 @@ static void _CopyItemWithSelectorFromMenu(NSMenu *destMenu, NSMenu *sourceMenu,
 		NSInteger (*sortFunctions[])(id*, id*) = { compareTitleString, compareLabelString, compareDateModified, compareDateCreated };
 		NSInteger (*reverseSortFunctions[])(id*, id*) = { compareTitleStringReverse, compareLabelStringReverse, compareDateModifiedReverse, 
 			compareDateCreatedReverse };
+		uint64_t (*sortKeyFunctions[])(id) = { NULL, NULL, dateModifiedSortKeyOfNote, dateCreatedSortKeyOfNote };
 		
 		unsigned int i;
 		for (i=0; i<sizeof(colStrings)/sizeof(NSString*); i++) {
@@ -92,6 +93,7 @@ static void _CopyItemWithSelectorFromMenu(NSMenu *destMenu, NSMenu *sourceMenu,
 			[column setDereferencingFunction:colReferencors[i]];
 			[column setSortingFunction:sortFunctions[i]];
 			[column setReverseSortingFunction:reverseSortFunctions[i]];
+			[column setSortKeyFunction:sortKeyFunctions[i]];
 			[column setResizingMask:NSTableColumnUserResizingMask];
 			
 			[allColsDict setObject:column forKey:colStrings[i]];
@@ -8,9 +8,7 @@
 #import "PreviewController.h"
 #import "AppController.h" // TODO for the defines only, can you get around that?
 #import "AppController_Preview.h"
-#import "NSString_MultiMarkdown.h"
-#import "NSString_Markdown.h"
-#import "NSString_Textile.h"
+#import "NSString_Markup.h"
 #import "NoteObject.h"
 #import "ETTransparentButtonCell.h"
 #import "ETTransparentButton.h"
@@ -336,8 +334,7 @@
 //	NSString *lastScrollPosition = [[preview windowScriptObject] evaluateWebScript:@"document.getElementsByTagName('body')[0].scrollTop"];
 	AppController *app = object;
 	NSString *rawString = [app noteContent];
-	SEL mode = [self markupProcessorSelector:[app currentPreviewMode]];
-	NSString *processedString = [NSString performSelector:mode withObject:rawString];
+	NSString *processedString = [NSString stringWithProcessedMarkup:rawString previewMode:[app currentPreviewMode]];
   NSString *previewString = processedString;
 	NSMutableString *outputString = [NSMutableString stringWithString:(NSString *)htmlString];
 	NSString *noteTitle =  ([app selectedNoteObject]) ? [NSString stringWithFormat:@"%@",titleOfNote([app selectedNoteObject])] : @"";
@@ -366,20 +363,6 @@
     self.isPreviewOutdated = NO;
 }
 
--(SEL)markupProcessorSelector:(NSInteger)previewMode
-{
-    if (previewMode == MarkdownPreview) {
-		previewMode = MultiMarkdownPreview;
-        return @selector(stringWithProcessedMultiMarkdown:);
-    } else if (previewMode == MultiMarkdownPreview) {
-        return @selector(stringWithProcessedMultiMarkdown:);
-    } else if (previewMode == TextilePreview) {
-        return @selector(stringWithProcessedTextile:);
-    }
-
-    return nil;
-}
-
 + (void) createCustomFiles
 {
 		NSFileManager *fileManager = [NSFileManager defaultManager];
@@ -461,8 +444,7 @@
   AppController *app = [NSApp delegate];
 	NSString *noteTitle = [NSString stringWithFormat:@"%@",titleOfNote([app selectedNoteObject])];
   NSString *rawString = [app noteContent];
-  SEL mode = [self markupProcessorSelector:[app currentPreviewMode]];
-  NSString *processedString = [NSString performSelector:mode withObject:rawString];
+  NSString *processedString = [NSString stringWithProcessedMarkup:rawString previewMode:[app currentPreviewMode]];
 
 
 	NSMutableURLRequest *request = [[NSMutableURLRequest alloc]
@@ -519,15 +501,8 @@
 
 		AppController *app = [[NSApplication sharedApplication] delegate];
 		NSString *rawString = [app noteContent];
-		NSString *processedString = [[[NSString alloc] init] autorelease];
-
-		if ([app currentPreviewMode] == MarkdownPreview) {
-			processedString = [NSString stringWithProcessedMarkdown:rawString];
-		} else if ([app currentPreviewMode] == MultiMarkdownPreview) {
-			processedString = ( [includeTemplate state] == NSOnState ) ? [NSString documentWithProcessedMultiMarkdown:rawString] : [NSString xhtmlWithProcessedMultiMarkdown:rawString];
-		} else if ([app currentPreviewMode] == TextilePreview) {
-			processedString = ( [includeTemplate state] == NSOnState ) ? [NSString documentWithProcessedTextile:rawString] : [NSString xhtmlWithProcessedTextile:rawString];
-		}
+		NSString *processedString = ( [includeTemplate state] == NSOnState ) ? [NSString documentWithProcessedMarkup:rawString previewMode:[app currentPreviewMode]] :
+			[NSString xhtmlWithProcessedMarkup:rawString previewMode:[app currentPreviewMode]];
     NSURL *file = [sheet URL];
     NSError *error;
     [processedString writeToURL:file atomically:YES encoding:NSUTF8StringEncoding error:&error];
@@ -557,7 +532,7 @@
 
 
   NSString *rawString = [app noteContent];
-  NSString *xhtmlOutput = [NSString xhtmlWithProcessedMultiMarkdown:rawString];
+  NSString *xhtmlOutput = [NSString xhtmlWithProcessedMarkup:rawString previewMode:[app currentPreviewMode]];
   if ([xhtmlOutput hasPrefix:@"<?xml version="]) {
     [includeTemplate setState:0];
     [includeTemplate setEnabled:NO];
@@ -19,6 +19,7 @@
 #import <Cocoa/Cocoa.h>
 
 #import "SyncServiceSessionProtocol.h"
+#include "FetchWindow.h"
 
 @class NoteObject;
 @class DeletedNoteObject;
@@ -27,12 +28,17 @@
 @interface SimplenoteEntryCollector : NSObject <SyncServiceTask> {
 	NSArray *entriesToCollect;
 	NSMutableArray *entriesCollected, *entriesInError;
-	NSUInteger entryFinishedCount;
 	NSString *simperiumToken;
 	SEL entriesFinishedCallback;
 	id collectionDelegate;
 	BOOL stopped;
-	SyncResponseFetcher *currentFetcher;
+	
+	//fetchWindow decides which entries are fetched at once and which are retried; each finished entry waits in entryResults
+	//until those before it have finished too, so that entriesCollected and entriesInError keep the order of entriesToCollect
+	FetchWindow *fetchWindow;
+	NSMutableArray *activeFetchers, *activeFetcherIndexes;
+	NSMutableArray *entryResults;
+	NSMutableIndexSet *entryIndexesInError;
 	
 	id representedObject;
 }
@@ -50,8 +56,13 @@
 
 - (NSString*)localizedActionDescription;
 
+- (void)setMaximumConcurrentFetches:(NSUInteger)count;
+- (NSUInteger)maximumConcurrentFetches;
+
 - (void)startCollectingWithCallback:(SEL)aSEL collectionDelegate:(id)aDelegate;
 
+- (BOOL)shouldRetryFetcher:(SyncResponseFetcher*)fetcher;
+
 - (SyncResponseFetcher*)fetcherForEntry:(id)anEntry;
 
 - (NSDictionary*)preparedDictionaryWithFetcher:(SyncResponseFetcher*)fetcher receivedData:(NSData*)data;
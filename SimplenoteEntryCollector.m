@@ -27,6 +27,15 @@
 #import "DeletedNoteObject.h"
 
 
+#define kDefaultConcurrentFetches 4
+#define kMaximumFetchAttempts 3
+#define kRetryBaseDelay 1.0
+
+@interface SimplenoteEntryCollector (Private)
+- (void)_startFetchesInWindow;
+- (void)_finishIfDone;
+@end
+
 @implementation SimplenoteEntryCollector
 
 //instances this short-lived class are intended to be started only once, and then deallocated
@@ -42,6 +51,14 @@
 			NSLog(@"%s: missing parameters", _cmd);
 			return nil;
 		}
+		fetchWindow = FetchWindowCreate([entriesToCollect count], kDefaultConcurrentFetches, kMaximumFetchAttempts, kRetryBaseDelay);
+		activeFetchers = [[NSMutableArray alloc] initWithCapacity:kDefaultConcurrentFetches];
+		activeFetcherIndexes = [[NSMutableArray alloc] initWithCapacity:kDefaultConcurrentFetches];
+		entryIndexesInError = [[NSMutableIndexSet alloc] init];
+		
+		NSUInteger i = [entriesToCollect count];
+		entryResults = [[NSMutableArray alloc] initWithCapacity:i];
+		while (i--) [entryResults addObject:[NSNull null]];
 	}
 	return self;
 }
@@ -58,7 +75,16 @@
 }
 
 - (BOOL)collectionStarted {
-	return entryFinishedCount != 0;
+	return FetchWindowHasStarted(fetchWindow);
+}
+
+- (void)setMaximumConcurrentFetches:(NSUInteger)count {
+	NSAssert(![self collectionStarted], @"can't change the number of concurrent fetches once collection has started");
+	FetchWindowSetMaximumConcurrent(fetchWindow, count);
+}
+
+- (NSUInteger)maximumConcurrentFetches {
+	return FetchWindowMaximumConcurrent(fetchWindow);
 }
 
 - (BOOL)collectionStoppedPrematurely {
@@ -78,6 +104,11 @@
 	[entriesCollected release];
 	[entriesToCollect release];
 	[entriesInError release];
+	[entryResults release];
+	[entryIndexesInError release];
+	[activeFetchers release];
+	[activeFetcherIndexes release];
+	FetchWindowFree(fetchWindow);
 	[representedObject release];
 	[simperiumToken release];
 	[super dealloc];
@@ -85,11 +116,12 @@
 
 - (NSString*)statusText {
 	return [NSString stringWithFormat:NSLocalizedString(@"Downloading %u of %u notes", @"status text when downloading a note from the remote sync server"), 
-			entryFinishedCount, [entriesToCollect count]];
+			FetchWindowFinishedCount(fetchWindow), [entriesToCollect count]];
 }
 
 - (SyncResponseFetcher*)currentFetcher {
-	return currentFetcher;
+	//the most recently started of the fetchers still running
+	return [activeFetchers lastObject];
 }
 
 - (NSString*)localizedActionDescription {
@@ -97,11 +129,20 @@
 }
 
 - (void)stop {
+	if (stopped) return;
 	stopped = YES;
 	
-	//cancel the current fetcher, which will cause it to send its finished callback
-	//and the stopped condition will send this class' finished callback
-	[currentFetcher cancel];
+	//each retry was scheduled with its own index as the argument, which a selector-specific cancel would have to match
+	if (FetchWindowRetriesPending(fetchWindow))
+		[NSObject cancelPreviousPerformRequestsWithTarget:self];
+	FetchWindowStop(fetchWindow);
+	
+	//cancel the running fetchers, each of which will send its finished callback;
+	//once the last has done so the stopped condition will send this class' finished callback
+	NSArray *fetchers = [[activeFetchers copy] autorelease];
+	[fetchers makeObjectsPerformSelector:@selector(cancel)];
+	
+	[self _finishIfDone];
 }
 
 - (SyncResponseFetcher*)fetcherForEntry:(id)entry {
@@ -127,7 +168,63 @@
 	
 	[self retain];
 	
-	[(currentFetcher = [self fetcherForEntry:[entriesToCollect objectAtIndex:entryFinishedCount++]]) start];
+	[self _startFetchesInWindow];
+}
+
+- (void)_startFetchingEntryAtIndex:(NSUInteger)entryIndex {
+	SyncResponseFetcher *fetcher = [self fetcherForEntry:[entriesToCollect objectAtIndex:entryIndex]];
+	
+	[activeFetchers addObject:fetcher];
+	[activeFetcherIndexes addObject:[NSNumber numberWithUnsignedInteger:entryIndex]];
+	
+	if (![fetcher start]) {
+		//no callback will come from a fetcher that couldn't start
+		[self syncResponseFetcher:fetcher receivedData:nil returningError:NSLocalizedString(@"The connection could not be created.", nil)];
+	}
+}
+
+- (void)_startFetchesInWindow {
+	size_t entryIndex;
+	while ((entryIndex = FetchWindowStartNextEntry(fetchWindow)) != FETCH_WINDOW_NONE) {
+		[self _startFetchingEntryAtIndex:entryIndex];
+	}
+}
+
+- (void)_retryEntryWithIndex:(NSNumber*)entryIndex {
+	if (FetchWindowStartRetry(fetchWindow, [entryIndex unsignedIntegerValue]))
+		[self _startFetchingEntryAtIndex:[entryIndex unsignedIntegerValue]];
+}
+
+- (BOOL)shouldRetryFetcher:(SyncResponseFetcher*)fetcher {
+	//only failures that another attempt could plausibly fix
+	if ([fetcher didCancel]) return NO;
+	return FetchWindowStatusIsRetryable([fetcher statusCode]);
+}
+
+- (void)_mergeFinishedEntries {
+	//hand results over in the order the entries were given, regardless of the order their fetches finished
+	size_t entryIndex;
+	
+	while ((entryIndex = FetchWindowNextEntryToMerge(fetchWindow)) != FETCH_WINDOW_NONE) {
+		NSDictionary *result = [entryResults objectAtIndex:entryIndex];
+		if ([result count]) {
+			[([entryIndexesInError containsIndex:entryIndex] ? entriesInError : entriesCollected) addObject:result];
+		}
+		[entryResults replaceObjectAtIndex:entryIndex withObject:[NSNull null]];
+	}
+}
+
+- (void)_finishIfDone {
+	if (!entriesFinishedCallback) return;
+	
+	if (FetchWindowIsDone(fetchWindow)) {
+		//no more entries to collect!
+		SEL callback = entriesFinishedCallback;
+		entriesFinishedCallback = NULL;
+		[collectionDelegate performSelector:callback withObject:self];
+		[self autorelease];
+		[collectionDelegate autorelease];
+	}
 }
 
 - (NSDictionary*)preparedDictionaryWithFetcher:(SyncResponseFetcher*)fetcher receivedData:(NSData*)data {
@@ -183,40 +280,45 @@
 
 - (void)syncResponseFetcher:(SyncResponseFetcher*)fetcher receivedData:(NSData*)data returningError:(NSString*)errString {
 	
-	if (errString) {
-		NSLog(@"%s: collector-%@ returned %@", _cmd, fetcher, errString);
-		id obj = [fetcher representedObject];
-		if (obj) {
-			[entriesInError addObject:[NSDictionary dictionaryWithObjectsAndKeys: obj, @"NoteObject", 
-									   [NSNumber numberWithInt:[fetcher statusCode]], @"StatusCode", nil]];
-		}
-	} else {
-		NSDictionary *preparedDictionary = [self preparedDictionaryWithFetcher:fetcher receivedData:data];
-		if (!preparedDictionary) {
-			// Parsing JSON failed.  Is this the right way to handle the error?
-			id obj = [fetcher representedObject];
-			if (obj) {
-				[entriesInError addObject: [NSDictionary dictionaryWithObjectsAndKeys: obj, @"NoteObject",
-											[NSNumber numberWithInt:[fetcher statusCode]], @"StatusCode", nil]];
-			}
-		} else {
-			if ([preparedDictionary count]) {
-				[entriesCollected addObject: preparedDictionary];
-			}
-		}
+	NSUInteger fetcherIndex = [activeFetchers indexOfObjectIdenticalTo:fetcher];
+	if (fetcherIndex == NSNotFound) {
+		NSLog(@"%s: got a callback from unknown fetcher %@", _cmd, fetcher);
+		return;
 	}
+	NSUInteger entryIndex = [[activeFetcherIndexes objectAtIndex:fetcherIndex] unsignedIntegerValue];
+	[[fetcher retain] autorelease];
+	[activeFetchers removeObjectAtIndex:fetcherIndex];
+	[activeFetcherIndexes removeObjectAtIndex:fetcherIndex];
 	
-	if (entryFinishedCount >= [entriesToCollect count] || stopped) {
-		//no more entries to collect!
-		currentFetcher = nil;
-		[collectionDelegate performSelector:entriesFinishedCallback withObject:self];
-		[self autorelease];
-		[collectionDelegate autorelease];
+	BOOL failed = errString || [fetcher statusCode] >= 500 || [fetcher statusCode] == 429;
+	NSTimeInterval delay = FetchWindowFinishEntry(fetchWindow, entryIndex, failed, failed && [self shouldRetryFetcher:fetcher]);
+	if (delay >= 0.0) {
+		//backing off exponentially, this entry keeps its place in the window until it is tried again
+		NSLog(@"%s: collector-%@ returned %@ (status %d); retrying in %g seconds", _cmd, fetcher, errString, [fetcher statusCode], delay);
+		[self performSelector:@selector(_retryEntryWithIndex:) withObject:[NSNumber numberWithUnsignedInteger:entryIndex] afterDelay:delay];
+		return;
+	}
+	
+	NSDictionary *result = nil;
+	if (!errString) {
+		result = [self preparedDictionaryWithFetcher:fetcher receivedData:data];
+		// a nil result means parsing JSON failed.  Is this the right way to handle the error?
 	} else {
-		//queue next entry
-		[(currentFetcher = [self fetcherForEntry:[entriesToCollect objectAtIndex:entryFinishedCount++]]) start];
+		NSLog(@"%s: collector-%@ returned %@", _cmd, fetcher, errString);
+	}
+	if (!result) {
+		id obj = [fetcher representedObject];
+		result = obj ? [NSDictionary dictionaryWithObjectsAndKeys: obj, @"NoteObject", 
+						[NSNumber numberWithInt:[fetcher statusCode]], @"StatusCode", nil] : [NSDictionary dictionary];
+		[entryIndexesInError addIndex:entryIndex];
 	}
+	[entryResults replaceObjectAtIndex:entryIndex withObject:result];
 	
+	[self _mergeFinishedEntries];
+	
+	//queue next entries
+	[self _startFetchesInWindow];
+	[self _finishIfDone];
 }
 
 @end
@@ -251,6 +353,12 @@
 	return [self performSelector:fetcherOpSEL withObject:anEntry];
 }
 
+- (BOOL)shouldRetryFetcher:(SyncResponseFetcher*)fetcher {
+	//a failed creation might still have reached the server, and a retry would create the note again under a new key
+	if (@selector(fetcherForCreatingNote:) == fetcherOpSEL) return NO;
+	return [super shouldRetryFetcher:fetcher];
+}
+
 - (SyncResponseFetcher*)_fetcherForNote:(NoteObject*)aNote creator:(BOOL)doesCreate {
 	NSAssert([aNote isKindOfClass:[NoteObject class]], @"need a real note to create");
 	
@@ -348,7 +456,7 @@
 - (NSString*)statusText {
 	NSString *opName = [self localizedActionDescription];
 	if ([entriesToCollect count] == 1) {
-		NoteObject *aNote = [currentFetcher representedObject];
+		NoteObject *aNote = [[self currentFetcher] representedObject];
 		if ([aNote isKindOfClass:[NoteObject class]]) {
 			return [NSString stringWithFormat:NSLocalizedString(@"%@ quot%@quot...",@"example: Updating 'joe shmoe note'"), opName, titleOfNote(aNote)];
 		} else {
@@ -356,7 +464,7 @@
 		}
 	}
 	return [NSString stringWithFormat:NSLocalizedString(@"%@ %u of %u notes", @"Downloading/Creating/Updating/Deleting 5 of 10 notes"), 
-			opName, entryFinishedCount, [entriesToCollect count]];
+			opName, FetchWindowFinishedCount(fetchWindow), [entriesToCollect count]];
 }
 
 #if 0 /* allowing creation to complete will be of no use when the note's 
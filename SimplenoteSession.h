@@ -112,6 +112,7 @@ extern NSString * const kSimperiumAPIKey;
 - (void)_clearTokenAndDependencies;
 - (BOOL)_checkToken;
 
+- (NSDictionary*)_indexEntryWithRawEntry:(NSDictionary*)rawEntry;
 - (NSArray*)_notesWithEntries:(NSArray*)entries;
 - (NSMutableDictionary*)_invertedContentHashesOfNotes:(NSArray*)notes withSeparator:(NSString*)sep;
 
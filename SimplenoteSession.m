@@ -20,6 +20,7 @@
 #import "SimperiumConfig.h"
 #import "SimplenoteSession.h"
 #import "SyncResponseFetcher.h"
+#import "JSONStreamParser.h"
 #import "SimplenoteEntryCollector.h"
 #import "NSCollection_utils.h"
 #import "GlobalPrefs.h"
@@ -321,6 +322,7 @@ static void SNReachabilityCallback(SCNetworkReachabilityRef	target, SCNetworkCon
 
 		NSDictionary *headers = [NSMutableDictionary dictionaryWithObject:simperiumToken forKey:@"X-Simperium-Token"];
 		listFetcher = [[SyncResponseFetcher alloc] initWithURL:listURL POSTData:nil headers:headers delegate:self];
+		[listFetcher setStreamsReceivedData:YES];
 	}
 	return listFetcher;
 }
@@ -336,6 +338,7 @@ static void SNReachabilityCallback(SCNetworkReachabilityRef	target, SCNetworkCon
 
 		NSDictionary *headers = [NSMutableDictionary dictionaryWithObject:simperiumToken forKey:@"X-Simperium-Token"];
 		changesFetcher = [[SyncResponseFetcher alloc] initWithURL:changesURL POSTData:nil headers:headers delegate:self];
+		[changesFetcher setStreamsReceivedData:YES];
 	}
 	return changesFetcher;
 }
@@ -731,18 +734,10 @@ static void SNReachabilityCallback(SCNetworkReachabilityRef	target, SCNetworkCon
 	NSMutableDictionary *dict = [NSMutableDictionary dictionaryWithCapacity:[notes count]];
 	NSUInteger i = 0;
 	//build two kinds of dicts:
+	//each note's digest is derived from the one it keeps of its body, so bodies are neither combined nor hashed again
 	for (i=0; i<[notes count]; i++) {
 		NoteObject *aNote = [notes objectAtIndex:i];
-		NSMutableString *combined = [[NSMutableString alloc] initWithCapacity:[[aNote contentString] length] + [titleOfNote(aNote) length] + [sep length]];
-		[combined appendString:titleOfNote(aNote)];
-		[combined appendString:sep];
-		[combined appendString:[[aNote contentString] string]];
-#if MAC_OS_X_VERSION_MIN_REQUIRED >= MAC_OS_X_VERSION_10_5
-		[dict setObject:aNote forKey:[NSNumber numberWithUnsignedInteger:[combined hash]]];
-#else
-		[dict setObject:aNote forKey:[NSNumber numberWithUnsignedInt:[combined hash]]];
-#endif
-		[combined release];
+		[dict setObject:aNote forKey:[NSNumber numberWithUnsignedLongLong:[aNote contentDigestWithSeparator:sep]]];
 	}
 	return dict;
 }
@@ -776,10 +771,12 @@ static void SNReachabilityCallback(SCNetworkReachabilityRef	target, SCNetworkCon
 	NSArray *localNotes = [collector representedObject];
 	NSAssert([localNotes isKindOfClass:[NSArray class]], @"list of locally-added notes must be an array!");
 	
-	//localnotes have no keys, servernotes have keys; match them together by building a dictionary of content-hashes -> notes
+	//localnotes have no keys, servernotes have keys; match them together by building a dictionary of content-digests -> notes
+	CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
 	NSMutableDictionary *doubleNewlineLocalNotes = [self _invertedContentHashesOfNotes:localNotes withSeparator:@"\n\n"];
 	NSMutableDictionary *singleNewlineLocalNotes = [self _invertedContentHashesOfNotes:localNotes withSeparator:@"\n"];
 	NSMutableDictionary *serverContentNotes = [NSMutableDictionary dictionary];
+	CFAbsoluteTime localDigestTime = CFAbsoluteTimeGetCurrent();
 	
 	NSMutableArray *downloadedNotesToKeep = [NSMutableArray array];
 	NSMutableArray *notesToReportModified = [NSMutableArray array];
@@ -789,11 +786,7 @@ static void SNReachabilityCallback(SCNetworkReachabilityRef	target, SCNetworkCon
 	for (i=0; i<[serverNotes count]; i++) {
 		NoteObject *serverNote = [serverNotes objectAtIndex:i];
 		NSDictionary *info = [entries objectAtIndex:i];
-#if MAC_OS_X_VERSION_MIN_REQUIRED >= MAC_OS_X_VERSION_10_5
-		NSNumber *contentHashNum = [NSNumber numberWithUnsignedInteger:[[info objectForKey:@"content"] hash]];
-#else
-		NSNumber *contentHashNum = [NSNumber numberWithUnsignedInt:[[info objectForKey:@"content"] hash]];
-#endif
+		NSNumber *contentHashNum = [NSNumber numberWithUnsignedLongLong:contentDigestOfString([info objectForKey:@"content"])];
 		NoteObject *matchingLocalNote = [singleNewlineLocalNotes objectForKey:contentHashNum];
 		if (matchingLocalNote || (matchingLocalNote = [doubleNewlineLocalNotes objectForKey:contentHashNum])) {
 			//update matchingLocalNote in place with the sync info from this entry
@@ -824,6 +817,9 @@ static void SNReachabilityCallback(SCNetworkReachabilityRef	target, SCNetworkCon
 		NSNumber *hashNum = [sngLocalNoteHashes objectAtIndex:i];
 		if ([serverContentNotes objectForKey:hashNum]) [localNotesToUpload removeObject:[singleNewlineLocalNotes objectForKey:hashNum]];
 	}
+	CFAbsoluteTime joinTime = CFAbsoluteTimeGetCurrent();
+	NSLog(@"%s: merged %u local with %u server notes in %.1f ms (local digests %.1f ms, join %.1f ms)", _cmd, [localNotes count], [serverNotes count],
+		  (joinTime - startTime) * 1000.0, (localDigestTime - startTime) * 1000.0, (joinTime - localDigestTime) * 1000.0);
 		
 	if ([downloadedNotesToKeep count]) {
 		NSLog(@"%s: found %u genuinely new notes on the server",_cmd, [downloadedNotesToKeep count]);
@@ -945,6 +941,17 @@ static void SNReachabilityCallback(SCNetworkReachabilityRef	target, SCNetworkCon
 }
 
 - (void)_modifyNotes:(NSArray*)notes withOperation:(SEL)opSEL {
+	if (@selector(fetcherForDeletingNote:) != opSEL) {
+		//a note whose body couldn't be read would be uploaded without it, replacing the server's copy
+		NSMutableArray *readableNotes = [NSMutableArray arrayWithCapacity:[notes count]];
+		NSUInteger i;
+		for (i=0; i<[notes count]; i++) {
+			id <SynchronizedNote> aNote = [notes objectAtIndex:i];
+			if (![aNote isKindOfClass:[NoteObject class]] || [(NoteObject*)aNote hasReadableBody])
+				[readableNotes addObject:aNote];
+		}
+		notes = readableNotes;
+	}
 	if (![notes count]) {
 		//NSLog(@"not doing %s because no notes specified", opSEL);
 		return;
@@ -1066,7 +1073,67 @@ static void SNReachabilityCallback(SCNetworkReachabilityRef	target, SCNetworkCon
 }
 
 
+- (NSDictionary*)_indexEntryWithRawEntry:(NSDictionary*)rawEntry {
+	//convert syncnum, dates and "deleted" indicator into NSNumbers
+	if (![rawEntry isKindOfClass:[NSDictionary class]]) return nil;
+	
+	NSString *noteKey = [rawEntry objectForKey:@"id"];
+	NSNumber *version = [NSNumber numberWithInt:[[rawEntry objectForKey:@"v"] intValue]];
+	if (![noteKey length] || ![version intValue]) return nil;
+
+	NSDictionary *noteData = [rawEntry objectForKey:@"d"];
+	NSMutableDictionary *entry = [NSMutableDictionary dictionaryWithCapacity:6];
+	if (noteData) {
+		[entry setObject:[NSNumber numberWithDouble:[[NSDate dateWithTimeIntervalSince1970:[[noteData objectForKey:@"modificationDate"] doubleValue]] timeIntervalSinceReferenceDate]] forKey:@"modify"];
+		[entry setObject:[NSNumber numberWithInt:[[noteData objectForKey:@"deleted"] intValue]] forKey:@"deleted"];
+		[entry setObject:[noteData objectForKey:@"systemTags"] forKey:@"systemtags"];
+		[entry setObject:[noteData objectForKey:@"tags"] forKey:@"tags"];
+	}
+	[entry setObject:noteKey forKey:@"key"];
+	[entry setObject:version forKey:@"version"];
+	return entry;
+}
+
+- (id)jsonStreamParser:(JSONStreamParser*)parser objectForElement:(id)element {
+	//index and change entries are reduced to what we need as soon as each is parsed, 
+	//so that neither the response nor its full object graph is ever held in memory
+	if (parser == [listFetcher representedObject]) {
+		return [self _indexEntryWithRawEntry:element];
+	}
+	if (![element isKindOfClass:[NSDictionary class]] || ![element objectForKey:@"id"]) return nil;
+	
+	NSMutableDictionary *change = [NSMutableDictionary dictionaryWithCapacity:4];
+	[change setObject:[element objectForKey:@"id"] forKey:@"id"];
+	if ([element objectForKey:@"ev"]) [change setObject:[element objectForKey:@"ev"] forKey:@"ev"];
+	if ([element objectForKey:@"o"]) [change setObject:[element objectForKey:@"o"] forKey:@"o"];
+	if ([element objectForKey:@"cv"]) [change setObject:[element objectForKey:@"cv"] forKey:@"cv"];
+	return change;
+}
+
+- (void)syncResponseFetcher:(SyncResponseFetcher*)fetcher receivedPartialData:(NSData*)data {
+	//the index and changes fetchers are parsed as their responses arrive
+	JSONStreamParser *parser = [fetcher representedObject];
+	if (!parser) {
+		parser = [[JSONStreamParser alloc] initWithStreamedArrayKey:fetcher == listFetcher ? @"index" : nil delegate:self];
+		[fetcher setRepresentedObject:parser];
+		[parser release];
+	}
+	[parser parseData:data];
+}
+
+- (void)syncResponseFetcherDidStartResponse:(SyncResponseFetcher*)fetcher {
+	//a parser half-way through an earlier body would otherwise read this one as its continuation
+	[fetcher setRepresentedObject:nil];
+}
+
 - (void)syncResponseFetcher:(SyncResponseFetcher*)fetcher receivedData:(NSData*)data returningError:(NSString*)errString {
+	//the changes fetcher is reused, so it must not keep the parser for this response
+	JSONStreamParser *parser = nil;
+	if ([fetcher streamsReceivedData]) {
+		parser = [[[fetcher representedObject] retain] autorelease];
+		[fetcher setRepresentedObject:nil];
+	}
+	
 	if (errString) {
 		if ((fetcher == listFetcher || fetcher == changesFetcher) && [fetcher statusCode] == 401 && !lastIndexAuthFailed) {
 			//token might have expired, and the only reason we would be asked to fetch the list would be if it were for a full sync
@@ -1082,13 +1149,17 @@ static void SNReachabilityCallback(SCNetworkReachabilityRef	target, SCNetworkCon
 		[self _stoppedWithErrorString:[fetcher didCancel] ? nil : errString];
 		return;
 	}
-	NSString *bodyString = [[[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] autorelease];
+	NSString *bodyString = nil;
 	NSDictionary *responseDictionary = nil;
 	NSArray *rawEntries = nil;
-	NSMutableArray *entries = nil;
 	NSUInteger i = 0;
 
+	if (parser && ![parser finish]) {
+		NSLog(@"Error while parsing Simplenote JSON index: %@", [parser errorDescription]);
+	}
+
 	if (fetcher == loginFetcher) {
+		bodyString = [[[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] autorelease];
 		@try {
 			responseDictionary = [NSDictionary dictionaryWithJSONString:bodyString];
 		} @catch (NSException *e) {
@@ -1101,18 +1172,10 @@ static void SNReachabilityCallback(SCNetworkReachabilityRef	target, SCNetworkCon
 			[self _stoppedWithErrorString:NSLocalizedString(@"No authorization token", @"Simplenote-specific error")];
 		}
 	} else if (fetcher == changesFetcher) {
-		bodyString = [NSString stringWithFormat:@"{\"changes\":%@}", bodyString];
-		@try {
-			responseDictionary = [NSDictionary dictionaryWithJSONString:bodyString];
-			if (responseDictionary) {
-				rawEntries = [responseDictionary objectForKey:@"changes"];
-			}
-		} @catch (NSException *e) {
-			NSLog(@"Exception while parsing Simplenote JSON index: %@", [e reason]);
-		} @finally {
-			if (!rawEntries) {
-				[self _stoppedWithErrorString:NSLocalizedString(@"The index of notes could not be parsed.", @"Simplenote-specific error")];
-			}
+		//the changes are reduced by jsonStreamParser:objectForElement: as they are parsed
+		rawEntries = [[parser rootObject] isKindOfClass:[NSArray class]] ? [parser rootObject] : nil;
+		if (!rawEntries) {
+			[self _stoppedWithErrorString:NSLocalizedString(@"The index of notes could not be parsed.", @"Simplenote-specific error")];
 		}
 		if ([fetcher statusCode] == 400 || [fetcher statusCode] == 401 || [fetcher statusCode] == 404) {
 			NSLog(@"changes fetcher error code: %u", [fetcher statusCode]);
@@ -1159,41 +1222,16 @@ static void SNReachabilityCallback(SCNetworkReachabilityRef	target, SCNetworkCon
 
     } else if (fetcher == listFetcher) {
 		lastIndexAuthFailed = NO;
-		@try {
-			responseDictionary = [NSDictionary dictionaryWithJSONString:bodyString];
-			if (responseDictionary) {
-				rawEntries = [responseDictionary objectForKey:@"index"];
-			}
-		} @catch (NSException *e) {
-			NSLog(@"Exception while parsing Simplenote JSON index: %@", [e reason]);
-		} @finally {
-			if (!rawEntries) {
-				[self _stoppedWithErrorString:NSLocalizedString(@"The index of notes could not be parsed.", @"Simplenote-specific error")];
-				return;
-			}
+		//the entries were already converted by jsonStreamParser:objectForElement: as they were parsed
+		if ([[parser rootObject] isKindOfClass:[NSDictionary class]]) {
+			responseDictionary = [parser rootObject];
+			rawEntries = [responseDictionary objectForKey:@"index"];
 		}
-
-		//convert syncnum, dates and "deleted" indicator into NSNumbers
-		entries = [NSMutableArray arrayWithCapacity:[rawEntries count]];
-		for (i=0; i<[rawEntries count]; i++) {
-			NSDictionary *rawEntry = [rawEntries objectAtIndex:i];
-			NSString *noteKey = [rawEntry objectForKey:@"id"];
-			NSNumber *version = [NSNumber numberWithInt:[[rawEntry objectForKey:@"v"] intValue]];
-
-			NSDictionary *noteData = [rawEntry objectForKey:@"d"];
-			NSMutableDictionary *entry = [NSMutableDictionary dictionaryWithCapacity:6];
-			if (noteData) {
-				[entry setObject:[NSNumber numberWithDouble:[[NSDate dateWithTimeIntervalSince1970:[[noteData objectForKey:@"modificationDate"] doubleValue]] timeIntervalSinceReferenceDate]] forKey:@"modify"];
-				[entry setObject:[NSNumber numberWithInt:[[noteData objectForKey:@"deleted"] intValue]] forKey:@"deleted"];
-				[entry setObject:[noteData objectForKey:@"systemTags"] forKey:@"systemtags"];
-				[entry setObject:[noteData objectForKey:@"tags"] forKey:@"tags"];
-			}
-			if ([noteKey length] && [version intValue]) {
-				[entry setObject:noteKey forKey:@"key"];
-				[entry setObject:version forKey:@"version"];
-				[entries addObject:entry];
-			}
+		if (![rawEntries isKindOfClass:[NSArray class]]) {
+			[self _stoppedWithErrorString:NSLocalizedString(@"The index of notes could not be parsed.", @"Simplenote-specific error")];
+			return;
 		}
+		NSArray *entries = rawEntries;
 
 		[lastErrorString autorelease];
 		lastErrorString = nil;
@@ -1249,6 +1287,7 @@ static void SNReachabilityCallback(SCNetworkReachabilityRef	target, SCNetworkCon
 			indexEntryBuffer = nil;
 		}
 	} else {
+		bodyString = [[[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] autorelease];
 		NSLog(@"unknown fetcher returned: %@, body: %@", fetcher, bodyString);
 	}
 }
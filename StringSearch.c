@@ -0,0 +1,85 @@
+/*
+ *  StringSearch.c
+ *  Notation
+ *
+ */
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+#include "StringSearch.h"
+#include <stdint.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//defined by the prefix header in the app, but not where the tests build this file
+#if !defined(force_inline)
+#define force_inline __attribute__((always_inline))
+#endif
+
+static inline force_inline int RestOfNeedleMatches(const char *s, const char *needle) {
+	//stops at the end of s, too, as its NUL can never equal a byte of the needle
+	while (*needle && *s == *needle) {
+		s++;
+		needle++;
+	}
+	return !*needle;
+}
+
+/* compares the first two bytes of the needle against 16 haystack positions at once, confirming only the positions that match;
+   the haystack is scanned only up to the first match or the terminating NUL, so that matches near the start of a long note
+   are found without first measuring the whole note. blocks are loaded at 16-byte-aligned addresses
+   so that reading past the NUL can never cross into an unmapped page */
+char *fast_strstr(const char *haystack, const char *needle) {
+	if (!*needle)
+		return (char*)haystack;
+	
+#if defined(__SSE2__)
+	const __m128i first = _mm_set1_epi8(needle[0]), second = _mm_set1_epi8(needle[1]);
+	const __m128i zero = _mm_setzero_si128();
+	size_t misalignment = (uintptr_t)haystack & 15;
+	const char *block = haystack - misalignment;
+	unsigned int ignoredMask = (1U << misalignment) - 1;
+	
+	for (;;) {
+		__m128i bytes = _mm_load_si128((const __m128i*)block);
+		unsigned int endMask = _mm_movemask_epi8(_mm_cmpeq_epi8(zero, bytes)) & ~ignoredMask;
+		unsigned int firstMask = _mm_movemask_epi8(_mm_cmpeq_epi8(first, bytes)) & ~ignoredMask;
+		
+		//a position is worth confirming only if the byte after it matches too; that byte is in the next block for the last position
+		if (needle[1])
+			firstMask &= (_mm_movemask_epi8(_mm_cmpeq_epi8(second, bytes)) >> 1) | 0x8000;
+		
+		if (endMask)
+			firstMask &= endMask - 1;
+		
+		while (firstMask) {
+			unsigned int bit = __builtin_ctz(firstMask);
+			if (RestOfNeedleMatches(block + bit + 1, needle + 1))
+				return (char*)block + bit;
+			firstMask &= firstMask - 1;
+		}
+		if (endMask)
+			return NULL;
+		
+		block += 16;
+		ignoredMask = 0;
+	}
+#else
+	for (; (haystack = strchr(haystack, needle[0])); haystack++) {
+		if (RestOfNeedleMatches(haystack + 1, needle + 1))
+			return (char*)haystack;
+	}
+	return NULL;
+#endif
+}
@@ -0,0 +1,10 @@
+/*
+ *  StringSearch.h
+ *  Notation
+ *
+ *  the substring search behind note filtering, kept free of Carbon so that Tests/fast_strstr_test.c can check it
+ *
+ */
+
+//the same result as strstr(haystack, needle), found 16 bytes at a time where SSE2 is available
+char *fast_strstr(const char *haystack, const char *needle);
@@ -37,7 +37,7 @@
 	
 	NSInvocation *successInvocation;
 	id delegate;
-	BOOL isRunning, didCancel;
+	BOOL isRunning, didCancel, streamsReceivedData;
 }
 
 - (id)initWithURL:(NSURL*)aURL bodyStringAsUTF8B64:(NSString*)stringToEncode delegate:(id)aDelegate;
@@ -46,6 +46,8 @@
 - (id)initWithURL:(NSURL*)aURL POSTData:(NSData*)POSTData headers:(NSDictionary *)aHeaders contentType:(NSString*)contentType delegate:(id)aDelegate;
 - (void)setRepresentedObject:(id)anObject;
 - (id)representedObject;
+- (void)setStreamsReceivedData:(BOOL)shouldStream;
+- (BOOL)streamsReceivedData;
 - (NSInvocation*)successInvocation;
 - (NSURL*)requestURL;
 - (NSDictionary*)headers;
@@ -65,4 +67,10 @@
 
 - (void)syncResponseFetcher:(SyncResponseFetcher*)fetcher receivedData:(NSData*)data returningError:(NSString*)errString;
 
+//sent instead of accumulating each chunk as it arrives for fetchers that stream their received data,
+//whose final callback above then includes no data
+- (void)syncResponseFetcher:(SyncResponseFetcher*)fetcher receivedPartialData:(NSData*)data;
+//sent to the same delegates before the first chunk of each response, and again if the connection starts over with another
+- (void)syncResponseFetcherDidStartResponse:(SyncResponseFetcher*)fetcher;
+
 @end
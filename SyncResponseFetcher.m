@@ -76,6 +76,14 @@
 	return representedObject;
 }
 
+- (void)setStreamsReceivedData:(BOOL)shouldStream {
+	streamsReceivedData = shouldStream;
+}
+
+- (BOOL)streamsReceivedData {
+	return streamsReceivedData;
+}
+
 - (BOOL)startWithSuccessInvocation:(NSInvocation*)anInvocation {
 
 	successInvocation = [anInvocation retain];
@@ -227,12 +235,19 @@
 	} else if (responseValid) {
 		[headers autorelease];
 		headers = [[(NSHTTPURLResponse*)response allHeaderFields] copy];
+		
+		//a redirect or a repeated response starts the body over, so whatever was made of the chunks so far is now useless
+		if (streamsReceivedData) [delegate syncResponseFetcherDidStartResponse:self];
 	}
 }
 
 - (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data {
 	if (data) {
-		[receivedData appendData:data];
+		if (streamsReceivedData) {
+			[delegate syncResponseFetcher:self receivedPartialData:data];
+		} else {
+			[receivedData appendData:data];
+		}
 	}
 }
 
@@ -197,8 +197,8 @@ static void SleepCallBack(void *refcon, io_service_t y, natural_t messageType, v
 	
 	//file notifications are not always caught without user activity; let's make sure the directory is always in sync
 	//this will have the side effect of showing the deletion-warning sheet at potentially unexpected times
-	if ([syncDelegate respondsToSelector:@selector(synchronizeNotesFromDirectory)])
-		[syncDelegate synchronizeNotesFromDirectory];
+	if ([syncDelegate respondsToSelector:@selector(synchronizeChangedNotesFromDirectory)])
+		[syncDelegate synchronizeChangedNotesFromDirectory];
 	
 	[session startFetchingListForFullSync];
 }
@@ -22,9 +22,11 @@
 	} else {
 		[dict addEntriesFromDictionary:aDict];
 	}
+	[self _syncServicesMDDidChange];
 }
 - (void)removeAllSyncMDForService:(NSString*)serviceName {
 	[syncServicesMD removeObjectForKey:serviceName];
+	[self _syncServicesMDDidChange];
 }
 //- (void)removeKey:(NSString*)aKey forService:(NSString*)serviceName {
 //	[[syncServicesMD objectForKey:serviceName] removeObjectForKey:aKey];
@@ -0,0 +1,189 @@
+/*
+ *  aho_corasick_test.c
+ *  Notation
+ *
+ *  checks ACAutomatonScan against one strstr per needle, with needles that overlap, contain one another or share
+ *  prefixes and suffixes so that matches are found through failure links, for the found mask, the early stop and the
+ *  position of the tracked needle; also checks that an automaton is recognized for its own needles and survives
+ *  being shared; with -bench, compares a scan with the naive search and times building the automaton
+ *
+ */
+
+#include "AhoCorasick.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//the textbook failure-link cases, and a needle that is a suffix of another found only through its link
+static const char *classicNeedles[] = { "he", "she", "his", "hers", "ushers", "e", "sh" };
+
+static void fillText(char *text, size_t length, int alphabet) {
+	size_t i;
+	for (i = 0; i < length; i++) text[i] = 'a' + rand() % alphabet;
+	text[length] = '\0';
+}
+
+static int checkScan(const ACAutomaton *automaton, const char **needles, unsigned int needleCount, const char *text,
+					 uint64_t initialMask, unsigned int trackedNeedle) {
+	uint64_t expectedMask = initialMask, foundMask = initialMask;
+	unsigned int i;
+
+	for (i = 0; i < needleCount; i++)
+		if (strstr(text, needles[i])) expectedMask |= 1ULL << i;
+	const char *expectedMatch = strstr(text, needles[trackedNeedle]);
+
+	const char *match = ACAutomatonScan(automaton, text, &foundMask, trackedNeedle);
+	if (foundMask != expectedMask || match != expectedMatch) {
+		printf("FAIL: in \"%.40s\"%s, found %#llx (expected %#llx), needle %u at %ld (expected %ld)\n", text, strlen(text) > 40 ? "..." : "",
+			   (unsigned long long)foundMask, (unsigned long long)expectedMask, trackedNeedle,
+			   match ? (long)(match - text) : -1L, expectedMatch ? (long)(expectedMatch - text) : -1L);
+		return 1;
+	}
+	return 0;
+}
+
+static int checkClassic(void) {
+	static const char *texts[] = { "ushers", "ahishers", "she", "hhhe", "his hers", "", "xyz", "sushi", "shhe" };
+	unsigned int needleCount = sizeof(classicNeedles) / sizeof(classicNeedles[0]), i, tracked;
+	ACAutomaton *automaton = ACAutomatonCreate(classicNeedles, needleCount);
+	int failures = 0;
+
+	for (i = 0; i < sizeof(texts) / sizeof(texts[0]); i++)
+		for (tracked = 0; tracked < needleCount; tracked++)
+			failures += checkScan(automaton, classicNeedles, needleCount, texts[i], 0, tracked);
+	ACAutomatonFree(automaton);
+	return failures;
+}
+
+static int checkRandom(unsigned int trials) {
+	int failures = 0;
+	unsigned int t;
+
+	srand(1975);
+	for (t = 0; t < trials && failures < 10; t++) {
+		char needleBuffers[kACMaxNeedles][8], text[600];
+		const char *needles[kACMaxNeedles];
+		unsigned int needleCount = 1 + rand() % (t % 16 ? 6 : kACMaxNeedles), i;
+		//a tiny alphabet makes overlapping and nested needles the rule
+		int alphabet = 2 + rand() % 3;
+
+		for (i = 0; i < needleCount; i++) {
+			fillText(needleBuffers[i], 1 + rand() % 5, alphabet);
+			needles[i] = needleBuffers[i];
+		}
+		fillText(text, rand() % sizeof(text), alphabet);
+
+		ACAutomaton *automaton = ACAutomatonCreate(needles, needleCount);
+		//needles found in an earlier field of the same note arrive in the initial mask
+		uint64_t initialMask = rand() % 2 ? 0 : ((uint64_t)rand() << 32 | rand()) & ACAutomatonAllNeedlesMask(automaton);
+		failures += checkScan(automaton, needles, needleCount, text, initialMask, rand() % needleCount);
+		ACAutomatonFree(automaton);
+	}
+	return failures;
+}
+
+static int checkReuse(void) {
+	const char *same[] = { "he", "she", "his", "hers", "ushers", "e", "sh" };
+	const char *reordered[] = { "she", "he", "his", "hers", "ushers", "e", "sh" };
+	const char *longer[] = { "he", "she", "his", "hers", "ushers", "e", "shh" };
+	unsigned int needleCount = sizeof(classicNeedles) / sizeof(classicNeedles[0]);
+	ACAutomaton *automaton = ACAutomatonCreate(classicNeedles, needleCount);
+	int failures = 0;
+
+	//the bit of each needle follows its position, so a reordering is a different automaton
+	if (!ACAutomatonHasNeedles(automaton, same, needleCount) || ACAutomatonHasNeedles(automaton, reordered, needleCount) ||
+		ACAutomatonHasNeedles(automaton, longer, needleCount) || ACAutomatonHasNeedles(automaton, same, needleCount - 1)) {
+		printf("FAIL: an automaton wasn't recognized by its needles\n");
+		failures++;
+	}
+
+	//one reference given up leaves the other usable
+	ACAutomatonFree(ACAutomatonRetain(automaton));
+	failures += checkScan(automaton, classicNeedles, needleCount, "ushers", 0, 0);
+	ACAutomatonFree(automaton);
+
+	if (ACAutomatonCreate(NULL, 0) || ACAutomatonCreate(classicNeedles, kACMaxNeedles + 1)) {
+		printf("FAIL: an automaton was made for no needles or too many\n");
+		failures++;
+	}
+	return failures;
+}
+
+static double secondsNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(void) {
+	static const char *words[] = { "the ", "note ", "quick ", "brown ", "fox ", "\n", "todo: ", "meeting ", "agenda " };
+	static const char *needles[] = { "meeting", "agenda", "todo", "velocity", "brown fox", "notational", "zzz", "quick" };
+	const size_t noteCount = 2000, noteLength = 4000, passes = 10;
+	char **notes = (char **)malloc(noteCount * sizeof(char *));
+	size_t i, n, p, needleCount;
+
+	srand(1);
+	for (i = 0; i < noteCount; i++) {
+		size_t length = 0;
+		notes[i] = (char *)malloc(noteLength + 16);
+		while (length < noteLength) {
+			const char *word = words[rand() % (sizeof(words) / sizeof(words[0]))];
+			strcpy(notes[i] + length, word);
+			length += strlen(word);
+		}
+	}
+
+	printf("%zu notes of %zu bytes\n", noteCount, noteLength);
+	printf("%8s %14s %14s %14s\n", "words", "strstr (ms)", "automaton (ms)", "building (us)");
+	for (needleCount = 2; needleCount <= sizeof(needles) / sizeof(needles[0]); needleCount += 2) {
+		size_t naiveMatches = 0, automatonMatches = 0;
+
+		double start = secondsNow();
+		for (p = 0; p < passes; p++) {
+			for (i = 0; i < noteCount; i++) {
+				//as a note is filtered: it fails at the first word it lacks
+				for (n = 0; n < needleCount && strstr(notes[i], needles[n]); n++);
+				naiveMatches += n == needleCount;
+			}
+		}
+		double naiveTime = (secondsNow() - start) / passes;
+
+		start = secondsNow();
+		ACAutomaton *automaton = NULL;
+		for (p = 0; p < 1000; p++) {
+			ACAutomatonFree(automaton);
+			automaton = ACAutomatonCreate(needles, (unsigned int)needleCount);
+		}
+		double buildTime = (secondsNow() - start) / 1000;
+
+		start = secondsNow();
+		for (p = 0; p < passes; p++) {
+			for (i = 0; i < noteCount; i++) {
+				uint64_t foundMask = 0;
+				ACAutomatonScan(automaton, notes[i], &foundMask, (unsigned int)needleCount - 1);
+				automatonMatches += foundMask == ACAutomatonAllNeedlesMask(automaton);
+			}
+		}
+		double automatonTime = (secondsNow() - start) / passes;
+		ACAutomatonFree(automaton);
+
+		if (naiveMatches != automatonMatches) printf("(the automaton matched %zu notes, strstr %zu)\n", automatonMatches, naiveMatches);
+		printf("%8zu %14.3f %14.3f %14.1f\n", needleCount, naiveTime * 1e3, automatonTime * 1e3, buildTime * 1e6);
+	}
+
+	for (i = 0; i < noteCount; i++) free(notes[i]);
+	free(notes);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && !strcmp(argv[1], "-bench")) {
+		bench();
+		return 0;
+	}
+
+	int failures = checkClassic() + checkRandom(100000) + checkReuse();
+	printf("aho-corasick: %s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,70 @@
+/*
+ *  dispatch.h
+ *  Notation
+ *
+ *  just enough of libdispatch for the C sources that use it to build and run on systems without it
+ *
+ */
+
+#ifndef NV_DISPATCH_COMPAT_H
+#define NV_DISPATCH_COMPAT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define DISPATCH_QUEUE_PRIORITY_DEFAULT 0
+
+typedef void *dispatch_queue_t;
+
+static inline dispatch_queue_t dispatch_get_global_queue(long priority, unsigned long flags) {
+	(void)priority; (void)flags;
+	return NULL;
+}
+
+typedef struct {
+	void *context;
+	void (*work)(void *, size_t);
+	size_t iterations;
+	size_t next;
+	pthread_mutex_t lock;
+} nv_dispatch_apply_state;
+
+static void *nv_dispatch_apply_worker(void *arg) {
+	nv_dispatch_apply_state *state = (nv_dispatch_apply_state *)arg;
+	for (;;) {
+		pthread_mutex_lock(&state->lock);
+		size_t index = state->next++;
+		pthread_mutex_unlock(&state->lock);
+		if (index >= state->iterations)
+			return NULL;
+		state->work(state->context, index);
+	}
+}
+
+//like the real one, returns only once every iteration has finished, and runs on as many threads as there are CPUs
+static inline void dispatch_apply_f(size_t iterations, dispatch_queue_t queue, void *context, void (*work)(void *, size_t)) {
+	nv_dispatch_apply_state state = { context, work, iterations, 0, PTHREAD_MUTEX_INITIALIZER };
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t i, threadCount = cpus > 1 ? (size_t)cpus : 1;
+	(void)queue;
+	
+	if (threadCount > iterations)
+		threadCount = iterations;
+	pthread_t *threads = (pthread_t *)calloc(threadCount ? threadCount : 1, sizeof(pthread_t));
+	
+	//the calling thread works too, as it does with libdispatch
+	size_t started = 0;
+	for (i = 1; i < threadCount; i++) {
+		if (!pthread_create(&threads[started], NULL, nv_dispatch_apply_worker, &state))
+			started++;
+	}
+	nv_dispatch_apply_worker(&state);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&state.lock);
+}
+
+#endif
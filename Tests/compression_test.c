@@ -0,0 +1,223 @@
+/*
+ *  compression_test.c
+ *  Notation
+ *
+ *  checks that record parts round-trip through nv_compress and nv_uncompress at every length around the chunk
+ *  boundaries, that the chunked header is laid out as documented, that blobs in the legacy single-stream format are
+ *  still read, and that damaged data is refused; with -bench, compares the chunked format with a single zlib stream over a large text
+ *
+ */
+
+#include "ChunkedCompression.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define CHUNK NV_COMPRESSION_CHUNK_SIZE
+
+static const char *words[] = { "the ", "note ", "quick ", "brown ", "fox ", "\n", "- [ ] ", "todo: ", "http://example.com/ ", "2010-04-16 " };
+
+//text that compresses like notes do, or noise that doesn't compress at all
+static void FillBytes(unsigned char *bytes, size_t length, int compressible) {
+	size_t i = 0;
+	while (i < length) {
+		if (compressible) {
+			const char *word = words[rand() % (sizeof(words) / sizeof(words[0]))];
+			while (*word && i < length) bytes[i++] = *word++;
+		} else {
+			bytes[i++] = (unsigned char)rand();
+		}
+	}
+}
+
+static uint32_t ReadBig32(const unsigned char *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int CheckRoundTrip(size_t length, int compressible) {
+	unsigned char *original = (unsigned char *)malloc(length ? length : 1);
+	size_t compressedLength = 0, uncompressedLength = 0;
+	int failures = 0;
+
+	FillBytes(original, length, compressible);
+	unsigned char *compressed = nv_compress(original, length, Z_DEFAULT_COMPRESSION, &compressedLength);
+	if (!compressed) {
+		printf("FAIL: %zu bytes couldn't be compressed\n", length);
+		free(original);
+		return 1;
+	}
+
+	int chunked = nv_is_chunked_compressed(compressed, compressedLength);
+	if (chunked != (length > CHUNK) || nv_is_zlib_compressed(compressed, compressedLength) == chunked) {
+		printf("FAIL: %zu bytes were written in the wrong format\n", length);
+		failures++;
+	}
+
+	unsigned char *uncompressed = nv_uncompress(compressed, compressedLength, &uncompressedLength);
+	if (!uncompressed || uncompressedLength != length || memcmp(uncompressed, original, length)) {
+		printf("FAIL: %zu %s bytes didn't survive the round trip\n", length, compressible ? "text" : "random");
+		failures++;
+	}
+
+	if (chunked) {
+		//the header: magic, codec, chunk size, chunk count, 64-bit original length, then one length per chunk
+		size_t i, chunkCount = (length + CHUNK - 1) / CHUNK, payload = 0;
+		if (memcmp(compressed, "NVzC", 4) || ReadBig32(compressed + 4) != NVCompressionCodecZlib || ReadBig32(compressed + 8) != CHUNK ||
+			ReadBig32(compressed + 12) != chunkCount || ReadBig32(compressed + 16) != 0 || ReadBig32(compressed + 20) != length) {
+			printf("FAIL: the chunked header of %zu bytes is not as documented\n", length);
+			failures++;
+		}
+		for (i = 0; i < chunkCount; i++) {
+			uint32_t chunkLength = ReadBig32(compressed + 24 + i * 4);
+			//noise can't be compressed, so every chunk of it must have been stored as it was
+			if (!compressible && chunkLength != (0x80000000U | (i + 1 < chunkCount ? CHUNK : length - i * CHUNK))) {
+				printf("FAIL: chunk %zu of %zu random bytes wasn't stored\n", i, length);
+				failures++;
+			}
+			payload += chunkLength & ~0x80000000U;
+		}
+		if (24 + chunkCount * 4 + payload != compressedLength) {
+			printf("FAIL: the chunks of %zu bytes don't fill the data\n", length);
+			failures++;
+		}
+	}
+
+	free(uncompressed);
+	free(compressed);
+	free(original);
+	return failures;
+}
+
+//a blob as the versions before the chunked format wrote every compressed database and record
+static int CheckLegacyBlobs(unsigned int trials) {
+	int failures = 0;
+	unsigned int t;
+
+	for (t = 0; t < trials; t++) {
+		//larger than a chunk too, as a whole database was written in one stream
+		size_t length = t % 4 == 3 ? CHUNK + rand() % (3 * CHUNK) : rand() % 8192, uncompressedLength = 0;
+		unsigned char *original = (unsigned char *)malloc(length + 1);
+		uLongf bufferLength = compressBound(length);
+		unsigned char *blob = (unsigned char *)malloc(bufferLength + 4);
+
+		FillBytes(original, length, t % 2);
+		compress2(blob, &bufferLength, original, length, 1 + t % 9);
+		blob[bufferLength] = (unsigned char)(length >> 24); blob[bufferLength + 1] = (unsigned char)(length >> 16);
+		blob[bufferLength + 2] = (unsigned char)(length >> 8); blob[bufferLength + 3] = (unsigned char)length;
+
+		unsigned char *uncompressed = NULL;
+		if (nv_is_chunked_compressed(blob, bufferLength + 4) || !nv_is_zlib_compressed(blob, bufferLength + 4) ||
+			!(uncompressed = nv_uncompress(blob, bufferLength + 4, &uncompressedLength)) ||
+			uncompressedLength != length || memcmp(uncompressed, original, length)) {
+			printf("FAIL: a legacy blob of %zu bytes wasn't read back\n", length);
+			failures++;
+		}
+		free(uncompressed);
+		free(blob);
+		free(original);
+	}
+	return failures;
+}
+
+//truncated or altered data must be refused, without reading outside of it
+static int CheckDamagedData(unsigned int trials) {
+	size_t length = 3 * CHUNK + 1000, compressedLength = 0, uncompressedLength = 0;
+	unsigned char *original = (unsigned char *)malloc(length);
+	int failures = 0;
+	unsigned int t;
+
+	FillBytes(original, length, 1);
+	unsigned char *compressed = nv_compress(original, length, Z_DEFAULT_COMPRESSION, &compressedLength);
+
+	for (t = 0; t < trials; t++) {
+		unsigned char *damaged = (unsigned char *)malloc(compressedLength);
+		size_t damagedLength = compressedLength;
+		memcpy(damaged, compressed, compressedLength);
+
+		switch (t % 3) {
+			case 0: damagedLength = rand() % compressedLength; break;
+			//the header and chunk table
+			case 1: damaged[4 + rand() % 32] ^= 1 << (rand() % 8); break;
+			default: damaged[rand() % compressedLength] ^= 1 << (rand() % 8); break;
+		}
+
+		unsigned char *uncompressed = nv_uncompress(damaged, damagedLength, &uncompressedLength);
+		//a flip that zlib's checksums let through must at least leave the original
+		if (uncompressed && (uncompressedLength != length || memcmp(uncompressed, original, length))) {
+			printf("FAIL: damaged data (trial %u) decompressed to something other than the original\n", t);
+			failures++;
+		}
+		free(uncompressed);
+		free(damaged);
+	}
+
+	free(compressed);
+	free(original);
+	return failures;
+}
+
+static double SecondsNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Bench(void) {
+	size_t length = 32 << 20, compressedLength = 0, uncompressedLength = 0;
+	unsigned char *original = (unsigned char *)malloc(length), *uncompressed = (unsigned char *)malloc(length);
+	uLongf streamLength = compressBound(length), outLength = length;
+	unsigned char *stream = (unsigned char *)malloc(streamLength);
+
+	srand(1);
+	FillBytes(original, length, 1);
+
+	double start = SecondsNow();
+	compress2(stream, &streamLength, original, length, Z_DEFAULT_COMPRESSION);
+	double streamCompress = SecondsNow() - start;
+	start = SecondsNow();
+	uncompress(uncompressed, &outLength, stream, streamLength);
+	double streamUncompress = SecondsNow() - start;
+
+	start = SecondsNow();
+	unsigned char *chunked = nv_chunked_compress(original, length, NVCompressionCodecZlib, Z_DEFAULT_COMPRESSION, &compressedLength);
+	double chunkedCompress = SecondsNow() - start;
+	start = SecondsNow();
+	free(nv_uncompress(chunked, compressedLength, &uncompressedLength));
+	double chunkedUncompress = SecondsNow() - start;
+
+	printf("%zu MB of text, %ld cores\n", length >> 20, sysconf(_SC_NPROCESSORS_ONLN));
+	printf("%16s %16s %16s %8s\n", "", "compress MB/s", "decompress MB/s", "ratio");
+	printf("%16s %16.0f %16.0f %8.3f\n", "single stream", length / streamCompress / 1e6, length / streamUncompress / 1e6, (double)streamLength / length);
+	printf("%16s %16.0f %16.0f %8.3f\n", "chunked", length / chunkedCompress / 1e6, length / chunkedUncompress / 1e6, (double)compressedLength / length);
+
+	free(chunked);
+	free(stream);
+	free(uncompressed);
+	free(original);
+}
+
+int main(int argc, char *argv[]) {
+	static const size_t lengths[] = { 0, 1, 100, CHUNK - 1, CHUNK, CHUNK + 1, 2 * CHUNK, 2 * CHUNK + 1, 5 * CHUNK + 12345 };
+	int failures = 0;
+	size_t i;
+
+	if (argc > 1 && !strcmp(argv[1], "-bench")) {
+		Bench();
+		return 0;
+	}
+
+	srand(1950);
+	for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+		failures += CheckRoundTrip(lengths[i], 1) + CheckRoundTrip(lengths[i], 0);
+	for (i = 0; i < 40; i++)
+		failures += CheckRoundTrip(rand() % (6 * CHUNK), i % 4 != 0);
+	failures += CheckLegacyBlobs(200);
+	failures += CheckDamagedData(600);
+
+	printf("compression: %s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
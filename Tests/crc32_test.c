@@ -0,0 +1,137 @@
+/*
+ *  crc32_test.c
+ *  Notation
+ *
+ *  checks nv_crc32_update against zlib's crc32 over random lengths, alignments and split points, and nv_crc32
+ *  against the bitwise definition of the un-inverted checksum; with -bench, compares the throughput of all three
+ *
+ */
+
+#include "CRC32.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#define MAX_TEST_LENGTH (70 * 1024)
+#define MAX_ALIGNMENT 64
+
+//one bit at a time, as the polynomial defines it
+static uint32_t bitwiseCRC32(uint32_t crc, const unsigned char *s, size_t len) {
+	while (len--) {
+		int bit;
+		crc ^= *s++;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xedb88320U & -(crc & 1));
+	}
+	return crc;
+}
+
+static double secondsNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t randomLength(void) {
+	//mostly short records, as the journal writes them, but every length across the 64-byte folding boundaries too
+	switch (rand() % 4) {
+		case 0: return rand() % 64;
+		case 1: return 64 + rand() % 256;
+		case 2: return rand() % 4096;
+		default: return rand() % MAX_TEST_LENGTH;
+	}
+}
+
+static int check(unsigned int trials) {
+	unsigned char *buffer = (unsigned char *)malloc(MAX_TEST_LENGTH + MAX_ALIGNMENT);
+	int failures = 0;
+	unsigned int t;
+	size_t i;
+
+	srand(0xedb88320U);
+	for (i = 0; i < MAX_TEST_LENGTH + MAX_ALIGNMENT; i++)
+		buffer[i] = (unsigned char)rand();
+
+	for (t = 0; t < trials; t++) {
+		size_t offset = rand() % MAX_ALIGNMENT, len = randomLength();
+		const unsigned char *s = buffer + offset;
+
+		uint32_t expected = (uint32_t)crc32(0, s, (uInt)len);
+		uint32_t whole = nv_crc32_update(0, s, len);
+		if (whole != expected) {
+			printf("FAIL: %zu bytes at offset %zu: %08x, zlib says %08x\n", len, offset, whole, expected);
+			failures++;
+		}
+
+		size_t split = len ? rand() % (len + 1) : 0;
+		uint32_t chained = nv_crc32_update(nv_crc32_update(0, s, split), s + split, len - split);
+		if (chained != expected) {
+			printf("FAIL: %zu bytes at offset %zu split at %zu: %08x, zlib says %08x\n", len, offset, split, chained, expected);
+			failures++;
+		}
+
+		if (len < 8192) {
+			uint32_t legacy = (uint32_t)nv_crc32(s, (unsigned int)len), bitwise = bitwiseCRC32(0, s, len);
+			if (legacy != bitwise) {
+				printf("FAIL: nv_crc32 of %zu bytes at offset %zu: %08x, expected %08x\n", len, offset, legacy, bitwise);
+				failures++;
+			}
+		}
+	}
+
+	free(buffer);
+	return failures;
+}
+
+static void bench(void) {
+	static const size_t lengths[] = { 64, 512, 4096, 65536, 1 << 20 };
+	size_t totalBytes = 256 << 20, i, j, rounds;
+	unsigned char *buffer = (unsigned char *)malloc(lengths[sizeof(lengths) / sizeof(lengths[0]) - 1] + 1);
+	uint32_t sink = 0;
+
+	for (i = 0; i <= lengths[sizeof(lengths) / sizeof(lengths[0]) - 1]; i++)
+		buffer[i] = (unsigned char)(i * 31);
+
+	printf("%8s %14s %14s %14s\n", "bytes", "bitwise MB/s", "zlib MB/s", "nv_crc32 MB/s");
+	for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		//unaligned by one, as the checksummed part of a record generally is
+		const unsigned char *s = buffer + 1;
+		size_t len = lengths[i];
+		double rates[3];
+
+		rounds = totalBytes / len;
+		double start = secondsNow();
+		for (j = 0; j < rounds / 64; j++)
+			sink ^= bitwiseCRC32(0, s, len);
+		rates[0] = (double)(rounds / 64) * len / (secondsNow() - start) / 1e6;
+
+		start = secondsNow();
+		for (j = 0; j < rounds; j++)
+			sink ^= (uint32_t)crc32(0, s, (uInt)len);
+		rates[1] = (double)rounds * len / (secondsNow() - start) / 1e6;
+
+		start = secondsNow();
+		for (j = 0; j < rounds; j++)
+			sink ^= nv_crc32_update(0, s, len);
+		rates[2] = (double)rounds * len / (secondsNow() - start) / 1e6;
+
+		printf("%8zu %14.0f %14.0f %14.0f\n", len, rates[0], rates[1], rates[2]);
+	}
+
+	free(buffer);
+	if (sink == 0x12345678) printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && !strcmp(argv[1], "-bench")) {
+		bench();
+		return 0;
+	}
+
+	int failures = check(20000);
+	printf("%s: %s\n", argv[0], failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+/*
+ *  fast_strstr_test.c
+ *  Notation
+ *
+ *  checks fast_strstr against libc's strstr for random haystacks and needles at every alignment, with matches, near misses
+ *  and terminators in the last bytes of a block, and with haystacks ending right before an unreadable page so that a
+ *  load crossing into it would fault; with -bench, compares the two over note-sized text
+ *
+ */
+
+#include "StringSearch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+//a small alphabet, so that first bytes and partial matches are frequent
+static void fillText(char *text, size_t length, int alphabet) {
+	size_t i;
+	for (i = 0; i < length; i++) text[i] = 'a' + rand() % alphabet;
+	text[length] = '\0';
+}
+
+static int checkOne(const char *haystack, const char *needle, const char *what) {
+	char *expected = strstr(haystack, needle), *found = fast_strstr(haystack, needle);
+	if (found != expected) {
+		printf("FAIL: %s: \"%s\" in %zu bytes at offset %ld, expected %ld\n", what, needle, strlen(haystack),
+			   found ? (long)(found - haystack) : -1L, expected ? (long)(expected - haystack) : -1L);
+		return 1;
+	}
+	return 0;
+}
+
+static int checkRandom(unsigned int trials) {
+	char *buffer = (char *)malloc(4096 + 64);
+	int failures = 0;
+	unsigned int t;
+
+	srand(3);
+	for (t = 0; t < trials && failures < 10; t++) {
+		size_t offset = rand() % 32, length = rand() % (t % 4 ? 80 : 3000), needleLength = rand() % 9;
+		int alphabet = 2 + rand() % 4;
+		char needle[16], *haystack = buffer + offset;
+
+		fillText(haystack, length, alphabet);
+		if (length && rand() % 2) {
+			//taken from the haystack, so that it is found, often only in the tail
+			size_t start = length - 1 - (rand() % length) / (rand() % 4 ? 1 : 8);
+			if (start + needleLength > length) needleLength = length - start;
+			memcpy(needle, haystack + start, needleLength);
+			needle[needleLength] = '\0';
+		} else {
+			fillText(needle, needleLength, alphabet);
+		}
+		failures += checkOne(haystack, needle, "random");
+	}
+	free(buffer);
+	return failures;
+}
+
+//a match or its first byte in each of the last positions before the terminator, at every alignment
+static int checkBlockTails(void) {
+	char buffer[128], needle[] = "xyz";
+	int failures = 0;
+	size_t offset, length, position;
+
+	for (offset = 0; offset < 16; offset++) {
+		for (length = 0; length < 48; length++) {
+			char *haystack = buffer + offset;
+			memset(haystack, 'a', length);
+			haystack[length] = '\0';
+			failures += checkOne(haystack, needle, "no match");
+
+			for (position = length >= 3 ? length - 3 : 0; position < length; position++) {
+				memset(haystack, 'a', length);
+				memcpy(haystack + position, needle, length - position < 3 ? length - position : 3);
+				//the whole needle fits only when position is at least three before the end
+				failures += checkOne(haystack, needle, "tail");
+			}
+			//a NUL inside the block, with the needle's first byte after it that must be ignored
+			if (length + 2 < sizeof(buffer) - offset) {
+				memset(haystack, 'a', length);
+				haystack[length] = '\0';
+				haystack[length + 1] = 'x';
+				failures += checkOne(haystack, "x", "past the terminator");
+			}
+		}
+	}
+	return failures;
+}
+
+//haystacks that end at the last byte of a page followed by an unreadable one
+static int checkPageBoundary(void) {
+	long pageSize = sysconf(_SC_PAGESIZE);
+	char *pages = (char *)mmap(NULL, pageSize * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	int failures = 0;
+	size_t length;
+
+	if (pages == MAP_FAILED || mprotect(pages + pageSize, pageSize, PROT_NONE)) {
+		printf("FAIL: couldn't map a guard page\n");
+		return 1;
+	}
+	for (length = 0; length < 80; length++) {
+		char *haystack = pages + pageSize - 1 - length;
+		memset(haystack, 'b', length);
+		haystack[length] = '\0';
+		failures += checkOne(haystack, "bc", "before a guard page");
+		if (length) {
+			haystack[length - 1] = 'c';
+			failures += checkOne(haystack, "bc", "a match before a guard page");
+			failures += checkOne(haystack, "cd", "a near miss before a guard page");
+		}
+	}
+	munmap(pages, pageSize * 2);
+	return failures;
+}
+
+static double secondsNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(void) {
+	static const char *words[] = { "the ", "note ", "quick ", "brown ", "fox ", "\n", "todo: ", "meeting ", "agenda " };
+	static const char *needles[] = { "t", "fox", "agenda", "velocity", "notational velocity" };
+	const size_t noteCount = 2000, noteLength = 4000, passes = 20;
+	char **notes = (char **)malloc(noteCount * sizeof(char *));
+	size_t i, n, p;
+
+	srand(1);
+	for (i = 0; i < noteCount; i++) {
+		size_t length = 0;
+		notes[i] = (char *)malloc(noteLength + 16);
+		while (length < noteLength) {
+			const char *word = words[rand() % (sizeof(words) / sizeof(words[0]))];
+			strcpy(notes[i] + length, word);
+			length += strlen(word);
+		}
+	}
+
+	printf("%zu notes of %zu bytes\n", noteCount, noteLength);
+	printf("%22s %14s %14s %8s\n", "needle", "strstr (ms)", "fast (ms)", "speedup");
+	for (n = 0; n < sizeof(needles) / sizeof(needles[0]); n++) {
+		size_t libcFound = 0, fastFound = 0;
+
+		double start = secondsNow();
+		for (p = 0; p < passes; p++)
+			for (i = 0; i < noteCount; i++) libcFound += strstr(notes[i], needles[n]) != NULL;
+		double libcTime = (secondsNow() - start) / passes;
+
+		start = secondsNow();
+		for (p = 0; p < passes; p++)
+			for (i = 0; i < noteCount; i++) fastFound += fast_strstr(notes[i], needles[n]) != NULL;
+		double fastTime = (secondsNow() - start) / passes;
+
+		if (libcFound != fastFound) printf("(found in %zu notes, strstr %zu)\n", fastFound / passes, libcFound / passes);
+		printf("%22s %14.3f %14.3f %7.2fx\n", needles[n], libcTime * 1e3, fastTime * 1e3, libcTime / fastTime);
+	}
+
+	for (i = 0; i < noteCount; i++) free(notes[i]);
+	free(notes);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && !strcmp(argv[1], "-bench")) {
+		bench();
+		return 0;
+	}
+
+	int failures = checkRandom(200000) + checkBlockTails() + checkPageBoundary();
+	printf("fast_strstr: %s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
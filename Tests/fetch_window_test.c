@@ -0,0 +1,319 @@
+/*
+ *  fetch_window_test.c
+ *  Notation
+ *
+ *  drives FetchWindow as SimplenoteEntryCollector does, against a scripted transport on a simulated clock: checks that
+ *  no more fetches run than the window allows, that only retryable failures are tried again and with the documented
+ *  back-off, that results are handed over in the order of the entries however their fetches finish, and that stopping
+ *  starts nothing more; with -bench, reports how long a simulated collection takes at each window size
+ *
+ */
+
+#include "FetchWindow.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ENTRIES 64
+
+//the collector's own settings
+#define kMaximumFetchAttempts 3
+#define kRetryBaseDelay 1.0
+
+#define MAX_ATTEMPTS kMaximumFetchAttempts
+
+enum { EventResponse, EventRetry };
+
+typedef struct {
+	double time;
+	int kind;
+	size_t entry;
+} Event;
+
+//what the server answers to each attempt at each entry, and how long it takes to
+typedef struct {
+	long statuses[MAX_ENTRIES][MAX_ATTEMPTS];
+	double latencies[MAX_ENTRIES];
+	size_t entryCount, maximumConcurrent;
+	int creating;
+	//stop the collection when this many responses have come back, or never if 0
+	unsigned int stopAfterResponses;
+} Script;
+
+typedef struct {
+	unsigned int attempts[MAX_ENTRIES];
+	double attemptTimes[MAX_ENTRIES][MAX_ATTEMPTS + 1];
+	long finalStatuses[MAX_ENTRIES];
+	size_t merged[MAX_ENTRIES], mergedCount, peakInFlight;
+	unsigned int responses;
+	double finishTime;
+	int done, overran, startedAfterStop;
+} Outcome;
+
+typedef struct {
+	Event events[MAX_ENTRIES * (MAX_ATTEMPTS + 1)];
+	size_t count;
+} EventQueue;
+
+static void Schedule(EventQueue *queue, double time, int kind, size_t entry) {
+	Event event = { time, kind, entry };
+	queue->events[queue->count++] = event;
+}
+
+//the earliest event, the first scheduled among equals
+static int NextEvent(EventQueue *queue, Event *event) {
+	size_t i, earliest = 0;
+	if (!queue->count) return 0;
+	for (i = 1; i < queue->count; i++)
+		if (queue->events[i].time < queue->events[earliest].time) earliest = i;
+	*event = queue->events[earliest];
+	memmove(queue->events + earliest, queue->events + earliest + 1, (queue->count - earliest - 1) * sizeof(Event));
+	queue->count--;
+	return 1;
+}
+
+static void StartFetch(const Script *script, Outcome *outcome, EventQueue *queue, double now, size_t entry, int stopped) {
+	if (stopped) outcome->startedAfterStop = 1;
+	outcome->attemptTimes[entry][outcome->attempts[entry]++] = now;
+	Schedule(queue, now + script->latencies[entry], EventResponse, entry);
+}
+
+static void StartFetchesInWindow(FetchWindow *window, const Script *script, Outcome *outcome, EventQueue *queue, double now, int stopped) {
+	size_t entry;
+	while ((entry = FetchWindowStartNextEntry(window)) != FETCH_WINDOW_NONE)
+		StartFetch(script, outcome, queue, now, entry, stopped);
+
+	size_t inFlight = FetchWindowRunningCount(window) + FetchWindowRetriesPending(window);
+	if (inFlight > outcome->peakInFlight) outcome->peakInFlight = inFlight;
+	if (inFlight > script->maximumConcurrent) outcome->overran = 1;
+}
+
+//what syncResponseFetcher:receivedData:returningError: and its helpers do, minus the Cocoa
+static void Run(const Script *script, Outcome *outcome) {
+	FetchWindow *window = FetchWindowCreate(script->entryCount, script->maximumConcurrent, kMaximumFetchAttempts, kRetryBaseDelay);
+	EventQueue *queue = (EventQueue *)calloc(1, sizeof(EventQueue));
+	size_t entry;
+	int stopped = 0;
+	Event event;
+
+	memset(outcome, 0, sizeof(Outcome));
+	StartFetchesInWindow(window, script, outcome, queue, 0.0, stopped);
+
+	while (!outcome->done && NextEvent(queue, &event)) {
+		if (event.kind == EventRetry) {
+			//a cancelled perform request would never have fired
+			if (stopped) continue;
+			if (FetchWindowStartRetry(window, event.entry))
+				StartFetch(script, outcome, queue, event.time, event.entry, stopped);
+			continue;
+		}
+
+		long status = script->statuses[event.entry][outcome->attempts[event.entry] - 1];
+		//status 0 stands for a connection that failed without any response
+		int failed = status == 0 || status >= 500 || status == 429;
+		//a cancelled fetch is never retried, nor are creations
+		int retryable = !stopped && !script->creating && FetchWindowStatusIsRetryable(status);
+		outcome->responses++;
+
+		double delay = FetchWindowFinishEntry(window, event.entry, failed, failed && retryable);
+		if (delay >= 0.0) {
+			Schedule(queue, event.time + delay, EventRetry, event.entry);
+		} else {
+			outcome->finalStatuses[event.entry] = status;
+			while ((entry = FetchWindowNextEntryToMerge(window)) != FETCH_WINDOW_NONE)
+				outcome->merged[outcome->mergedCount++] = entry;
+		}
+
+		if (script->stopAfterResponses && outcome->responses == script->stopAfterResponses) {
+			stopped = 1;
+			FetchWindowStop(window);
+		}
+		StartFetchesInWindow(window, script, outcome, queue, event.time, stopped);
+		if (FetchWindowIsDone(window)) {
+			outcome->done = 1;
+			outcome->finishTime = event.time;
+		}
+	}
+
+	free(queue);
+	FetchWindowFree(window);
+}
+
+//every entry answered at once, with latencies that make later entries finish first
+static void InitScript(Script *script, size_t entryCount, size_t maximumConcurrent) {
+	size_t i, j;
+	memset(script, 0, sizeof(Script));
+	script->entryCount = entryCount;
+	script->maximumConcurrent = maximumConcurrent;
+	for (i = 0; i < entryCount; i++) {
+		for (j = 0; j < MAX_ATTEMPTS; j++) script->statuses[i][j] = 200;
+		script->latencies[i] = 0.1 + 0.05 * ((entryCount - i) % 7);
+	}
+}
+
+static int CheckMergedInOrder(const Outcome *outcome, size_t count, const char *name) {
+	size_t i;
+	for (i = 0; i < count; i++) {
+		if (i >= outcome->mergedCount || outcome->merged[i] != i) {
+			printf("FAIL: %s: entries weren't handed over in order\n", name);
+			return 1;
+		}
+	}
+	if (outcome->mergedCount != count) {
+		printf("FAIL: %s: %zu entries were handed over, not %zu\n", name, outcome->mergedCount, count);
+		return 1;
+	}
+	return 0;
+}
+
+static int CheckWindow(void) {
+	static const size_t sizes[] = { 1, 2, 4, 7, 64 };
+	int failures = 0;
+	size_t i;
+	Script script;
+	Outcome outcome;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		char name[64];
+		snprintf(name, sizeof(name), "a window of %zu", sizes[i]);
+		InitScript(&script, 40, sizes[i]);
+		//some entries back off too, which must not let more into the window
+		script.statuses[3][0] = 503;
+		script.statuses[11][0] = 429;
+		script.statuses[11][1] = 502;
+		Run(&script, &outcome);
+
+		if (!outcome.done || outcome.overran || outcome.peakInFlight != (sizes[i] < 40 ? sizes[i] : 40)) {
+			printf("FAIL: %s ran up to %zu fetches at once\n", name, outcome.peakInFlight);
+			failures++;
+		}
+		failures += CheckMergedInOrder(&outcome, 40, name);
+	}
+	return failures;
+}
+
+static int CheckRetries(void) {
+	int failures = 0;
+	Script script;
+	Outcome outcome;
+
+	InitScript(&script, 6, 4);
+	//succeeds on the third attempt, is given up after the third, isn't worth retrying, asks to back off, gets no response
+	script.statuses[0][0] = 503; script.statuses[0][1] = 500;
+	script.statuses[1][0] = 503; script.statuses[1][1] = 503; script.statuses[1][2] = 503;
+	script.statuses[2][0] = 404;
+	script.statuses[3][0] = 429;
+	script.statuses[4][0] = 0;
+	script.statuses[5][0] = 412;
+	Run(&script, &outcome);
+
+	if (!outcome.done) {
+		printf("FAIL: retries: the collection never finished\n");
+		return 1;
+	}
+	if (outcome.attempts[0] != 3 || outcome.finalStatuses[0] != 200 ||
+		fabs(outcome.attemptTimes[0][1] - (outcome.attemptTimes[0][0] + script.latencies[0]) - kRetryBaseDelay) > 1e-9 ||
+		fabs(outcome.attemptTimes[0][2] - (outcome.attemptTimes[0][1] + script.latencies[0]) - 2 * kRetryBaseDelay) > 1e-9) {
+		printf("FAIL: retries: a server error wasn't retried after 1 and then 2 seconds\n");
+		failures++;
+	}
+	if (outcome.attempts[1] != kMaximumFetchAttempts || outcome.finalStatuses[1] != 503) {
+		printf("FAIL: retries: a persistent server error was attempted %u times\n", outcome.attempts[1]);
+		failures++;
+	}
+	if (outcome.attempts[2] != 1 || outcome.finalStatuses[2] != 404 || outcome.attempts[5] != 1 || outcome.finalStatuses[5] != 412) {
+		printf("FAIL: retries: a client error was retried\n");
+		failures++;
+	}
+	if (outcome.attempts[3] != 2 || outcome.finalStatuses[3] != 200 || outcome.attempts[4] != 2 || outcome.finalStatuses[4] != 200) {
+		printf("FAIL: retries: a 429 or a missing response wasn't retried\n");
+		failures++;
+	}
+	failures += CheckMergedInOrder(&outcome, 6, "retries");
+
+	//a creation that failed might still have reached the server
+	InitScript(&script, 3, 4);
+	script.creating = 1;
+	script.statuses[1][0] = 503;
+	Run(&script, &outcome);
+	if (!outcome.done || outcome.attempts[1] != 1 || outcome.finalStatuses[1] != 503) {
+		printf("FAIL: retries: a creation was retried\n");
+		failures++;
+	}
+	failures += CheckMergedInOrder(&outcome, 3, "creations");
+
+	return failures;
+}
+
+static int CheckStop(void) {
+	int failures = 0;
+	size_t i;
+	Script script;
+	Outcome outcome;
+
+	InitScript(&script, 20, 4);
+	for (i = 0; i < 20; i++) script.statuses[i][0] = 503;
+	//stopped while some entries wait to be retried and others are still running
+	script.stopAfterResponses = 2;
+	Run(&script, &outcome);
+
+	if (!outcome.done || outcome.startedAfterStop) {
+		printf("FAIL: stop: fetches were started after stopping, or the collection never finished\n");
+		failures++;
+	}
+	for (i = 0; i < 20; i++) {
+		if (outcome.attempts[i] > 1) {
+			printf("FAIL: stop: entry %zu was retried after stopping\n", i);
+			failures++;
+			break;
+		}
+	}
+	if (outcome.responses != 4) {
+		printf("FAIL: stop: %u responses came back instead of the 4 already running\n", outcome.responses);
+		failures++;
+	}
+	return failures;
+}
+
+static void Bench(void) {
+	static const size_t sizes[] = { 1, 2, 4, 8, 16 };
+	size_t i, j;
+	Script script;
+	Outcome outcome;
+
+	printf("64 notes at 100-400 ms each, 1 in 8 answered 503 once\n");
+	printf("%8s %16s\n", "window", "simulated secs");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		InitScript(&script, 64, sizes[i]);
+		for (j = 0; j < 64; j++) {
+			script.latencies[j] = 0.1 + 0.1 * (j * 7 % 4);
+			if (j % 8 == 5) script.statuses[j][0] = 503;
+		}
+		Run(&script, &outcome);
+		printf("%8zu %16.2f\n", sizes[i], outcome.finishTime);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int failures = 0;
+
+	if (argc > 1 && !strcmp(argv[1], "-bench")) {
+		Bench();
+		return 0;
+	}
+
+	if (!FetchWindowStatusIsRetryable(0) || !FetchWindowStatusIsRetryable(429) || !FetchWindowStatusIsRetryable(500) ||
+		!FetchWindowStatusIsRetryable(599) || FetchWindowStatusIsRetryable(200) || FetchWindowStatusIsRetryable(404) ||
+		FetchWindowStatusIsRetryable(412) || FetchWindowStatusIsRetryable(600)) {
+		printf("FAIL: the wrong statuses are considered retryable\n");
+		failures++;
+	}
+	failures += CheckWindow();
+	failures += CheckRetries();
+	failures += CheckStop();
+
+	printf("fetch window: %s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
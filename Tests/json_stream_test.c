@@ -0,0 +1,283 @@
+/*
+ *  json_stream_test.c
+ *  Notation
+ *
+ *  feeds JSONStreamTokenizer documents split at every byte, one byte at a time and at random points, so that escapes,
+ *  \u surrogate pairs, multi-byte characters, literals and numbers all straddle a chunk boundary somewhere, and checks
+ *  that the tokens always match those expected for the whole document and that malformed documents fail the same way;
+ *  with -bench, times a large /changes-like response read in network-sized chunks
+ *
+ */
+
+#include "JSONStreamTokenizer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+	char *text;
+	size_t length, capacity;
+	size_t tokenCount;
+	//the handler refuses the token with this number, when set
+	size_t stopAt;
+} tokenLog;
+
+static void logAppend(tokenLog *log, const char *bytes, size_t length) {
+	if (log->length + length + 1 > log->capacity) {
+		while (log->length + length + 1 > log->capacity) log->capacity = log->capacity ? log->capacity * 2 : 256;
+		log->text = (char *)realloc(log->text, log->capacity);
+	}
+	memcpy(log->text + log->length, bytes, length);
+	log->length += length;
+	log->text[log->length] = '\0';
+}
+
+//each token as one space-separated word; decoded strings are written byte for byte, in hex when outside printable ASCII
+static int logToken(void *context, JSONStreamTokenizer *tokenizer, const JSONToken *token) {
+	tokenLog *log = (tokenLog *)context;
+	char word[64];
+	size_t i;
+
+	if (log->stopAt && ++log->tokenCount == log->stopAt) {
+		JSONStreamTokenizerFail(tokenizer, "refused");
+		return 0;
+	}
+	if (log->length) logAppend(log, " ", 1);
+	switch (token->type) {
+		case JSONTokenBeginObject: snprintf(word, sizeof(word), "{%u", token->depth); break;
+		case JSONTokenEndObject: snprintf(word, sizeof(word), "}%u", token->depth); break;
+		case JSONTokenBeginArray: snprintf(word, sizeof(word), "[%u", token->depth); break;
+		case JSONTokenEndArray: snprintf(word, sizeof(word), "]%u", token->depth); break;
+		case JSONTokenInteger: snprintf(word, sizeof(word), "i%lld", token->integer); break;
+		case JSONTokenReal: snprintf(word, sizeof(word), "r%.17g", token->real); break;
+		case JSONTokenTrue: strcpy(word, "true"); break;
+		case JSONTokenFalse: strcpy(word, "false"); break;
+		case JSONTokenNull: strcpy(word, "null"); break;
+		case JSONTokenKey:
+		case JSONTokenString:
+			logAppend(log, token->type == JSONTokenKey ? "k\"" : "s\"", 2);
+			if (strlen(token->bytes) != token->length) logAppend(log, "<length>", 8);
+			for (i = 0; i < token->length; i++) {
+				unsigned char c = (unsigned char)token->bytes[i];
+				if (c > ' ' && c < 0x7F && c != '\\') {
+					logAppend(log, (const char *)&c, 1);
+				} else {
+					snprintf(word, sizeof(word), "\\%02X", c);
+					logAppend(log, word, 3);
+				}
+			}
+			logAppend(log, "\"", 1);
+			return 1;
+	}
+	logAppend(log, word, strlen(word));
+	return 1;
+}
+
+//the log of the tokens and the outcome, with the input cut at the given offsets
+static char *parseInChunks(const char *json, const size_t *cuts, size_t cutCount, size_t stopAt) {
+	tokenLog log = { NULL, 0, 0, 0, stopAt };
+	JSONStreamTokenizer *tokenizer = JSONStreamTokenizerCreate(logToken, &log);
+	size_t length = strlen(json), start = 0, c;
+
+	for (c = 0; c <= cutCount; c++) {
+		size_t end = c < cutCount ? cuts[c] : length;
+		//a chunk of its own, so that a read past its end would be caught by a memory checker
+		unsigned char *chunk = (unsigned char *)malloc(end - start + 1);
+		memcpy(chunk, json + start, end - start);
+		int parsed = JSONStreamTokenizerParse(tokenizer, chunk, end - start);
+		free(chunk);
+		start = end;
+		if (!parsed) break;
+	}
+	JSONStreamTokenizerFinish(tokenizer);
+
+	const char *error = JSONStreamTokenizerError(tokenizer);
+	logAppend(&log, error ? " ! " : " .", error ? 3 : 2);
+	if (error) logAppend(&log, error, strlen(error));
+	JSONStreamTokenizerFree(tokenizer);
+	return log.text;
+}
+
+typedef struct {
+	const char *json;
+	//the tokens, then " ." for a complete document or " ! " and the error
+	const char *expected;
+} testCase;
+
+static const testCase cases[] = {
+	{ "\"\\\"\\\\\\/\\b\\f\\n\\r\\t\"", "s\"\"\\5C/\\08\\0C\\0A\\0D\\09\" ." },
+	{ "[\"caf\\u00e9\", \"\\u20AC\", \"\\u0041\\u0000z\"]",
+		"[0 s\"caf\\C3\\A9\" s\"\\E2\\82\\AC\" s\"<length>A\\00z\" ]0 ." },
+	//a pair becomes one four-byte character, in either case of hex digits
+	{ "\"a\\ud83d\\ude00b\\uD834\\uDD1E\"", "s\"a\\F0\\9F\\98\\80b\\F0\\9D\\84\\9E\" ." },
+	//a high surrogate followed by anything but a low one, and a low one on its own, can't be represented
+	{ "[\"\\ud83d\", \"\\ud83dx\", \"\\ud83d\\n\", \"\\ude00\", \"\\ud83d\\ud83d\\ude00\"]",
+		"[0 s\"\\EF\\BF\\BD\" s\"\\EF\\BF\\BDx\" s\"\\EF\\BF\\BD\\0A\" s\"\\EF\\BF\\BD\" s\"\\EF\\BF\\BD\\F0\\9F\\98\\80\" ]0 ." },
+	//raw UTF-8 is passed through untouched
+	{ "\"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\"", "s\"\\C3\\A9\\E2\\82\\AC\\F0\\9F\\98\\80\" ." },
+	{ "[0,-1,1234567890,-9223372036854775808,9223372036854775807]",
+		"[0 i0 i-1 i1234567890 i-9223372036854775808 i9223372036854775807 ]0 ." },
+	//too large for an integer, so read as a real
+	{ "[9223372036854775808, 1.5, -0.25e+2, 6E-1, 1e3]", "[0 r9.2233720368547758e+18 r1.5 r-25 r0.59999999999999998 r1000 ]0 ." },
+	//numbers ended by each of the bytes that can follow one
+	{ "{\"a\":12,\"b\":[34],\"c\":56}", "{0 k\"a\" i12 k\"b\" [1 i34 ]1 k\"c\" i56 }0 ." },
+	{ "[7 ,8\n,9\t]", "[0 i7 i8 i9 ]0 ." },
+	//a number at the top level ends only when the data does
+	{ "314159", "i314159 ." },
+	{ " -2.5e-3 ", "r-0.0025000000000000001 ." },
+	{ "[true,false,null,{},[]]", "[0 true false null {1 }1 [1 ]1 ]0 ." },
+	{ "{\"index\":[{\"id\":\"k1\",\"v\":3,\"d\":{\"tags\":[\"t\"],\"deleted\":false}}],\"mark\":\"m\"}",
+		"{0 k\"index\" [1 {2 k\"id\" s\"k1\" k\"v\" i3 k\"d\" {3 k\"tags\" [4 s\"t\" ]4 k\"deleted\" false }3 }2 ]1 k\"mark\" s\"m\" }0 ." },
+	{ "\"\"", "s\"\" ." },
+	{ "{\"\":\"\"}", "{0 k\"\" s\"\" }0 ." },
+
+	{ "", " ! Unexpected end of data" },
+	//a number inside a container isn't over until something follows it
+	{ "[1,2", "[0 i1 ! Unexpected end of data" },
+	{ "\"abc", " ! Unexpected end of data" },
+	{ "\"\\u12", " ! Unexpected end of data" },
+	{ "[1]]", "[0 i1 ]0 ! Unexpected data after the end of the value" },
+	{ "[1}", "[0 i1 ! Unexpected '}'" },
+	{ "{\"a\" 1}", "{0 k\"a\" ! Expected ':'" },
+	{ "{1:2}", "{0 ! Expected a string key" },
+	{ "[1 2]", "[0 i1 ! Expected ',' or the end of a container" },
+	{ "[tru]", "[0 ! Invalid literal; expected 'true'" },
+	{ "nul", " ! Unexpected end of data" },
+	{ "\"\\x\"", " ! Invalid escape '\\x'" },
+	{ "\"\\u12g4\"", " ! Invalid unicode escape" },
+	{ "[1.2.3]", "[0 ! Invalid number '1.2.3'" },
+	{ "[-]", "[0 ! Invalid number '-'" },
+	{ "@", " ! Unexpected character '@'" },
+};
+
+static int checkOneCase(const testCase *test, const size_t *cuts, size_t cutCount, const char *how) {
+	char *log = parseInChunks(test->json, cuts, cutCount, 0);
+	int failed = strcmp(log, test->expected) != 0;
+	if (failed) printf("FAIL: %s: %s\n  read as: %s\n  expected: %s\n", how, test->json, log, test->expected);
+	free(log);
+	return failed;
+}
+
+static int checkCases(void) {
+	int failures = 0;
+	size_t t, i;
+
+	srand(2009);
+	for (t = 0; t < sizeof(cases) / sizeof(cases[0]) && failures < 10; t++) {
+		const testCase *test = &cases[t];
+		size_t length = strlen(test->json), *cuts = (size_t *)malloc((length + 1) * sizeof(size_t));
+
+		failures += checkOneCase(test, NULL, 0, "whole");
+		for (i = 0; i <= length; i++) {
+			cuts[0] = i;
+			failures += checkOneCase(test, cuts, 1, "split once");
+		}
+		for (i = 0; i < length; i++) cuts[i] = i + 1;
+		failures += checkOneCase(test, cuts, length ? length - 1 : 0, "a byte at a time");
+
+		for (i = 0; i < 50; i++) {
+			size_t cutCount = length ? rand() % length : 0, c;
+			for (c = 0; c < cutCount; c++) cuts[c] = rand() % (length + 1);
+			//sorted, with repeats left in as empty chunks
+			for (c = 1; c < cutCount; c++) {
+				size_t cut = cuts[c], d;
+				for (d = c; d > 0 && cuts[d - 1] > cut; d--) cuts[d] = cuts[d - 1];
+				cuts[d] = cut;
+			}
+			failures += checkOneCase(test, cuts, cutCount, "split at random");
+		}
+		free(cuts);
+	}
+	return failures;
+}
+
+static int checkLimits(void) {
+	char *deep = (char *)malloc(2 * kJSONMaxNestingDepth + 3), *log;
+	int failures = 0;
+
+	//as deep as allowed, then one more
+	memset(deep, '[', kJSONMaxNestingDepth);
+	memset(deep + kJSONMaxNestingDepth, ']', kJSONMaxNestingDepth);
+	deep[2 * kJSONMaxNestingDepth] = '\0';
+	log = parseInChunks(deep, NULL, 0, 0);
+	if (strcmp(log + strlen(log) - 2, " .")) {
+		printf("FAIL: %d nested arrays were refused\n", kJSONMaxNestingDepth);
+		failures++;
+	}
+	free(log);
+	memmove(deep + 1, deep, 2 * kJSONMaxNestingDepth + 1);
+	deep[0] = '[';
+	log = parseInChunks(deep, NULL, 0, 0);
+	if (!strstr(log, "! JSON nested too deeply")) {
+		printf("FAIL: %d nested arrays were accepted\n", kJSONMaxNestingDepth + 1);
+		failures++;
+	}
+	free(log);
+	free(deep);
+
+	//a handler that refuses a token stops the parse, with its own reason
+	log = parseInChunks("[1,2,3]", NULL, 0, 3);
+	if (strcmp(log, "[0 i1 ! refused")) {
+		printf("FAIL: a refused token was read as: %s\n", log);
+		failures++;
+	}
+	free(log);
+	return failures;
+}
+
+static int countToken(void *context, JSONStreamTokenizer *tokenizer, const JSONToken *token) {
+	(*(size_t *)context)++;
+	return 1;
+}
+
+static double secondsNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(void) {
+	const size_t changeCount = 20000, chunkSize = 16 * 1024, passes = 5;
+	tokenLog json = { NULL, 0, 0, 0, 0 };
+	size_t i, p, tokenCount = 0;
+
+	//a /changes response: an array of change objects, each carrying a note's text with escapes and non-ASCII characters
+	logAppend(&json, "[", 1);
+	for (i = 0; i < changeCount; i++) {
+		char change[512];
+		int length = snprintf(change, sizeof(change), "%s{\"id\":\"%08zx\",\"ev\":\"M\",\"cv\":\"%zu\",\"o\":\"M\",\"v\":{\"content\":{\"o\":\"+\",\"v\":"
+							  "\"Meeting notes\\n\\nagenda: caf\\u00e9 \\ud83d\\ude00 \\\"quoted\\\" 3.5\\t%zu\"},\"modificationDate\":{\"o\":\"r\",\"v\":%zu.25},"
+							  "\"tags\":{\"o\":\"r\",\"v\":[\"work\",\"todo\"]},\"deleted\":{\"o\":\"r\",\"v\":false}}}",
+							  i ? "," : "", i, i, i, 1300000000 + i);
+		logAppend(&json, change, length);
+	}
+	logAppend(&json, "]", 1);
+
+	double start = secondsNow();
+	for (p = 0; p < passes; p++) {
+		JSONStreamTokenizer *tokenizer = JSONStreamTokenizerCreate(countToken, &tokenCount);
+		for (i = 0; i < json.length; i += chunkSize)
+			JSONStreamTokenizerParse(tokenizer, (const unsigned char *)json.text + i, i + chunkSize < json.length ? chunkSize : json.length - i);
+		if (!JSONStreamTokenizerFinish(tokenizer)) printf("(the response failed to parse: %s)\n", JSONStreamTokenizerError(tokenizer));
+		JSONStreamTokenizerFree(tokenizer);
+	}
+	double seconds = (secondsNow() - start) / passes;
+
+	printf("%zu changes, %.1f MB in %zu KB chunks\n", changeCount, json.length / 1e6, chunkSize / 1024);
+	printf("%12s %12s %12s\n", "tokens", "ms", "MB/s");
+	printf("%12zu %12.3f %12.1f\n", tokenCount / passes, seconds * 1e3, json.length / 1e6 / seconds);
+	free(json.text);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && !strcmp(argv[1], "-bench")) {
+		bench();
+		return 0;
+	}
+
+	int failures = checkCases() + checkLimits();
+	printf("json stream tokenizer: %s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,277 @@
+/*
+ *  markdown_test.c
+ *  Notation
+ *
+ *  checks MarkdownCopyXHTML against the bundled Markdown.pl over its readme and thousands of generated documents,
+ *  which are built from fragments that exercise every pass, malformed html included; e-mail addresses are compared
+ *  with their entities decoded, as both encode them at random, and the script is run again when its random choices
+ *  italicized part of an address, which the renderer never does; documents in which the script leaks the placeholder
+ *  of an html block, which the renderer puts the block back for, are only checked for placeholders.  with -bench,
+ *  compares the latency of a render in process with that of a perl launch, as the preview used to pay on every refresh
+ *
+ */
+
+#include "MarkdownRenderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MARKDOWN_SCRIPT "../Markdown_1.0.1/Markdown.pl"
+#define MARKDOWN_README "../Markdown_1.0.1/Markdown Readme.text"
+
+static const char *fragments[] = {
+	"*", "**", "_", "__", "`", "``", "[", "]", "(", ")", "!", "<", ">", "&", "&amp;", "&#123;", "\\", "\\*", "\\_", "#", "##", "###### ",
+	"1. ", "2. ", "* ", "- ", "+ ", "    ", "  ", " ", "\t", "\n", "\n\n", "\n\n\n", "> ", ">", "---", "===", "* * *", "___",
+	"<div>", "</div>", "<p>", "</p>", "<pre>", "</pre>", "<hr>", "<hr />", "<!-- c -->", "<!--", "-->", "<b>", "</b>",
+	"<a href=\"x_y*z\">", "</a>", "<span>", "<ins>", "</ins>", "[a]", "[b][]", "[a][b]", "[link](http://x.com/a_b)", "[l](<u> \"t\")",
+	"[l](u 't')", "![img](p.png)", "![i](p.png \"T\")", "![a][b]", "[b]: http://b.com/?a=1&b=2 \"Title\"", "[a]: <http://a.org>",
+	"[c]:\n  u  \n  (t)", "<http://foo.com/bar>", "<https://x.y>", "<foo@bar.com>", "<mailto:a_b@c.d.org>", "word", "text", "foo bar",
+	"x", "12", "3.", "\"", "'", "=", "-", "~", "{", "}", "|", "@", ".", "\xC3\xA9", "\xE6\x97\xA5\xE6\x9C\xAC",
+};
+static const char *lineStarts[] = { "\n", "\n\n", "\n    ", "\n* ", "\n1. ", "\n> ", "\n  * ", "\n#" };
+
+typedef struct {
+	char *bytes;
+	size_t length, capacity;
+} TestBuffer;
+
+static void Append(TestBuffer *buffer, const char *bytes, size_t length) {
+	if (buffer->length + length + 1 > buffer->capacity) {
+		buffer->capacity = (buffer->length + length + 1) * 2;
+		buffer->bytes = (char*)realloc(buffer->bytes, buffer->capacity);
+	}
+	memcpy(buffer->bytes + buffer->length, bytes, length);
+	buffer->length += length;
+	buffer->bytes[buffer->length] = '\0';
+}
+
+static void AppendString(TestBuffer *buffer, const char *s) {
+	Append(buffer, s, strlen(s));
+}
+
+static void GenerateDocument(TestBuffer *document, unsigned int seed) {
+	unsigned int i, pieces;
+
+	srand(seed);
+	document->length = 0;
+	AppendString(document, "");
+	for (i = 0, pieces = 1 + rand() % 60; i < pieces; i++) {
+		if (rand() % 10 < 3) AppendString(document, lineStarts[rand() % (sizeof(lineStarts) / sizeof(lineStarts[0]))]);
+		AppendString(document, fragments[rand() % (sizeof(fragments) / sizeof(fragments[0]))]);
+		if (rand() % 10 < 4) AppendString(document, " ");
+	}
+}
+
+static int ReadFile(const char *path, TestBuffer *contents) {
+	FILE *file = fopen(path, "rb");
+	char chunk[4096];
+	size_t count;
+
+	if (!file) return 0;
+	contents->length = 0;
+	AppendString(contents, "");
+	while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		Append(contents, chunk, count);
+	fclose(file);
+	return 1;
+}
+
+//the output of Markdown.pl for the document
+static int RenderWithPerl(const TestBuffer *document, TestBuffer *output) {
+	char inputPath[] = "/tmp/markdown_testXXXXXX", command[256];
+	int fd = mkstemp(inputPath);
+	if (fd < 0) return 0;
+	if (write(fd, document->bytes, document->length) != (ssize_t)document->length) {
+		close(fd);
+		unlink(inputPath);
+		return 0;
+	}
+	close(fd);
+
+	snprintf(command, sizeof(command), "perl '%s' < '%s'", MARKDOWN_SCRIPT, inputPath);
+	FILE *pipe = popen(command, "r");
+	char chunk[4096];
+	size_t count;
+
+	output->length = 0;
+	AppendString(output, "");
+	while (pipe && (count = fread(chunk, 1, sizeof(chunk), pipe)) > 0)
+		Append(output, chunk, count);
+	int status = pipe ? pclose(pipe) : -1;
+	unlink(inputPath);
+	return status == 0;
+}
+
+static int IsAddressChar(long c) {
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c && strchr("@.:_-+", (int)c));
+}
+
+//numeric entities of the characters that e-mail addresses are made of, decoded (even where they were encoded again
+//inside code), so that the random choices of both renderers compare equal
+static void DecodeAddressEntities(TestBuffer *html) {
+	size_t p = 0, q = 0;
+	while (p < html->length) {
+		size_t number = !strncmp(html->bytes + p, "&#", 2) ? p + 2 : !strncmp(html->bytes + p, "&amp;#", 6) ? p + 6 : 0;
+		if (number) {
+			int hex = html->bytes[number] == 'x';
+			char *end = NULL;
+			long c = strtol(html->bytes + number + hex, &end, hex ? 16 : 10);
+			if (end && *end == ';' && end > html->bytes + number + hex && IsAddressChar(c)) {
+				html->bytes[q++] = (char)c;
+				p = end + 1 - html->bytes;
+				continue;
+			}
+		}
+		html->bytes[q++] = html->bytes[p++];
+	}
+	html->length = q;
+	html->bytes[q] = '\0';
+}
+
+//whether the script left the MD5 placeholder of an html block in its output, where the renderer puts back the block
+static int HasLeakedKey(const TestBuffer *html) {
+	size_t p, run = 0;
+	for (p = 0; p <= html->length; p++) {
+		char c = html->bytes[p];
+		if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')) {
+			run++;
+		} else {
+			if (run == 32) return 1;
+			run = 0;
+		}
+	}
+	return 0;
+}
+
+//an address left readable in a mailto: link would defeat the point of encoding it
+static int HasReadableAddress(const char *html) {
+	const char *link = html;
+	while ((link = strstr(link, "<a href=\""))) {
+		const char *href = link + 9, *hrefEnd = strchr(href, '"');
+		if (!hrefEnd) break;
+		if (memchr(href, '@', hrefEnd - href)) {
+			TestBuffer decoded = { NULL, 0, 0 };
+			Append(&decoded, href, hrefEnd - href);
+			DecodeAddressEntities(&decoded);
+			int isMailto = !strncmp(decoded.bytes, "mailto:", 7);
+			free(decoded.bytes);
+			if (isMailto) return 1;
+		}
+		link = hrefEnd;
+	}
+	return 0;
+}
+
+//documents left uncompared because the script leaked a placeholder for them
+static unsigned int leakedKeyDocuments;
+
+static int CheckDocument(const TestBuffer *document, const char *name) {
+	TestBuffer expected = { NULL, 0, 0 }, actual = { NULL, 0, 0 };
+	size_t length = 0;
+	int hasAddress = memchr(document->bytes, '@', document->length) != NULL;
+	int failed = 0, attempts = hasAddress ? 20 : 1;
+
+	char *output = MarkdownCopyXHTML(document->bytes, document->length, &length);
+	Append(&actual, output, length);
+	free(output);
+
+	if (HasReadableAddress(actual.bytes)) {
+		printf("FAIL: %s: an e-mail address was left unencoded\n", name);
+		failed = 1;
+	}
+	if (memchr(actual.bytes, '\x1A', actual.length) || memchr(actual.bytes, '\x1B', actual.length)) {
+		printf("FAIL: %s: a placeholder was left in the output\n", name);
+		failed = 1;
+	}
+	DecodeAddressEntities(&actual);
+
+	while (!failed && attempts--) {
+		if (!RenderWithPerl(document, &expected)) {
+			printf("FAIL: couldn't run %s for %s\n", MARKDOWN_SCRIPT, name);
+			failed = 1;
+			break;
+		}
+		if (HasLeakedKey(&expected)) {
+			leakedKeyDocuments++;
+			break;
+		}
+		DecodeAddressEntities(&expected);
+		if (expected.length == actual.length && !memcmp(expected.bytes, actual.bytes, actual.length))
+			break;
+		if (!attempts) {
+			size_t i = 0;
+			while (i < expected.length && i < actual.length && expected.bytes[i] == actual.bytes[i]) i++;
+			printf("FAIL: %s differs from Markdown.pl at byte %zu\n", name, i);
+			failed = 1;
+		}
+	}
+
+	free(expected.bytes);
+	free(actual.bytes);
+	return failed;
+}
+
+static double SecondsNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Bench(void) {
+	TestBuffer readme = { NULL, 0, 0 }, output = { NULL, 0, 0 };
+	unsigned int i, nativeRuns = 200, perlRuns = 20;
+
+	if (!ReadFile(MARKDOWN_README, &readme)) {
+		printf("couldn't read %s\n", MARKDOWN_README);
+		return;
+	}
+
+	double start = SecondsNow();
+	for (i = 0; i < nativeRuns; i++) {
+		free(MarkdownCopyXHTML(readme.bytes, readme.length, NULL));
+	}
+	double nativeTime = (SecondsNow() - start) / nativeRuns;
+
+	start = SecondsNow();
+	for (i = 0; i < perlRuns; i++) {
+		RenderWithPerl(&readme, &output);
+	}
+	double perlTime = (SecondsNow() - start) / perlRuns;
+
+	printf("%zu-byte readme: %.2f ms per render in process, %.2f ms per perl launch\n", readme.length, nativeTime * 1000, perlTime * 1000);
+	free(readme.bytes);
+	free(output.bytes);
+}
+
+int main(int argc, char *argv[]) {
+	TestBuffer document = { NULL, 0, 0 };
+	unsigned int seed, documents = argc > 1 && strcmp(argv[1], "-bench") ? (unsigned int)atoi(argv[1]) : 1000;
+	int failures = 0;
+	char name[64];
+
+	if (argc > 1 && !strcmp(argv[1], "-bench")) {
+		Bench();
+		return 0;
+	}
+
+	if (ReadFile(MARKDOWN_README, &document))
+		failures += CheckDocument(&document, "the Markdown readme");
+	else
+		failures++;
+	if (ReadFile("../README.markdown", &document))
+		failures += CheckDocument(&document, "README.markdown");
+
+	for (seed = 1; seed <= documents; seed++) {
+		GenerateDocument(&document, seed);
+		snprintf(name, sizeof(name), "generated document %u", seed);
+		failures += CheckDocument(&document, name);
+	}
+
+	free(document.bytes);
+	if (leakedKeyDocuments) printf("(%u documents where Markdown.pl leaked a placeholder were only checked for placeholders)\n", leakedKeyDocuments);
+	printf("markdown: %s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,176 @@
+/*
+ *  pbkdf2_test.c
+ *  Notation
+ *
+ *  checks pbkdf2_sha1 against the RFC 6070 vectors and against the per-iteration HMAC implementation it replaced;
+ *  with -bench, times the two at the key lengths and iteration counts that NotationPrefs uses
+ *
+ */
+
+#include "pbkdf2.h"
+#include "hmacsha1.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//the implementation before the HMAC states were precomputed, which every stored key was derived with
+static int reference_pbkdf2_sha1(const char *password, size_t Plen, const char *salt, size_t Slen,
+								 unsigned int c, char *derivedKey, size_t dkLen) {
+	unsigned int hLen = 20;
+	char U[20], T[20];
+	unsigned int u, l, r, i, k;
+	char *tmp;
+
+	size_t tmplen = Slen + 4;
+
+	if (!c || !dkLen || dkLen > 4294967295U)
+		return 0;
+
+	l = (((int)dkLen - 1) / hLen) + 1;
+	r = (int)dkLen - (l - 1) * hLen;
+
+	if (!(tmp = (char*)malloc(tmplen)))
+		return 0;
+
+	memcpy(tmp, salt, Slen);
+
+	for (i = 1; i <= l; i++) {
+		memset (T, 0, hLen);
+
+		for (u = 1; u <= c; u++) {
+			if (u == 1) {
+				tmp[Slen + 0] = (i & 0xff000000) >> 24;
+				tmp[Slen + 1] = (i & 0x00ff0000) >> 16;
+				tmp[Slen + 2] = (i & 0x0000ff00) >> 8;
+				tmp[Slen + 3] = (i & 0x000000ff) >> 0;
+
+				hmac_sha1 (password, Plen, tmp, tmplen, U);
+			} else
+				hmac_sha1 (password, Plen, U, hLen, U);
+
+			for (k = 0; k < hLen; k++)
+				T[k] ^= U[k];
+		}
+
+		memcpy(derivedKey + (i - 1) * hLen, T, i == l ? r : hLen);
+    }
+
+	free(tmp);
+
+	return 1;
+}
+
+typedef struct {
+	const char *password;
+	size_t Plen;
+	const char *salt;
+	size_t Slen;
+	unsigned int c;
+	size_t dkLen;
+	const char *hex;
+} pbkdf2_vector;
+
+static const pbkdf2_vector rfc6070Vectors[] = {
+	{ "password", 8, "salt", 4, 1, 20, "0c60c80f961f0e71f3a9b524af6012062fe037a6" },
+	{ "password", 8, "salt", 4, 2, 20, "ea6c014dc72d6f8ccd1ed92ace1d41f0d8de8957" },
+	{ "password", 8, "salt", 4, 4096, 20, "4b007901b765489abead49d926f721d065a429c1" },
+	{ "password", 8, "salt", 4, 16777216, 20, "eefe3d61cd4da4e4e9945b3d6ba2158c2634e984" },
+	{ "passwordPASSWORDpassword", 24, "saltSALTsaltSALTsaltSALTsaltSALTsalt", 36, 4096, 25, "3d2eec4fe41c849b80c8d83662c0e44a8b291a964cf2f07038" },
+	{ "pass\0word", 9, "sa\0lt", 5, 4096, 16, "56fa6aa75548099dcc37d7f03425e0c3" },
+};
+
+static void hexOfBytes(const unsigned char *bytes, size_t length, char *hex) {
+	size_t i;
+	for (i = 0; i < length; i++)
+		sprintf(hex + i * 2, "%02x", bytes[i]);
+}
+
+static double secondsNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int checkVectors(void) {
+	int failures = 0;
+	size_t i;
+
+	for (i = 0; i < sizeof(rfc6070Vectors) / sizeof(rfc6070Vectors[0]); i++) {
+		const pbkdf2_vector *v = &rfc6070Vectors[i];
+		unsigned char key[64];
+		char hex[129];
+
+		if (!pbkdf2_sha1(v->password, v->Plen, v->salt, v->Slen, v->c, (char*)key, v->dkLen)) {
+			printf("FAIL: RFC 6070 vector %zu was refused\n", i + 1);
+			failures++;
+			continue;
+		}
+		hexOfBytes(key, v->dkLen, hex);
+		if (strcmp(hex, v->hex)) {
+			printf("FAIL: RFC 6070 vector %zu: %s, expected %s\n", i + 1, hex, v->hex);
+			failures++;
+		}
+	}
+	return failures;
+}
+
+static int checkAgainstReference(unsigned int trials) {
+	int failures = 0;
+	unsigned int t;
+
+	srand(6070);
+	for (t = 0; t < trials; t++) {
+		char password[200], salt[80], expected[300], derived[300];
+		size_t Plen = rand() % sizeof(password), Slen = rand() % sizeof(salt), dkLen = 1 + rand() % sizeof(derived), j;
+		//past the parallel threshold now and then, so that dispatched blocks are checked too
+		unsigned int c = 1 + (t % 8 == 7 ? 4096 + rand() % 512 : rand() % 64);
+
+		for (j = 0; j < Plen; j++) password[j] = (char)rand();
+		for (j = 0; j < Slen; j++) salt[j] = (char)rand();
+
+		reference_pbkdf2_sha1(password, Plen, salt, Slen, c, expected, dkLen);
+		pbkdf2_sha1(password, Plen, salt, Slen, c, derived, dkLen);
+		if (memcmp(expected, derived, dkLen)) {
+			printf("FAIL: password %zu bytes, salt %zu bytes, %u iterations, %zu-byte key differs from the reference\n", Plen, Slen, c, dkLen);
+			failures++;
+		}
+	}
+	return failures;
+}
+
+static void bench(void) {
+	static const unsigned int iterationCounts[] = { 10000, 100000, 1000000 };
+	static const size_t keyLengths[] = { 16, 32 };
+	char key[32];
+	size_t i, j;
+
+	printf("%10s %6s %14s %14s %8s\n", "iterations", "bytes", "reference (s)", "current (s)", "speedup");
+	for (i = 0; i < sizeof(keyLengths) / sizeof(keyLengths[0]); i++) {
+		for (j = 0; j < sizeof(iterationCounts) / sizeof(iterationCounts[0]); j++) {
+			unsigned int c = iterationCounts[j];
+
+			double start = secondsNow();
+			reference_pbkdf2_sha1("correct horse battery", 21, "0123456789abcdef", 16, c, key, keyLengths[i]);
+			double referenceTime = secondsNow() - start;
+
+			start = secondsNow();
+			pbkdf2_sha1("correct horse battery", 21, "0123456789abcdef", 16, c, key, keyLengths[i]);
+			double currentTime = secondsNow() - start;
+
+			printf("%10u %6zu %14.4f %14.4f %7.2fx\n", c, keyLengths[i], referenceTime, currentTime, referenceTime / currentTime);
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && !strcmp(argv[1], "-bench")) {
+		bench();
+		return 0;
+	}
+
+	int failures = checkVectors() + checkAgainstReference(400);
+	printf("pbkdf2: %s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,225 @@
+/*
+ *  title_prefix_trie_test.c
+ *  Notation
+ *
+ *  files, retitles and removes thousands of values at random in a TitlePrefixTrie, with titles from a tiny alphabet so
+ *  that edges are split and merged all the time and the value table grows and shifts entries back on removal, and
+ *  checks every prefix query against a brute-force scan of the titles; with -bench, compares the two for auto-completion
+ *
+ */
+
+#include "TitlePrefixTrie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define VALUE_COUNT 3000
+#define MAX_TITLE 10
+#define MAX_COPIED 8
+
+typedef struct {
+	char title[MAX_TITLE + 1];
+	int filed;
+	//when the value was last filed under a new title, as values sharing a title are kept in that order
+	unsigned long sequence;
+} oracleEntry;
+
+//the values themselves are only compared, never read, but must be distinct and spread over the table's hash
+static char valueStorage[VALUE_COUNT][16];
+static oracleEntry oracle[VALUE_COUNT];
+static unsigned long sequence;
+
+static void randomTitle(char *title, size_t maxLength, int alphabet) {
+	size_t i, length = rand() % (maxLength + 1);
+	for (i = 0; i < length; i++) title[i] = 'a' + rand() % alphabet;
+	title[length] = '\0';
+}
+
+static void setTitle(TitlePrefixTrie *trie, size_t v, const char *title) {
+	TitlePrefixTrieSetTitle(trie, valueStorage[v], title);
+	if (!oracle[v].filed || strcmp(oracle[v].title, title)) {
+		strcpy(oracle[v].title, title);
+		oracle[v].sequence = sequence++;
+		oracle[v].filed = 1;
+	}
+}
+
+static void removeValue(TitlePrefixTrie *trie, size_t v) {
+	TitlePrefixTrieRemoveValue(trie, valueStorage[v]);
+	oracle[v].filed = 0;
+}
+
+//shortest, then alphabetically first, then first filed
+static int oracleOrder(size_t a, size_t b) {
+	size_t lengthA = strlen(oracle[a].title), lengthB = strlen(oracle[b].title);
+	int comparison;
+	if (lengthA != lengthB) return lengthA < lengthB ? -1 : 1;
+	if ((comparison = strcmp(oracle[a].title, oracle[b].title))) return comparison;
+	return oracle[a].sequence < oracle[b].sequence ? -1 : (oracle[a].sequence > oracle[b].sequence);
+}
+
+static const void *oracleShortestWithPrefix(const char *prefix, size_t prefixLength) {
+	size_t v, best = VALUE_COUNT;
+	for (v = 0; v < VALUE_COUNT; v++) {
+		if (oracle[v].filed && !strncmp(oracle[v].title, prefix, prefixLength) && strlen(oracle[v].title) >= prefixLength &&
+			(best == VALUE_COUNT || oracleOrder(v, best) < 0))
+			best = v;
+	}
+	return best == VALUE_COUNT ? NULL : valueStorage[best];
+}
+
+static size_t oraclePrefixesOfTitle(const char *title, size_t minLength, const void **values, size_t maxValues) {
+	size_t v, i, count = 0, candidates[VALUE_COUNT];
+	for (v = 0; v < VALUE_COUNT; v++) {
+		size_t length = strlen(oracle[v].title);
+		if (oracle[v].filed && length >= minLength && !strncmp(oracle[v].title, title, length) && length <= strlen(title)) {
+			//an insertion sort by length and filing order; titles of equal length that are both prefixes are equal
+			for (i = count; i > 0 && oracleOrder(v, candidates[i - 1]) < 0; i--) candidates[i] = candidates[i - 1];
+			candidates[i] = v;
+			count++;
+		}
+	}
+	if (count > maxValues) count = maxValues;
+	for (i = 0; i < count; i++) values[i] = valueStorage[candidates[i]];
+	return count;
+}
+
+static int checkQueries(const TitlePrefixTrie *trie, int alphabet, unsigned int queries) {
+	int failures = 0;
+	unsigned int q;
+
+	for (q = 0; q < queries; q++) {
+		char query[MAX_TITLE + 1];
+		const void *values[MAX_COPIED], *expectedValues[MAX_COPIED];
+		randomTitle(query, MAX_TITLE, alphabet);
+		size_t queryLength = strlen(query), prefixLength = queryLength ? rand() % (queryLength + 1) : 0;
+
+		const void *shortest = TitlePrefixTrieShortestTitleWithPrefix(trie, query, prefixLength);
+		const void *expected = oracleShortestWithPrefix(query, prefixLength);
+		if (shortest != expected) {
+			printf("FAIL: the shortest title beginning \"%.*s\" was value %ld, expected %ld\n", (int)prefixLength, query,
+				   shortest ? (long)((const char (*)[16])shortest - valueStorage) : -1L,
+				   expected ? (long)((const char (*)[16])expected - valueStorage) : -1L);
+			failures++;
+		}
+
+		size_t minLength = rand() % 3, maxValues = 1 + rand() % MAX_COPIED;
+		size_t copied = TitlePrefixTrieCopyPrefixesOfTitle(trie, query, minLength, values, maxValues);
+		size_t expectedCount = oraclePrefixesOfTitle(query, minLength, expectedValues, maxValues);
+		if (copied != expectedCount || memcmp(values, expectedValues, copied * sizeof(const void *))) {
+			printf("FAIL: %zu prefixes of \"%s\" of at least %zu bytes were copied, expected %zu\n", copied, query, minLength, expectedCount);
+			failures++;
+		}
+		if (failures) break;
+	}
+	return failures;
+}
+
+static int checkTrie(void) {
+	static const int alphabets[] = { 2, 3, 26 };
+	int failures = 0;
+	size_t a;
+
+	srand(2010);
+	for (a = 0; a < sizeof(alphabets) / sizeof(alphabets[0]) && !failures; a++) {
+		TitlePrefixTrie *trie = TitlePrefixTrieCreate();
+		int alphabet = alphabets[a];
+		unsigned int round;
+
+		memset(oracle, 0, sizeof(oracle));
+		for (round = 0; round < 60 && !failures; round++) {
+			unsigned int changes = rand() % 400, c;
+			//filing mostly at first, so that the table grows, then removing as much, so that entries are shifted back
+			int removalOdds = round < 30 ? 3 : 7;
+
+			for (c = 0; c < changes; c++) {
+				size_t v = rand() % VALUE_COUNT;
+				char title[MAX_TITLE + 1];
+				int operation = rand() % 10;
+
+				if (oracle[v].filed && operation < removalOdds) {
+					removeValue(trie, v);
+				} else if (oracle[v].filed && operation == 9) {
+					//unchanged, which must keep its place among values of the same title
+					setTitle(trie, v, oracle[v].title);
+				} else if (oracle[v].filed && operation == 8 && strlen(oracle[v].title) < MAX_TITLE) {
+					//a title being typed, one letter at a time
+					strcpy(title, oracle[v].title);
+					title[strlen(title) + 1] = '\0';
+					title[strlen(title)] = 'a' + rand() % alphabet;
+					setTitle(trie, v, title);
+				} else {
+					randomTitle(title, MAX_TITLE, alphabet);
+					setTitle(trie, v, title);
+				}
+			}
+			failures += checkQueries(trie, alphabet, 150);
+		}
+
+		//every value taken out again must leave an empty trie behind
+		if (!failures) {
+			size_t v;
+			for (v = 0; v < VALUE_COUNT; v++)
+				if (oracle[v].filed) removeValue(trie, v);
+			if (TitlePrefixTrieShortestTitleWithPrefix(trie, "", 0)) {
+				printf("FAIL: values remained after all were removed\n");
+				failures++;
+			}
+		}
+		TitlePrefixTrieFree(trie);
+	}
+	return failures;
+}
+
+static double secondsNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(void) {
+	const size_t queries = 2000;
+	TitlePrefixTrie *trie = TitlePrefixTrieCreate();
+	char (*prefixes)[MAX_TITLE + 1] = malloc(queries * sizeof(*prefixes));
+	size_t v, q, found = 0, expectedFound = 0;
+
+	srand(1);
+	memset(oracle, 0, sizeof(oracle));
+	double start = secondsNow();
+	for (v = 0; v < VALUE_COUNT; v++) {
+		char title[MAX_TITLE + 1];
+		randomTitle(title, MAX_TITLE, 26);
+		setTitle(trie, v, title);
+	}
+	double buildTime = secondsNow() - start;
+	for (q = 0; q < queries; q++) randomTitle(prefixes[q], 3, 26);
+
+	start = secondsNow();
+	for (q = 0; q < queries; q++) found += TitlePrefixTrieShortestTitleWithPrefix(trie, prefixes[q], strlen(prefixes[q])) != NULL;
+	double trieTime = (secondsNow() - start) / queries;
+
+	start = secondsNow();
+	for (q = 0; q < queries; q++) expectedFound += oracleShortestWithPrefix(prefixes[q], strlen(prefixes[q])) != NULL;
+	double scanTime = (secondsNow() - start) / queries;
+
+	if (found != expectedFound) printf("(the trie completed %zu prefixes, the scan %zu)\n", found, expectedFound);
+	printf("%d titles filed in %.3f ms\n", VALUE_COUNT, buildTime * 1e3);
+	printf("%16s %16s %8s\n", "scan (us)", "trie (us)", "speedup");
+	printf("%16.3f %16.3f %7.0fx\n", scanTime * 1e6, trieTime * 1e6, scanTime / trieTime);
+
+	free(prefixes);
+	TitlePrefixTrieFree(trie);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && !strcmp(argv[1], "-bench")) {
+		bench();
+		return 0;
+	}
+
+	int failures = checkTrie();
+	printf("title prefix trie: %s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,300 @@
+/*
+ *  trigram_index_test.c
+ *  Notation
+ *
+ *  checks that TrigramIndexCopyCandidates never misses a note that a strstr scan would find, and that for current notes
+ *  it narrows the candidates to exactly those holding every trigram of the needles, as notes are added, changed,
+ *  invalidated and removed; with -bench, times a search of a large notation through the index against the plain scan
+ *
+ */
+
+#include "TrigramIndex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_DOCS 600
+#define FIELD_COUNT 3
+
+typedef struct {
+	uint32_t docID;
+	char *fields[FIELD_COUNT];
+	int current;
+} testDoc;
+
+static const char *words[] = { "note", "notational", "velocity", "the", "quick", "brown", "fox", "jumps", "over", "lazy",
+	"dog", "simplenote", "sync", "tag", "todo", "meeting", "agenda", "recipe", "flour", "butter", "http", "example" };
+
+//lowercase text, as the search caches are, with a few words run together so that trigrams cross word boundaries
+static char *randomText(size_t wordCount) {
+	char *text = (char *)malloc(wordCount * 12 + 1);
+	size_t i, length = 0;
+
+	for (i = 0; i < wordCount; i++) {
+		const char *word = words[rand() % (sizeof(words) / sizeof(words[0]))];
+		size_t wordLength = strlen(word);
+		memcpy(text + length, word, wordLength);
+		length += wordLength;
+		if (rand() % 5) text[length++] = rand() % 7 ? ' ' : '\n';
+	}
+	text[length] = '\0';
+	return text;
+}
+
+static void setDocText(TrigramIndex *index, testDoc *doc, int updateIndex) {
+	unsigned int f;
+	for (f = 0; f < FIELD_COUNT; f++) {
+		free(doc->fields[f]);
+		//the title, the labels and the body
+		doc->fields[f] = randomText(f == 2 ? rand() % 60 : rand() % 4);
+	}
+	if (updateIndex) {
+		TrigramIndexUpdateDocument(index, doc->docID, (const char **)doc->fields, FIELD_COUNT);
+		doc->current = 1;
+	} else {
+		TrigramIndexInvalidateDocument(index, doc->docID);
+		doc->current = 0;
+	}
+}
+
+static int fieldsContain(const testDoc *doc, const char *needle) {
+	unsigned int f;
+	for (f = 0; f < FIELD_COUNT; f++)
+		if (strstr(doc->fields[f], needle)) return 1;
+	return 0;
+}
+
+//whether some field holds each trigram of each needle long enough to have any, which is all the index can know
+static int holdsEveryTrigram(const testDoc *doc, const char **needles, unsigned int needleCount) {
+	unsigned int n;
+	for (n = 0; n < needleCount; n++) {
+		size_t i, length = strlen(needles[n]);
+		for (i = 0; i + 3 <= length; i++) {
+			char trigram[4] = { needles[n][i], needles[n][i + 1], needles[n][i + 2], '\0' };
+			if (!fieldsContain(doc, trigram)) return 0;
+		}
+	}
+	return 1;
+}
+
+static void randomNeedle(char *needle, size_t capacity) {
+	//a piece of a word, or of two run together
+	char *text = randomText(2);
+	size_t length = strlen(text), start = rand() % (length + 1), needleLength = 1 + rand() % 7;
+	if (start + needleLength > length) needleLength = length - start;
+	if (needleLength >= capacity) needleLength = capacity - 1;
+	memcpy(needle, text + start, needleLength);
+	needle[needleLength] = '\0';
+	if (!needleLength) strcpy(needle, "zzq");
+	free(text);
+}
+
+static int checkCandidates(TrigramIndex *index, testDoc *docs, size_t docCount, uint8_t **bitmap, size_t *bitmapSize, unsigned int trials) {
+	int failures = 0;
+	unsigned int t;
+
+	for (t = 0; t < trials; t++) {
+		char needleBuffers[3][16];
+		const char *needles[3];
+		unsigned int n, needleCount = 1 + rand() % 3, shortNeedles = 0;
+		uint32_t docLimit = 0;
+		size_t i;
+
+		for (n = 0; n < needleCount; n++) {
+			randomNeedle(needleBuffers[n], sizeof(needleBuffers[n]));
+			needles[n] = needleBuffers[n];
+			if (strlen(needles[n]) < 3) shortNeedles++;
+		}
+
+		if (!TrigramIndexCopyCandidates(index, needles, needleCount, bitmap, bitmapSize, &docLimit)) {
+			if (shortNeedles != needleCount) {
+				printf("FAIL: needles with trigrams were refused\n");
+				failures++;
+			}
+			continue;
+		}
+		if (shortNeedles == needleCount) {
+			printf("FAIL: needles without any trigram were said to narrow the search\n");
+			failures++;
+			continue;
+		}
+
+		for (i = 0; i < docCount; i++) {
+			const testDoc *doc = &docs[i];
+			if (doc->docID == kTrigramIndexNoDocument) continue;
+
+			int candidate = doc->docID < docLimit && TrigramBitmapContains(*bitmap, doc->docID);
+			int matches = 1;
+			for (n = 0; n < needleCount && matches; n++)
+				matches = fieldsContain(doc, needles[n]);
+
+			if (matches && !candidate) {
+				printf("FAIL: a note containing \"%s\"%s was not a candidate\n", needles[0], needleCount > 1 ? " and more" : "");
+				failures++;
+			} else if (!doc->current && !candidate) {
+				printf("FAIL: a stale note was left out of the candidates\n");
+				failures++;
+			} else if (doc->current && candidate != holdsEveryTrigram(doc, needles, needleCount)) {
+				printf("FAIL: a current note was %s the candidates for \"%s\"\n", candidate ? "wrongly among" : "missing from", needles[0]);
+				failures++;
+			}
+		}
+		if (failures) break;
+	}
+	return failures;
+}
+
+static int checkIndex(void) {
+	TrigramIndex *index = TrigramIndexCreate();
+	testDoc *docs = (testDoc *)calloc(MAX_DOCS, sizeof(testDoc));
+	uint8_t *bitmap = NULL;
+	size_t bitmapSize = 0, i, docCount = 0;
+	int failures = 0;
+	unsigned int round;
+
+	srand(31);
+	for (round = 0; round < 40 && !failures; round++) {
+		unsigned int changes = 1 + rand() % 60, c;
+
+		for (c = 0; c < changes; c++) {
+			int operation = rand() % 10;
+			if (docCount < MAX_DOCS && (operation < 4 || !docCount)) {
+				//added, reusing the slot of a removed note when there is one
+				testDoc *doc = &docs[docCount++];
+				doc->docID = TrigramIndexAddDocument(index);
+				setDocText(index, doc, rand() % 8 != 0);
+			} else {
+				testDoc *doc = &docs[rand() % docCount];
+				if (doc->docID == kTrigramIndexNoDocument) {
+					doc->docID = TrigramIndexAddDocument(index);
+					setDocText(index, doc, 1);
+				} else if (operation < 7) {
+					//edited, and indexed again now or only invalidated until the next pass
+					setDocText(index, doc, operation < 6);
+				} else if (operation < 8 && !doc->current) {
+					TrigramIndexUpdateDocument(index, doc->docID, (const char **)doc->fields, FIELD_COUNT);
+					doc->current = 1;
+				} else {
+					TrigramIndexRemoveDocument(index, doc->docID);
+					doc->docID = kTrigramIndexNoDocument;
+					doc->current = 0;
+				}
+			}
+		}
+
+		for (i = 0; i < docCount; i++) {
+			if (docs[i].docID != kTrigramIndexNoDocument && TrigramIndexDocumentIsCurrent(index, docs[i].docID) != docs[i].current) {
+				printf("FAIL: note %zu is %scurrent in the index\n", i, docs[i].current ? "not " : "");
+				failures++;
+				break;
+			}
+		}
+		failures += checkCandidates(index, docs, docCount, &bitmap, &bitmapSize, 60);
+	}
+
+	//a removed note is never a candidate, until its ID is handed out again
+	if (!failures) {
+		const char *needle = "velocity";
+		uint32_t docLimit = 0, removedID = docs[0].docID;
+		if (removedID == kTrigramIndexNoDocument) {
+			removedID = docs[0].docID = TrigramIndexAddDocument(index);
+			setDocText(index, &docs[0], 1);
+		}
+		TrigramIndexRemoveDocument(index, removedID);
+		docs[0].docID = kTrigramIndexNoDocument;
+		TrigramIndexCopyCandidates(index, &needle, 1, &bitmap, &bitmapSize, &docLimit);
+		if (removedID < docLimit && TrigramBitmapContains(bitmap, removedID)) {
+			printf("FAIL: a removed note was still a candidate\n");
+			failures++;
+		}
+	}
+
+	for (i = 0; i < MAX_DOCS; i++) {
+		unsigned int f;
+		for (f = 0; f < FIELD_COUNT; f++) free(docs[i].fields[f]);
+	}
+	free(docs);
+	free(bitmap);
+	TrigramIndexFree(index);
+	return failures;
+}
+
+static double secondsNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(void) {
+	static const char *queries[] = { "velocity", "meeting agenda", "flour", "brown fox", "zzq" };
+	const size_t docCount = 20000, searches = 20;
+	TrigramIndex *index = TrigramIndexCreate();
+	char **bodies = (char **)malloc(docCount * sizeof(char *));
+	uint32_t *docIDs = (uint32_t *)malloc(docCount * sizeof(uint32_t));
+	uint8_t *bitmap = NULL;
+	size_t bitmapSize = 0, i, q, s;
+
+	srand(1);
+	double start = secondsNow();
+	for (i = 0; i < docCount; i++) {
+		const char *fields[1];
+		//mostly the common words, with a few notes that hold the rarer ones
+		bodies[i] = randomText(200 + rand() % 200);
+		if (i % 97) {
+			char *p;
+			for (p = bodies[i]; (p = strstr(p, "velocity")); p++) p[0] = 'x';
+			for (p = bodies[i]; (p = strstr(p, "flour")); p++) p[0] = 'x';
+		}
+		fields[0] = bodies[i];
+		docIDs[i] = TrigramIndexAddDocument(index);
+		TrigramIndexUpdateDocument(index, docIDs[i], fields, 1);
+	}
+	printf("%zu notes indexed in %.3f s\n", docCount, secondsNow() - start);
+	printf("%16s %12s %12s %12s %8s\n", "query", "candidates", "scan (ms)", "index (ms)", "speedup");
+
+	for (q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+		size_t scanMatches = 0, indexMatches = 0, candidates = 0;
+
+		start = secondsNow();
+		for (s = 0; s < searches; s++) {
+			for (i = 0; i < docCount; i++)
+				scanMatches += strstr(bodies[i], queries[q]) != NULL;
+		}
+		double scanTime = (secondsNow() - start) / searches;
+
+		start = secondsNow();
+		for (s = 0; s < searches; s++) {
+			uint32_t docLimit = 0;
+			const char *needle = queries[q];
+			int narrowed = TrigramIndexCopyCandidates(index, &needle, 1, &bitmap, &bitmapSize, &docLimit);
+			for (i = 0; i < docCount; i++) {
+				if (narrowed && !TrigramBitmapContains(bitmap, docIDs[i])) continue;
+				candidates++;
+				indexMatches += strstr(bodies[i], queries[q]) != NULL;
+			}
+		}
+		double indexTime = (secondsNow() - start) / searches;
+
+		if (scanMatches != indexMatches) printf("(the index found %zu matches, the scan %zu)\n", indexMatches, scanMatches);
+		printf("%16s %12zu %12.3f %12.3f %7.1fx\n", queries[q], candidates / searches, scanTime * 1e3, indexTime * 1e3, scanTime / indexTime);
+	}
+
+	for (i = 0; i < docCount; i++) free(bodies[i]);
+	free(bodies);
+	free(docIDs);
+	free(bitmap);
+	TrigramIndexFree(index);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && !strcmp(argv[1], "-bench")) {
+		bench();
+		return 0;
+	}
+
+	int failures = checkIndex();
+	printf("trigram index: %s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,396 @@
+/*
+ *  TitlePrefixTrie.c
+ *  Notation
+ *
+ */
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+
+#include "TitlePrefixTrie.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+typedef struct _TrieNode {
+	struct _TrieNode *parent;
+	//the bytes of the edge leading to this node from its parent
+	char *label;
+	size_t labelLength, depth; //depth is the length of the whole key ending at this node
+
+	struct _TrieNode **children; //sorted by the first byte of their labels, which are distinct
+	unsigned int childCount, childCapacity;
+
+	const void **values; //in the order they were filed
+	unsigned int valueCount, valueCapacity;
+
+	//the shallowest node in this subtree that has values, taking the first child on ties; NULL if there are none
+	struct _TrieNode *shortest;
+} TrieNode;
+
+typedef struct _TrieValueEntry {
+	const void *value; //NULL marks an empty bucket
+	TrieNode *node;
+	char *title;
+} TrieValueEntry;
+
+struct _TitlePrefixTrie {
+	TrieNode *root;
+
+	//value -> where it is filed, so that it can be moved without knowing its old title
+	TrieValueEntry *entries;
+	size_t entryCount, bucketCount; //bucketCount is always a power of two
+};
+
+#define kInitialBucketCount 1024U
+
+static inline size_t ValueHash(const void *value, size_t bucketCount) {
+	return (size_t)(((uintptr_t)value >> 4) * 2654435761U) & (bucketCount - 1);
+}
+
+static TrieValueEntry *EntryForValue(const TitlePrefixTrie *trie, const void *value) {
+	size_t i = ValueHash(value, trie->bucketCount);
+
+	while (trie->entries[i].value) {
+		if (trie->entries[i].value == value)
+			return &trie->entries[i];
+		i = (i + 1) & (trie->bucketCount - 1);
+	}
+	return NULL;
+}
+
+static TrieValueEntry *InsertEntry(TitlePrefixTrie *trie, const void *value) {
+	if ((trie->entryCount + 1) * 4 > trie->bucketCount * 3) {
+		TrieValueEntry *oldEntries = trie->entries;
+		size_t j, oldBucketCount = trie->bucketCount;
+
+		trie->bucketCount *= 2;
+		trie->entries = (TrieValueEntry*)calloc(trie->bucketCount, sizeof(TrieValueEntry));
+		for (j=0; j<oldBucketCount; j++) {
+			if (oldEntries[j].value) {
+				size_t k = ValueHash(oldEntries[j].value, trie->bucketCount);
+				while (trie->entries[k].value)
+					k = (k + 1) & (trie->bucketCount - 1);
+				trie->entries[k] = oldEntries[j];
+			}
+		}
+		free(oldEntries);
+	}
+
+	size_t i = ValueHash(value, trie->bucketCount);
+	while (trie->entries[i].value)
+		i = (i + 1) & (trie->bucketCount - 1);
+
+	trie->entries[i].value = value;
+	trie->entryCount++;
+	return &trie->entries[i];
+}
+
+static void RemoveEntry(TitlePrefixTrie *trie, TrieValueEntry *entry) {
+	//shift later entries of the same probe sequence back, so that no tombstones are needed
+	size_t mask = trie->bucketCount - 1, i = entry - trie->entries, j = i;
+
+	free(entry->title);
+	for (;;) {
+		trie->entries[i].value = NULL;
+		for (;;) {
+			j = (j + 1) & mask;
+			if (!trie->entries[j].value) {
+				trie->entryCount--;
+				return;
+			}
+			size_t home = ValueHash(trie->entries[j].value, trie->bucketCount);
+			//move j into i only if its home bucket is not cyclically within (i, j]
+			if ((i <= j) ? (home <= i || home > j) : (home <= i && home > j))
+				break;
+		}
+		trie->entries[i] = trie->entries[j];
+		i = j;
+	}
+}
+
+static TrieNode *NewNode(TrieNode *parent, const char *label, size_t labelLength) {
+	TrieNode *node = (TrieNode*)calloc(1, sizeof(TrieNode));
+
+	node->parent = parent;
+	node->label = (char*)malloc(labelLength + 1);
+	memcpy(node->label, label, labelLength);
+	node->label[labelLength] = '\0';
+	node->labelLength = labelLength;
+	node->depth = (parent ? parent->depth : 0) + labelLength;
+	return node;
+}
+
+static void FreeNode(TrieNode *node) {
+	unsigned int i;
+	for (i=0; i<node->childCount; i++)
+		FreeNode(node->children[i]);
+	free(node->children);
+	free(node->values);
+	free(node->label);
+	free(node);
+}
+
+static unsigned int ChildSlot(const TrieNode *node, unsigned char byte, int *found) {
+	unsigned int low = 0, high = node->childCount;
+
+	while (low < high) {
+		unsigned int mid = (low + high) >> 1;
+		unsigned char midByte = (unsigned char)node->children[mid]->label[0];
+		if (midByte == byte) {
+			*found = 1;
+			return mid;
+		}
+		if (midByte < byte) low = mid + 1;
+		else high = mid;
+	}
+	*found = 0;
+	return low;
+}
+
+static TrieNode *ChildForByte(const TrieNode *node, unsigned char byte) {
+	int found;
+	unsigned int slot = ChildSlot(node, byte, &found);
+	return found ? node->children[slot] : NULL;
+}
+
+static void InsertChild(TrieNode *node, TrieNode *child) {
+	int found;
+	unsigned int slot = ChildSlot(node, (unsigned char)child->label[0], &found);
+	assert(!found);
+
+	if (node->childCount == node->childCapacity) {
+		node->childCapacity = node->childCapacity ? node->childCapacity * 2 : 2;
+		node->children = (TrieNode**)realloc(node->children, node->childCapacity * sizeof(TrieNode*));
+	}
+	memmove(&node->children[slot + 1], &node->children[slot], (node->childCount - slot) * sizeof(TrieNode*));
+	node->children[slot] = child;
+	node->childCount++;
+	child->parent = node;
+}
+
+static void RemoveChild(TrieNode *node, TrieNode *child) {
+	int found;
+	unsigned int slot = ChildSlot(node, (unsigned char)child->label[0], &found);
+	assert(found && node->children[slot] == child);
+
+	memmove(&node->children[slot], &node->children[slot + 1], (node->childCount - slot - 1) * sizeof(TrieNode*));
+	node->childCount--;
+}
+
+static void UpdateShortestFromNode(TrieNode *node) {
+	//only the nodes between a change and the root can have a different shortest descendant
+	for (; node; node = node->parent) {
+		TrieNode *shortest = NULL;
+		unsigned int i;
+
+		if (node->valueCount) {
+			shortest = node;
+		} else {
+			for (i=0; i<node->childCount; i++) {
+				TrieNode *candidate = node->children[i]->shortest;
+				if (candidate && (!shortest || candidate->depth < shortest->depth))
+					shortest = candidate;
+			}
+		}
+		node->shortest = shortest;
+	}
+}
+
+static TrieNode *NodeForInsertingTitle(TitlePrefixTrie *trie, const char *title) {
+	TrieNode *node = trie->root;
+	size_t titleLength = strlen(title), matched = 0;
+
+	while (matched < titleLength) {
+		const char *rest = title + matched;
+		TrieNode *child = ChildForByte(node, (unsigned char)rest[0]);
+
+		if (!child) {
+			TrieNode *leaf = NewNode(node, rest, titleLength - matched);
+			InsertChild(node, leaf);
+			return leaf;
+		}
+
+		size_t common = 1;
+		while (common < child->labelLength && rest[common] && rest[common] == child->label[common])
+			common++;
+
+		if (common < child->labelLength) {
+			//split the edge where the title leaves it
+			TrieNode *middle = NewNode(node, child->label, common);
+			RemoveChild(node, child);
+			InsertChild(node, middle);
+
+			memmove(child->label, child->label + common, child->labelLength - common + 1);
+			child->labelLength -= common;
+			InsertChild(middle, child);
+
+			middle->shortest = child->shortest;
+			child = middle;
+		}
+		node = child;
+		matched += common;
+	}
+	return node;
+}
+
+static TrieNode *PruneNode(TitlePrefixTrie *trie, TrieNode *node) {
+	//removes a node left without values, or merges it into its only child, to keep every edge as long as possible;
+	//returns the deepest node that remains on the path, from which the shortest nodes must be recomputed
+	TrieNode *parent = node->parent;
+
+	if (node == trie->root || node->valueCount || node->childCount > 1)
+		return node;
+
+	if (!node->childCount) {
+		RemoveChild(parent, node);
+		FreeNode(node);
+		return PruneNode(trie, parent);
+	}
+
+	TrieNode *child = node->children[0];
+	size_t combinedLength = node->labelLength + child->labelLength;
+	char *combinedLabel = (char*)malloc(combinedLength + 1);
+
+	memcpy(combinedLabel, node->label, node->labelLength);
+	memcpy(combinedLabel + node->labelLength, child->label, child->labelLength + 1);
+	free(child->label);
+	child->label = combinedLabel;
+	child->labelLength = combinedLength;
+
+	RemoveChild(parent, node);
+	node->childCount = 0;
+	FreeNode(node);
+	InsertChild(parent, child);
+
+	return child;
+}
+
+static void DetachEntry(TitlePrefixTrie *trie, TrieValueEntry *entry) {
+	TrieNode *node = entry->node;
+	unsigned int i;
+
+	for (i=0; i<node->valueCount; i++) {
+		if (node->values[i] == entry->value) {
+			memmove(&node->values[i], &node->values[i + 1], (node->valueCount - i - 1) * sizeof(const void*));
+			node->valueCount--;
+			break;
+		}
+	}
+	entry->node = NULL;
+
+	UpdateShortestFromNode(PruneNode(trie, node));
+}
+
+TitlePrefixTrie *TitlePrefixTrieCreate(void) {
+	TitlePrefixTrie *trie = (TitlePrefixTrie*)calloc(1, sizeof(TitlePrefixTrie));
+
+	trie->root = NewNode(NULL, "", 0);
+	trie->bucketCount = kInitialBucketCount;
+	trie->entries = (TrieValueEntry*)calloc(trie->bucketCount, sizeof(TrieValueEntry));
+	return trie;
+}
+
+void TitlePrefixTrieFree(TitlePrefixTrie *trie) {
+	size_t i;
+	if (!trie) return;
+
+	for (i=0; i<trie->bucketCount; i++) {
+		if (trie->entries[i].value)
+			free(trie->entries[i].title);
+	}
+	free(trie->entries);
+	FreeNode(trie->root);
+	free(trie);
+}
+
+void TitlePrefixTrieSetTitle(TitlePrefixTrie *trie, const void *value, const char *title) {
+	assert(value != NULL);
+	if (!title) title = "";
+
+	TrieValueEntry *entry = EntryForValue(trie, value);
+	if (entry) {
+		if (!strcmp(entry->title, title))
+			return;
+		DetachEntry(trie, entry);
+		free(entry->title);
+	} else {
+		entry = InsertEntry(trie, value);
+	}
+
+	TrieNode *node = NodeForInsertingTitle(trie, title);
+	if (node->valueCount == node->valueCapacity) {
+		node->valueCapacity = node->valueCapacity ? node->valueCapacity * 2 : 1;
+		node->values = (const void**)realloc(node->values, node->valueCapacity * sizeof(const void*));
+	}
+	node->values[node->valueCount++] = value;
+
+	entry->node = node;
+	entry->title = strdup(title);
+
+	UpdateShortestFromNode(node);
+}
+
+void TitlePrefixTrieRemoveValue(TitlePrefixTrie *trie, const void *value) {
+	TrieValueEntry *entry = EntryForValue(trie, value);
+
+	if (entry) {
+		DetachEntry(trie, entry);
+		RemoveEntry(trie, entry);
+	}
+}
+
+const void *TitlePrefixTrieShortestTitleWithPrefix(const TitlePrefixTrie *trie, const char *prefix, size_t prefixLength) {
+	const TrieNode *node = trie->root;
+	size_t matched = 0;
+
+	while (matched < prefixLength) {
+		const TrieNode *child = ChildForByte(node, (unsigned char)prefix[matched]);
+		if (!child)
+			return NULL;
+
+		size_t i, length = child->labelLength < prefixLength - matched ? child->labelLength : prefixLength - matched;
+		for (i=1; i<length; i++) {
+			if (child->label[i] != prefix[matched + i])
+				return NULL;
+		}
+		node = child;
+		matched += length;
+	}
+
+	return node->shortest ? node->shortest->values[0] : NULL;
+}
+
+size_t TitlePrefixTrieCopyPrefixesOfTitle(const TitlePrefixTrie *trie, const char *title, size_t minLength,
+										  const void **values, size_t maxValues) {
+	const TrieNode *node = trie->root;
+	size_t copied = 0, matched = 0, titleLength = strlen(title);
+
+	for (;;) {
+		unsigned int i;
+		if (node->depth >= minLength) {
+			for (i=0; i<node->valueCount && copied < maxValues; i++)
+				values[copied++] = node->values[i];
+		}
+		if (matched == titleLength || copied == maxValues)
+			break;
+
+		const TrieNode *child = ChildForByte(node, (unsigned char)title[matched]);
+		if (!child || child->labelLength > titleLength - matched || memcmp(child->label, title + matched, child->labelLength))
+			break;
+
+		node = child;
+		matched += child->labelLength;
+	}
+	return copied;
+}
@@ -0,0 +1,40 @@
+/*
+ *  TitlePrefixTrie.h
+ *  Notation
+ *
+ */
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+//a compressed trie over the lowercase title caches of all notes, kept current one title at a time,
+//so that auto-completion never has to sort or scan the notes to find titles sharing a prefix
+
+//values are opaque and not retained; each is filed under at most one title at a time
+
+#include <stddef.h>
+
+typedef struct _TitlePrefixTrie TitlePrefixTrie;
+
+TitlePrefixTrie *TitlePrefixTrieCreate(void);
+void TitlePrefixTrieFree(TitlePrefixTrie *trie);
+
+//files value under title, moving it from wherever it was filed before; does nothing if the title is unchanged
+void TitlePrefixTrieSetTitle(TitlePrefixTrie *trie, const void *value, const char *title);
+void TitlePrefixTrieRemoveValue(TitlePrefixTrie *trie, const void *value);
+
+//the value with the shortest title beginning with prefix (the alphabetically first of those, if there are several), or NULL
+const void *TitlePrefixTrieShortestTitleWithPrefix(const TitlePrefixTrie *trie, const char *prefix, size_t prefixLength);
+
+//copies, shortest first, up to maxValues values whose titles are both prefixes of title and at least minLength bytes long
+//returns the number of values copied
+size_t TitlePrefixTrieCopyPrefixesOfTitle(const TitlePrefixTrie *trie, const char *title, size_t minLength,
+										  const void **values, size_t maxValues);
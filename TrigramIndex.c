@@ -0,0 +1,360 @@
+/*
+ *  TrigramIndex.c
+ *  Notation
+ *
+ */
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+
+#include "TrigramIndex.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+typedef struct _TrigramPostings {
+	uint32_t key; //three bytes packed big-endian; 0 marks an empty bucket, as the caches never contain NULs
+	uint32_t count, capacity;
+	uint32_t *docIDs; //sorted ascending
+} TrigramPostings;
+
+typedef struct _TrigramDocument {
+	uint32_t *keys; //sorted and unique, so that an update only has to touch the trigrams that changed
+	uint32_t keyCount;
+	uint8_t inUse, current;
+} TrigramDocument;
+
+struct _TrigramIndex {
+	TrigramPostings *buckets;
+	uint32_t bucketCount, usedBucketCount; //bucketCount is always a power of two
+
+	TrigramDocument *docs; //indexed by doc ID
+	uint32_t docLimit, docCapacity;
+
+	uint32_t *freeDocIDs;
+	uint32_t freeDocIDCount, freeDocIDCapacity;
+
+	uint32_t *scratchKeys;
+	size_t scratchCapacity;
+	
+	TrigramPostings **scratchPostings;
+	size_t scratchPostingsCapacity;
+};
+
+#define kInitialBucketCount 4096U
+
+static inline uint32_t TrigramHash(uint32_t key) {
+	return key * 2654435761U;
+}
+
+static TrigramPostings *PostingsForKey(TrigramIndex *index, uint32_t key, int create);
+
+TrigramIndex *TrigramIndexCreate(void) {
+	TrigramIndex *index = (TrigramIndex*)calloc(1, sizeof(TrigramIndex));
+
+	index->bucketCount = kInitialBucketCount;
+	index->buckets = (TrigramPostings*)calloc(index->bucketCount, sizeof(TrigramPostings));
+
+	//reserve doc ID 0
+	index->docCapacity = 256;
+	index->docs = (TrigramDocument*)calloc(index->docCapacity, sizeof(TrigramDocument));
+	index->docLimit = 1;
+
+	return index;
+}
+
+void TrigramIndexFree(TrigramIndex *index) {
+	uint32_t i;
+	if (!index) return;
+
+	for (i=0; i<index->bucketCount; i++) {
+		if (index->buckets[i].docIDs)
+			free(index->buckets[i].docIDs);
+	}
+	for (i=0; i<index->docLimit; i++) {
+		if (index->docs[i].keys)
+			free(index->docs[i].keys);
+	}
+	free(index->buckets);
+	free(index->docs);
+	if (index->freeDocIDs)
+		free(index->freeDocIDs);
+	if (index->scratchKeys)
+		free(index->scratchKeys);
+	if (index->scratchPostings)
+		free(index->scratchPostings);
+	free(index);
+}
+
+static void GrowBuckets(TrigramIndex *index) {
+	uint32_t i, oldCount = index->bucketCount;
+	TrigramPostings *oldBuckets = index->buckets;
+
+	index->bucketCount = oldCount * 2;
+	index->buckets = (TrigramPostings*)calloc(index->bucketCount, sizeof(TrigramPostings));
+
+	for (i=0; i<oldCount; i++) {
+		if (oldBuckets[i].key) {
+			uint32_t mask = index->bucketCount - 1, slot = TrigramHash(oldBuckets[i].key) & mask;
+			while (index->buckets[slot].key)
+				slot = (slot + 1) & mask;
+			index->buckets[slot] = oldBuckets[i];
+		}
+	}
+	free(oldBuckets);
+}
+
+static TrigramPostings *PostingsForKey(TrigramIndex *index, uint32_t key, int create) {
+	uint32_t mask = index->bucketCount - 1, slot = TrigramHash(key) & mask;
+
+	while (index->buckets[slot].key) {
+		if (index->buckets[slot].key == key)
+			return &index->buckets[slot];
+		slot = (slot + 1) & mask;
+	}
+	if (!create)
+		return NULL;
+
+	//emptied posting lists keep their buckets, so the table never needs tombstones
+	if ((index->usedBucketCount + 1) * 4 > index->bucketCount * 3) {
+		GrowBuckets(index);
+		return PostingsForKey(index, key, create);
+	}
+	index->usedBucketCount++;
+	index->buckets[slot].key = key;
+	return &index->buckets[slot];
+}
+
+static uint32_t LowerBound(const uint32_t *array, uint32_t count, uint32_t value) {
+	uint32_t low = 0, high = count;
+	while (low < high) {
+		uint32_t mid = low + ((high - low) >> 1);
+		if (array[mid] < value) low = mid + 1;
+		else high = mid;
+	}
+	return low;
+}
+
+static void PostingsInsert(TrigramPostings *postings, uint32_t docID) {
+	uint32_t pos = postings->count && postings->docIDs[postings->count - 1] < docID ?
+		postings->count : LowerBound(postings->docIDs, postings->count, docID);
+
+	if (pos < postings->count && postings->docIDs[pos] == docID)
+		return;
+
+	if (postings->count == postings->capacity) {
+		postings->capacity = postings->capacity ? postings->capacity * 2 : 4;
+		postings->docIDs = (uint32_t*)realloc(postings->docIDs, postings->capacity * sizeof(uint32_t));
+	}
+	memmove(postings->docIDs + pos + 1, postings->docIDs + pos, (postings->count - pos) * sizeof(uint32_t));
+	postings->docIDs[pos] = docID;
+	postings->count++;
+}
+
+static void PostingsRemove(TrigramPostings *postings, uint32_t docID) {
+	uint32_t pos = LowerBound(postings->docIDs, postings->count, docID);
+
+	if (pos < postings->count && postings->docIDs[pos] == docID) {
+		memmove(postings->docIDs + pos, postings->docIDs + pos + 1, (postings->count - pos - 1) * sizeof(uint32_t));
+		postings->count--;
+	}
+}
+
+static int CompareKeys(const void *a, const void *b) {
+	uint32_t one = *(const uint32_t*)a, two = *(const uint32_t*)b;
+	return one < two ? -1 : (one > two);
+}
+
+//collects the sorted, unique trigrams of all fields into the index's scratch buffer
+static uint32_t CollectTrigrams(TrigramIndex *index, const char **fields, unsigned int fieldCount) {
+	size_t total = 0;
+	unsigned int i;
+
+	for (i=0; i<fieldCount; i++) {
+		if (fields[i]) total += strlen(fields[i]);
+	}
+	if (total > index->scratchCapacity) {
+		index->scratchCapacity = total;
+		index->scratchKeys = (uint32_t*)realloc(index->scratchKeys, total * sizeof(uint32_t));
+	}
+
+	uint32_t keyCount = 0;
+	for (i=0; i<fieldCount; i++) {
+		const unsigned char *s = (const unsigned char*)fields[i];
+		if (!s || !s[0] || !s[1]) continue;
+
+		uint32_t key = (s[0] << 8) | s[1];
+		for (s += 2; *s; s++) {
+			key = ((key << 8) | *s) & 0xFFFFFF;
+			index->scratchKeys[keyCount++] = key;
+		}
+	}
+	if (!keyCount)
+		return 0;
+
+	qsort(index->scratchKeys, keyCount, sizeof(uint32_t), CompareKeys);
+
+	uint32_t j, uniqueCount = 1;
+	for (j=1; j<keyCount; j++) {
+		if (index->scratchKeys[j] != index->scratchKeys[uniqueCount - 1])
+			index->scratchKeys[uniqueCount++] = index->scratchKeys[j];
+	}
+	return uniqueCount;
+}
+
+uint32_t TrigramIndexAddDocument(TrigramIndex *index) {
+	uint32_t docID;
+
+	if (index->freeDocIDCount) {
+		docID = index->freeDocIDs[--index->freeDocIDCount];
+	} else {
+		if (index->docLimit == index->docCapacity) {
+			index->docs = (TrigramDocument*)realloc(index->docs, index->docCapacity * 2 * sizeof(TrigramDocument));
+			memset(index->docs + index->docCapacity, 0, index->docCapacity * sizeof(TrigramDocument));
+			index->docCapacity *= 2;
+		}
+		docID = index->docLimit++;
+	}
+
+	index->docs[docID].inUse = 1;
+	index->docs[docID].current = 0;
+	return docID;
+}
+
+void TrigramIndexRemoveDocument(TrigramIndex *index, uint32_t docID) {
+	if (docID == kTrigramIndexNoDocument || docID >= index->docLimit || !index->docs[docID].inUse)
+		return;
+
+	TrigramDocument *doc = &index->docs[docID];
+	uint32_t i;
+	for (i=0; i<doc->keyCount; i++) {
+		TrigramPostings *postings = PostingsForKey(index, doc->keys[i], 0);
+		if (postings) PostingsRemove(postings, docID);
+	}
+	if (doc->keys)
+		free(doc->keys);
+	memset(doc, 0, sizeof(TrigramDocument));
+
+	if (index->freeDocIDCount == index->freeDocIDCapacity) {
+		index->freeDocIDCapacity = index->freeDocIDCapacity ? index->freeDocIDCapacity * 2 : 64;
+		index->freeDocIDs = (uint32_t*)realloc(index->freeDocIDs, index->freeDocIDCapacity * sizeof(uint32_t));
+	}
+	index->freeDocIDs[index->freeDocIDCount++] = docID;
+}
+
+void TrigramIndexUpdateDocument(TrigramIndex *index, uint32_t docID, const char **fields, unsigned int fieldCount) {
+	assert(docID != kTrigramIndexNoDocument && docID < index->docLimit && index->docs[docID].inUse);
+
+	uint32_t newCount = CollectTrigrams(index, fields, fieldCount);
+	const uint32_t *newKeys = index->scratchKeys;
+	TrigramDocument *doc = &index->docs[docID];
+
+	//merge the old and new key lists, touching only the posting lists of trigrams that were added or removed
+	uint32_t i = 0, j = 0;
+	while (i < doc->keyCount || j < newCount) {
+		if (j == newCount || (i < doc->keyCount && doc->keys[i] < newKeys[j])) {
+			TrigramPostings *postings = PostingsForKey(index, doc->keys[i], 0);
+			if (postings) PostingsRemove(postings, docID);
+			i++;
+		} else if (i == doc->keyCount || newKeys[j] < doc->keys[i]) {
+			PostingsInsert(PostingsForKey(index, newKeys[j], 1), docID);
+			j++;
+		} else {
+			i++; j++;
+		}
+	}
+
+	doc = &index->docs[docID];
+	doc->keys = (uint32_t*)realloc(doc->keys, (newCount ? newCount : 1) * sizeof(uint32_t));
+	if (newCount) memcpy(doc->keys, newKeys, newCount * sizeof(uint32_t));
+	doc->keyCount = newCount;
+	doc->current = 1;
+}
+
+void TrigramIndexInvalidateDocument(TrigramIndex *index, uint32_t docID) {
+	if (docID != kTrigramIndexNoDocument && docID < index->docLimit)
+		index->docs[docID].current = 0;
+}
+
+int TrigramIndexDocumentIsCurrent(const TrigramIndex *index, uint32_t docID) {
+	return docID != kTrigramIndexNoDocument && docID < index->docLimit &&
+		index->docs[docID].inUse && index->docs[docID].current;
+}
+
+static int ComparePostingsCounts(const void *a, const void *b) {
+	uint32_t one = (*(TrigramPostings* const*)a)->count, two = (*(TrigramPostings* const*)b)->count;
+	return one < two ? -1 : (one > two);
+}
+
+int TrigramIndexCopyCandidates(TrigramIndex *index, const char **needles, unsigned int needleCount, uint8_t **bitmap, size_t *bitmapSize, uint32_t *docLimit) {
+	unsigned int i;
+	for (i=0; i<needleCount; i++) {
+		const char *s = needles[i];
+		if (s[0] && s[1] && s[2])
+			break;
+	}
+	if (i == needleCount)
+		return 0;
+
+	size_t requiredSize = (index->docLimit + 7) >> 3;
+	if (requiredSize > *bitmapSize || !*bitmap) {
+		*bitmap = (uint8_t*)realloc(*bitmap, requiredSize);
+		*bitmapSize = requiredSize;
+	}
+	memset(*bitmap, 0, *bitmapSize);
+	*docLimit = index->docLimit;
+
+	//every candidate must appear in the posting lists of all trigrams of all needles,
+	//so seed from the rarest of those lists and probe the others, shortest first, for each of its docs
+	uint32_t keyCount = CollectTrigrams(index, needles, needleCount);
+	if (keyCount > index->scratchPostingsCapacity) {
+		index->scratchPostingsCapacity = keyCount;
+		index->scratchPostings = (TrigramPostings**)realloc(index->scratchPostings, keyCount * sizeof(TrigramPostings*));
+	}
+	TrigramPostings **postingsList = index->scratchPostings;
+	uint32_t j, k;
+	int missingTrigram = 0;
+
+	for (j=0; j<keyCount; j++) {
+		TrigramPostings *postings = PostingsForKey(index, index->scratchKeys[j], 0);
+		if (!postings || !postings->count) {
+			missingTrigram = 1;
+			break;
+		}
+		postingsList[j] = postings;
+	}
+
+	if (!missingTrigram) {
+		qsort(postingsList, keyCount, sizeof(TrigramPostings*), ComparePostingsCounts);
+		
+		TrigramPostings *rarest = postingsList[0];
+		for (j=0; j<rarest->count; j++) {
+			uint32_t docID = rarest->docIDs[j];
+			for (k=1; k<keyCount; k++) {
+				TrigramPostings *postings = postingsList[k];
+				uint32_t pos = LowerBound(postings->docIDs, postings->count, docID);
+				if (pos == postings->count || postings->docIDs[pos] != docID)
+					break;
+			}
+			if (k == keyCount)
+				(*bitmap)[docID >> 3] |= (1 << (docID & 7));
+		}
+	}
+
+	//stale documents can't be excluded
+	for (j=1; j<index->docLimit; j++) {
+		if (index->docs[j].inUse && !index->docs[j].current)
+			(*bitmap)[j >> 3] |= (1 << (j & 7));
+	}
+
+	return 1;
+}
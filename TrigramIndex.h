@@ -0,0 +1,45 @@
+/*
+ *  TrigramIndex.h
+ *  Notation
+ *
+ */
+
+/*Copyright (c) 2010, Zachary Schneirov. All rights reserved.
+  Redistribution and use in source and binary forms, with or without modification, are permitted
+  provided that the following conditions are met:
+   - Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice, this list of
+	 conditions and the following disclaimer in the documentation and/or other materials provided with
+     the distribution.
+   - Neither the name of Notational Velocity nor the names of its contributors may be used to endorse
+     or promote products derived from this software without specific prior written permission. */
+
+//an inverted index from every 3-byte sequence in the lowercase search caches to the documents containing it
+//used only to narrow the set of notes that must be confirmed with a real substring search:
+//a note can contain a needle only if it contains every trigram of that needle
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct _TrigramIndex TrigramIndex;
+
+//document ID 0 is never handed out; it means "not in the index"
+#define kTrigramIndexNoDocument 0U
+
+TrigramIndex *TrigramIndexCreate(void);
+void TrigramIndexFree(TrigramIndex *index);
+
+uint32_t TrigramIndexAddDocument(TrigramIndex *index);
+void TrigramIndexRemoveDocument(TrigramIndex *index, uint32_t docID);
+void TrigramIndexUpdateDocument(TrigramIndex *index, uint32_t docID, const char **fields, unsigned int fieldCount);
+void TrigramIndexInvalidateDocument(TrigramIndex *index, uint32_t docID);
+int TrigramIndexDocumentIsCurrent(const TrigramIndex *index, uint32_t docID);
+
+//fills *bitmap (reallocating as necessary) with one bit per document ID that could contain every one of the needles;
+//documents that are stale or were added after the call must always be treated as candidates
+//returns 0 if all needles are too short for the index to narrow anything, in which case the bitmap is untouched
+int TrigramIndexCopyCandidates(TrigramIndex *index, const char **needles, unsigned int needleCount,
+							   uint8_t **bitmap, size_t *bitmapSize, uint32_t *docLimit);
+
+#define TrigramBitmapContains(__bitmap, __docID) (((__bitmap)[(__docID) >> 3] >> ((__docID) & 7)) & 1)
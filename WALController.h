@@ -22,8 +22,26 @@
 #include <zlib.h>
 
 #define RECORD_SALT_LEN 32
+#define SESSION_SALT_LEN 24
+
+//newer journals begin with this header, and its version says how their records were written; older journals have none,
+//and start straight with a record, whose first eight bytes can't read as the magic followed by a known version
+#define WAL_JOURNAL_MAGIC 0x4E564A4C /* 'NVJL' */
+//each record was encrypted with the subkey of its journal session and compressed on its own,
+//so that each can be inflated without the records before it
+#define WAL_JOURNAL_VERSION_SESSION_KEYED 1
+
+typedef struct _WALJournalHeader {
+	u_int32_t magic;
+	u_int32_t version;
+} WALJournalHeader;
+
+//the first word of the nonce that record IVs are made from
+#define WAL_SESSION_KEY_MAGIC 0x4E56534B /* 'NVSK' */
 
 //each note will have its own key--the "LogSessionKey" salt of master key + per-record salt
+//or, in newer journals, each journal has its own subkey--the LogSessionKey + a per-session salt--
+//and each record gets its own IV from its position in the session, sparing every write a key derivation and a read of /dev/random
 typedef union {
     struct {
 		u_int32_t originalDataLength;
@@ -31,15 +49,40 @@ typedef union {
 		u_int32_t checksum;
 		char saltBuffer[RECORD_SALT_LEN];
 	};
+	struct {
+		u_int32_t _lengthsAndChecksum[3];
+		char sessionSalt[SESSION_SALT_LEN];
+		u_int32_t recordCounter;
+		u_int32_t reserved;
+	};
 	char recordBuffer[(sizeof(u_int32_t) * 3) + RECORD_SALT_LEN];
 } WALRecordHeader;
 
+//a group-commit batch is a single record whose (inflated) data begins with this header instead of a keyed archive,
+//followed by noteCount frames of a big-endian length and the keyed archive of one note
+#define WAL_BATCH_MAGIC 0x4E564742 /* 'NVGB' */
+
+typedef struct _WALBatchHeader {
+	u_int32_t magic;
+	u_int32_t noteCount;
+} WALBatchHeader;
+
+//where a record was found in the mapped journal, with the lengths and checksum of its header in host byte order
+typedef struct _WALRecordSpan {
+	WALRecordHeader header;
+	size_t dataOffset;
+	NSData *sessionKey; //nil for records with keys of their own
+} WALRecordSpan;
+
 @interface WALController : NSObject {
 	int logFD;
 	char *journalFile;
 	NSData *logSessionKey;
 	id delegate;
 	
+	//the salt and subkey of the journal session being written or (most recently) recovered
+	NSData *sessionSalt, *sessionKey;
+	
 	z_stream compressionStream;
 }
 
@@ -53,14 +96,17 @@ typedef union {
 
 @interface WALStorageController : WALController {
     NSMutableData *unwrittenData;
+	u_int32_t recordCounter;
 }
 - (id)initWithParentFSRep:(const char*)path encryptionKey:(NSData*)key;
 - (BOOL)writeEstablishedNote:(id<SynchronizedNote>)aNoteObject;
 - (BOOL)writeRemovalForNote:(id<SynchronizedNote>)aNoteObject;
 - (BOOL)writeNoteObject:(id<SynchronizedNote>)aNoteObject;
-- (void)writeNoteObjects:(NSArray*)notes;
+- (BOOL)writeEstablishedNotes:(NSArray*)notes failedNotes:(NSMutableArray*)failedNotes;
+- (BOOL)writeNoteObjects:(NSArray*)notes failedNotes:(NSMutableArray*)failedNotes;
 - (BOOL)_attemptToWriteUnwrittenData;
 - (BOOL)_encryptAndWriteData:(NSMutableData*)data;
+- (BOOL)_syncJournalFile;
 - (BOOL)synchronize;
 
 @end
@@ -68,9 +114,17 @@ typedef union {
 
 
 @interface WALRecoveryController : WALController {
-    off_t fileLength, totalBytesRead;
-    //to ensure we don't mistakenly allocate more memory
-    //than there exists data in what we have yet to read
+	//the journal is mapped and the boundaries of all its records found up front,
+	//so that the records ahead of the one being recovered can be checked, decrypted and inflated concurrently
+	NSData *journalData;
+	u_int32_t journalVersion;
+	WALRecordSpan *records;
+	NSMutableData **decodedRecords;
+	NSUInteger recordCount, nextRecord, decodedLimit;
+	
+	//the rest of the notes from the last group-commit batch, handed out before the next record is read
+	NSMutableArray *batchedObjects;
+	NSUInteger nextBatchedObject;
 }
 
 - (id)initWithParentFSRep:(const char*)path encryptionKey:(NSData*)key;
@@ -21,6 +21,7 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <dispatch/dispatch.h>
 #import "NSData_transformations.h"
 #import "WALController.h"
 #import "DeletedNoteObject.h"
@@ -35,6 +36,11 @@
 //if the other app already recovered the journal and rewrote the database file then it won't matter
 //if it didn't, well at least the notes have been saved
 
+//notes in a group commit are split into multiple batch records once their archives reach this size
+#define WAL_BATCH_MAX_LENGTH (4 * 1024 * 1024)
+//the number of records decoded concurrently ahead of the one being recovered
+#define WAL_RECOVERY_WINDOW 64
+
 @implementation WALController
 
 - (id)initWithParentFSRep:(const char*)path encryptionKey:(NSData*)key {
@@ -100,10 +106,37 @@
     return YES;
 }
 
+- (NSData*)_keyForSessionSalt:(const char*)saltBytes {
+	//a journal normally holds the records of just one session, so this derives a key only once
+	if (!sessionSalt || memcmp([sessionSalt bytes], saltBytes, SESSION_SALT_LEN)) {
+		[sessionSalt release];
+		[sessionKey release];
+		sessionSalt = [[NSData alloc] initWithBytes:saltBytes length:SESSION_SALT_LEN];
+		sessionKey = [[logSessionKey derivedKeyOfLength:[logSessionKey length] salt:sessionSalt iterations:1] retain];
+	}
+	return sessionKey;
+}
+
+static NSData *RecordIVForCounter(NSData *key, u_int32_t counter) {
+	//CBC needs IVs that can't be predicted, so rather than the counter itself use its encryption
+	//under the session key (as in appendix C of NIST SP 800-38A)
+	static const char zeroIV[16] = { 0 };
+	u_int32_t nonce[4] = { CFSwapInt32HostToBig(WAL_SESSION_KEY_MAGIC), CFSwapInt32HostToBig(counter), 0, 0 };
+	NSMutableData *ivData = [NSMutableData dataWithBytes:nonce length:sizeof(nonce)];
+	
+	if (![ivData encryptAESDataWithKey:key iv:[NSData dataWithBytesNoCopy:(void*)zeroIV length:sizeof(zeroIV) freeWhenDone:NO]])
+		return nil;
+	[ivData setLength:sizeof(nonce)];
+	
+	return ivData;
+}
+
 - (void)dealloc {
 	if (journalFile)
 		free(journalFile);
 	[logSessionKey release];
+	[sessionSalt release];
+	[sessionKey release];
 	
 	[super dealloc];
 }
@@ -129,6 +162,14 @@
 	//we could make parent dir writable just in case, but that might be a security hazard depending on ownership
 	//chmod(path, S_IRWXU | S_IRWXG | S_IRWXO);
 	
+	//the only key derivation of this session; records are then told apart by their counters
+	NSData *newSessionSalt = [NSData randomDataOfLength:SESSION_SALT_LEN];
+	if (!newSessionSalt || ![self _keyForSessionSalt:[newSessionSalt bytes]]) {
+		NSLog(@"WALStorageController: couldn't create a key for this session");
+		return nil;
+	}
+	recordCounter = 0;
+	
 	//attempt to open/create the file exclusively with write-only and append access
 	
 	if ((logFD = open(journalFile, O_CREAT | O_EXCL | O_WRONLY | O_APPEND, S_IRUSR | S_IWUSR)) < 0) {
@@ -142,6 +183,13 @@
 	if (fcntl(logFD, F_NOCACHE, 1) < 0) {
 		NSLog(@"Unable to disable disk caching for writing: %s", strerror(errno));
 	}
+	
+	//the file is new, so the header goes first, telling recovery how the records after it are keyed
+	WALJournalHeader header = { CFSwapInt32HostToBig(WAL_JOURNAL_MAGIC), CFSwapInt32HostToBig(WAL_JOURNAL_VERSION_SESSION_KEYED) };
+	if (write(logFD, &header, sizeof(header)) != sizeof(header)) {
+		NSLog(@"WALStorageController: couldn't write the header of journal %s: %s", journalFile, strerror(errno));
+		return nil;
+	}
 		
 	//this will grow as necessary
 	unwrittenData = [[NSMutableData dataWithCapacity:16] retain];
@@ -163,13 +211,19 @@
     return self;
 }
 
-- (BOOL)writeNoteObject:(id<SynchronizedNote>)aNoteObject {
-	//this method serializes a note object, encrypts it, and writes it to the log
+static NSMutableData *ArchivedNoteData(id<SynchronizedNote> aNoteObject) {
     NSMutableData *noteData = [NSMutableData data];
 	NSKeyedArchiver *archiver = [[[NSKeyedArchiver alloc] initForWritingWithMutableData:noteData] autorelease];
 	[archiver encodeObject:aNoteObject forKey:@"aNote"];
 	[archiver finishEncoding];
 	
+	return noteData;
+}
+
+- (BOOL)writeNoteObject:(id<SynchronizedNote>)aNoteObject {
+	//this method serializes a note object, encrypts it, and writes it to the log
+    NSMutableData *noteData = ArchivedNoteData(aNoteObject);
+	
     if ([noteData length])
 		return [self _encryptAndWriteData:noteData];
     
@@ -192,12 +246,73 @@
 	return [self writeNoteObject:removedNote];	
 }
 
-- (void)writeNoteObjects:(NSArray*)notes {
+- (BOOL)writeEstablishedNotes:(NSArray*)notes failedNotes:(NSMutableArray*)failedNotes {
+	[notes makeObjectsPerformSelector:@selector(incrementLSN)];
+	
+	return [self writeNoteObjects:notes failedNotes:failedNotes];
+}
+
+- (BOOL)_writeBatchData:(NSMutableData*)batchData noteCount:(NSUInteger)noteCount bytesWritten:(size_t*)bytesWritten {
+	WALBatchHeader *header = (WALBatchHeader*)[batchData mutableBytes];
+	header->magic = CFSwapInt32HostToBig(WAL_BATCH_MAGIC);
+	header->noteCount = CFSwapInt32HostToBig(noteCount);
+	
+	BOOL result = [self _encryptAndWriteData:batchData];
+	//now compressed and encrypted
+	*bytesWritten += sizeof(WALRecordHeader) + [batchData length];
+	
+	return result;
+}
+
+//group commit: instead of a record (and a key, a deflate and a write) for each note, the notes are framed together
+//into as few records as possible, all of which are flushed to disk with a single fsync
+//the notes of any record that couldn't be written are added to failedNotes; all of them are if the fsync fails
+- (BOOL)writeNoteObjects:(NSArray*)notes failedNotes:(NSMutableArray*)failedNotes {
 	//assume that the LSNs have been incremented already if they needed to be
-	NSUInteger i;
-    for (i=0; i<[notes count]; i++) {
-		[self writeNoteObject:[notes objectAtIndex:i]];
+	NSUInteger i, batchStart = 0, noteCount = [notes count];
+	size_t bytesWritten = 0;
+	
+	if (!noteCount)
+		return YES;
+	
+	CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+	NSMutableData *batchData = [NSMutableData dataWithLength:sizeof(WALBatchHeader)];
+	NSMutableArray *notesNotWritten = [NSMutableArray array];
+	
+    for (i=0; i<noteCount; i++) {
+		NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+		
+		NSMutableData *noteData = ArchivedNoteData([notes objectAtIndex:i]);
+		u_int32_t frameLength = CFSwapInt32HostToBig([noteData length]);
+		[batchData appendBytes:&frameLength length:sizeof(frameLength)];
+		[batchData appendData:noteData];
+		
+		if ([batchData length] >= WAL_BATCH_MAX_LENGTH || i == noteCount - 1) {
+			if (![self _writeBatchData:batchData noteCount:i + 1 - batchStart bytesWritten:&bytesWritten]) {
+				[notesNotWritten addObjectsFromArray:[notes subarrayWithRange:NSMakeRange(batchStart, i + 1 - batchStart)]];
+			}
+			[batchData setLength:sizeof(WALBatchHeader)];
+			batchStart = i + 1;
+		}
+		
+		[pool release];
+	}
+	//whatever of the failed records is still buffered belongs to notes already counted as not written
+	[self _attemptToWriteUnwrittenData];
+	if (![self _syncJournalFile]) {
+		//written or not, none of the records can be counted on now
+		[notesNotWritten setArray:notes];
 	}
+	[failedNotes addObjectsFromArray:notesNotWritten];
+	
+	//quiet unless asked for with "defaults write net.elasticthreads.nv LogJournalThroughput -bool YES"
+	if ([[NSUserDefaults standardUserDefaults] boolForKey:@"LogJournalThroughput"]) {
+		CFAbsoluteTime elapsedTime = CFAbsoluteTimeGetCurrent() - startTime;
+		NSLog(@"journaled %lu notes in %lu bytes: %.0f records/sec, %.1f bytes/record", (unsigned long)noteCount, (unsigned long)bytesWritten,
+			  elapsedTime > 0.0 ? (double)noteCount / elapsedTime : 0.0, (double)bytesWritten / (double)noteCount);
+	}
+	
+	return ![notesNotWritten count];
 }
 
 - (BOOL)_attemptToWriteUnwrittenData {
@@ -226,8 +341,12 @@
 	
 	record.originalDataLength = CFSwapInt32HostToBig([data length]);
 	
-	size_t compressedDataBufferSize = [data length] + (( [data length] + 99 ) / 100 ) + 12;
+	size_t compressedDataBufferSize = deflateBound(&compressionStream, [data length]);
 	Bytef *compressedDataBuffer = (Bytef *)malloc(compressedDataBufferSize);
+	if (!compressedDataBuffer) {
+		NSLog(@"Couldn't allocate %lu bytes to compress a WAL record", (unsigned long)compressedDataBufferSize);
+		return NO;
+	}
 	
     //adapt nsdata to compression stream
 	compressionStream.next_in = (Bytef*)[data bytes];
@@ -236,18 +355,20 @@
 	compressionStream.avail_out = compressedDataBufferSize;
 	compressionStream.data_type = Z_BINARY;
 	
-	uLong previousOut = compressionStream.total_out;
-	/* Perform the compression here. */
-	int deflateResult = deflate(&compressionStream, Z_SYNC_FLUSH);
+	/* Perform the compression here; each record is a complete stream, so that recovery need not inflate them in sequence */
+	int deflateResult = deflate(&compressionStream, Z_FINISH);
 	/*Find the total size of the resulting compressed data. */
-	uLong zlibAfterBufLen = compressionStream.total_out - previousOut;
-
-	if (deflateResult != Z_OK) {
-		NSLog(@"zlib deflation error: %s\n", compressionStream.msg);
+	uLong zlibAfterBufLen = compressionStream.total_out;
+	
+	//reset even after a failure, so that the next record starts a fresh stream
+	if (deflateReset(&compressionStream) != Z_OK || deflateResult != Z_STREAM_END) {
+		NSLog(@"zlib deflation error: %s\n", zError(deflateResult));
+		free(compressedDataBuffer);
 		return NO;
 	}
 	if (zlibAfterBufLen > compressedDataBufferSize) {
 		NSLog(@"zlibAfterBufLen is larger than the allocated compressed buffer!");
+		free(compressedDataBuffer);
 		return NO;
 	}
 	
@@ -255,21 +376,21 @@
 	memcpy([data mutableBytes], compressedDataBuffer, zlibAfterBufLen);
 	free(compressedDataBuffer);
     
-	//encrypt nsdata here using record salt and record key
-	NSData *recordSalt = [NSData randomDataOfLength:RECORD_SALT_LEN];
-	NSData *recordKey = [logSessionKey derivedKeyOfLength:[logSessionKey length] salt:recordSalt iterations:1];
+	//encrypt nsdata here using the session key and the IV of the next record in the session
+	NSData *recordIV = RecordIVForCounter(sessionKey, ++recordCounter);
 	
-	if (![data encryptAESDataWithKey:recordKey iv:[recordSalt subdataWithRange:NSMakeRange(0, 16)]]) {
+	if (!recordIV || ![data encryptAESDataWithKey:sessionKey iv:recordIV]) {
 		NSLog(@"Couldn't encrypt WAL record data!");
 		return NO;
 	}
 	
-	//write length, checksum of data, record salt, then data itself
+	//write length, checksum of data, session salt and record counter, then data itself
     //assert(sizeof(record) == sizeof(record.recordBuffer));
     
     record.dataLength = CFSwapInt32HostToBig([data length]);
     record.checksum = CFSwapInt32HostToBig([data CRC32]);
-	memcpy(record.saltBuffer, [recordSalt bytes], RECORD_SALT_LEN);
+	memcpy(record.sessionSalt, [sessionSalt bytes], SESSION_SALT_LEN);
+	record.recordCounter = CFSwapInt32HostToBig(recordCounter);
     
     //pack all the data to avoid multiple writes
     size_t dataChunkSize = sizeof(record) + [data length];
@@ -303,17 +424,20 @@
     return ((size_t)bytesWritten == dataChunkSize);
 }
 
-- (BOOL)synchronize {
-    
-    BOOL flushedUnwritten = [self _attemptToWriteUnwrittenData];
-    
+- (BOOL)_syncJournalFile {
     //F_FULLFSYNC is probably overkill
     if (fsync(logFD)) {
 	NSLog(@"synchronize WAL: fsync error: %s", strerror(errno));
 	return NO;
     }
+    return YES;
+}
+
+- (BOOL)synchronize {
+    
+    BOOL flushedUnwritten = [self _attemptToWriteUnwrittenData];
     
-    return flushedUnwritten;
+    return [self _syncJournalFile] && flushedUnwritten;
 }
 
 - (void)dealloc {
@@ -325,6 +449,179 @@
 
 @implementation WALRecoveryController
 
+- (void)_indexRecords {
+	const char *bytes = [journalData bytes];
+	size_t offset = 0, length = [journalData length];
+	NSUInteger capacity = 16;
+	
+	records = (WALRecordSpan*)malloc(capacity * sizeof(WALRecordSpan));
+	
+	//a journal without a header is from before session keys, and its records have keys of their own
+	journalVersion = 0;
+	if (length >= sizeof(WALJournalHeader)) {
+		WALJournalHeader header;
+		memcpy(&header, bytes, sizeof(WALJournalHeader));
+		
+		if (CFSwapInt32BigToHost(header.magic) == WAL_JOURNAL_MAGIC) {
+			journalVersion = CFSwapInt32BigToHost(header.version);
+			offset = sizeof(WALJournalHeader);
+			
+			if (journalVersion != WAL_JOURNAL_VERSION_SESSION_KEYED) {
+				NSLog(@"recovery can't read journal version %u", journalVersion);
+				length = offset;
+			}
+		}
+	}
+	
+	while (length - offset >= sizeof(WALRecordHeader)) {
+		WALRecordSpan span;
+		memcpy(span.header.recordBuffer, bytes + offset, sizeof(WALRecordHeader));
+		
+		span.header.originalDataLength = CFSwapInt32BigToHost(span.header.originalDataLength);
+		span.header.dataLength = CFSwapInt32BigToHost(span.header.dataLength);
+		span.header.checksum = CFSwapInt32BigToHost(span.header.checksum);
+		span.dataOffset = offset + sizeof(WALRecordHeader);
+		
+		if (span.header.dataLength > length - span.dataOffset) {
+			NSLog(@"recovery can't continue past record %lu because its size is larger than the rest of the file!", (unsigned long)recordCount);
+			break;
+		}
+		//session subkeys are derived here, while still on one thread; journals rarely have more than one session
+		span.sessionKey = journalVersion ? [[self _keyForSessionSalt:span.header.sessionSalt] retain] : nil;
+		
+		if (recordCount >= capacity) {
+			capacity *= 2;
+			records = (WALRecordSpan*)realloc(records, capacity * sizeof(WALRecordSpan));
+		}
+		records[recordCount++] = span;
+		offset = span.dataOffset + span.header.dataLength;
+	}
+	if (offset < length && length - offset < sizeof(WALRecordHeader)) {
+		NSLog(@"recovery can't read the (entire) header of the last log record");
+	}
+	
+	decodedRecords = (NSMutableData**)calloc(MAX(recordCount, 1), sizeof(NSMutableData*));
+}
+
+static BOOL InflateStandaloneRecordData(NSMutableData *data, u_int32_t originalDataLength) {
+	z_stream stream;
+	memset(&stream, 0, sizeof(z_stream));
+	
+	if (inflateInit2(&stream, MAX_WBITS) != Z_OK) {
+		NSLog(@"inflateInit2 error: %s", stream.msg);
+		return NO;
+	}
+	Bytef *uncompressedDataBuffer = (Bytef *)malloc(originalDataLength);
+	
+	stream.avail_in = [data length];
+	stream.next_in = (Bytef*)[data bytes];
+	stream.avail_out = originalDataLength;
+	stream.next_out = uncompressedDataBuffer;
+	stream.data_type = Z_BINARY;
+	
+	int inflateResult = inflate(&stream, Z_FINISH);
+	inflateEnd(&stream);
+	
+	if (inflateResult != Z_STREAM_END || stream.avail_out != 0) {
+		NSLog(@"err: inflateResult = %d, avail_out = %d", inflateResult, stream.avail_out);
+		free(uncompressedDataBuffer);
+		return NO;
+	}
+	
+	[data setLength:originalDataLength];
+	memcpy([data mutableBytes], uncompressedDataBuffer, originalDataLength);
+	free(uncompressedDataBuffer);
+	
+	return YES;
+}
+
+//checksums and decrypts a record, also inflating it if it was compressed on its own
+//touches no state shared with other records, so that it can be called for many records at once
+- (NSMutableData*)_copyDecodedDataOfRecord:(WALRecordSpan*)span {
+	
+	NSMutableData *presumablySerializedData = [[NSMutableData alloc] initWithBytes:(const char*)[journalData bytes] + span->dataOffset 
+																			length:span->header.dataLength];
+    if ([presumablySerializedData CRC32] != span->header.checksum) {
+		NSLog(@"recoverNextObject: checksum of read data does not match that of record header");
+		[presumablySerializedData release];
+		return nil;
+    }
+	
+	NSData *recordKey = span->sessionKey, *recordIV = nil;
+	
+	if (recordKey) {
+		//attempt to decrypt using the subkey of the record's session and the IV of its counter
+		recordIV = RecordIVForCounter(recordKey, CFSwapInt32BigToHost(span->header.recordCounter));
+	} else {
+		//attempt to decrypt using record key based on record salt and log session key
+		NSData *recordSalt = [NSData dataWithBytesNoCopy:span->header.saltBuffer length:RECORD_SALT_LEN freeWhenDone:NO];
+		recordKey = [logSessionKey derivedKeyOfLength:[logSessionKey length] salt:recordSalt iterations:1];
+		recordIV = [recordSalt subdataWithRange:NSMakeRange(0, 16)];
+	}
+	
+	if (!recordIV || !([presumablySerializedData decryptAESDataWithKey:recordKey iv:recordIV])) {
+		NSLog(@"Record decryption failed!");
+		[presumablySerializedData release];
+		return nil;
+	}
+	
+	if (journalVersion && !InflateStandaloneRecordData(presumablySerializedData, span->header.originalDataLength)) {
+		[presumablySerializedData release];
+		return nil;
+	}
+	
+	return presumablySerializedData;
+}
+
+//records in older journals continue the compression stream of the records before them, and so must be inflated here, in order
+- (BOOL)_inflateChainedRecordData:(NSMutableData*)presumablySerializedData originalLength:(u_int32_t)originalDataLength {
+	
+	Bytef *uncompressedDataBuffer = (Bytef *)malloc(originalDataLength);
+	
+	compressionStream.avail_in = [presumablySerializedData length];
+	compressionStream.next_in = (Bytef*)[presumablySerializedData bytes];
+	compressionStream.avail_out = originalDataLength;
+	compressionStream.next_out = uncompressedDataBuffer;
+	compressionStream.data_type = Z_BINARY;
+	
+	int inflateResult = inflate(&compressionStream, Z_SYNC_FLUSH);
+	if (inflateResult == Z_STREAM_ERROR) {
+		NSLog(@"zlib inflate error: %s", compressionStream.msg);
+		free(uncompressedDataBuffer);
+		return NO;
+	}
+	if (inflateResult == Z_NEED_DICT || inflateResult == Z_DATA_ERROR || 
+		inflateResult == Z_MEM_ERROR) {
+		NSLog(@"err: inflateResult = %d", inflateResult);
+		free(uncompressedDataBuffer);
+		return NO;
+	}
+	
+	if (compressionStream.avail_out != 0) {
+		NSLog(@"recoverNextObject: compressionStream.avail_out(%d) != 0", compressionStream.avail_out);
+		free(uncompressedDataBuffer);
+		return NO;
+	}
+	
+	[presumablySerializedData setLength:originalDataLength];
+	memcpy([presumablySerializedData mutableBytes], uncompressedDataBuffer, originalDataLength);
+	free(uncompressedDataBuffer);
+	
+	return YES;
+}
+
+//decodes the next window of records concurrently, to be handed out by recoverNextObject one at a time
+- (void)_decodeRecordsAfterNextRecord {
+	NSUInteger windowStart = nextRecord, windowLength = MIN(recordCount - nextRecord, WAL_RECOVERY_WINDOW);
+	
+	dispatch_apply(windowLength, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^(size_t i) {
+		NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+		decodedRecords[windowStart + i] = [self _copyDecodedDataOfRecord:&records[windowStart + i]];
+		[pool release];
+	});
+	decodedLimit = windowStart + windowLength;
+}
+
 //record structure:
 //int size
 //int CRC32
@@ -341,7 +638,6 @@
 
 - (id)initWithParentFSRep:(const char*)path encryptionKey:(NSData*)key {
     if ([super initWithParentFSRep:path encryptionKey:key]) {
-	fileLength = totalBytesRead = 0;
 	
 	//make file readable just in case
 	chmod(journalFile, S_IRUSR);
@@ -363,9 +659,14 @@
 	    return nil;
 	}
 	
-	fileLength = sb.st_size;
+	NSError *error = nil;
+	if (!(journalData = [[NSData alloc] initWithContentsOfFile:[[NSFileManager defaultManager] stringWithFileSystemRepresentation:journalFile length:strlen(journalFile)]
+													   options:NSDataReadingMapped error:&error])) {
+		NSLog(@"WALRecoveryController: couldn't map file %s: %@", journalFile, error);
+		return nil;
+	}
 	
-	//initialize decompression context
+	//initialize decompression context, for journals whose records were all compressed as one stream
 	compressionStream.total_in = 0;
 	compressionStream.total_out = 0;
 	compressionStream.zalloc = Z_NULL;
@@ -377,108 +678,114 @@
 		return nil;
 	}
 	
+	[self _indexRecords];
     }
     return self;
 }
 
+static id UnarchivedNoteObject(NSData *data) {
+    id object = nil;
+	@try {
+		NSKeyedUnarchiver *unarchiver = [[NSKeyedUnarchiver alloc] initForReadingWithData:data];
+		object = [unarchiver decodeObjectForKey:@"aNote"];
+		[unarchiver release];	
+    } @catch (NSException *e) {
+		NSLog(@"recoverNextObject got an exception while unarchiving object: %@; returning NSNull to skip", [e reason]);
+		object = [NSNull null];
+    }
+	
+	return object;
+}
+
+static BOOL IsBatchData(NSData *data) {
+	WALBatchHeader header;
+	if ([data length] < sizeof(WALBatchHeader))
+		return NO;
+	
+	memcpy(&header, [data bytes], sizeof(WALBatchHeader));
+	return CFSwapInt32BigToHost(header.magic) == WAL_BATCH_MAGIC;
+}
+
+- (id <SynchronizedNote>)_nextBatchedObject {
+	if (nextBatchedObject >= [batchedObjects count]) {
+		//an empty (or unreadable) batch shouldn't stop recovery of the records after it
+		return (id<SynchronizedNote>)[NSNull null];
+	}
+	return [batchedObjects objectAtIndex:nextBatchedObject++];
+}
+
+//unarchives each note of a batch into batchedObjects, returning the first
+- (id <SynchronizedNote>)_unpackBatchData:(NSData*)batchData {
+	WALBatchHeader header;
+	memcpy(&header, [batchData bytes], sizeof(WALBatchHeader));
+	
+	u_int32_t i, noteCount = CFSwapInt32BigToHost(header.noteCount);
+	const char *bytes = [batchData bytes];
+	size_t offset = sizeof(WALBatchHeader), length = [batchData length];
+	
+	if (!batchedObjects) batchedObjects = [[NSMutableArray alloc] initWithCapacity:noteCount];
+	[batchedObjects removeAllObjects];
+	nextBatchedObject = 0;
+	
+	for (i=0; i<noteCount; i++) {
+		u_int32_t frameLength;
+		if (offset + sizeof(frameLength) > length) break;
+		
+		memcpy(&frameLength, bytes + offset, sizeof(frameLength));
+		frameLength = CFSwapInt32BigToHost(frameLength);
+		offset += sizeof(frameLength);
+		if (frameLength > length - offset) break;
+		
+		NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+		NSData *frameData = [NSData dataWithBytesNoCopy:(void*)(bytes + offset) length:frameLength freeWhenDone:NO];
+		id object = UnarchivedNoteObject(frameData);
+		[batchedObjects addObject:object ? object : [NSNull null]];
+		[pool release];
+		
+		offset += frameLength;
+	}
+	if (i < noteCount) {
+		NSLog(@"recoverNextObject: batch record ends after %u of its %u notes", i, noteCount);
+	}
+	
+	return [self _nextBatchedObject];
+}
+
 //log enumerating method
 - (id <SynchronizedNote>)recoverNextObject {
-    WALRecordHeader record = {{0}};
+	
+	if (nextBatchedObject < [batchedObjects count]) {
+		//still working through the notes of a batch
+		return [self _nextBatchedObject];
+	}
     
-    //attempt to read size of log record and checksum
-    //if it's smaller than the remaining bytes to read
-    //allocate enough memory, try to read data in, and checksum it
-    //if checksum matches, attempt to deserialize
+    //take the next record, decoding it and those after it if they haven't been already
+    //if its checksum matches and it could be decrypted and inflated, attempt to deserialize
     //if deserialization was successful, then return a new object!
     
     //if any of these fail, return nil
 	
-    //adapt reads to read from decompression stream
-    
-    ssize_t readBytes = read(logFD, &record, sizeof(WALRecordHeader));
-    totalBytesRead += MAX(0, readBytes);
-	
-    if (readBytes < (int)sizeof(WALRecordHeader)) {
-		NSLog(@"recoverNextObject can't even read (entire) log record header: %s", strerror(errno));
-		return nil;
-    }
-	
-	record.originalDataLength = CFSwapInt32BigToHost(record.originalDataLength);
-	record.dataLength = CFSwapInt32BigToHost(record.dataLength);
-	record.checksum = CFSwapInt32BigToHost(record.checksum);
-    
-    if (record.dataLength > fileLength - totalBytesRead) {
-		NSLog(@"recoverNextObject can't continue because the size of this record is larger than the rest of the file!");
-		return nil;
-    }
-    
-    char *presumablySerializedBytes = (char*)malloc(record.dataLength);
-    
-    readBytes = read(logFD, presumablySerializedBytes, record.dataLength);
-    totalBytesRead += MAX(0, readBytes);
-    
-    if (readBytes < (int)record.dataLength) {
-		NSLog(@"recoverNextObject can't read all serialized bytes: %s", strerror(errno));
-		free(presumablySerializedBytes);
-		return nil;
-    }
-    
-    NSMutableData *presumablySerializedData = [[NSMutableData alloc] initWithBytesNoCopy:presumablySerializedBytes 
-																				  length:record.dataLength freeWhenDone:YES];
-    if ([presumablySerializedData CRC32] != record.checksum) {
-		NSLog(@"recoverNextObject: checksum of read data does not match that of record header");
-		[presumablySerializedData release];
-		return nil;
-    }
-	    
-    //attempt to decrypt using record key based on record salt and log session key
-	NSData *recordSalt = [NSData dataWithBytesNoCopy:record.saltBuffer length:RECORD_SALT_LEN freeWhenDone:NO];
-	NSData *recordKey = [logSessionKey derivedKeyOfLength:[logSessionKey length] salt:recordSalt iterations:1];
-	
-	if (!([presumablySerializedData decryptAESDataWithKey:recordKey iv:[recordSalt subdataWithRange:NSMakeRange(0, 16)]])) {
-		NSLog(@"Record decryption failed!");
+	if (nextRecord >= recordCount)
 		return nil;
-	}
 	
-	//decompress here
-	Bytef *uncompressedDataBuffer = (Bytef *)malloc(record.originalDataLength);
+	if (nextRecord >= decodedLimit)
+		[self _decodeRecordsAfterNextRecord];
 	
-	compressionStream.avail_in = [presumablySerializedData length];
-	compressionStream.next_in = (Bytef*)[presumablySerializedData bytes];
-	compressionStream.avail_out = record.originalDataLength;
-	compressionStream.next_out = uncompressedDataBuffer;
-	compressionStream.data_type = Z_BINARY;
+	WALRecordSpan *span = &records[nextRecord];
+	NSMutableData *presumablySerializedData = decodedRecords[nextRecord];
+	decodedRecords[nextRecord++] = nil;
 	
-	int inflateResult = inflate(&compressionStream, Z_SYNC_FLUSH);
-	if (inflateResult == Z_STREAM_ERROR) {
-		NSLog(@"zlib inflate error: %s", compressionStream.msg);
-		return nil;
-	}
-	if (inflateResult == Z_NEED_DICT || inflateResult == Z_DATA_ERROR || 
-		inflateResult == Z_MEM_ERROR) {
-		NSLog(@"err: inflateResult = %d", inflateResult);
+	if (!presumablySerializedData)
 		return nil;
-	}
 	
-	if (compressionStream.avail_out != 0) {
-		NSLog(@"recoverNextObject: compressionStream.avail_out(%d) != 0", compressionStream.avail_out);
+	if (!journalVersion && ![self _inflateChainedRecordData:presumablySerializedData originalLength:span->header.originalDataLength]) {
+		[presumablySerializedData release];
 		return nil;
 	}
 	
-	[presumablySerializedData setLength:record.originalDataLength];
-	memcpy([presumablySerializedData mutableBytes], uncompressedDataBuffer, record.originalDataLength);
-	free(uncompressedDataBuffer);
-	
-    
-    id <SynchronizedNote> object = nil;
-	@try {
-		NSKeyedUnarchiver *unarchiver = [[NSKeyedUnarchiver alloc] initForReadingWithData:presumablySerializedData];
-		object = [unarchiver decodeObjectForKey:@"aNote"];
-		[unarchiver release];	
-    } @catch (NSException *e) {
-		NSLog(@"recoverNextObject got an exception while unarchiving object: %@; returning NSNull to skip", [e reason]);
-		object = (id<SynchronizedNote>)[NSNull null];
-    }
+	//objects are always unarchived on this thread and in the order they were written, so that their LSNs are compared as before
+    id <SynchronizedNote> object = IsBatchData(presumablySerializedData) ? [self _unpackBatchData:presumablySerializedData] :
+		UnarchivedNoteObject(presumablySerializedData);
     
     [presumablySerializedData release];
     
@@ -540,4 +847,19 @@ static Boolean SynchronizedNoteIsEqual(const void *o, const void *p) {
 	return [(NSDictionary*)recoveredNotes autorelease];
 }
 
+- (void)dealloc {
+	NSUInteger i;
+	for (i=0; i<recordCount; i++) {
+		[records[i].sessionKey release];
+		[decodedRecords[i] release];
+	}
+	if (records)
+		free(records);
+	if (decodedRecords)
+		free(decodedRecords);
+	[journalData release];
+	[batchedObjects release];
+	[super dealloc];
+}
+
 @end
@@ -205,27 +205,16 @@ void sha1_process_bytes (const void *buffer, size_t len, sha1_ctx_nv *ctx) {
 #define F3(B,C,D) ( ( B & C ) | ( D & ( B | C ) ) )
 #define F4(B,C,D) (B ^ C ^ D)
 
-/* Process LEN bytes of BUFFER, accumulating context into CTX.
-It is assumed that LEN % 64 == 0.
-Most of this code comes from GnuPG's cipher/sha1.c.  */
+/* Run the 80 rounds over the 16 host-order words of X (which are overwritten by
+the message schedule), adding the result into the five words of STATE.  */
 
-static void sha1_process_block (const void *buffer, size_t len, sha1_ctx_nv *ctx) {
-	const uint32_t *words = buffer;
-	size_t nwords = len / sizeof (uint32_t);
-	const uint32_t *endp = words + nwords;
-	uint32_t x[16];
-	uint32_t a = ctx->A;
-	uint32_t b = ctx->B;
-	uint32_t c = ctx->C;
-	uint32_t d = ctx->D;
-	uint32_t e = ctx->E;
-	
-	/* First increment the byte count.  RFC 1321 specifies the possible
-		length of the file up to 2^64 bits.  Here we only compute the
-		number of bytes.  Do a double word increment.  */
-	ctx->total[0] += len;
-	if (ctx->total[0] < len)
-		++ctx->total[1];
+static inline void sha1_transform (uint32_t *state, uint32_t *x) {
+	uint32_t a = state[0];
+	uint32_t b = state[1];
+	uint32_t c = state[2];
+	uint32_t d = state[3];
+	uint32_t e = state[4];
+	uint32_t tm;
 	
 #define rol(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
 	
@@ -240,16 +229,6 @@ static void sha1_process_block (const void *buffer, size_t len, sha1_ctx_nv *ctx
 		B = rol( B, 30 );    \
 } while(0)
 
-while (words < endp)
-{
-	uint32_t tm;
-	int t;
-	for (t = 0; t < 16; t++)
-	{
-		x[t] = SWAP (*words);
-		words++;
-	}
-	
 	R( a, b, c, d, e, F1, K1, x[ 0] );
 	R( e, a, b, c, d, F1, K1, x[ 1] );
 	R( d, e, a, b, c, F1, K1, x[ 2] );
@@ -331,12 +310,49 @@ while (words < endp)
 	R( c, d, e, a, b, F4, K4, M(78) );
 	R( b, c, d, e, a, F4, K4, M(79) );
 	
-	a = ctx->A += a;
-	b = ctx->B += b;
-	c = ctx->C += c;
-	d = ctx->D += d;
-	e = ctx->E += e;
+	
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
 }
+
+/* Process LEN bytes of BUFFER, accumulating context into CTX.
+It is assumed that LEN % 64 == 0.
+Most of this code comes from GnuPG's cipher/sha1.c.  */
+
+static void sha1_process_block (const void *buffer, size_t len, sha1_ctx_nv *ctx) {
+	const uint32_t *words = buffer;
+	size_t nwords = len / sizeof (uint32_t);
+	const uint32_t *endp = words + nwords;
+	uint32_t x[16];
+	uint32_t state[5] = { ctx->A, ctx->B, ctx->C, ctx->D, ctx->E };
+	
+	/* First increment the byte count.  RFC 1321 specifies the possible
+		length of the file up to 2^64 bits.  Here we only compute the
+		number of bytes.  Do a double word increment.  */
+	ctx->total[0] += len;
+	if (ctx->total[0] < len)
+		++ctx->total[1];
+	
+	while (words < endp)
+	{
+		int t;
+		for (t = 0; t < 16; t++)
+		{
+			x[t] = SWAP (*words);
+			words++;
+		}
+		
+		sha1_transform (state, x);
+	}
+	
+	ctx->A = state[0];
+	ctx->B = state[1];
+	ctx->C = state[2];
+	ctx->D = state[3];
+	ctx->E = state[4];
 }
 
 /* hmac-sha1.c -- hashed message authentication codes
@@ -361,12 +377,10 @@ while (words < endp)
 #define IPAD 0x36
 #define OPAD 0x5c
 
-void hmac_sha1 (const void *key, size_t keylen, const void *in, size_t inlen, void *resbuf) {
-	sha1_ctx_nv inner;
-	sha1_ctx_nv outer;
+void hmac_sha1_init_key (hmac_sha1_key_nv *hkey, const void *key, size_t keylen) {
+	sha1_ctx_nv ctx;
 	char optkeybuf[20];
 	char block[64];
-	char innerhash[20];
 	
 	/* Reduce the key's size, so that it becomes <= 64 bytes large.  */
 	
@@ -381,28 +395,84 @@ void hmac_sha1 (const void *key, size_t keylen, const void *in, size_t inlen, vo
 		keylen = 20;
     }
 	
-	/* Compute INNERHASH from KEY and IN.  */
-	
-	sha1_init_ctx (&inner);
+	/* Keep the states after the padded key blocks, which are the same for every message.  */
 	
-	memset(block, IPAD, sizeof (block));
-	memxor(block, key, keylen);
+	sha1_init_ctx (&ctx);
+	memset (block, IPAD, sizeof (block));
+	memxor (block, key, keylen);
+	sha1_process_block (block, 64, &ctx);
 	
-	sha1_process_block (block, 64, &inner);
-	sha1_process_bytes (in, inlen, &inner);
+	hkey->inner[0] = ctx.A; hkey->inner[1] = ctx.B; hkey->inner[2] = ctx.C; hkey->inner[3] = ctx.D; hkey->inner[4] = ctx.E;
 	
-	sha1_finish_ctx (&inner, innerhash);
+	sha1_init_ctx (&ctx);
+	memset (block, OPAD, sizeof (block));
+	memxor (block, key, keylen);
+	sha1_process_block (block, 64, &ctx);
 	
-	/* Compute result from KEY and INNERHASH.  */
+	hkey->outer[0] = ctx.A; hkey->outer[1] = ctx.B; hkey->outer[2] = ctx.C; hkey->outer[3] = ctx.D; hkey->outer[4] = ctx.E;
+}
+
+static void sha1_init_ctx_with_state (sha1_ctx_nv *ctx, const uint32_t *state) {
+	/* A context that has already hashed one 64-byte block into STATE.  */
+	ctx->A = state[0];
+	ctx->B = state[1];
+	ctx->C = state[2];
+	ctx->D = state[3];
+	ctx->E = state[4];
 	
-	sha1_init_ctx (&outer);
+	ctx->total[0] = 64;
+	ctx->total[1] = 0;
+	ctx->buflen = 0;
+}
+
+void hmac_sha1_init_ctx (const hmac_sha1_key_nv *hkey, sha1_ctx_nv *ctx) {
+	sha1_init_ctx_with_state (ctx, hkey->inner);
+}
+
+void hmac_sha1_finish_ctx (const hmac_sha1_key_nv *hkey, sha1_ctx_nv *ctx, void *resbuf) {
+	sha1_ctx_nv outer;
+	uint32_t innerhash[5];
 	
-	memset (block, OPAD, sizeof (block));
-	memxor (block, key, keylen);
+	sha1_finish_ctx (ctx, innerhash);
 	
-	sha1_process_block (block, 64, &outer);
+	sha1_init_ctx_with_state (&outer, hkey->outer);
 	sha1_process_bytes (innerhash, 20, &outer);
-	
 	sha1_finish_ctx (&outer, resbuf);
 }
 
+void hmac_sha1_words (const hmac_sha1_key_nv *hkey, const uint32_t *in, uint32_t *out) {
+	/* A 20-byte message fits in a single block after the key's, so each hash is one
+	transform from the stored state, with the padding and length written directly.  */
+	uint32_t x[16];
+	uint32_t state[5];
+	int t;
+	
+	memcpy (state, hkey->inner, sizeof (state));
+	for (t = 0; t < 5; t++)
+		x[t] = in[t];
+	x[5] = 0x80000000;
+	for (t = 6; t < 15; t++)
+		x[t] = 0;
+	x[15] = (64 + 20) * 8;
+	sha1_transform (state, x);
+	
+	for (t = 0; t < 5; t++)
+		x[t] = state[t];
+	x[5] = 0x80000000;
+	for (t = 6; t < 15; t++)
+		x[t] = 0;
+	x[15] = (64 + 20) * 8;
+	memcpy (out, hkey->outer, sizeof (state));
+	sha1_transform (out, x);
+}
+
+void hmac_sha1 (const void *key, size_t keylen, const void *in, size_t inlen, void *resbuf) {
+	hmac_sha1_key_nv hkey;
+	sha1_ctx_nv ctx;
+	
+	hmac_sha1_init_key (&hkey, key, keylen);
+	
+	hmac_sha1_init_ctx (&hkey, &ctx);
+	sha1_process_bytes (in, inlen, &ctx);
+	hmac_sha1_finish_ctx (&hkey, &ctx, resbuf);
+}
@@ -25,3 +25,17 @@ typedef struct _sha1_ctx {
 void sha1_process_bytes (const void *buffer, size_t len, sha1_ctx_nv *ctx);
 void *sha1_finish_ctx (sha1_ctx_nv *ctx, void *resbuf);
 void sha1_init_ctx (sha1_ctx_nv *ctx);
+
+//the SHA-1 states after the inner and outer padded blocks of an HMAC key, so that the key
+//is hashed only once however many messages are authenticated with it
+typedef struct _hmac_sha1_key {
+	uint32_t inner[5];
+	uint32_t outer[5];
+} hmac_sha1_key_nv;
+
+void hmac_sha1_init_key (hmac_sha1_key_nv *hkey, const void *key, size_t keylen);
+//begin a message with sha1_process_bytes after hmac_sha1_init_ctx; hmac_sha1_finish_ctx writes its 20-byte HMAC to resbuf
+void hmac_sha1_init_ctx (const hmac_sha1_key_nv *hkey, sha1_ctx_nv *ctx);
+void hmac_sha1_finish_ctx (const hmac_sha1_key_nv *hkey, sha1_ctx_nv *ctx, void *resbuf);
+//the HMAC of a 20-byte message, both given as five big-endian words in host order; in and out may be the same
+void hmac_sha1_words (const hmac_sha1_key_nv *hkey, const uint32_t *in, uint32_t *out);
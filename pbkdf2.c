@@ -6,51 +6,90 @@
 #include "pbkdf2.h"
 #include "hmacsha1.h"
 
-#include <stdlib.h>
 #include <string.h>
+#include <dispatch/dispatch.h>
+
+//below this many iterations, deriving the blocks of a key one after another is quicker than dispatching them
+#define PARALLEL_ITERATION_THRESHOLD 4096
+
+typedef struct {
+	hmac_sha1_key_nv hkey;
+	const char *salt;
+	size_t Slen;
+	unsigned int c;
+	char *derivedKey;
+	size_t dkLen;
+} pbkdf2_params;
+
+static void pbkdf2_sha1_block(void *context, size_t index) {
+	const pbkdf2_params *p = (const pbkdf2_params *)context;
+	unsigned int hLen = 20, i = (unsigned int)index + 1;
+	uint32_t U[5], T[5];
+	unsigned char INT[4], block[20];
+	unsigned int u, k;
+	sha1_ctx_nv ctx;
+	
+	INT[0] = (i & 0xff000000) >> 24;
+	INT[1] = (i & 0x00ff0000) >> 16;
+	INT[2] = (i & 0x0000ff00) >> 8;
+	INT[3] = (i & 0x000000ff) >> 0;
+	
+	hmac_sha1_init_ctx(&p->hkey, &ctx);
+	sha1_process_bytes(p->salt, p->Slen, &ctx);
+	sha1_process_bytes(INT, 4, &ctx);
+	hmac_sha1_finish_ctx(&p->hkey, &ctx, block);
+	
+	//the remaining iterations stay in words, hashing each U from the key's stored states
+	for (k = 0; k < 5; k++)
+		T[k] = U[k] = ((uint32_t)block[k*4] << 24) | ((uint32_t)block[k*4 + 1] << 16) | ((uint32_t)block[k*4 + 2] << 8) | (uint32_t)block[k*4 + 3];
+	
+	for (u = 2; u <= p->c; u++) {
+		hmac_sha1_words(&p->hkey, U, U);
+		
+		T[0] ^= U[0];
+		T[1] ^= U[1];
+		T[2] ^= U[2];
+		T[3] ^= U[3];
+		T[4] ^= U[4];
+	}
+	
+	for (k = 0; k < 5; k++) {
+		block[k*4 + 0] = (T[k] >> 24) & 0xff;
+		block[k*4 + 1] = (T[k] >> 16) & 0xff;
+		block[k*4 + 2] = (T[k] >> 8) & 0xff;
+		block[k*4 + 3] = T[k] & 0xff;
+	}
+	
+	size_t offset = index * hLen;
+	memcpy(p->derivedKey + offset, block, p->dkLen - offset < hLen ? p->dkLen - offset : hLen);
+}
 
 int pbkdf2_sha1(const char *password, size_t Plen, const char *salt, size_t Slen, 
 				 unsigned int c, char *derivedKey, size_t dkLen) {
 	unsigned int hLen = 20;
-	char U[20], T[20];
-	unsigned int u, l, r, i, k;
-	char *tmp;
-	
-	size_t tmplen = Slen + 4;
+	size_t i, l;
+	pbkdf2_params params;
 	
 	if (!c || !dkLen || dkLen > 4294967295U)
 		return 0;
 	
-	l = (((int)dkLen - 1) / hLen) + 1;
-	r = (int)dkLen - (l - 1) * hLen;
-	
-	if (!(tmp = (char*)malloc(tmplen)))
-		return 0;
-	
-	memcpy(tmp, salt, Slen);
+	l = ((dkLen - 1) / hLen) + 1;
 	
-	for (i = 1; i <= l; i++) {
-		memset (T, 0, hLen);
-		
-		for (u = 1; u <= c; u++) {
-			if (u == 1) {
-				tmp[Slen + 0] = (i & 0xff000000) >> 24;
-				tmp[Slen + 1] = (i & 0x00ff0000) >> 16;
-				tmp[Slen + 2] = (i & 0x0000ff00) >> 8;
-				tmp[Slen + 3] = (i & 0x000000ff) >> 0;
-				
-				hmac_sha1 (password, Plen, tmp, tmplen, U);
-			} else
-				hmac_sha1 (password, Plen, U, hLen, U);
-			
-			for (k = 0; k < hLen; k++)
-				T[k] ^= U[k];
-		}
-		
-		memcpy(derivedKey + (i - 1) * hLen, T, i == l ? r : hLen);
-    }
+	//the password is hashed into its HMAC states just once, rather than twice per iteration
+	hmac_sha1_init_key(&params.hkey, password, Plen);
+	params.salt = salt;
+	params.Slen = Slen;
+	params.c = c;
+	params.derivedKey = derivedKey;
+	params.dkLen = dkLen;
 	
-	free(tmp);
+	if (l > 1 && c >= PARALLEL_ITERATION_THRESHOLD) {
+		//each block of the key is independent of the others, so they can all be derived at once
+		dispatch_apply_f(l, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), &params, pbkdf2_sha1_block);
+	} else {
+		for (i = 0; i < l; i++)
+			pbkdf2_sha1_block(&params, i);
+	}
 	
 	return 1;
 }